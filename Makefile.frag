@@ -0,0 +1,20 @@
+BENCH_ARGS =
+EMBED_ARGS =
+EMBED_LIBS = -L$(prefix)/lib -Wl,-rpath,$(prefix)/lib -lphp
+
+bench: all
+	$(PHP_EXECUTABLE) -n $(srcdir)/bench/run.php --php=$(PHP_EXECUTABLE) --extension=$(phplibdir)/vyrtue.so $(BENCH_ARGS)
+
+# requires PHP built with --enable-embed
+$(builddir)/vyrtue-embed: $(srcdir)/bench/embed.c $(addprefix $(srcdir)/,$(PHP_VYRTUE_SOURCES))
+	$(CC) $(COMMON_FLAGS) $(CFLAGS_CLEAN) $(EXTRA_CFLAGS) -I$(builddir) -I$(srcdir) -I$(srcdir)/src $(INCLUDES) $(DEFS) -DZEND_ENABLE_STATIC_TSRMLS_CACHE=1 -o $@ $^ $(EMBED_LIBS)
+
+embed: $(builddir)/vyrtue-embed
+
+test-embed: embed
+	$(builddir)/vyrtue-embed test
+
+bench-embed: embed
+	$(builddir)/vyrtue-embed bench $(EMBED_ARGS)
+
+.PHONY: bench embed test-embed bench-embed
@@ -0,0 +1,41 @@
+<?php
+/**
+ * Child process of bench/run.php: compiles every file of a list a number of
+ * times and writes the samples as JSON to stdout.
+ *
+ * php -d opcache.enable_cli=0 bench/compile.php <list> <iterations>
+ *
+ * Each sample is the time of a single include, which compiles the file and
+ * runs its if (false) body. Output of the debug visitors goes to stderr.
+ */
+
+if (filter_var(ini_get('opcache.enable_cli'), FILTER_VALIDATE_BOOL)) {
+    fwrite(STDERR, "opcache.enable_cli must be off, or only the first include is compiled\n");
+    exit(1);
+}
+
+$files = file($argv[1], FILE_IGNORE_NEW_LINES | FILE_SKIP_EMPTY_LINES);
+$iterations = max(1, (int) ($argv[2] ?? 5));
+
+// warm up the realpath cache and the allocator before measuring
+foreach ($files as $file) {
+    include $file;
+}
+if (function_exists('VyrtueExt\\stats_reset')) {
+    VyrtueExt\stats_reset();
+}
+
+$samples = [];
+for ($i = 0; $i < $iterations; $i++) {
+    foreach ($files as $file) {
+        $start = hrtime(true);
+        include $file;
+        $samples[] = hrtime(true) - $start;
+    }
+}
+
+echo json_encode([
+    'samples' => $samples,
+    'peak_memory' => memory_get_peak_usage(),
+    'stats' => function_exists('VyrtueExt\\stats') ? VyrtueExt\stats() : null,
+]), "\n";
@@ -0,0 +1,230 @@
+<?php
+/**
+ * Generates a synthetic corpus for bench/run.php.
+ *
+ * php bench/corpus.php <directory> [--files=20] [--scale=200] [--depth=24] [--shapes=wide,deep,...]
+ *
+ * Every shape stresses a different part of the walker:
+ *
+ * - wide: long statement lists
+ * - deep: nested control structures
+ * - calls: function calls, including ones the internal visitors rewrite
+ * - imports: use imports and names resolved through them
+ * - attributes: classes with attributed members
+ * - debug: calls and attributes handled by the visitors of debug builds
+ *
+ * Generated code is wrapped in if (false) so it can be included repeatedly
+ * without declaring anything or running.
+ */
+
+const VYRTUE_BENCH_SHAPES = ['wide', 'deep', 'calls', 'imports', 'attributes', 'debug'];
+
+// each nesting level pushes three nodes, the walker's node stack holds 128
+const VYRTUE_BENCH_MAX_DEPTH = 40;
+
+function vyrtue_bench_shape_wide(int $scale, int $depth): array
+{
+    $body = '';
+    for ($i = 0; $i < $scale * 5; $i++) {
+        $body .= "\$v$i = $i + \$v" . max(0, $i - 1) . " * 2;\n";
+    }
+    return [[], $body];
+}
+
+function vyrtue_bench_shape_deep(int $scale, int $depth): array
+{
+    $depth = min($depth, VYRTUE_BENCH_MAX_DEPTH);
+    $body = '';
+    for ($n = 0; $n < max(1, intdiv($scale, $depth)); $n++) {
+        $open = '';
+        $close = '';
+        for ($i = 0; $i < $depth; $i++) {
+            $open .= ($i % 2 ? "foreach (\$a$i as \$k$i => \$b$i) {\n" : "if (\$a$i > $i) {\n");
+            $close .= "}\n";
+        }
+        $body .= $open . "\$r = \$a0 + $n;\n" . $close;
+    }
+    return [[], $body];
+}
+
+function vyrtue_bench_shape_calls(int $scale, int $depth): array
+{
+    $calls = [
+        "\\strlen('abcdef')",
+        "\\str_repeat('-', 3)",
+        "\\sprintf('%s-%d', \$s, \$i)",
+        "\\in_array(\$i, [1, 2, 3], true)",
+        "\\count([1, 2, 3])",
+        "\\array_map(fn (\$x) => \$x * 2, \$list)",
+        "helper(\$i, \$s)",
+        "\$object->method(\$i)",
+        "Helper::make(\$i)",
+    ];
+    $body = '';
+    for ($i = 0; $i < $scale * 2; $i++) {
+        $body .= "\$r$i = " . $calls[$i % count($calls)] . ";\n";
+    }
+    return [[], $body];
+}
+
+function vyrtue_bench_shape_imports(int $scale, int $depth): array
+{
+    $uses = [];
+    $body = '';
+    for ($i = 0; $i < $scale; $i++) {
+        $uses[] = "use Vendor\\Package$i\\Service$i;";
+        $uses[] = "use Vendor\\Package$i\\Model$i as Alias$i;";
+        $uses[] = "use function Vendor\\Package$i\\helper$i;";
+        $uses[] = "use const Vendor\\Package$i\\LIMIT$i;";
+        $body .= "\$x$i = new Service$i(Alias$i::class, helper$i(LIMIT$i));\n";
+    }
+    return [$uses, $body];
+}
+
+function vyrtue_bench_shape_attributes(int $scale, int $depth): array
+{
+    $body = '';
+    for ($c = 0; $c < max(1, intdiv($scale, 10)); $c++) {
+        $body .= "#[Entity(table: 'table_$c')]\nfinal class Model$c\n{\n";
+        for ($i = 0; $i < 10; $i++) {
+            $body .= "    #[Column(name: 'column_$i', type: 'string', nullable: true)]\n";
+            $body .= "    public ?string \$property$i = null;\n\n";
+            $body .= "    #[Route('/model/$c/$i', methods: ['GET', 'POST'])]\n";
+            $body .= "    public function action$i(#[FromQuery] int \$id): string\n    {\n        return \$this->property$i ?? '';\n    }\n\n";
+        }
+        $body .= "}\n";
+    }
+    return [[], $body];
+}
+
+function vyrtue_bench_shape_debug(int $scale, int $depth): array
+{
+    $body = '';
+    for ($i = 0; $i < $scale; $i++) {
+        $body .= "\\VyrtueExt\\Debug\\sample_function($i);\n";
+        if ($i % 10 === 0) {
+            $body .= "#[\\VyrtueExt\\Debug\\SampleAttribute]\nfunction debug_sample_$i() {}\n";
+        }
+    }
+    return [[], $body];
+}
+
+/**
+ * Writes the corpus and returns the generated file names, keyed by shape.
+ */
+function vyrtue_bench_generate(string $dir, array $shapes, int $files, int $scale, int $depth): array
+{
+    if (!is_dir($dir) && !mkdir($dir, 0777, true)) {
+        throw new RuntimeException("failed to create $dir");
+    }
+
+    $result = [];
+    foreach ($shapes as $shape) {
+        if (!in_array($shape, VYRTUE_BENCH_SHAPES, true)) {
+            throw new InvalidArgumentException("unknown shape $shape");
+        }
+        for ($n = 0; $n < $files; $n++) {
+            [$uses, $body] = ('vyrtue_bench_shape_' . $shape)($scale, $depth);
+            $code = "<?php\nnamespace Bench\\" . ucfirst($shape) . "$n;\n\n";
+            $code .= $uses ? implode("\n", $uses) . "\n\n" : '';
+            $code .= "if (false) {\n" . $body . "}\n";
+
+            $file = sprintf('%s/%s-%03d.php', $dir, $shape, $n);
+            file_put_contents($file, $code);
+            $result[$shape][] = $file;
+        }
+    }
+
+    return $result;
+}
+
+/**
+ * Copies a file of real code into $target with its body wrapped in if (false),
+ * like the generated shapes. The open tag, declare, namespace and use imports
+ * stay at the top. Returns false for files that cannot be wrapped: inline
+ * HTML, braced or multiple namespaces, top-level constants and
+ * __halt_compiler().
+ */
+function vyrtue_bench_import(string $source, string $target): bool
+{
+    $tokens = PhpToken::tokenize(file_get_contents($source));
+    $header = '';
+    $body = '';
+    $depth = 0;
+    $namespaces = 0;
+    $statement = null;
+    $previous = null;
+
+    foreach ($tokens as $token) {
+        if ($token->is([T_INLINE_HTML, T_HALT_COMPILER])) {
+            return false;
+        }
+        if ($depth === 0 && $statement === null) {
+            if ($token->is(T_CONST)) {
+                return false;
+            }
+            if ($token->is(T_NAMESPACE)) {
+                $namespaces++;
+                $statement = '';
+            } elseif ($token->is(T_DECLARE) || ($token->is(T_USE) && $previous?->text !== ')')) {
+                $statement = '';
+            }
+        }
+        if (!$token->isIgnorable()) {
+            $previous = $token;
+        }
+
+        if ($statement !== null) {
+            $statement .= $token->text;
+            if ($token->text === '{') {
+                return false;
+            }
+            if ($token->text === ';') {
+                $header .= $statement . "\n";
+                $statement = null;
+            }
+            continue;
+        }
+
+        if ($token->is(T_OPEN_TAG)) {
+            $header .= rtrim($token->text) . "\n";
+            continue;
+        }
+        if ($token->is(T_CLOSE_TAG)) {
+            continue;
+        }
+        if (in_array($token->text, ['{', '${'], true) || $token->is([T_CURLY_OPEN, T_DOLLAR_OPEN_CURLY_BRACES])) {
+            $depth++;
+        } elseif ($token->text === '}') {
+            $depth--;
+        }
+        $body .= $token->text;
+    }
+
+    if ($namespaces > 1 || $header === '') {
+        return false;
+    }
+
+    return false !== file_put_contents($target, $header . "if (false) {\n" . $body . "\n}\n");
+}
+
+if (realpath($_SERVER['SCRIPT_FILENAME'] ?? '') === __FILE__) {
+    $options = getopt('', ['files:', 'scale:', 'depth:', 'shapes:'], $rest);
+    $dir = $argv[$rest] ?? null;
+    if ($dir === null) {
+        fwrite(STDERR, "usage: php bench/corpus.php <directory> [--files=20] [--scale=200] [--depth=24] [--shapes=" . implode(',', VYRTUE_BENCH_SHAPES) . "]\n");
+        exit(1);
+    }
+
+    $generated = vyrtue_bench_generate(
+        $dir,
+        isset($options['shapes']) ? explode(',', $options['shapes']) : VYRTUE_BENCH_SHAPES,
+        (int) ($options['files'] ?? 20),
+        (int) ($options['scale'] ?? 200),
+        (int) ($options['depth'] ?? 24)
+    );
+
+    foreach ($generated as $shape => $list) {
+        printf("%-12s %d files\n", $shape, count($list));
+    }
+}
@@ -0,0 +1,520 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Harness for the walker, built with make embed against the embed SAPI with
+ * the extension sources linked in statically.
+ *
+ * vyrtue-embed test
+ *     Unit tests for name resolution and the context stacks, in TAP format.
+ *
+ * vyrtue-embed bench [-n iterations] file...
+ *     Parses every file once per iteration and runs vyrtue_ast_process_file
+ *     on it, without compiling. Reports ns, allocations and bytes per node,
+ *     and the deepest node stack, for each file.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <Zend/zend_API.h>
+#include <Zend/zend_alloc.h>
+#include <Zend/zend_arena.h>
+#include <Zend/zend_compile.h>
+#include <Zend/zend_language_scanner.h>
+#include <Zend/zend_language_scanner_defs.h>
+#include <main/php.h>
+#include <main/php_streams.h>
+#include <sapi/embed/php_embed.h>
+
+#include "php_vyrtue.h"
+#include "compile.h"
+#include "context.h"
+#include "stats.h"
+
+/* {{{ allocation counting */
+
+static zend_mm_heap *vyrtue_embed_heap;
+static uint64_t vyrtue_embed_allocs;
+static uint64_t vyrtue_embed_alloc_bytes;
+
+static void *vyrtue_embed_malloc(size_t size ZEND_FILE_LINE_DC ZEND_FILE_LINE_ORIG_DC)
+{
+    vyrtue_embed_allocs++;
+    vyrtue_embed_alloc_bytes += size;
+    return _zend_mm_alloc(vyrtue_embed_heap, size ZEND_FILE_LINE_RELAY_CC ZEND_FILE_LINE_ORIG_RELAY_CC);
+}
+
+static void vyrtue_embed_free(void *ptr ZEND_FILE_LINE_DC ZEND_FILE_LINE_ORIG_DC)
+{
+    _zend_mm_free(vyrtue_embed_heap, ptr ZEND_FILE_LINE_RELAY_CC ZEND_FILE_LINE_ORIG_RELAY_CC);
+}
+
+static void *vyrtue_embed_realloc(void *ptr, size_t size ZEND_FILE_LINE_DC ZEND_FILE_LINE_ORIG_DC)
+{
+    vyrtue_embed_allocs++;
+    vyrtue_embed_alloc_bytes += size;
+    return _zend_mm_realloc(vyrtue_embed_heap, ptr, size ZEND_FILE_LINE_RELAY_CC ZEND_FILE_LINE_ORIG_RELAY_CC);
+}
+
+/**
+ * The handlers forward to the same heap, so memory allocated while counting
+ * may be freed after.
+ */
+static void vyrtue_embed_count_allocs(bool enable)
+{
+    vyrtue_embed_heap = zend_mm_get_heap();
+
+    if (enable) {
+        // debug builds pass the file and line along, and need handlers that take them
+#if ZEND_DEBUG
+        zend_mm_set_custom_debug_handlers(vyrtue_embed_heap, vyrtue_embed_malloc, vyrtue_embed_free, vyrtue_embed_realloc);
+#else
+        zend_mm_set_custom_handlers(vyrtue_embed_heap, vyrtue_embed_malloc, vyrtue_embed_free, vyrtue_embed_realloc);
+#endif
+    } else {
+        zend_mm_set_custom_handlers(vyrtue_embed_heap, NULL, NULL, NULL);
+    }
+}
+
+/* }}} allocation counting */
+
+/* {{{ parsing */
+
+/**
+ * Parses code into an AST in its own arena, like ext/ast, without compiling
+ * it. Returns NULL on a parse error.
+ */
+static zend_ast *vyrtue_embed_parse(zend_string *code, zend_string *filename, zend_arena **arena)
+{
+    zend_lex_state original_lex_state;
+    bool original_in_compilation = CG(in_compilation);
+    zend_ast *ast;
+    zval code_zv;
+
+    ZVAL_STR_COPY(&code_zv, code);
+
+    CG(in_compilation) = 1;
+    zend_save_lexical_state(&original_lex_state);
+    zend_prepare_string_for_scanning(&code_zv, filename);
+    CG(ast) = NULL;
+    CG(ast_arena) = zend_arena_create(32 * 1024);
+    LANG_SCNG(yy_state) = yycINITIAL;
+
+    if (zendparse() != 0) {
+        zend_ast_destroy(CG(ast));
+        zend_arena_destroy(CG(ast_arena));
+        CG(ast) = NULL;
+        CG(ast_arena) = NULL;
+    }
+
+    ast = CG(ast);
+    *arena = CG(ast_arena);
+
+    zend_restore_lexical_state(&original_lex_state);
+    CG(in_compilation) = original_in_compilation;
+
+    zval_ptr_dtor(&code_zv);
+
+    return ast;
+}
+
+/**
+ * Depth of the node stack at the deepest node, descending like the walker:
+ * only into the bodies of functions and classes.
+ */
+static size_t vyrtue_embed_depth(zend_ast *ast)
+{
+    size_t depth = 0;
+
+    if (ast == NULL) {
+        return 0;
+    }
+
+    switch (ast->kind) {
+        case ZEND_AST_FUNC_DECL:
+        case ZEND_AST_CLOSURE:
+        case ZEND_AST_METHOD:
+        case ZEND_AST_ARROW_FUNC:
+        case ZEND_AST_CLASS:
+            return 1 + vyrtue_embed_depth(((zend_ast_decl *) ast)->child[2]);
+        default:
+            break;
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        for (uint32_t i = 0; i < list->children; i++) {
+            depth = MAX(depth, vyrtue_embed_depth(list->child[i]));
+        }
+    } else {
+        uint32_t children = zend_ast_get_num_children(ast);
+        for (uint32_t i = 0; i < children; i++) {
+            depth = MAX(depth, vyrtue_embed_depth(ast->child[i]));
+        }
+    }
+
+    return 1 + depth;
+}
+
+/**
+ * Parses and processes a file, returns false on a parse error.
+ */
+static bool vyrtue_embed_process(zend_string *code, zend_string *filename, bool count_allocs, uint64_t *time_ns, size_t *depth)
+{
+    zend_arena *arena;
+    zend_ast *ast = vyrtue_embed_parse(code, filename, &arena);
+
+    if (ast == NULL) {
+        return false;
+    }
+
+    if (depth != NULL) {
+        *depth = vyrtue_embed_depth(ast);
+    }
+
+    // visitors create replacement nodes in the compiler's arena
+    CG(ast_arena) = arena;
+
+    if (count_allocs) {
+        vyrtue_embed_count_allocs(true);
+    }
+
+    uint64_t start = vyrtue_stats_now();
+    vyrtue_ast_process_file(ast);
+    *time_ns = vyrtue_stats_now() - start;
+
+    if (count_allocs) {
+        vyrtue_embed_count_allocs(false);
+    }
+
+    zend_ast_destroy(ast);
+    zend_arena_destroy(arena);
+    CG(ast_arena) = NULL;
+
+    return true;
+}
+
+/* }}} parsing */
+
+/* {{{ bench */
+
+static int vyrtue_embed_bench(int argc, char **argv)
+{
+    int iterations = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            iterations = MAX(1, atoi(optarg));
+        } else {
+            fprintf(stderr, "usage: vyrtue-embed bench [-n iterations] file...\n");
+            return 1;
+        }
+    }
+
+    printf("%-40s %10s %10s %12s %12s %6s\n", "file", "nodes", "ns/node", "allocs/node", "bytes/node", "depth");
+
+    for (int i = optind; i < argc; i++) {
+        zend_string *filename = zend_string_init(argv[i], strlen(argv[i]), 0);
+        zend_string *code = NULL;
+        php_stream *stream = php_stream_open_wrapper(argv[i], "rb", REPORT_ERRORS, NULL);
+        uint64_t time_ns = 0;
+        uint64_t best_ns = UINT64_MAX;
+        uint64_t nodes;
+        size_t depth = 0;
+
+        if (stream != NULL) {
+            code = php_stream_copy_to_mem(stream, PHP_STREAM_COPY_ALL, 0);
+            php_stream_close(stream);
+        }
+        if (code == NULL) {
+            zend_string_release(filename);
+            return 1;
+        }
+
+        // one pass with stats to count nodes, including those of replacements
+        vyrtue_stats_reset();
+        VYRTUE_G(stats) = true;
+        bool parsed = vyrtue_embed_process(code, filename, false, &time_ns, &depth);
+        VYRTUE_G(stats) = false;
+        nodes = MAX(1, vyrtue_stats_get(NULL, NULL)->nodes);
+
+        if (!parsed) {
+            fprintf(stderr, "%s: parse error\n", argv[i]);
+            zend_string_release(code);
+            zend_string_release(filename);
+            return 1;
+        }
+
+        // counting is not part of the timed runs
+        vyrtue_embed_allocs = 0;
+        vyrtue_embed_alloc_bytes = 0;
+        vyrtue_embed_process(code, filename, true, &time_ns, NULL);
+
+        for (int n = 0; n < iterations; n++) {
+            vyrtue_embed_process(code, filename, false, &time_ns, NULL);
+            best_ns = MIN(best_ns, time_ns);
+        }
+
+        printf(
+            "%-40s %10" PRIu64 " %10.1f %12.3f %12.1f %6zu\n",
+            argv[i],
+            nodes,
+            (double) best_ns / nodes,
+            (double) vyrtue_embed_allocs / nodes,
+            (double) vyrtue_embed_alloc_bytes / nodes,
+            depth
+        );
+
+        zend_string_release(code);
+        zend_string_release(filename);
+    }
+
+    return 0;
+}
+
+/* }}} bench */
+
+/* {{{ test */
+
+static int vyrtue_embed_test_count;
+static int vyrtue_embed_test_failures;
+static int vyrtue_embed_test_destroyed;
+
+static void vyrtue_embed_ok(bool ok, const char *description)
+{
+    vyrtue_embed_test_count++;
+    if (!ok) {
+        vyrtue_embed_test_failures++;
+    }
+    printf("%sok %d - %s\n", ok ? "" : "not ", vyrtue_embed_test_count, description);
+}
+
+/**
+ * Consumes result and compares it to expected, NULL meaning no result.
+ */
+static void vyrtue_embed_ok_str(zend_string *result, const char *expected, const char *description)
+{
+    bool ok = result == NULL ? expected == NULL : expected != NULL && zend_string_equals_cstr(result, expected, strlen(expected));
+
+    if (!ok) {
+        printf("# expected \"%s\", got \"%s\"\n", expected ? expected : "(null)", result ? ZSTR_VAL(result) : "(null)");
+    }
+    vyrtue_embed_ok(ok, description);
+
+    if (result != NULL) {
+        zend_string_release(result);
+    }
+}
+
+static void vyrtue_embed_import(struct vyrtue_context *ctx, uint32_t type, const char *alias, const char *name)
+{
+    zend_hash_str_add_ptr(vyrtue_get_import_ht(type, ctx), alias, strlen(alias), zend_string_init(name, strlen(name), 0));
+}
+
+static zend_string *vyrtue_embed_resolve_class(const char *name, uint32_t type, struct vyrtue_context *ctx)
+{
+    zend_string *str = zend_string_init(name, strlen(name), 0);
+    zend_string *result = vyrtue_resolve_class_name(str, type, ctx);
+    zend_string_release(str);
+    return result;
+}
+
+static zend_string *vyrtue_embed_resolve_function(const char *name, uint32_t type, bool *is_fully_qualified, struct vyrtue_context *ctx)
+{
+    zend_string *str = zend_string_init(name, strlen(name), 0);
+    zend_string *result = vyrtue_resolve_function_name(str, type, is_fully_qualified, ctx);
+    zend_string_release(str);
+    return result;
+}
+
+static void vyrtue_embed_test_resolve_class_name(void)
+{
+    struct vyrtue_context ctx = {
+        .arena = zend_arena_create(8 * 1024),
+    };
+    zend_string *ns = zend_string_init(ZEND_STRL("App"), 0);
+
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("Foo", ZEND_NAME_NOT_FQ, &ctx), "Foo", "class: unqualified, global namespace");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("\\Foo", ZEND_NAME_FQ, &ctx), "Foo", "class: leading backslash is removed");
+
+    ctx.current_namespace = ns;
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("Foo", ZEND_NAME_NOT_FQ, &ctx), "App\\Foo", "class: unqualified, prefixed with namespace");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("Foo\\Bar", ZEND_NAME_NOT_FQ, &ctx), "App\\Foo\\Bar", "class: qualified, prefixed with namespace");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("Foo", ZEND_NAME_RELATIVE, &ctx), "App\\Foo", "class: namespace relative");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("Vendor\\Foo", ZEND_NAME_FQ, &ctx), "Vendor\\Foo", "class: fully qualified");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("self", ZEND_NAME_NOT_FQ, &ctx), "self", "class: self is not resolved");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("Static", ZEND_NAME_NOT_FQ, &ctx), "Static", "class: static is case insensitive");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("parent", ZEND_NAME_FQ, &ctx), NULL, "class: fully qualified parent is invalid");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("self", ZEND_NAME_RELATIVE, &ctx), NULL, "class: namespace relative self is invalid");
+
+    vyrtue_embed_import(&ctx, ZEND_SYMBOL_CLASS, "bar", "Vendor\\Bar");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("Bar", ZEND_NAME_NOT_FQ, &ctx), "Vendor\\Bar", "class: imported");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("BAR", ZEND_NAME_NOT_FQ, &ctx), "Vendor\\Bar", "class: imports are case insensitive");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("Bar\\Baz", ZEND_NAME_NOT_FQ, &ctx), "Vendor\\Bar\\Baz", "class: imported namespace prefix");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("Bar", ZEND_NAME_FQ, &ctx), "Bar", "class: fully qualified ignores imports");
+
+    vyrtue_end_namespace(&ctx);
+    vyrtue_embed_ok(ctx.current_namespace == NULL && ctx.imports == NULL, "class: ending the namespace resets imports");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_class("Bar", ZEND_NAME_NOT_FQ, &ctx), "Bar", "class: not imported after the namespace");
+
+    zend_string_release(ns);
+    zend_arena_destroy(ctx.arena);
+}
+
+static void vyrtue_embed_test_resolve_function_name(void)
+{
+    struct vyrtue_context ctx = {
+        .arena = zend_arena_create(8 * 1024),
+    };
+    zend_string *ns = zend_string_init(ZEND_STRL("App"), 0);
+    bool fq = true;
+
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_function("strlen", ZEND_NAME_NOT_FQ, &fq, &ctx), "strlen", "function: unqualified, global namespace");
+    vyrtue_embed_ok(!fq, "function: unqualified is not fully qualified");
+
+    ctx.current_namespace = ns;
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_function("strlen", ZEND_NAME_NOT_FQ, &fq, &ctx), "App\\strlen", "function: unqualified, prefixed with namespace");
+    vyrtue_embed_ok(!fq, "function: unqualified may fall back to the global namespace");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_function("\\strlen", ZEND_NAME_NOT_FQ, &fq, &ctx), "strlen", "function: leading backslash is removed");
+    vyrtue_embed_ok(fq, "function: leading backslash is fully qualified");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_function("Sub\\fn", ZEND_NAME_NOT_FQ, &fq, &ctx), "App\\Sub\\fn", "function: qualified, prefixed with namespace");
+    vyrtue_embed_ok(fq, "function: qualified is fully qualified");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_function("fn", ZEND_NAME_RELATIVE, &fq, &ctx), "App\\fn", "function: namespace relative");
+    vyrtue_embed_ok(fq, "function: namespace relative is fully qualified");
+
+    vyrtue_embed_import(&ctx, ZEND_SYMBOL_FUNCTION, "helper", "Vendor\\helper");
+    vyrtue_embed_import(&ctx, ZEND_SYMBOL_CLASS, "sub", "Vendor\\Sub");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_function("Helper", ZEND_NAME_NOT_FQ, &fq, &ctx), "Vendor\\helper", "function: imported, case insensitive");
+    vyrtue_embed_ok(fq, "function: imported is fully qualified");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_function("Sub\\fn", ZEND_NAME_NOT_FQ, &fq, &ctx), "Vendor\\Sub\\fn", "function: imported namespace prefix");
+    vyrtue_embed_ok_str(vyrtue_embed_resolve_function("sub", ZEND_NAME_NOT_FQ, &fq, &ctx), "App\\sub", "function: class imports do not apply");
+
+    vyrtue_end_namespace(&ctx);
+
+    zend_string_release(ns);
+    zend_arena_destroy(ctx.arena);
+}
+
+static void vyrtue_embed_test_dtor(zval *zv)
+{
+    vyrtue_embed_test_destroyed++;
+}
+
+static void vyrtue_embed_test_context_stack(void)
+{
+    struct vyrtue_context ctx = {0};
+    zend_ast *stmt_list = zend_ast_create_list(0, ZEND_AST_STMT_LIST);
+    zend_ast *const_decl = zend_ast_create_list(0, ZEND_AST_CONST_DECL);
+    zend_ast *array = zend_ast_create_list(0, ZEND_AST_ARRAY);
+    HashTable ht;
+    bool overflowed = false;
+
+    vyrtue_embed_ok(vyrtue_context_stack_count(&ctx.node_stack) == 0, "stack: empty");
+
+    vyrtue_context_stack_push(&ctx.node_stack, stmt_list);
+    vyrtue_context_stack_push(&ctx.node_stack, const_decl);
+    vyrtue_context_stack_push(&ctx.node_stack, array);
+    vyrtue_embed_ok(vyrtue_context_stack_count(&ctx.node_stack) == 3, "stack: count after push");
+    vyrtue_embed_ok(vyrtue_context_stack_top(&ctx.node_stack)->ast == array, "stack: top is the last pushed");
+    vyrtue_embed_ok(vyrtue_context_in_const_expr(&ctx), "stack: in constant expression below a constant declaration");
+
+    zend_hash_init(&ht, 8, NULL, vyrtue_embed_test_dtor, 0);
+    zend_hash_index_add_ptr(&ht, 1, array);
+    vyrtue_context_stack_top(&ctx.node_stack)->ht = &ht;
+    vyrtue_context_stack_pop(&ctx.node_stack, array);
+    vyrtue_embed_ok(vyrtue_embed_test_destroyed == 1, "stack: the frame's hash table is destroyed on pop");
+
+    vyrtue_context_stack_pop(&ctx.node_stack, const_decl);
+    vyrtue_embed_ok(!vyrtue_context_in_const_expr(&ctx), "stack: not in constant expression below a statement list");
+    vyrtue_context_stack_pop(&ctx.node_stack, stmt_list);
+    vyrtue_embed_ok(vyrtue_context_stack_count(&ctx.node_stack) == 0, "stack: empty after pop");
+
+    // the overflow is a compile error, which bails out
+    bool display_errors = PG(display_errors);
+    PG(display_errors) = 0;
+    zend_try
+    {
+        for (size_t i = 0; i <= VYRTUE_STACK_SIZE; i++) {
+            vyrtue_context_stack_push(&ctx.node_stack, array);
+        }
+    }
+    zend_catch
+    {
+        overflowed = true;
+    }
+    zend_end_try();
+    PG(display_errors) = display_errors;
+    vyrtue_embed_ok(overflowed && vyrtue_context_stack_count(&ctx.node_stack) == VYRTUE_STACK_SIZE, "stack: overflow after VYRTUE_STACK_SIZE");
+
+    zend_ast_destroy(stmt_list);
+    zend_ast_destroy(const_decl);
+    zend_ast_destroy(array);
+}
+
+static int vyrtue_embed_test(void)
+{
+    vyrtue_embed_test_resolve_class_name();
+    vyrtue_embed_test_resolve_function_name();
+    vyrtue_embed_test_context_stack();
+
+    printf("1..%d\n", vyrtue_embed_test_count);
+
+    return vyrtue_embed_test_failures > 0 ? 1 : 0;
+}
+
+/* }}} test */
+
+static int vyrtue_embed_startup(sapi_module_struct *sapi_module)
+{
+#if PHP_VERSION_ID >= 80200
+    return php_module_startup(sapi_module, &vyrtue_module_entry);
+#else
+    return php_module_startup(sapi_module, &vyrtue_module_entry, 1);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    int status = 1;
+
+    if (argc < 2 || (strcmp(argv[1], "test") != 0 && strcmp(argv[1], "bench") != 0)) {
+        fprintf(stderr, "usage: vyrtue-embed test\n       vyrtue-embed bench [-n iterations] file...\n");
+        return 1;
+    }
+
+    php_embed_module.startup = vyrtue_embed_startup;
+
+    PHP_EMBED_START_BLOCK(argc, argv)
+    if (strcmp(argv[1], "test") == 0) {
+        status = vyrtue_embed_test();
+    } else {
+        status = vyrtue_embed_bench(argc - 1, argv + 1);
+    }
+    PHP_EMBED_END_BLOCK()
+
+    return status;
+}
@@ -0,0 +1,58 @@
+<?php
+/**
+ * Measures a hot loop calling a small function, with and without
+ * #[VyrtueExt\Inline].
+ *
+ * php -d extension=vyrtue.so bench/inline.php [calls] [iterations]
+ *
+ * Both functions are declared in the same generated file, identical except
+ * for the attribute, so the difference is the cost of the call itself. Run
+ * it with opcache on as well, whose optimizer does not inline userland
+ * functions either.
+ */
+
+$calls = (int) ($argv[1] ?? 1000000);
+$iterations = (int) ($argv[2] ?? 10);
+
+$file = tempnam(sys_get_temp_dir(), 'vyrtue-bench-');
+file_put_contents($file, <<<'PHP'
+<?php
+#[VyrtueExt\Inline]
+function vyrtue_bench_inlined($a, $b) {
+    return $a * 31 + $b;
+}
+function vyrtue_bench_called($a, $b) {
+    return $a * 31 + $b;
+}
+return [
+    'inlined' => function (int $calls): int {
+        $h = 0;
+        for ($i = 0; $i < $calls; $i++) {
+            $h = vyrtue_bench_inlined($h, $i) & 0xffffff;
+        }
+        return $h;
+    },
+    'called' => function (int $calls): int {
+        $h = 0;
+        for ($i = 0; $i < $calls; $i++) {
+            $h = vyrtue_bench_called($h, $i) & 0xffffff;
+        }
+        return $h;
+    },
+];
+PHP);
+$loops = include $file;
+unlink($file);
+
+$best = [];
+foreach ($loops as $name => $loop) {
+    $best[$name] = PHP_INT_MAX;
+    for ($i = 0; $i < $iterations; $i++) {
+        $start = hrtime(true);
+        $loop($calls);
+        $best[$name] = min($best[$name], hrtime(true) - $start);
+    }
+    printf("%-8s %10.3f ms\n", $name, $best[$name] / 1e6);
+}
+
+printf("\nper call saved: %.1f ns\n", ($best['called'] - $best['inlined']) / $calls);
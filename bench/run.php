@@ -0,0 +1,179 @@
+<?php
+/**
+ * Compile throughput benchmark, run by make bench.
+ *
+ * php bench/run.php --extension=modules/vyrtue.so [--extension=...] [--php=php]
+ *     [--files=20] [--scale=200] [--depth=24] [--shapes=wide,deep,...]
+ *     [--iterations=5] [--corpus=DIR] [--output=FILE]
+ *
+ * Generates a synthetic corpus with bench/corpus.php and compiles every shape
+ * in a fresh process per configuration:
+ *
+ * - off: without the extension
+ * - internal: with the extension and the internal visitors
+ * - debug: with an extension built with --enable-vyrtue-debug, which also
+ *   registers the visitors of src/debug.c
+ * - internal-cache: like internal, with vyrtue.ast_cache_dir set, so after the
+ *   warm-up include files are loaded from the AST cache instead of being lexed,
+ *   parsed and walked
+ *
+ * Each --extension adds a configuration, named after the build it points to,
+ * so a debug and a release build can be compared in one run. --corpus (or
+ * BENCH_CORPUS) adds a directory of real code as the shape "corpus", see
+ * vyrtue_bench_import() for the files that are skipped.
+ *
+ * Results are written as JSON, with files/s, nodes/s, per file percentiles in
+ * microseconds and peak memory in bytes for every configuration and shape.
+ * Node counts come from a separate pass with vyrtue.stats=1, so counting
+ * does not affect the timed runs.
+ */
+
+require __DIR__ . '/corpus.php';
+
+$options = getopt('', ['php:', 'extension:', 'files:', 'scale:', 'depth:', 'shapes:', 'iterations:', 'corpus:', 'output:']);
+
+$php = $options['php'] ?? PHP_BINARY;
+$extensions = (array) ($options['extension'] ?? []);
+$iterations = (int) ($options['iterations'] ?? 5);
+$corpus = $options['corpus'] ?? (getenv('BENCH_CORPUS') ?: null);
+$params = [
+    'files' => (int) ($options['files'] ?? 20),
+    'scale' => (int) ($options['scale'] ?? 200),
+    'depth' => (int) ($options['depth'] ?? 24),
+];
+$shapes = isset($options['shapes']) ? explode(',', $options['shapes']) : VYRTUE_BENCH_SHAPES;
+
+if (!$extensions) {
+    fwrite(STDERR, "usage: php bench/run.php --extension=modules/vyrtue.so [--extension=...] [--php=php] [--files=20] [--scale=200] [--depth=24] [--shapes=...] [--iterations=5] [--corpus=DIR] [--output=FILE]\n");
+    exit(1);
+}
+
+/**
+ * Runs a php child process and returns its stdout, discarding stderr.
+ */
+function vyrtue_bench_exec(string $php, array $ini, array $args): string
+{
+    $command = [$php, '-n', '-d', 'opcache.enable_cli=0', '-d', 'memory_limit=-1'];
+    foreach ($ini as $key => $value) {
+        array_push($command, '-d', "$key=$value");
+    }
+    array_push($command, ...$args);
+
+    $process = proc_open($command, [1 => ['pipe', 'w'], 2 => ['file', '/dev/null', 'w']], $pipes);
+    if (!is_resource($process)) {
+        throw new RuntimeException('failed to start ' . $php);
+    }
+    $output = stream_get_contents($pipes[1]);
+    fclose($pipes[1]);
+    $status = proc_close($process);
+    if ($status !== 0) {
+        throw new RuntimeException(sprintf('%s exited with status %d', implode(' ', $command), $status));
+    }
+
+    return $output;
+}
+
+function vyrtue_bench_percentile(array $sorted, float $p): int
+{
+    return $sorted[min(count($sorted) - 1, (int) floor($p * count($sorted)))];
+}
+
+function vyrtue_bench_summarize(array $run, int $files, int $nodes, int $iterations): array
+{
+    $samples = $run['samples'];
+    sort($samples);
+    $total = array_sum($samples) ?: 1;
+
+    return [
+        'files' => $files,
+        'nodes' => $nodes,
+        'samples' => count($samples),
+        'files_per_s' => round(count($samples) / ($total / 1e9), 1),
+        'nodes_per_s' => round($nodes * $iterations / ($total / 1e9), 1),
+        'p50_us' => round(vyrtue_bench_percentile($samples, 0.50) / 1e3, 2),
+        'p90_us' => round(vyrtue_bench_percentile($samples, 0.90) / 1e3, 2),
+        'p99_us' => round(vyrtue_bench_percentile($samples, 0.99) / 1e3, 2),
+        'max_us' => round(end($samples) / 1e3, 2),
+        'peak_memory' => $run['peak_memory'],
+    ];
+}
+
+$dir = sys_get_temp_dir() . '/vyrtue-bench-' . getmypid();
+$lists = [];
+foreach (vyrtue_bench_generate($dir, $shapes, $params['files'], $params['scale'], $params['depth']) as $shape => $files) {
+    $lists[$shape] = $files;
+}
+if ($corpus !== null) {
+    $files = [];
+    foreach (new RecursiveIteratorIterator(new RecursiveDirectoryIterator($corpus, FilesystemIterator::SKIP_DOTS)) as $file) {
+        if ($file->getExtension() === 'php') {
+            $files[] = $file->getPathname();
+        }
+    }
+    sort($files);
+    mkdir("$dir/corpus");
+    foreach ($files as $n => $file) {
+        $target = sprintf('%s/corpus/%05d.php', $dir, $n);
+        if (vyrtue_bench_import($file, $target)) {
+            $lists['corpus'][] = $target;
+        }
+    }
+}
+$lists = array_filter($lists);
+foreach ($lists as $shape => $files) {
+    file_put_contents("$dir/$shape.list", implode("\n", $files) . "\n");
+}
+
+$configurations = ['off' => []];
+$versions = [];
+foreach ($extensions as $extension) {
+    $ini = ['extension' => realpath($extension) ?: $extension];
+    [$version, $debug] = json_decode(vyrtue_bench_exec($php, $ini, ['-r', 'echo json_encode([VyrtueExt\VERSION, VyrtueExt\DEBUG]);']), true);
+    $name = $debug ? 'debug' : 'internal';
+    for ($n = 2; isset($configurations[$name]); $n++) {
+        $name = ($debug ? 'debug' : 'internal') . "-$n";
+    }
+    $configurations[$name] = $ini;
+    $configurations["$name-cache"] = $ini + ['vyrtue.ast_cache_dir' => "$dir/ast-cache"];
+    $versions[$name] = $versions["$name-cache"] = $version;
+}
+@mkdir("$dir/ast-cache");
+
+$results = [];
+foreach ($lists as $shape => $files) {
+    $nodes = 0;
+    foreach ($configurations as $name => $ini) {
+        if ($name === 'off') {
+            continue;
+        }
+        $count = json_decode(vyrtue_bench_exec($php, $ini + ['vyrtue.stats' => 1], [__DIR__ . '/compile.php', "$dir/$shape.list", 1]), true);
+        $nodes = max($nodes, $count['stats']['totals']['nodes'] ?? 0);
+    }
+
+    foreach ($configurations as $name => $ini) {
+        $run = json_decode(vyrtue_bench_exec($php, $ini, [__DIR__ . '/compile.php', "$dir/$shape.list", $iterations]), true);
+        $results[$name][$shape] = vyrtue_bench_summarize($run, count($files), $nodes, $iterations);
+    }
+}
+
+foreach (array_merge(glob("$dir/corpus/*"), glob("$dir/ast-cache/*"), glob("$dir/*.*")) as $file) {
+    unlink($file);
+}
+rmdir("$dir/ast-cache");
+if (is_dir("$dir/corpus")) {
+    rmdir("$dir/corpus");
+}
+rmdir($dir);
+
+$report = json_encode([
+    'php' => trim(vyrtue_bench_exec($php, [], ['-r', 'echo PHP_VERSION;'])),
+    'versions' => $versions,
+    'parameters' => $params + ['iterations' => $iterations, 'corpus' => $corpus],
+    'results' => $results,
+], JSON_PRETTY_PRINT | JSON_UNESCAPED_SLASHES) . "\n";
+
+if (isset($options['output'])) {
+    file_put_contents($options['output'], $report);
+} else {
+    echo $report;
+}
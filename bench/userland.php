@@ -0,0 +1,65 @@
+<?php
+/**
+ * Measures the cost of a userland visitor callback.
+ *
+ * php -d extension=vyrtue.so -d opcache.enable_cli=0 bench/userland.php [calls] [iterations]
+ *
+ * Compiles a file of generated calls without any userland visitor, with a
+ * visitor on a kind that does not occur in the file, and with a visitor that
+ * is called for every call, and reports the difference per callback.
+ */
+
+use VyrtueExt\Node;
+use function VyrtueExt\register_visitor;
+
+$calls = (int) ($argv[1] ?? 10000);
+$iterations = (int) ($argv[2] ?? 20);
+
+if (filter_var(ini_get('opcache.enable_cli'), FILTER_VALIDATE_BOOL)) {
+    fwrite(STDERR, "opcache.enable_cli must be off, or only the first include is compiled\n");
+    exit(1);
+}
+
+$file = tempnam(sys_get_temp_dir(), 'vyrtue-bench-');
+$code = "<?php\nif (false) {\n";
+for ($i = 0; $i < $calls; $i++) {
+    $code .= "    vyrtue_bench_$i($i);\n";
+}
+$code .= "}\n";
+file_put_contents($file, $code);
+
+function bench(string $file, int $iterations): float
+{
+    $best = PHP_INT_MAX;
+    for ($i = 0; $i < $iterations; $i++) {
+        $start = hrtime(true);
+        include $file;
+        $best = min($best, hrtime(true) - $start);
+    }
+    return $best / 1e6;
+}
+
+$baseline = bench($file, $iterations);
+printf("%-24s %10.3f ms\n", 'no visitors', $baseline);
+
+register_visitor(VyrtueExt\AST_MATCH, function (Node $node) {
+    return null;
+});
+$unrelated = bench($file, $iterations);
+printf("%-24s %10.3f ms\n", 'unrelated kind', $unrelated);
+
+register_visitor(VyrtueExt\AST_CALL, function (Node $node) {
+    return null;
+});
+$noop = bench($file, $iterations);
+printf("%-24s %10.3f ms\n", 'no-op', $noop);
+
+register_visitor(VyrtueExt\AST_CALL, function (Node $node) {
+    return $node->children[1]->children[0] === -1 ? 0 : null;
+});
+$children = bench($file, $iterations);
+printf("%-24s %10.3f ms\n", 'no-op + reading children', $children);
+
+printf("\nper callback: %.0f ns, per callback reading children: %.0f ns\n", ($noop - $unrelated) * 1e6 / $calls, ($children - $noop) * 1e6 / $calls);
+
+unlink($file);
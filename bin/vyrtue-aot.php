@@ -0,0 +1,241 @@
+<?php
+/**
+ * Ahead of time transform of a source tree.
+ *
+ * php -d extension=vyrtue.so bin/vyrtue-aot.php [--jobs=N] [--force] SRC OUT
+ *
+ * Every .php file under SRC is run through the registered visitors with
+ * VyrtueExt\transform_file() and written to the same place under OUT, other
+ * files are copied. The transformed tree can then be run with
+ * vyrtue.process=0, so nothing is walked at compile time.
+ *
+ * Files are handed out one at a time to --jobs worker processes (forked, so
+ * they share this process's configuration and visitors; without pcntl they are
+ * transformed in this process). A worker that dies fails the file it was on,
+ * and the others carry on. OUT/.vyrtue-aot.json records the content hash
+ * of every file, and files whose hash has not changed are skipped, unless the
+ * visitors or vyrtue INI settings changed (see VyrtueExt\fingerprint()) or
+ * --force is given. Files
+ * removed from SRC are removed from OUT.
+ *
+ * Exported code does not keep comments, formatting or line numbers, so
+ * __LINE__ and error messages refer to the transformed file.
+ */
+
+const VYRTUE_AOT_MANIFEST = '.vyrtue-aot.json';
+
+$options = getopt('', ['jobs:', 'force'], $rest);
+$args = array_slice($argv, $rest);
+
+if (count($args) !== 2 || !extension_loaded('vyrtue')) {
+    fwrite(STDERR, "usage: php -d extension=vyrtue.so bin/vyrtue-aot.php [--jobs=N] [--force] SRC OUT\n");
+    exit(1);
+}
+
+$jobs = max(1, (int) ($options['jobs'] ?? vyrtue_aot_cpus()));
+$force = isset($options['force']);
+$src = realpath($args[0]);
+$out = rtrim($args[1], '/');
+
+if ($src === false || !is_dir($src)) {
+    fwrite(STDERR, "vyrtue-aot: {$args[0]} is not a directory\n");
+    exit(1);
+}
+if (!is_dir($out) && !mkdir($out, 0777, true)) {
+    exit(1);
+}
+$out = realpath($out);
+
+function vyrtue_aot_cpus(): int
+{
+    $cpus = @file_get_contents('/proc/cpuinfo');
+    return $cpus ? max(1, preg_match_all('/^processor/m', $cpus)) : 1;
+}
+
+/**
+ * Everything besides the sources that decides what a transform produces.
+ */
+function vyrtue_aot_fingerprint(): string
+{
+    return hash('xxh128', serialize([PHP_VERSION, VyrtueExt\fingerprint()]));
+}
+
+function vyrtue_aot_write(string $file, string $contents): void
+{
+    if (!is_dir(dirname($file))) {
+        mkdir(dirname($file), 0777, true);
+    }
+
+    // renamed into place, so a failed run never leaves half a file behind
+    $tmp = $file . '.' . getmypid() . '.tmp';
+    if (false === file_put_contents($tmp, $contents) || !rename($tmp, $file)) {
+        @unlink($tmp);
+        throw new RuntimeException("failed to write $file");
+    }
+}
+
+/**
+ * Transforms or copies one file, returns an error message or null.
+ */
+function vyrtue_aot_process(string $src, string $out, string $file): ?string
+{
+    try {
+        if (str_ends_with($file, '.php')) {
+            $code = VyrtueExt\transform_file("$src/$file");
+            if ($code === false) {
+                return 'failed to read';
+            }
+        } else {
+            $code = file_get_contents("$src/$file");
+        }
+        vyrtue_aot_write("$out/$file", $code);
+    } catch (Throwable $e) {
+        return $e->getMessage();
+    }
+
+    return null;
+}
+
+/**
+ * Forks workers that read file names from a socket and answer with a line of
+ * JSON each, and feeds them until the queue is empty.
+ */
+function vyrtue_aot_run(string $src, string $out, array $queue, int $jobs, callable $done): void
+{
+    if ($jobs === 1 || count($queue) <= 1 || !function_exists('pcntl_fork')) {
+        foreach ($queue as $file) {
+            $done($file, vyrtue_aot_process($src, $out, $file));
+        }
+        return;
+    }
+
+    $workers = [];
+    for ($i = 0; $i < min($jobs, count($queue)); $i++) {
+        [$parent, $child] = stream_socket_pair(STREAM_PF_UNIX, STREAM_SOCK_STREAM, STREAM_IPPROTO_IP);
+        $pid = pcntl_fork();
+        if ($pid === -1) {
+            throw new RuntimeException('fork failed');
+        }
+        if ($pid === 0) {
+            fclose($parent);
+            // or the other workers would never see their socket closed
+            foreach ($workers as $socket) {
+                fclose($socket);
+            }
+            while (false !== ($file = fgets($child))) {
+                $file = rtrim($file, "\n");
+                fwrite($child, json_encode([$file, vyrtue_aot_process($src, $out, $file)]) . "\n");
+            }
+            exit(0);
+        }
+        fclose($child);
+        $workers[$pid] = $parent;
+    }
+
+    // the file each worker is on
+    $current = [];
+    foreach ($workers as $pid => $socket) {
+        $current[$pid] = array_shift($queue);
+        fwrite($socket, $current[$pid] . "\n");
+    }
+
+    try {
+        while ($workers) {
+            $read = $workers;
+            $write = $except = null;
+            if (false === stream_select($read, $write, $except, null)) {
+                throw new RuntimeException('select failed');
+            }
+
+            foreach ($read as $socket) {
+                $pid = array_search($socket, $workers, true);
+                $line = fgets($socket);
+                $reply = $line === false ? null : json_decode($line, true);
+
+                if (!is_array($reply)) {
+                    $done($current[$pid], 'worker exited while transforming it');
+                } else {
+                    $done(...$reply);
+                    if ($queue) {
+                        $current[$pid] = array_shift($queue);
+                        fwrite($socket, $current[$pid] . "\n");
+                        continue;
+                    }
+                }
+
+                fclose($socket);
+                unset($workers[$pid], $current[$pid]);
+                pcntl_waitpid($pid, $status);
+            }
+        }
+    } finally {
+        // workers exit once their socket is closed
+        foreach ($workers as $pid => $socket) {
+            fclose($socket);
+            pcntl_waitpid($pid, $status);
+        }
+    }
+
+    // every worker died before the queue was empty
+    foreach ($queue as $file) {
+        $done($file, vyrtue_aot_process($src, $out, $file));
+    }
+}
+
+$fingerprint = vyrtue_aot_fingerprint();
+$manifest = json_decode(@file_get_contents("$out/" . VYRTUE_AOT_MANIFEST) ?: '[]', true) ?: [];
+if ($force || ($manifest['fingerprint'] ?? null) !== $fingerprint) {
+    $manifest = ['fingerprint' => $fingerprint, 'files' => []];
+}
+
+$hashes = [];
+$queue = [];
+$iterator = new RecursiveIteratorIterator(new RecursiveDirectoryIterator($src, FilesystemIterator::SKIP_DOTS));
+foreach ($iterator as $info) {
+    if (!$info->isFile()) {
+        continue;
+    }
+    $file = substr($info->getPathname(), strlen($src) + 1);
+    // an output directory inside the source tree is not a source
+    if (str_starts_with($info->getPathname(), $out . '/')) {
+        continue;
+    }
+
+    $hashes[$file] = hash_file('xxh128', $info->getPathname());
+    if (($manifest['files'][$file] ?? null) !== $hashes[$file] || !is_file("$out/$file")) {
+        $queue[] = $file;
+    }
+}
+sort($queue);
+
+foreach (array_diff_key($manifest['files'], $hashes) as $file => $hash) {
+    @unlink("$out/$file");
+    unset($manifest['files'][$file]);
+}
+
+$errors = 0;
+$start = hrtime(true);
+vyrtue_aot_run($src, $out, $queue, $jobs, function (string $file, ?string $error) use (&$manifest, &$errors, $hashes) {
+    if ($error !== null) {
+        fwrite(STDERR, "vyrtue-aot: $file: $error\n");
+        unset($manifest['files'][$file]);
+        $errors++;
+    } else {
+        $manifest['files'][$file] = $hashes[$file];
+    }
+});
+
+ksort($manifest['files']);
+vyrtue_aot_write("$out/" . VYRTUE_AOT_MANIFEST, json_encode($manifest, JSON_PRETTY_PRINT | JSON_UNESCAPED_SLASHES) . "\n");
+
+fprintf(
+    STDERR,
+    "vyrtue-aot: %d files, %d written, %d skipped, %d errors in %.2fs\n",
+    count($hashes),
+    count($queue) - $errors,
+    count($hashes) - count($queue),
+    $errors,
+    (hrtime(true) - $start) / 1e9
+);
+
+exit($errors > 0 ? 1 : 0);
@@ -24,6 +24,9 @@ PHP_ARG_ENABLE(vyrtue,     whether to enable vyrtue support,
 PHP_ARG_ENABLE(vyrtue-debug, whether to enable vyrtue debug support,
 [AS_HELP_STRING([--enable-vyrtue-debug], [Enable vyrtue debug support])], [no], [no])
 
+PHP_ARG_ENABLE(vyrtue-dtrace, whether to enable vyrtue USDT probes,
+[AS_HELP_STRING([--enable-vyrtue-dtrace], [Enable vyrtue USDT probes (requires sys/sdt.h)])], [no], [no])
+
 AC_DEFUN([PHP_VYRTUE_ADD_SOURCES], [
   PHP_VYRTUE_SOURCES="$PHP_VYRTUE_SOURCES $1"
 ])
@@ -37,14 +40,48 @@ if test "$PHP_VYRTUE" != "no"; then
 
         PHP_VYRTUE_ADD_SOURCES([
             src/debug.c
+            src/debug_log.c
         ])
     fi
 
+    if test "$PHP_VYRTUE_DTRACE" == "yes"; then
+        AC_CHECK_HEADER([sys/sdt.h], [
+            AC_DEFINE([HAVE_VYRTUE_DTRACE], [1], [Enable vyrtue USDT probes])
+        ], [
+            AC_MSG_ERROR([sys/sdt.h not found, install systemtap-sdt-dev or equivalent])
+        ])
+    fi
+
+    dnl robust mutexes let the shared memory index recover from a worker that died holding its lock
+    AC_CHECK_FUNCS([pthread_mutexattr_setrobust pthread_mutex_consistent])
+
     PHP_VYRTUE_ADD_SOURCES([
+        src/alloc.c
+        src/aot.c
+        src/ast.c
+        src/ast_cache.c
+        src/autoload.c
         src/compile.c
         src/context.c
         src/extension.c
+        src/filter.c
+        src/fingerprint.c
+        src/fold.c
+        src/hydrate.c
+        src/in_array.c
+        src/index.c
+        src/inline.c
+        src/inject.c
+        src/loop.c
+        src/macro.c
+        src/memoize.c
         src/process.c
+        src/shm.c
+        src/sprintf.c
+        src/stats.c
+        src/strip.c
+        src/trace.c
+        src/userland.c
         src/visitor.c
     ])
 
@@ -53,5 +90,7 @@ if test "$PHP_VYRTUE" != "no"; then
     PHP_NEW_EXTENSION(vyrtue, $PHP_VYRTUE_SOURCES, $ext_shared, -DZEND_ENABLE_STATIC_TSRMLS_CACHE=1)
     PHP_ADD_EXTENSION_DEP(vyrtue, ast, true)
     PHP_ADD_EXTENSION_DEP(vyrtue, opcache, true)
+    PHP_ADD_MAKEFILE_FRAGMENT
     PHP_SUBST(VYRTUE_SHARED_LIBADD)
+    PHP_SUBST(PHP_VYRTUE_SOURCES)
 fi
@@ -26,6 +26,8 @@
 #define PHP_VYRTUE_VERSION "0.1.0"
 #define PHP_VYRTUE_RELEASE "2024-01-27"
 #define PHP_VYRTUE_AUTHORS "John Boehr <jbboehr@gmail.com> (lead)"
+#define PHP_VYRTUE_URL "https://github.com/jbboehr/php-vyrtue"
+#define PHP_VYRTUE_COPYRIGHT "Copyright (c) 2016-2024 John Boehr & contributors"
 
 #if (__GNUC__ >= 4) || defined(__clang__) || defined(HAVE_FUNC_ATTRIBUTE_VISIBILITY)
 #define VYRTUE_PUBLIC __attribute__((visibility("default")))
@@ -71,13 +73,79 @@ extern zend_module_entry vyrtue_module_entry;
 ZEND_TSRMLS_CACHE_EXTERN();
 #endif
 
+struct vyrtue_ast_cache_pending;
 struct vyrtue_context;
+struct vyrtue_trace_event;
+struct vyrtue_debug_log;
 typedef zend_ast *(*vyrtue_ast_callback)(zend_ast *ast, struct vyrtue_context *ctx);
 
+/**
+ * Compile statistics, collected when vyrtue.stats is enabled. Times are in
+ * nanoseconds.
+ */
+struct vyrtue_stats
+{
+    uint64_t files;
+    uint64_t nodes;
+    uint64_t visitor_calls;
+    uint64_t replacements;
+    uint64_t name_resolutions;
+    uint64_t arena_bytes;
+    uint64_t time_ns;
+};
+
+struct vyrtue_stats_visitor
+{
+    const char *name;
+    uint64_t enter_calls;
+    uint64_t leave_calls;
+    uint64_t replacements;
+    uint64_t time_ns;
+};
+
 ZEND_BEGIN_MODULE_GLOBALS(vyrtue)
     HashTable attribute_visitors;
     HashTable function_visitors;
     HashTable kind_visitors;
+    HashTable visitor_versions;
+    bool process;
+    bool fold_functions;
+    bool strip_debug;
+    char *strip_constants;
+    char *strip_functions;
+    zend_long shm_size;
+    zend_long max_process_ms;
+    zend_long max_nodes;
+    char *include_paths;
+    char *exclude_paths;
+    char *visitor_paths;
+    char *ast_cache_dir;
+    struct vyrtue_ast_cache_pending *ast_cache_pending;
+    HashTable *attribute_index;
+    uint64_t attribute_index_generation;
+    HashTable *class_map;
+    uint64_t class_map_generation;
+    HashTable *macros;
+    HashTable *debug_only;
+    HashTable *userland_visitors;
+    HashTable *userland_hooks;
+    uint64_t userland_epoch;
+    uint32_t userland_depth;
+    bool stats;
+    struct vyrtue_stats stats_totals;
+    struct vyrtue_stats_visitor *stats_visitors;
+    uint32_t stats_visitors_count;
+    HashTable stats_visitor_names;
+    HashTable *stats_files;
+    char *trace_file;
+    zend_long trace_threshold_us;
+    struct vyrtue_trace_event *trace_events;
+    uint32_t trace_head;
+    uint32_t trace_count;
+    uint64_t trace_dropped;
+    char *debug;
+    zend_long debug_buffer;
+    struct vyrtue_debug_log *debug_log;
 ZEND_END_MODULE_GLOBALS(vyrtue)
 
 ZEND_EXTERN_MODULE_GLOBALS(vyrtue);
@@ -99,6 +167,15 @@ VYRTUE_ATTR_NONNULL_ALL
 VYRTUE_ATTR_RETURNS_NONNULL
 zend_arena **vyrtue_context_get_arena_ptr(struct vyrtue_context *ctx);
 
+/**
+ * Creates a ZEND_AST_VAR for a fresh variable name that is unique within the
+ * file currently being processed.
+ */
+VYRTUE_PUBLIC
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_RETURNS_NONNULL
+zend_ast *vyrtue_context_create_temporary_var(struct vyrtue_context *ctx);
+
 VYRTUE_PUBLIC
 zend_never_inline void vyrtue_ast_process(zend_ast *ast);
 
@@ -106,6 +183,13 @@ VYRTUE_PUBLIC
 VYRTUE_ATTR_NONNULL_ALL
 void vyrtue_ast_process_file(zend_ast *ast);
 
+/**
+ * Optional visitors only rewrite for performance, the code means the same
+ * without them. They are skipped for the rest of a file once it exceeds
+ * vyrtue.max_process_ms or vyrtue.max_nodes.
+ */
+#define VYRTUE_VISITOR_OPTIONAL (1 << 0)
+
 VYRTUE_PUBLIC
 void vyrtue_register_attribute_visitor(const char *visitor_name, zend_string *attribute_name, vyrtue_ast_callback enter, vyrtue_ast_callback leave);
 
@@ -115,6 +199,30 @@ void vyrtue_register_function_visitor(const char *visitor_name, zend_string *fun
 VYRTUE_PUBLIC
 void vyrtue_register_kind_visitor(const char *visitor_name, enum _zend_ast_kind kind, vyrtue_ast_callback enter, vyrtue_ast_callback leave);
 
+VYRTUE_PUBLIC
+void vyrtue_register_attribute_visitor_ex(
+    const char *visitor_name, zend_string *attribute_name, vyrtue_ast_callback enter, vyrtue_ast_callback leave, uint32_t flags
+);
+
+VYRTUE_PUBLIC
+void vyrtue_register_function_visitor_ex(
+    const char *visitor_name, zend_string *function_name, vyrtue_ast_callback enter, vyrtue_ast_callback leave, uint32_t flags
+);
+
+VYRTUE_PUBLIC
+void vyrtue_register_kind_visitor_ex(
+    const char *visitor_name, enum _zend_ast_kind kind, vyrtue_ast_callback enter, vyrtue_ast_callback leave, uint32_t flags
+);
+
+/**
+ * Declares the version of a visitor, which is part of the fingerprint opcache
+ * entries are keyed on. Call it from MINIT and bump it whenever the visitor's
+ * output changes between releases. Both strings must outlive the module.
+ */
+VYRTUE_PUBLIC
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_register_visitor_version(const char *visitor_name, const char *version);
+
 VYRTUE_PUBLIC
 VYRTUE_ATTR_NONNULL_ALL
 VYRTUE_ATTR_RETURNS_NONNULL
@@ -133,6 +241,17 @@ VYRTUE_ATTR_RETURNS_NONNULL
 VYRTUE_ATTR_WARN_UNUSED_RESULT
 const struct vyrtue_visitor_array *vyrtue_get_kind_visitors(enum _zend_ast_kind kind);
 
+/**
+ * Returns the statistics collected by this process since startup or the last
+ * reset, and the per-visitor statistics in visitors.
+ */
+VYRTUE_PUBLIC
+VYRTUE_ATTR_RETURNS_NONNULL
+const struct vyrtue_stats *vyrtue_stats_get(const struct vyrtue_stats_visitor **visitors, uint32_t *visitors_count);
+
+VYRTUE_PUBLIC
+void vyrtue_stats_reset(void);
+
 // backwards compatibility
 #define vyrtue_preprocess_context vyrtue_context
 
@@ -0,0 +1,426 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef VYRTUE_DEBUG
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_alloc.h"
+#include "Zend/zend_smart_str.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "alloc.h"
+#include "debug_log.h"
+
+struct vyrtue_alloc_record
+{
+    void *ptr;
+    size_t size;
+    enum vyrtue_alloc_category category;
+};
+
+struct vyrtue_alloc_state
+{
+    bool active;
+    enum vyrtue_alloc_category category;
+    zend_mm_heap *heap;
+    // open addressing with linear probing, keyed by pointer
+    struct vyrtue_alloc_record *records;
+    size_t capacity;
+    size_t count;
+    uint64_t allocs[VYRTUE_ALLOC_CATEGORIES];
+    uint64_t bytes[VYRTUE_ALLOC_CATEGORIES];
+};
+
+static ZEND_TLS struct vyrtue_alloc_state vyrtue_alloc;
+
+static const char *const vyrtue_alloc_category_names[VYRTUE_ALLOC_CATEGORIES] = {
+    [VYRTUE_ALLOC_OTHER] = "other",
+    [VYRTUE_ALLOC_NAMES] = "names",
+    [VYRTUE_ALLOC_IMPORTS] = "imports",
+    [VYRTUE_ALLOC_SCOPE] = "scope",
+    [VYRTUE_ALLOC_ARENA] = "arena",
+};
+
+static zend_always_inline size_t vyrtue_alloc_hash(const void *ptr)
+{
+    return (size_t) (((uint64_t) (uintptr_t) ptr * UINT64_C(0x9E3779B97F4A7C15)) >> 32);
+}
+
+static struct vyrtue_alloc_record *vyrtue_alloc_find(const void *ptr)
+{
+    size_t mask = vyrtue_alloc.capacity - 1;
+
+    for (size_t i = vyrtue_alloc_hash(ptr) & mask;; i = (i + 1) & mask) {
+        if (vyrtue_alloc.records[i].ptr == ptr) {
+            return &vyrtue_alloc.records[i];
+        }
+        if (vyrtue_alloc.records[i].ptr == NULL) {
+            return NULL;
+        }
+    }
+}
+
+static void vyrtue_alloc_insert(void *ptr, size_t size, enum vyrtue_alloc_category category)
+{
+    // the table lives outside of the heap it accounts for
+    if ((vyrtue_alloc.count + 1) * 2 > vyrtue_alloc.capacity) {
+        struct vyrtue_alloc_record *old = vyrtue_alloc.records;
+        size_t old_capacity = vyrtue_alloc.capacity;
+
+        vyrtue_alloc.capacity = old_capacity ? old_capacity * 2 : 1024;
+        vyrtue_alloc.records = calloc(vyrtue_alloc.capacity, sizeof(*vyrtue_alloc.records));
+        if (UNEXPECTED(vyrtue_alloc.records == NULL)) {
+            zend_out_of_memory();
+        }
+        vyrtue_alloc.count = 0;
+
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].ptr != NULL) {
+                vyrtue_alloc_insert(old[i].ptr, old[i].size, old[i].category);
+            }
+        }
+        free(old);
+    }
+
+    size_t mask = vyrtue_alloc.capacity - 1;
+    size_t i = vyrtue_alloc_hash(ptr) & mask;
+    while (vyrtue_alloc.records[i].ptr != NULL) {
+        i = (i + 1) & mask;
+    }
+
+    vyrtue_alloc.records[i] = (struct vyrtue_alloc_record){ptr, size, category};
+    vyrtue_alloc.count++;
+}
+
+/**
+ * Backward shift deletion, so lookups never need tombstones.
+ */
+static void vyrtue_alloc_remove(struct vyrtue_alloc_record *record)
+{
+    size_t mask = vyrtue_alloc.capacity - 1;
+    size_t i = record - vyrtue_alloc.records;
+    size_t j = i;
+
+    vyrtue_alloc.count--;
+
+    for (;;) {
+        vyrtue_alloc.records[i].ptr = NULL;
+
+        for (;;) {
+            j = (j + 1) & mask;
+            if (vyrtue_alloc.records[j].ptr == NULL) {
+                return;
+            }
+
+            size_t k = vyrtue_alloc_hash(vyrtue_alloc.records[j].ptr) & mask;
+            if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+                continue;
+            }
+            break;
+        }
+
+        vyrtue_alloc.records[i] = vyrtue_alloc.records[j];
+        i = j;
+    }
+}
+
+static void *vyrtue_alloc_malloc(size_t size ZEND_FILE_LINE_DC ZEND_FILE_LINE_ORIG_DC)
+{
+    void *ptr = _zend_mm_alloc(vyrtue_alloc.heap, size ZEND_FILE_LINE_RELAY_CC ZEND_FILE_LINE_ORIG_RELAY_CC);
+
+    vyrtue_alloc.allocs[vyrtue_alloc.category]++;
+    vyrtue_alloc.bytes[vyrtue_alloc.category] += size;
+    vyrtue_alloc_insert(ptr, size, vyrtue_alloc.category);
+
+    return ptr;
+}
+
+static void vyrtue_alloc_free(void *ptr ZEND_FILE_LINE_DC ZEND_FILE_LINE_ORIG_DC)
+{
+    struct vyrtue_alloc_record *record = ptr ? vyrtue_alloc_find(ptr) : NULL;
+
+    if (record != NULL) {
+        vyrtue_alloc_remove(record);
+    }
+
+    _zend_mm_free(vyrtue_alloc.heap, ptr ZEND_FILE_LINE_RELAY_CC ZEND_FILE_LINE_ORIG_RELAY_CC);
+}
+
+static void *vyrtue_alloc_realloc(void *ptr, size_t size ZEND_FILE_LINE_DC ZEND_FILE_LINE_ORIG_DC)
+{
+    struct vyrtue_alloc_record *record = ptr ? vyrtue_alloc_find(ptr) : NULL;
+    enum vyrtue_alloc_category category = vyrtue_alloc.category;
+
+    if (record != NULL) {
+        category = record->category;
+        vyrtue_alloc_remove(record);
+    }
+
+    void *new_ptr = _zend_mm_realloc(vyrtue_alloc.heap, ptr, size ZEND_FILE_LINE_RELAY_CC ZEND_FILE_LINE_ORIG_RELAY_CC);
+
+    vyrtue_alloc.allocs[category]++;
+    vyrtue_alloc.bytes[category] += size;
+    vyrtue_alloc_insert(new_ptr, size, category);
+
+    return new_ptr;
+}
+
+static void vyrtue_alloc_claim(const void *ptr, enum vyrtue_alloc_category category)
+{
+    struct vyrtue_alloc_record *record = vyrtue_alloc_find(ptr);
+
+    if (record != NULL && record->category != category) {
+        vyrtue_alloc.allocs[record->category]--;
+        vyrtue_alloc.bytes[record->category] -= record->size;
+        vyrtue_alloc.allocs[category]++;
+        vyrtue_alloc.bytes[category] += record->size;
+        record->category = category;
+    }
+}
+
+static void vyrtue_alloc_disown(const void *ptr)
+{
+    struct vyrtue_alloc_record *record = vyrtue_alloc_find(ptr);
+
+    if (record != NULL) {
+        vyrtue_alloc_remove(record);
+    }
+}
+
+static void vyrtue_alloc_disown_zval(zval *zv)
+{
+    if (Z_TYPE_P(zv) == IS_STRING) {
+        vyrtue_alloc_disown(Z_STR_P(zv));
+    } else if (Z_TYPE_P(zv) == IS_ARRAY && !(GC_FLAGS(Z_ARR_P(zv)) & IS_ARRAY_IMMUTABLE)) {
+        zend_string *key;
+        zval *val;
+
+        vyrtue_alloc_disown(Z_ARR_P(zv));
+        if (!(HT_FLAGS(Z_ARR_P(zv)) & HASH_FLAG_UNINITIALIZED)) {
+            vyrtue_alloc_disown(HT_GET_DATA_ADDR(Z_ARR_P(zv)));
+        }
+        ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARR_P(zv), key, val)
+        {
+            if (key) {
+                vyrtue_alloc_disown(key);
+            }
+            vyrtue_alloc_disown_zval(val);
+        }
+        ZEND_HASH_FOREACH_END();
+    }
+}
+
+static void vyrtue_alloc_disown_ast(zend_ast *ast)
+{
+    if (ast == NULL) {
+        return;
+    }
+
+    if (ast->kind == ZEND_AST_ZVAL) {
+        vyrtue_alloc_disown_zval(zend_ast_get_zval(ast));
+    } else if (ast->kind == ZEND_AST_CONSTANT || ast->kind == ZEND_AST_ZNODE) {
+        return;
+    } else if (zend_ast_is_special(ast)) {
+        zend_ast_decl *decl = (zend_ast_decl *) ast;
+        if (decl->name) {
+            vyrtue_alloc_disown(decl->name);
+        }
+        if (decl->doc_comment) {
+            vyrtue_alloc_disown(decl->doc_comment);
+        }
+        for (uint32_t i = 0; i < sizeof(decl->child) / sizeof(decl->child[0]); i++) {
+            vyrtue_alloc_disown_ast(decl->child[i]);
+        }
+    } else if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        for (uint32_t i = 0; i < list->children; i++) {
+            vyrtue_alloc_disown_ast(list->child[i]);
+        }
+    } else {
+        uint32_t children = zend_ast_get_num_children(ast);
+        for (uint32_t i = 0; i < children; i++) {
+            vyrtue_alloc_disown_ast(ast->child[i]);
+        }
+    }
+}
+
+VYRTUE_LOCAL
+bool vyrtue_alloc_begin(void)
+{
+    if (vyrtue_alloc.active || !is_zend_mm()) {
+        return false;
+    }
+
+    memset(vyrtue_alloc.allocs, 0, sizeof(vyrtue_alloc.allocs));
+    memset(vyrtue_alloc.bytes, 0, sizeof(vyrtue_alloc.bytes));
+    vyrtue_alloc.category = VYRTUE_ALLOC_OTHER;
+    vyrtue_alloc.heap = zend_mm_get_heap();
+    vyrtue_alloc.active = true;
+
+    // debug builds pass the file and line along, and need handlers that take them
+#if ZEND_DEBUG
+    zend_mm_set_custom_debug_handlers(vyrtue_alloc.heap, vyrtue_alloc_malloc, vyrtue_alloc_free, vyrtue_alloc_realloc);
+#else
+    zend_mm_set_custom_handlers(vyrtue_alloc.heap, vyrtue_alloc_malloc, vyrtue_alloc_free, vyrtue_alloc_realloc);
+#endif
+
+    return true;
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_alloc_end(zend_ast *ast)
+{
+    uint64_t leaked_allocs[VYRTUE_ALLOC_CATEGORIES] = {0};
+    uint64_t leaked_bytes[VYRTUE_ALLOC_CATEGORIES] = {0};
+    zend_string *filename = zend_get_compiled_filename();
+    zend_string *key;
+
+    zend_mm_set_custom_handlers(vyrtue_alloc.heap, NULL, NULL, NULL);
+    vyrtue_alloc.active = false;
+
+    if (vyrtue_alloc.records == NULL) {
+        return;
+    }
+
+    // owned by the compiler: names in the tree, and strings interned while processing
+    vyrtue_alloc_disown_ast(ast);
+    if (!(HT_FLAGS(&CG(interned_strings)) & HASH_FLAG_UNINITIALIZED)) {
+        vyrtue_alloc_disown(HT_GET_DATA_ADDR(&CG(interned_strings)));
+    }
+    ZEND_HASH_FOREACH_STR_KEY(&CG(interned_strings), key)
+    {
+        vyrtue_alloc_disown(key);
+    }
+    ZEND_HASH_FOREACH_END();
+
+    for (size_t i = 0; i < vyrtue_alloc.capacity; i++) {
+        struct vyrtue_alloc_record *record = &vyrtue_alloc.records[i];
+        if (record->ptr != NULL) {
+            leaked_allocs[record->category]++;
+            leaked_bytes[record->category] += record->size;
+        }
+    }
+
+    free(vyrtue_alloc.records);
+    vyrtue_alloc.records = NULL;
+    vyrtue_alloc.capacity = 0;
+    vyrtue_alloc.count = 0;
+
+    if (VYRTUE_DEBUG_ENABLED(VYRTUE_DEBUG_ALLOC)) {
+        smart_str buf = {0};
+        for (int i = 0; i < VYRTUE_ALLOC_CATEGORIES; i++) {
+            smart_str_append_printf(
+                &buf,
+                " %s=%" PRIu64 "/%" PRIu64 "B",
+                vyrtue_alloc_category_names[i],
+                vyrtue_alloc.allocs[i],
+                vyrtue_alloc.bytes[i]
+            );
+        }
+        smart_str_0(&buf);
+        vyrtue_debug_log(VYRTUE_DEBUG_ALLOC, "VYRTUE_ALLOC: %s%s\n", filename ? ZSTR_VAL(filename) : "-", ZSTR_VAL(buf.s));
+        smart_str_free(&buf);
+    }
+
+    // what is left of other is owned by the tree or by visitors
+    for (int i = VYRTUE_ALLOC_OTHER + 1; i < VYRTUE_ALLOC_CATEGORIES; i++) {
+        if (UNEXPECTED(leaked_allocs[i] > 0)) {
+            zend_error(
+                E_WARNING,
+                "vyrtue: %s: %" PRIu64 " allocations (%" PRIu64 " bytes) of %s were not released",
+                filename ? ZSTR_VAL(filename) : "-",
+                leaked_allocs[i],
+                leaked_bytes[i],
+                vyrtue_alloc_category_names[i]
+            );
+        }
+    }
+}
+
+VYRTUE_LOCAL
+enum vyrtue_alloc_category vyrtue_alloc_set_category(enum vyrtue_alloc_category category)
+{
+    enum vyrtue_alloc_category previous = vyrtue_alloc.category;
+    vyrtue_alloc.category = category;
+    return previous;
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_alloc_claim_ht(HashTable *ht, enum vyrtue_alloc_category category)
+{
+    zend_string *key;
+    zval *val;
+
+    if (!vyrtue_alloc.active || vyrtue_alloc.records == NULL || (HT_FLAGS(ht) & HASH_FLAG_UNINITIALIZED)) {
+        return;
+    }
+
+    vyrtue_alloc_claim(HT_GET_DATA_ADDR(ht), category);
+
+    ZEND_HASH_FOREACH_STR_KEY_VAL(ht, key, val)
+    {
+        if (key && !ZSTR_IS_INTERNED(key)) {
+            vyrtue_alloc_claim(key, category);
+        }
+        if (Z_TYPE_P(val) == IS_STRING && !ZSTR_IS_INTERNED(Z_STR_P(val))) {
+            vyrtue_alloc_claim(Z_STR_P(val), category);
+        } else if (Z_TYPE_P(val) == IS_PTR) {
+            vyrtue_alloc_claim(Z_PTR_P(val), category);
+        }
+    }
+    ZEND_HASH_FOREACH_END();
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_alloc_claim_arena(zend_arena *arena)
+{
+    if (!vyrtue_alloc.active || vyrtue_alloc.records == NULL) {
+        return;
+    }
+
+    for (; arena != NULL; arena = arena->prev) {
+        vyrtue_alloc_claim(arena, VYRTUE_ALLOC_ARENA);
+    }
+}
+
+VYRTUE_LOCAL
+void vyrtue_alloc_abort(void)
+{
+    zend_mm_set_custom_handlers(vyrtue_alloc.heap, NULL, NULL, NULL);
+    vyrtue_alloc.active = false;
+
+    free(vyrtue_alloc.records);
+    vyrtue_alloc.records = NULL;
+    vyrtue_alloc.capacity = 0;
+    vyrtue_alloc.count = 0;
+}
+
+#endif
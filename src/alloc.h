@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHP_VYRTUE_ALLOC_H
+#define PHP_VYRTUE_ALLOC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <Zend/zend_API.h>
+#include <Zend/zend_arena.h>
+#include "php_vyrtue.h"
+
+/*
+ * Allocation accounting for debug builds. While a file is processed, the
+ * request heap is wrapped and every allocation is recorded with the category
+ * of the code that made it. Structures that own memory claim it for their
+ * category before they are released, so whatever of names, import tables,
+ * scope hash tables and the arena is still live at the end of the file was
+ * leaked, and raises a warning that fails the test run.
+ *
+ * Enable the alloc debug category to also log counts and bytes by category for
+ * every file. In release builds all of this compiles to nothing.
+ */
+
+enum vyrtue_alloc_category
+{
+    VYRTUE_ALLOC_OTHER = 0,
+    VYRTUE_ALLOC_NAMES,
+    VYRTUE_ALLOC_IMPORTS,
+    VYRTUE_ALLOC_SCOPE,
+    VYRTUE_ALLOC_ARENA,
+    VYRTUE_ALLOC_CATEGORIES,
+};
+
+#ifdef VYRTUE_DEBUG
+
+/**
+ * Starts accounting for a file. Returns false if it was not started, because
+ * a file is already being accounted for or the heap is not zend_mm.
+ */
+VYRTUE_LOCAL
+bool vyrtue_alloc_begin(void);
+
+/**
+ * Stops accounting, reports leaks for the file being compiled and prints the
+ * summary. Strings still referenced by ast are owned by the compiler.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_alloc_end(zend_ast *ast);
+
+/**
+ * Stops accounting without reporting, for a file that bailed out. Otherwise
+ * the handlers would stay installed and no other file could be accounted for.
+ */
+VYRTUE_LOCAL
+void vyrtue_alloc_abort(void);
+
+VYRTUE_LOCAL
+enum vyrtue_alloc_category vyrtue_alloc_set_category(enum vyrtue_alloc_category category);
+
+/**
+ * Moves the hash table's own memory, string keys and string or pointer
+ * values to category, before the table is destroyed.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_alloc_claim_ht(HashTable *ht, enum vyrtue_alloc_category category);
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_alloc_claim_arena(zend_arena *arena);
+
+#define VYRTUE_ALLOC_ENTER(category) enum vyrtue_alloc_category vyrtue_alloc_saved_category = vyrtue_alloc_set_category(category)
+#define VYRTUE_ALLOC_LEAVE() vyrtue_alloc_set_category(vyrtue_alloc_saved_category)
+
+#else
+
+#define vyrtue_alloc_begin() false
+#define vyrtue_alloc_end(ast) ((void) (ast))
+#define vyrtue_alloc_abort() ((void) 0)
+#define vyrtue_alloc_claim_ht(ht, category) ((void) 0)
+#define vyrtue_alloc_claim_arena(arena) ((void) 0)
+#define VYRTUE_ALLOC_ENTER(category)
+#define VYRTUE_ALLOC_LEAVE() ((void) 0)
+
+#endif
+
+#endif
@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_arena.h"
+#include "Zend/zend_compile.h"
+#include "Zend/zend_exceptions.h"
+#include "Zend/zend_language_scanner.h"
+#include "Zend/zend_language_scanner_defs.h"
+#include "main/php.h"
+#include "main/php_streams.h"
+#include "main/fopen_wrappers.h"
+
+#include "php_vyrtue.h"
+#include "filter.h"
+
+/*
+ * Transforms files ahead of time, for bin/vyrtue-aot.php. A file is parsed
+ * like ext/ast does, without compiling it, run through the registered
+ * visitors while it is the compiled file, and exported back to code. Files
+ * excluded by vyrtue.include_paths or vyrtue.exclude_paths come back as they
+ * are.
+ */
+
+/**
+ * The data after __halt_compiler() is not part of the AST, and code reading
+ * it relies on __COMPILER_HALT_OFFSET__, so such files can't be exported. It
+ * is only allowed in the outermost scope.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_aot_has_halt_compiler(zend_ast *ast)
+{
+    zend_ast_list *list = zend_ast_get_list(ast);
+
+    for (uint32_t i = 0; i < list->children; i++) {
+        if (list->child[i] != NULL && list->child[i]->kind == ZEND_AST_HALT_COMPILER) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+VYRTUE_LOCAL PHP_FUNCTION(vyrtue_transform_file)
+{
+    zend_string *path;
+    char resolved[MAXPATHLEN];
+    zend_lex_state original_lex_state;
+    bool original_in_compilation = CG(in_compilation);
+    zend_ast *original_ast = CG(ast);
+    zend_arena *original_ast_arena = CG(ast_arena);
+    zend_string *result = NULL;
+    zval code;
+
+    ZEND_PARSE_PARAMETERS_START(1, 1)
+    Z_PARAM_PATH_STR(path)
+    ZEND_PARSE_PARAMETERS_END();
+
+    if (NULL == expand_filepath(ZSTR_VAL(path), resolved)) {
+        zend_argument_value_error(1, "could not be resolved");
+        RETURN_THROWS();
+    }
+
+    php_stream *stream = php_stream_open_wrapper(resolved, "rb", REPORT_ERRORS, NULL);
+    if (stream == NULL) {
+        RETURN_FALSE;
+    }
+    zend_string *contents = php_stream_copy_to_mem(stream, PHP_STREAM_COPY_ALL, 0);
+    php_stream_close(stream);
+    if (contents == NULL) {
+        contents = ZSTR_EMPTY_ALLOC();
+    }
+
+    zend_string *filename = zend_string_init(resolved, strlen(resolved), 0);
+
+    if (!vyrtue_filter_file(filename)) {
+        zend_string_release(filename);
+        RETURN_STR(contents);
+    }
+
+    ZVAL_STR(&code, contents);
+
+    CG(in_compilation) = 1;
+    zend_save_lexical_state(&original_lex_state);
+    zend_prepare_string_for_scanning(&code, filename);
+    CG(ast) = NULL;
+    CG(ast_arena) = zend_arena_create(32 * 1024);
+    LANG_SCNG(yy_state) = yycINITIAL;
+
+    // a parse error leaves a ParseError to be thrown
+    if (zendparse() == 0 && CG(ast) != NULL) {
+        if (vyrtue_aot_has_halt_compiler(CG(ast))) {
+            result = zend_string_copy(contents);
+        } else {
+            vyrtue_ast_process_file(CG(ast));
+            if (!EG(exception)) {
+                result = zend_ast_export("<?php\n", CG(ast), "");
+            }
+        }
+    }
+
+    if (CG(ast)) {
+        zend_ast_destroy(CG(ast));
+    }
+    zend_arena_destroy(CG(ast_arena));
+
+    zend_restore_lexical_state(&original_lex_state);
+    CG(in_compilation) = original_in_compilation;
+    CG(ast) = original_ast;
+    CG(ast_arena) = original_ast_arena;
+
+    zval_ptr_dtor(&code);
+    zend_string_release(filename);
+
+    if (result == NULL) {
+        if (!EG(exception)) {
+            zend_throw_exception_ex(zend_ce_parse_error, 0, "vyrtue: failed to parse %s", resolved);
+        }
+        RETURN_THROWS();
+    }
+
+    RETURN_STR(result);
+}
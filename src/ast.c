@@ -0,0 +1,402 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_ast.h"
+#include "Zend/zend_compile.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "ast.h"
+#include "compile.h"
+#include "context.h"
+
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+static bool vyrtue_ast_eval_const_array(zend_ast *ast, zval *result)
+{
+    zend_ast_list *list = zend_ast_get_list(ast);
+    uint32_t i;
+
+    // list() and [] destructuring are never constants
+    if (ast->attr == ZEND_ARRAY_SYNTAX_LIST) {
+        return false;
+    }
+
+    array_init_size(result, list->children);
+
+    for (i = 0; i < list->children; i++) {
+        zend_ast *elem_ast = list->child[i];
+        zval value;
+        zval key;
+
+        if (elem_ast == NULL || elem_ast->kind != ZEND_AST_ARRAY_ELEM || elem_ast->attr /* by-ref */) {
+            goto fail;
+        }
+
+        if (!vyrtue_ast_eval_const(elem_ast->child[0], &value)) {
+            goto fail;
+        }
+
+        if (elem_ast->child[1] == NULL) {
+            if (NULL == zend_hash_next_index_insert(Z_ARRVAL_P(result), &value)) {
+                zval_ptr_dtor(&value);
+                goto fail;
+            }
+            continue;
+        }
+
+        if (!vyrtue_ast_eval_const(elem_ast->child[1], &key)) {
+            zval_ptr_dtor(&value);
+            goto fail;
+        }
+
+        // keys that would be coerced with a diagnostic (floats, bools, null) are left to the engine
+        switch (Z_TYPE(key)) {
+            case IS_LONG:
+                zend_hash_index_update(Z_ARRVAL_P(result), Z_LVAL(key), &value);
+                break;
+            case IS_STRING:
+                zend_symtable_update(Z_ARRVAL_P(result), Z_STR(key), &value);
+                zval_ptr_dtor_str(&key);
+                break;
+            default:
+                zval_ptr_dtor(&key);
+                zval_ptr_dtor(&value);
+                goto fail;
+        }
+    }
+
+    return true;
+
+fail:
+    zval_ptr_dtor(result);
+    return false;
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+bool vyrtue_ast_eval_const(zend_ast *ast, zval *result)
+{
+    switch (ast->kind) {
+        case ZEND_AST_ZVAL: {
+            zval *zv = zend_ast_get_zval(ast);
+            switch (Z_TYPE_P(zv)) {
+                case IS_NULL:
+                case IS_FALSE:
+                case IS_TRUE:
+                case IS_LONG:
+                case IS_DOUBLE:
+                case IS_STRING:
+                case IS_ARRAY:
+                    ZVAL_COPY(result, zv);
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        case ZEND_AST_CONST: {
+            zend_string *name = zend_ast_get_str(ast->child[0]);
+            if (zend_string_equals_literal_ci(name, "true")) {
+                ZVAL_TRUE(result);
+            } else if (zend_string_equals_literal_ci(name, "false")) {
+                ZVAL_FALSE(result);
+            } else if (zend_string_equals_literal_ci(name, "null")) {
+                ZVAL_NULL(result);
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        case ZEND_AST_UNARY_MINUS:
+        case ZEND_AST_UNARY_PLUS: {
+            zval operand;
+            if (!vyrtue_ast_eval_const(ast->child[0], &operand)) {
+                return false;
+            }
+            if (Z_TYPE(operand) == IS_LONG && Z_LVAL(operand) != ZEND_LONG_MIN) {
+                ZVAL_LONG(result, ast->kind == ZEND_AST_UNARY_MINUS ? -Z_LVAL(operand) : Z_LVAL(operand));
+                return true;
+            } else if (Z_TYPE(operand) == IS_DOUBLE) {
+                ZVAL_DOUBLE(result, ast->kind == ZEND_AST_UNARY_MINUS ? -Z_DVAL(operand) : Z_DVAL(operand));
+                return true;
+            }
+            zval_ptr_dtor(&operand);
+            return false;
+        }
+
+        case ZEND_AST_ARRAY:
+            return vyrtue_ast_eval_const_array(ast, result);
+
+        default:
+            return false;
+    }
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_RETURNS_NONNULL
+zend_ast *vyrtue_ast_create_array_from_zval(zval *arr)
+{
+    zend_ast *list = zend_ast_create_list(0, ZEND_AST_ARRAY);
+    zend_ulong num_key;
+    zend_string *str_key;
+    zval *val;
+    zval tmp;
+
+    list->attr = ZEND_ARRAY_SYNTAX_SHORT;
+
+    ZEND_HASH_FOREACH_KEY_VAL(Z_ARRVAL_P(arr), num_key, str_key, val)
+    {
+        zend_ast *key_ast;
+        zend_ast *val_ast;
+
+        if (str_key) {
+            key_ast = zend_ast_create_zval_from_str(zend_string_copy(str_key));
+        } else {
+            key_ast = zend_ast_create_zval_from_long((zend_long) num_key);
+        }
+
+        if (Z_TYPE_P(val) == IS_ARRAY) {
+            val_ast = vyrtue_ast_create_array_from_zval(val);
+        } else {
+            ZVAL_COPY(&tmp, val);
+            val_ast = zend_ast_create_zval(&tmp);
+        }
+
+        list = zend_ast_list_add(list, zend_ast_create(ZEND_AST_ARRAY_ELEM, val_ast, key_ast));
+    }
+    ZEND_HASH_FOREACH_END();
+
+    return list;
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+zend_ast *vyrtue_ast_dup(zend_ast *ast)
+{
+    zend_ast *copy;
+    zend_ast *children[4] = {NULL};
+    uint32_t i;
+
+    if (ast->kind == ZEND_AST_ZVAL) {
+        zval tmp;
+        ZVAL_COPY(&tmp, zend_ast_get_zval(ast));
+        copy = zend_ast_create_zval_with_lineno(&tmp, zend_ast_get_lineno(ast));
+        copy->attr = ast->attr;
+        return copy;
+    }
+
+    if (zend_ast_is_special(ast)) {
+        return NULL;
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        copy = zend_ast_create_list(0, ast->kind);
+        for (i = 0; i < list->children; i++) {
+            zend_ast *child = NULL;
+            if (list->child[i] && NULL == (child = vyrtue_ast_dup(list->child[i]))) {
+                zend_ast_destroy(copy);
+                return NULL;
+            }
+            copy = zend_ast_list_add(copy, child);
+        }
+        copy->attr = ast->attr;
+        ((zend_ast_list *) copy)->lineno = zend_ast_get_lineno(ast);
+        return copy;
+    }
+
+    uint32_t num_children = zend_ast_get_num_children(ast);
+    if (num_children > sizeof(children) / sizeof(children[0])) {
+        return NULL;
+    }
+
+    for (i = 0; i < num_children; i++) {
+        if (ast->child[i] && NULL == (children[i] = vyrtue_ast_dup(ast->child[i]))) {
+            goto fail;
+        }
+    }
+
+    switch (num_children) {
+        case 0:
+            copy = zend_ast_create_0(ast->kind);
+            break;
+        case 1:
+            copy = zend_ast_create_1(ast->kind, children[0]);
+            break;
+        case 2:
+            copy = zend_ast_create_2(ast->kind, children[0], children[1]);
+            break;
+        case 3:
+            copy = zend_ast_create_3(ast->kind, children[0], children[1], children[2]);
+            break;
+        default:
+            copy = zend_ast_create_4(ast->kind, children[0], children[1], children[2], children[3]);
+            break;
+    }
+
+    copy->attr = ast->attr;
+    copy->lineno = zend_ast_get_lineno(ast);
+    return copy;
+
+fail:
+    for (i = 0; i < num_children; i++) {
+        if (children[i]) {
+            zend_ast_destroy(children[i]);
+        }
+    }
+    return NULL;
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+zend_ast_list *vyrtue_ast_get_call_args(zend_ast *ast)
+{
+    zend_ast *args_ast = ast->child[1];
+    zend_ast_list *args;
+    uint32_t i;
+
+    // first-class callable syntax, e.g. strlen(...)
+    if (args_ast->kind != ZEND_AST_ARG_LIST) {
+        return NULL;
+    }
+
+    args = zend_ast_get_list(args_ast);
+
+    for (i = 0; i < args->children; i++) {
+        if (args->child[i]->kind == ZEND_AST_NAMED_ARG || args->child[i]->kind == ZEND_AST_UNPACK) {
+            return NULL;
+        }
+    }
+
+    return args;
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+zend_string *vyrtue_ast_get_call_name(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast *name_ast = ast->child[0];
+    bool is_fully_qualified;
+
+    // ignore dynamic calls
+    if (name_ast->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(name_ast)) != IS_STRING) {
+        return NULL;
+    }
+
+    zend_string *name_str = vyrtue_resolve_function_name(Z_STR_P(zend_ast_get_zval(name_ast)), name_ast->attr, &is_fully_qualified, ctx);
+
+    // unqualified calls inside a namespace may fall back to the global function at runtime
+    if (!is_fully_qualified && ctx->current_namespace != NULL) {
+        zend_string_release(name_str);
+        return NULL;
+    }
+
+    return name_str;
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_RETURNS_NONNULL
+zend_ast *vyrtue_ast_create_call(const char *name, size_t name_len, zend_ast *args)
+{
+    zend_ast *name_ast = zend_ast_create_zval_from_str(zend_string_init(name, name_len, 0));
+    name_ast->attr = ZEND_NAME_FQ;
+    return zend_ast_create(ZEND_AST_CALL, name_ast, args);
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(2)
+VYRTUE_ATTR_RETURNS_NONNULL
+zend_ast *vyrtue_ast_create_param(zend_ast *type, const char *name, size_t name_len)
+{
+    zend_ast *name_ast = zend_ast_create_zval_from_str(zend_string_init(name, name_len, 0));
+
+#if PHP_VERSION_ID >= 80400
+    // type, name, default, attributes, doc comment, hooks
+    return zend_ast_create_6(ZEND_AST_PARAM, type, name_ast, NULL, NULL, NULL, NULL);
+#else
+    // type, name, default, attributes, doc comment
+    return zend_ast_create_5(ZEND_AST_PARAM, type, name_ast, NULL, NULL, NULL);
+#endif
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(2, 4, 5)
+VYRTUE_ATTR_RETURNS_NONNULL
+zend_ast *vyrtue_ast_create_method(uint32_t flags, const char *name, size_t name_len, zend_ast *params, zend_ast *stmts, zend_ast *return_type)
+{
+    return zend_ast_create_decl(
+        ZEND_AST_METHOD,
+        flags,
+        CG(zend_lineno),
+        NULL,
+        zend_string_init(name, name_len, 0),
+        params,
+        NULL,
+        stmts,
+        return_type,
+        NULL
+    );
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+zend_ast *vyrtue_ast_find_attribute(zend_ast *ast, const char *name, size_t name_len, struct vyrtue_context *ctx)
+{
+    zend_ast_list *list = zend_ast_get_list(ast);
+    uint32_t g;
+    uint32_t i;
+
+    ZEND_ASSERT(ast->kind == ZEND_AST_ATTRIBUTE_LIST);
+
+    for (g = 0; g < list->children; g++) {
+        zend_ast_list *group = zend_ast_get_list(list->child[g]);
+
+        for (i = 0; i < group->children; i++) {
+            zend_ast *el = group->child[i];
+            zend_string *el_name = vyrtue_resolve_class_name_ast(el->child[0], ctx);
+            if (el_name == NULL) {
+                continue;
+            }
+
+            bool matches = 0 == zend_binary_strcasecmp(ZSTR_VAL(el_name), ZSTR_LEN(el_name), name, name_len);
+            zend_string_release(el_name);
+
+            if (matches) {
+                return el;
+            }
+        }
+    }
+
+    return NULL;
+}
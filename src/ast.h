@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHP_VYRTUE_AST_H
+#define PHP_VYRTUE_AST_H
+
+#include <stdbool.h>
+#include <Zend/zend_ast.h>
+#include "php_vyrtue.h"
+
+struct vyrtue_context;
+
+/**
+ * Evaluates a literal AST (scalars, true/false/null, unary +/- and array
+ * literals thereof) into result. Returns false and leaves result undefined
+ * if the AST is not a compile-time constant.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+bool vyrtue_ast_eval_const(zend_ast *ast, zval *result);
+
+/**
+ * Builds a ZEND_AST_ARRAY literal from a constant array, so that the engine's
+ * own compile-time array handling can apply to it.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_RETURNS_NONNULL
+zend_ast *vyrtue_ast_create_array_from_zval(zval *arr);
+
+/**
+ * Deep copies an expression AST. Returns NULL if it contains declarations
+ * (closures, arrow functions, anonymous classes) which cannot be copied.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+zend_ast *vyrtue_ast_dup(zend_ast *ast);
+
+/**
+ * Returns the argument list of a ZEND_AST_CALL, or NULL if the call uses
+ * first-class callable syntax, named arguments or argument unpacking.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+zend_ast_list *vyrtue_ast_get_call_args(zend_ast *ast);
+
+/**
+ * Returns the resolved name of a ZEND_AST_CALL, or NULL if it is dynamic or
+ * cannot be resolved at compile time. The caller must release the string.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+zend_string *vyrtue_ast_get_call_name(zend_ast *ast, struct vyrtue_context *ctx);
+
+/**
+ * Creates a call to the fully qualified function name with the given
+ * ZEND_AST_ARG_LIST.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_RETURNS_NONNULL
+zend_ast *vyrtue_ast_create_call(const char *name, size_t name_len, zend_ast *args);
+
+/**
+ * Creates an untyped (if type is NULL) by-value ZEND_AST_PARAM without a
+ * default value.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(2)
+VYRTUE_ATTR_RETURNS_NONNULL
+zend_ast *vyrtue_ast_create_param(zend_ast *type, const char *name, size_t name_len);
+
+/**
+ * Creates a ZEND_AST_METHOD declaration, to be appended to a class body.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(2, 4, 5)
+VYRTUE_ATTR_RETURNS_NONNULL
+zend_ast *vyrtue_ast_create_method(uint32_t flags, const char *name, size_t name_len, zend_ast *params, zend_ast *stmts, zend_ast *return_type);
+
+/**
+ * Returns the first ZEND_AST_ATTRIBUTE in a ZEND_AST_ATTRIBUTE_LIST whose
+ * resolved class name matches name (case-insensitively), or NULL.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+zend_ast *vyrtue_ast_find_attribute(zend_ast *ast, const char *name, size_t name_len, struct vyrtue_context *ctx);
+
+#endif
@@ -0,0 +1,876 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_ast.h"
+#include "Zend/zend_compile.h"
+#include "Zend/zend_smart_str.h"
+#include "Zend/zend_stream.h"
+#include "Zend/zend_virtual_cwd.h"
+#include "main/fopen_wrappers.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "ast_cache.h"
+#include "filter.h"
+#include "fingerprint.h"
+#include "shm.h"
+
+/*
+ * Entry layout, in native byte order, with no pointers so it can be used
+ * straight from the mapping:
+ *
+ *   header
+ *   source path           path_len bytes
+ *   string table          strings_count times: u32 length, bytes
+ *   nodes                 pre-order, see vyrtue_ast_cache_write_node()
+ *   index records         batch_len bytes, as collected in vyrtue_shm_batch
+ *
+ * Strings are referenced by their index in the table, so names repeated
+ * throughout a file are stored and interned once.
+ */
+
+#define VYRTUE_AST_CACHE_FORMAT 2
+#define VYRTUE_AST_CACHE_BYTE_ORDER 0x01020304
+#define VYRTUE_AST_CACHE_NULL_NODE 0xFFFF
+#define VYRTUE_AST_CACHE_NULL_STRING UINT32_MAX
+#define VYRTUE_AST_CACHE_DECL_CHILDREN (sizeof(((zend_ast_decl *) NULL)->child) / sizeof(zend_ast *))
+
+struct vyrtue_ast_cache_header
+{
+    char magic[4];
+    uint32_t format;
+    uint32_t php_version;
+    uint32_t byte_order;
+    uint64_t fingerprint;
+    int64_t mtime;
+    uint64_t size;
+    uint64_t hash;
+    uint32_t path_len;
+    uint32_t strings_count;
+    uint32_t nodes_len;
+    uint32_t batch_len;
+    uint32_t lineno;
+};
+
+struct vyrtue_ast_cache_writer
+{
+    smart_str buf;
+    HashTable strings;
+    bool ok;
+};
+
+struct vyrtue_ast_cache_reader
+{
+    const unsigned char *p;
+    const unsigned char *end;
+    zend_string **strings;
+    uint32_t strings_count;
+    bool ok;
+};
+
+/* {{{ writing */
+
+static bool vyrtue_ast_cache_is_decl(uint32_t kind)
+{
+    switch (kind) {
+        case ZEND_AST_FUNC_DECL:
+        case ZEND_AST_CLOSURE:
+        case ZEND_AST_METHOD:
+        case ZEND_AST_CLASS:
+        case ZEND_AST_ARROW_FUNC:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void vyrtue_ast_cache_write(struct vyrtue_ast_cache_writer *w, const void *data, size_t len)
+{
+    smart_str_appendl(&w->buf, (const char *) data, len);
+}
+
+#define VYRTUE_AST_CACHE_WRITE(w, type, value) \
+    do { \
+        type vyrtue_tmp = (value); \
+        vyrtue_ast_cache_write(w, &vyrtue_tmp, sizeof(type)); \
+    } while (0)
+
+static void vyrtue_ast_cache_write_string(struct vyrtue_ast_cache_writer *w, zend_string *str)
+{
+    zval *index;
+    zval tmp;
+
+    if (str == NULL) {
+        VYRTUE_AST_CACHE_WRITE(w, uint32_t, VYRTUE_AST_CACHE_NULL_STRING);
+        return;
+    }
+
+    index = zend_hash_find(&w->strings, str);
+    if (index == NULL) {
+        ZVAL_LONG(&tmp, zend_hash_num_elements(&w->strings));
+        index = zend_hash_add_new(&w->strings, str, &tmp);
+    }
+
+    VYRTUE_AST_CACHE_WRITE(w, uint32_t, (uint32_t) Z_LVAL_P(index));
+}
+
+static void vyrtue_ast_cache_write_zval(struct vyrtue_ast_cache_writer *w, zval *zv)
+{
+    zend_string *key;
+    zend_ulong index;
+    zval *val;
+
+    VYRTUE_AST_CACHE_WRITE(w, uint8_t, Z_TYPE_P(zv));
+
+    switch (Z_TYPE_P(zv)) {
+        case IS_NULL:
+        case IS_FALSE:
+        case IS_TRUE:
+            break;
+        case IS_LONG:
+            VYRTUE_AST_CACHE_WRITE(w, int64_t, Z_LVAL_P(zv));
+            break;
+        case IS_DOUBLE:
+            VYRTUE_AST_CACHE_WRITE(w, double, Z_DVAL_P(zv));
+            break;
+        case IS_STRING:
+            vyrtue_ast_cache_write_string(w, Z_STR_P(zv));
+            break;
+        case IS_ARRAY:
+            VYRTUE_AST_CACHE_WRITE(w, uint32_t, zend_hash_num_elements(Z_ARR_P(zv)));
+            ZEND_HASH_FOREACH_KEY_VAL(Z_ARR_P(zv), index, key, val)
+            {
+                if (key) {
+                    VYRTUE_AST_CACHE_WRITE(w, uint8_t, 1);
+                    vyrtue_ast_cache_write_string(w, key);
+                } else {
+                    VYRTUE_AST_CACHE_WRITE(w, uint8_t, 0);
+                    VYRTUE_AST_CACHE_WRITE(w, int64_t, (int64_t) index);
+                }
+                vyrtue_ast_cache_write_zval(w, val);
+            }
+            ZEND_HASH_FOREACH_END();
+            break;
+        default:
+            // objects and constant expressions don't occur in parsed code
+            w->ok = false;
+            break;
+    }
+}
+
+/**
+ * A node is its kind and attr, followed by:
+ * - zval: lineno, the value
+ * - constant: lineno, the name
+ * - declaration: start and end line, flags, doc comment, name, number of
+ *   children, the children
+ * - list: lineno, number of children, the children
+ * - other: lineno, the children, as many as the kind has
+ *
+ * A missing child is written as the kind 0xFFFF alone.
+ */
+static void vyrtue_ast_cache_write_node(struct vyrtue_ast_cache_writer *w, zend_ast *ast)
+{
+    if (ast == NULL) {
+        VYRTUE_AST_CACHE_WRITE(w, uint16_t, VYRTUE_AST_CACHE_NULL_NODE);
+        return;
+    }
+
+    VYRTUE_AST_CACHE_WRITE(w, uint16_t, ast->kind);
+    VYRTUE_AST_CACHE_WRITE(w, uint16_t, ast->attr);
+
+    if (ast->kind == ZEND_AST_ZVAL) {
+        VYRTUE_AST_CACHE_WRITE(w, uint32_t, zend_ast_get_lineno(ast));
+        vyrtue_ast_cache_write_zval(w, zend_ast_get_zval(ast));
+    } else if (ast->kind == ZEND_AST_CONSTANT) {
+        VYRTUE_AST_CACHE_WRITE(w, uint32_t, zend_ast_get_lineno(ast));
+        vyrtue_ast_cache_write_string(w, zend_ast_get_constant_name(ast));
+    } else if (ast->kind == ZEND_AST_ZNODE) {
+        w->ok = false;
+    } else if (vyrtue_ast_cache_is_decl(ast->kind)) {
+        zend_ast_decl *decl = (zend_ast_decl *) ast;
+        VYRTUE_AST_CACHE_WRITE(w, uint32_t, decl->start_lineno);
+        VYRTUE_AST_CACHE_WRITE(w, uint32_t, decl->end_lineno);
+        VYRTUE_AST_CACHE_WRITE(w, uint32_t, decl->flags);
+        vyrtue_ast_cache_write_string(w, decl->doc_comment);
+        vyrtue_ast_cache_write_string(w, decl->name);
+        VYRTUE_AST_CACHE_WRITE(w, uint32_t, VYRTUE_AST_CACHE_DECL_CHILDREN);
+        for (uint32_t i = 0; i < VYRTUE_AST_CACHE_DECL_CHILDREN && w->ok; i++) {
+            vyrtue_ast_cache_write_node(w, decl->child[i]);
+        }
+    } else if (zend_ast_is_special(ast)) {
+        w->ok = false;
+    } else if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        VYRTUE_AST_CACHE_WRITE(w, uint32_t, list->lineno);
+        VYRTUE_AST_CACHE_WRITE(w, uint32_t, list->children);
+        for (uint32_t i = 0; i < list->children && w->ok; i++) {
+            vyrtue_ast_cache_write_node(w, list->child[i]);
+        }
+    } else {
+        uint32_t children = zend_ast_get_num_children(ast);
+        VYRTUE_AST_CACHE_WRITE(w, uint32_t, ast->lineno);
+        for (uint32_t i = 0; i < children && w->ok; i++) {
+            vyrtue_ast_cache_write_node(w, ast->child[i]);
+        }
+    }
+}
+
+/* }}} writing */
+
+/* {{{ reading */
+
+static bool vyrtue_ast_cache_read(struct vyrtue_ast_cache_reader *r, void *dest, size_t len)
+{
+    if (!r->ok || (size_t) (r->end - r->p) < len) {
+        r->ok = false;
+        memset(dest, 0, len);
+        return false;
+    }
+
+    memcpy(dest, r->p, len);
+    r->p += len;
+
+    return true;
+}
+
+#define VYRTUE_AST_CACHE_READER(type, suffix) \
+    static type vyrtue_ast_cache_read_##suffix(struct vyrtue_ast_cache_reader *r) \
+    { \
+        type value; \
+        vyrtue_ast_cache_read(r, &value, sizeof(type)); \
+        return value; \
+    }
+
+VYRTUE_AST_CACHE_READER(uint8_t, u8)
+VYRTUE_AST_CACHE_READER(uint16_t, u16)
+VYRTUE_AST_CACHE_READER(uint32_t, u32)
+VYRTUE_AST_CACHE_READER(int64_t, i64)
+VYRTUE_AST_CACHE_READER(double, double)
+
+/**
+ * Returns a borrowed string from the table, or NULL.
+ */
+static zend_string *vyrtue_ast_cache_read_string(struct vyrtue_ast_cache_reader *r)
+{
+    uint32_t index = vyrtue_ast_cache_read_u32(r);
+
+    if (!r->ok || index == VYRTUE_AST_CACHE_NULL_STRING) {
+        return NULL;
+    }
+
+    if (index >= r->strings_count) {
+        r->ok = false;
+        return NULL;
+    }
+
+    return r->strings[index];
+}
+
+static bool vyrtue_ast_cache_read_zval(struct vyrtue_ast_cache_reader *r, zval *zv)
+{
+    uint8_t type = vyrtue_ast_cache_read_u8(r);
+    zend_string *str;
+
+    ZVAL_UNDEF(zv);
+
+    switch (type) {
+        case IS_NULL:
+            ZVAL_NULL(zv);
+            break;
+        case IS_FALSE:
+            ZVAL_FALSE(zv);
+            break;
+        case IS_TRUE:
+            ZVAL_TRUE(zv);
+            break;
+        case IS_LONG:
+            ZVAL_LONG(zv, (zend_long) vyrtue_ast_cache_read_i64(r));
+            break;
+        case IS_DOUBLE:
+            ZVAL_DOUBLE(zv, vyrtue_ast_cache_read_double(r));
+            break;
+        case IS_STRING:
+            str = vyrtue_ast_cache_read_string(r);
+            if (str == NULL) {
+                r->ok = false;
+                return false;
+            }
+            ZVAL_STR_COPY(zv, str);
+            break;
+        case IS_ARRAY: {
+            uint32_t count = vyrtue_ast_cache_read_u32(r);
+            // every element takes at least two bytes
+            if (!r->ok || count > (size_t) (r->end - r->p) / 2) {
+                r->ok = false;
+                return false;
+            }
+            zend_array *ht = zend_new_array(count);
+            for (uint32_t i = 0; i < count && r->ok; i++) {
+                uint8_t key_type = vyrtue_ast_cache_read_u8(r);
+                zend_string *key = NULL;
+                int64_t index = 0;
+                zval val;
+
+                if (key_type == 1) {
+                    key = vyrtue_ast_cache_read_string(r);
+                    if (key == NULL) {
+                        r->ok = false;
+                    }
+                } else {
+                    index = vyrtue_ast_cache_read_i64(r);
+                }
+
+                if (r->ok && vyrtue_ast_cache_read_zval(r, &val)) {
+                    if (key) {
+                        zend_hash_update(ht, key, &val);
+                    } else {
+                        zend_hash_index_update(ht, (zend_ulong) index, &val);
+                    }
+                }
+            }
+            ZVAL_ARR(zv, ht);
+            break;
+        }
+        default:
+            r->ok = false;
+            break;
+    }
+
+    if (!r->ok) {
+        zval_ptr_dtor_nogc(zv);
+        ZVAL_UNDEF(zv);
+    }
+
+    return r->ok;
+}
+
+/**
+ * Allocates in CG(ast_arena) like the parser does, so the compiler frees the
+ * result along with the rest of the file.
+ */
+static zend_ast *vyrtue_ast_cache_read_node(struct vyrtue_ast_cache_reader *r)
+{
+    uint16_t kind = vyrtue_ast_cache_read_u16(r);
+    zend_ast *ast;
+
+    if (!r->ok || kind == VYRTUE_AST_CACHE_NULL_NODE) {
+        return NULL;
+    }
+
+    zend_ast_attr attr = vyrtue_ast_cache_read_u16(r);
+
+    if (kind == ZEND_AST_ZVAL) {
+        uint32_t lineno = vyrtue_ast_cache_read_u32(r);
+        zval zv;
+        if (!vyrtue_ast_cache_read_zval(r, &zv)) {
+            return NULL;
+        }
+        ast = zend_ast_create_zval_with_lineno(&zv, lineno);
+        ast->attr = attr;
+    } else if (kind == ZEND_AST_CONSTANT) {
+        uint32_t lineno = vyrtue_ast_cache_read_u32(r);
+        zend_string *name = vyrtue_ast_cache_read_string(r);
+        if (name == NULL) {
+            r->ok = false;
+            return NULL;
+        }
+        ast = zend_ast_create_constant(zend_string_copy(name), attr);
+        Z_LINENO(((zend_ast_zval *) ast)->val) = lineno;
+    } else if (vyrtue_ast_cache_is_decl(kind)) {
+        zend_ast *child[VYRTUE_AST_CACHE_DECL_CHILDREN] = {0};
+        uint32_t start_lineno = vyrtue_ast_cache_read_u32(r);
+        uint32_t end_lineno = vyrtue_ast_cache_read_u32(r);
+        uint32_t flags = vyrtue_ast_cache_read_u32(r);
+        zend_string *doc_comment = vyrtue_ast_cache_read_string(r);
+        zend_string *name = vyrtue_ast_cache_read_string(r);
+        uint32_t children = vyrtue_ast_cache_read_u32(r);
+
+        if (children != VYRTUE_AST_CACHE_DECL_CHILDREN) {
+            r->ok = false;
+        }
+        for (uint32_t i = 0; i < VYRTUE_AST_CACHE_DECL_CHILDREN && r->ok; i++) {
+            child[i] = vyrtue_ast_cache_read_node(r);
+        }
+        if (!r->ok) {
+            for (uint32_t i = 0; i < VYRTUE_AST_CACHE_DECL_CHILDREN; i++) {
+                zend_ast_destroy(child[i]);
+            }
+            return NULL;
+        }
+
+        ast = zend_ast_create_decl(
+            kind,
+            flags,
+            start_lineno,
+            doc_comment ? zend_string_copy(doc_comment) : NULL,
+            name ? zend_string_copy(name) : NULL,
+            child[0],
+            child[1],
+            child[2],
+            child[3],
+            child[4]
+        );
+        ((zend_ast_decl *) ast)->end_lineno = end_lineno;
+        ast->attr = attr;
+    } else if ((kind >> ZEND_AST_SPECIAL_SHIFT) & 1) {
+        r->ok = false;
+        return NULL;
+    } else if ((kind >> ZEND_AST_IS_LIST_SHIFT) & 1) {
+        uint32_t lineno = vyrtue_ast_cache_read_u32(r);
+        uint32_t children = vyrtue_ast_cache_read_u32(r);
+        // every child takes at least two bytes
+        if (!r->ok || children > (size_t) (r->end - r->p) / 2) {
+            r->ok = false;
+            return NULL;
+        }
+
+        // room to grow like zend_ast_list_add() expects: at least 4, then powers of two
+        uint32_t capacity = 4;
+        while (capacity < children) {
+            capacity *= 2;
+        }
+
+        zend_ast_list *list = zend_arena_alloc(&CG(ast_arena), offsetof(zend_ast_list, child) + sizeof(zend_ast *) * capacity);
+        list->kind = kind;
+        list->attr = attr;
+        list->lineno = lineno;
+        list->children = 0;
+        while (list->children < children && r->ok) {
+            list->child[list->children++] = vyrtue_ast_cache_read_node(r);
+        }
+        ast = (zend_ast *) list;
+    } else {
+        uint32_t lineno = vyrtue_ast_cache_read_u32(r);
+        uint32_t children = kind >> ZEND_AST_NUM_CHILDREN_SHIFT;
+
+        ast = zend_arena_alloc(&CG(ast_arena), offsetof(zend_ast, child) + sizeof(zend_ast *) * MAX(children, 1));
+        ast->kind = kind;
+        ast->attr = attr;
+        ast->lineno = lineno;
+        memset(ast->child, 0, sizeof(zend_ast *) * children);
+        for (uint32_t i = 0; i < children && r->ok; i++) {
+            ast->child[i] = vyrtue_ast_cache_read_node(r);
+        }
+    }
+
+    if (!r->ok) {
+        zend_ast_destroy(ast);
+        return NULL;
+    }
+
+    return ast;
+}
+
+/* }}} reading */
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(2)
+bool vyrtue_ast_cache_key(zend_string *filename, struct vyrtue_ast_cache_key *key)
+{
+    const char *dir = VYRTUE_G(ast_cache_dir);
+    struct stat sb;
+    int fd;
+
+    if (EXPECTED(dir == NULL || dir[0] == '\0')) {
+        return false;
+    }
+
+    if (filename == NULL || !IS_ABSOLUTE_PATH(ZSTR_VAL(filename), ZSTR_LEN(filename))) {
+        return false;
+    }
+
+    if (VYRTUE_G(userland_visitors) != NULL && zend_hash_num_elements(VYRTUE_G(userland_visitors)) > 0) {
+        return false;
+    }
+
+    // a cached AST would miss expansions of macros declared since it was stored
+    if (VYRTUE_G(macros) != NULL && zend_hash_num_elements(VYRTUE_G(macros)) > 0) {
+        return false;
+    }
+
+    // likewise for calls to debug-only functions declared since
+    if (VYRTUE_G(debug_only) != NULL && zend_hash_num_elements(VYRTUE_G(debug_only)) > 0) {
+        return false;
+    }
+
+    fd = open(ZSTR_VAL(filename), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (0 != fstat(fd, &sb) || !S_ISREG(sb.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    key->hash = 0;
+    if (sb.st_size > 0) {
+        void *contents = mmap(NULL, (size_t) sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (contents == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        key->hash = zend_hash_func(contents, (size_t) sb.st_size);
+        munmap(contents, (size_t) sb.st_size);
+    }
+    close(fd);
+
+    key->filename = filename;
+    key->fingerprint = vyrtue_fingerprint();
+    key->mtime = (int64_t) sb.st_mtime;
+    key->size = (uint64_t) sb.st_size;
+
+    int n = snprintf(key->path, sizeof(key->path), "%s/%016" PRIx64 ".ast", dir, (uint64_t) zend_string_hash_val(filename));
+
+    return n > 0 && (size_t) n < sizeof(key->path);
+}
+
+/**
+ * Reads the entry for key into a new arena, which is stored in *arena on a
+ * hit, along with the line the scanner ended on in key->lineno. Returns NULL
+ * on a miss.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_ast_cache_load(struct vyrtue_ast_cache_key *key, zend_arena **arena)
+{
+    struct vyrtue_ast_cache_header header;
+    struct vyrtue_ast_cache_reader r = {0};
+    struct stat sb;
+    zend_ast *root = NULL;
+    void *map;
+    int fd;
+
+    fd = open(key->path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (0 != fstat(fd, &sb) || (size_t) sb.st_size < sizeof(header)) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, (size_t) sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    r.p = map;
+    r.end = r.p + sb.st_size;
+    r.ok = true;
+
+    vyrtue_ast_cache_read(&r, &header, sizeof(header));
+
+    if (0 != memcmp(header.magic, "VYAC", 4) || header.format != VYRTUE_AST_CACHE_FORMAT || header.php_version != PHP_VERSION_ID ||
+        header.byte_order != VYRTUE_AST_CACHE_BYTE_ORDER || header.fingerprint != key->fingerprint || header.mtime != key->mtime ||
+        header.size != key->size || header.hash != key->hash || header.lineno == 0 || header.path_len != ZSTR_LEN(key->filename) ||
+        (size_t) (r.end - r.p) < header.path_len || 0 != memcmp(r.p, ZSTR_VAL(key->filename), header.path_len)) {
+        munmap(map, (size_t) sb.st_size);
+        return NULL;
+    }
+    r.p += header.path_len;
+
+    // every string takes at least four bytes
+    if (header.strings_count > (size_t) (r.end - r.p) / 4) {
+        munmap(map, (size_t) sb.st_size);
+        return NULL;
+    }
+
+    // nodes are created in CG(ast_arena), which the file being compiled doesn't have yet
+    zend_arena *original_ast_arena = CG(ast_arena);
+    CG(ast_arena) = zend_arena_create(32 * 1024);
+
+    r.strings = emalloc(sizeof(zend_string *) * MAX(header.strings_count, 1));
+    for (r.strings_count = 0; r.strings_count < header.strings_count; r.strings_count++) {
+        uint32_t len = vyrtue_ast_cache_read_u32(&r);
+        if (!r.ok || (size_t) (r.end - r.p) < len) {
+            r.ok = false;
+            break;
+        }
+        r.strings[r.strings_count] = zend_new_interned_string(zend_string_init((const char *) r.p, len, 0));
+        r.p += len;
+    }
+
+    if (r.ok) {
+        const unsigned char *nodes_end = r.p + header.nodes_len;
+        if ((size_t) (r.end - r.p) < (size_t) header.nodes_len + header.batch_len) {
+            r.ok = false;
+        } else {
+            root = vyrtue_ast_cache_read_node(&r);
+            if (r.p != nodes_end || root == NULL || root->kind != ZEND_AST_STMT_LIST) {
+                r.ok = false;
+            }
+        }
+    }
+
+    if (r.ok) {
+        // the index records are replaced like after a walk
+        struct vyrtue_shm_batch batch = {0};
+        if (header.batch_len > 0) {
+            smart_str_appendl(&batch.buf, (const char *) r.p, header.batch_len);
+        }
+        vyrtue_shm_commit(key->filename, &batch);
+    } else if (root != NULL) {
+        zend_ast_destroy(root);
+        root = NULL;
+    }
+
+    for (uint32_t i = 0; i < r.strings_count; i++) {
+        zend_string_release(r.strings[i]);
+    }
+    efree(r.strings);
+    munmap(map, (size_t) sb.st_size);
+
+    if (root == NULL) {
+        zend_arena_destroy(CG(ast_arena));
+    } else {
+        *arena = CG(ast_arena);
+        key->lineno = header.lineno;
+    }
+    CG(ast_arena) = original_ast_arena;
+
+    return root;
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_ast_cache_store(const struct vyrtue_ast_cache_key *key, zend_ast *ast, const struct vyrtue_shm_batch *batch)
+{
+    struct vyrtue_ast_cache_writer w = {.buf = {0}, .ok = true};
+    struct vyrtue_ast_cache_header header = {
+        .magic = {'V', 'Y', 'A', 'C'},
+        .format = VYRTUE_AST_CACHE_FORMAT,
+        .php_version = PHP_VERSION_ID,
+        .byte_order = VYRTUE_AST_CACHE_BYTE_ORDER,
+        .fingerprint = key->fingerprint,
+        .mtime = key->mtime,
+        .size = key->size,
+        .hash = key->hash,
+        .path_len = (uint32_t) ZSTR_LEN(key->filename),
+        .batch_len = batch->buf.s ? (uint32_t) ZSTR_LEN(batch->buf.s) : 0,
+        .lineno = key->lineno,
+    };
+    smart_str out = {0};
+    char tmp_path[MAXPATHLEN];
+    zend_string *str;
+    int fd;
+
+    zend_hash_init(&w.strings, 64, NULL, NULL, 0);
+    vyrtue_ast_cache_write_node(&w, ast);
+
+    if (!w.ok || w.buf.s == NULL || ZSTR_LEN(w.buf.s) > UINT32_MAX) {
+        goto done;
+    }
+
+    header.strings_count = zend_hash_num_elements(&w.strings);
+    header.nodes_len = (uint32_t) ZSTR_LEN(w.buf.s);
+
+    smart_str_appendl(&out, (const char *) &header, sizeof(header));
+    smart_str_append(&out, key->filename);
+    ZEND_HASH_FOREACH_STR_KEY(&w.strings, str)
+    {
+        uint32_t len = (uint32_t) ZSTR_LEN(str);
+        smart_str_appendl(&out, (const char *) &len, sizeof(len));
+        smart_str_append(&out, str);
+    }
+    ZEND_HASH_FOREACH_END();
+    smart_str_append(&out, w.buf.s);
+    if (header.batch_len > 0) {
+        smart_str_append(&out, batch->buf.s);
+    }
+
+    // written aside and renamed, so concurrent processes never read a partial entry
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", key->path, (long) getpid());
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        goto done;
+    }
+    if (write(fd, ZSTR_VAL(out.s), ZSTR_LEN(out.s)) != (ssize_t) ZSTR_LEN(out.s) || 0 != close(fd) || 0 != rename(tmp_path, key->path)) {
+        unlink(tmp_path);
+    }
+
+done:
+    smart_str_free(&out);
+    smart_str_free(&w.buf);
+    zend_hash_destroy(&w.strings);
+}
+
+static zend_op_array *(*vyrtue_ast_cache_original_compile_file)(zend_file_handle *file_handle, int type) = NULL;
+
+/**
+ * Whether the file is being compiled for include_once or require_once, which
+ * add it to EG(included_files) themselves.
+ */
+static bool vyrtue_ast_cache_is_include_once(void)
+{
+    const zend_execute_data *ex = EG(current_execute_data);
+
+    return ex != NULL && ex->func != NULL && ZEND_USER_CODE(ex->func->type) && ex->opline != NULL &&
+        ex->opline->opcode == ZEND_INCLUDE_OR_EVAL &&
+        (ex->opline->extended_value == ZEND_INCLUDE_ONCE || ex->opline->extended_value == ZEND_REQUIRE_ONCE);
+}
+
+/**
+ * On a hit the file is never opened. The compiler is handed a buffer of as
+ * many newlines as the file had, so that the scanner ends on the same line as
+ * it would have, which is where the implicit return and op_array->line_end
+ * go, and vyrtue_ast_cache_process() swaps the cached AST in.
+ */
+static zend_op_array *vyrtue_ast_cache_compile_file(zend_file_handle *file_handle, int type)
+{
+    struct vyrtue_ast_cache_pending *previous = VYRTUE_G(ast_cache_pending);
+    struct vyrtue_ast_cache_pending pending = {0};
+    zend_string *filename = file_handle->opened_path;
+    zend_string *expanded = NULL;
+    zend_op_array *op_array = NULL;
+
+    // the path a plain file is opened as, and so compiled as, see php_stream_fopen_rel()
+    if (filename == NULL && file_handle->filename != NULL && IS_ABSOLUTE_PATH(ZSTR_VAL(file_handle->filename), ZSTR_LEN(file_handle->filename))) {
+        char *path = expand_filepath(ZSTR_VAL(file_handle->filename), NULL);
+        if (path != NULL) {
+            filename = expanded = zend_string_init(path, strlen(path), 0);
+            efree(path);
+        }
+    }
+
+    if (!VYRTUE_G(process) || filename == NULL || !vyrtue_filter_file(filename) || !vyrtue_ast_cache_key(filename, &pending.key)) {
+        if (expanded != NULL) {
+            zend_string_release(expanded);
+        }
+        return vyrtue_ast_cache_original_compile_file(file_handle, type);
+    }
+
+    // a handle that was already read is compiled from its buffer as usual
+    if (file_handle->buf == NULL) {
+        pending.ast = vyrtue_ast_cache_load(&pending.key, &pending.arena);
+        if (pending.ast != NULL) {
+            size_t len = pending.key.lineno - 1;
+
+            file_handle->buf = emalloc(len + ZEND_MMAP_AHEAD);
+            memset(file_handle->buf, '\n', len);
+            memset(file_handle->buf + len, 0, ZEND_MMAP_AHEAD);
+            file_handle->len = len;
+
+            if (file_handle->opened_path == NULL) {
+                file_handle->opened_path = zend_string_copy(filename);
+            }
+
+            // compile_filename() only records the files it opened, like opcache does for its hits
+            if (!vyrtue_ast_cache_is_include_once()) {
+                zend_hash_add_empty_element(&EG(included_files), file_handle->opened_path);
+            }
+        }
+    }
+
+    VYRTUE_G(ast_cache_pending) = &pending;
+
+    zend_try
+    {
+        op_array = vyrtue_ast_cache_original_compile_file(file_handle, type);
+    }
+    zend_catch
+    {
+        VYRTUE_G(ast_cache_pending) = previous;
+        if (expanded != NULL) {
+            zend_string_release(expanded);
+        }
+        zend_bailout();
+    }
+    zend_end_try();
+
+    VYRTUE_G(ast_cache_pending) = previous;
+
+    // never reached the compiler
+    if (pending.ast != NULL) {
+        zend_ast_destroy(pending.ast);
+        zend_arena_destroy(pending.arena);
+    }
+
+    if (expanded != NULL) {
+        zend_string_release(expanded);
+    }
+
+    return op_array;
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+bool vyrtue_ast_cache_process(zend_ast *ast)
+{
+    struct vyrtue_ast_cache_pending *pending = VYRTUE_G(ast_cache_pending);
+    zend_string *filename = zend_get_compiled_filename();
+
+    if (pending == NULL || CG(ast) != ast || filename == NULL || !zend_string_equals(pending->key.filename, filename)) {
+        return false;
+    }
+
+    // only the outermost compile of the file
+    VYRTUE_G(ast_cache_pending) = NULL;
+
+    if (pending->ast == NULL) {
+        // still the line zend_compile() took as the last one, which a hit has to end on too
+        pending->key.lineno = CG(zend_lineno);
+        vyrtue_ast_process_file_ex(ast, &pending->key);
+        return true;
+    }
+
+    // the compiler destroys CG(ast) and CG(ast_arena) once it is done
+    zend_ast_destroy(ast);
+    zend_arena_destroy(CG(ast_arena));
+    CG(ast) = pending->ast;
+    CG(ast_arena) = pending->arena;
+    pending->ast = NULL;
+    pending->arena = NULL;
+
+    return true;
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_ast_cache)
+{
+    if (VYRTUE_G(ast_cache_dir) != NULL && VYRTUE_G(ast_cache_dir)[0] != '\0' && vyrtue_ast_cache_original_compile_file == NULL) {
+        vyrtue_ast_cache_original_compile_file = zend_compile_file;
+        zend_compile_file = vyrtue_ast_cache_compile_file;
+    }
+
+    return SUCCESS;
+}
+
+VYRTUE_LOCAL PHP_MSHUTDOWN_FUNCTION(vyrtue_ast_cache)
+{
+    if (vyrtue_ast_cache_original_compile_file != NULL) {
+        zend_compile_file = vyrtue_ast_cache_original_compile_file;
+        vyrtue_ast_cache_original_compile_file = NULL;
+    }
+
+    return SUCCESS;
+}
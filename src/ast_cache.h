@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHP_VYRTUE_AST_CACHE_H
+#define PHP_VYRTUE_AST_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <Zend/zend_API.h>
+#include <Zend/zend_arena.h>
+#include <Zend/zend_ast.h>
+#include <Zend/zend_virtual_cwd.h>
+#include "php_vyrtue.h"
+#include "shm.h"
+
+/*
+ * An on-disk cache of processed ASTs, for processes that run without
+ * opcache, enabled by setting vyrtue.ast_cache_dir. Entries are keyed by the
+ * path of the source file and checked against its mtime, size and content
+ * hash and against vyrtue_fingerprint(). The cache wraps zend_compile_file,
+ * so on a hit the source is neither read nor parsed, and the walk is skipped.
+ *
+ * Files that define or expand macros, declare debug-only functions, or were
+ * cut short by vyrtue.max_process_ms or vyrtue.max_nodes, are not stored,
+ * and nothing is cached while userland visitors, macros or debug-only
+ * functions are registered, since their effects can't be replayed.
+ */
+
+struct vyrtue_ast_cache_key
+{
+    zend_string *filename;
+    uint64_t fingerprint;
+    int64_t mtime;
+    uint64_t size;
+    uint64_t hash;
+    // the line the scanner ended on, filled in once the file was parsed
+    uint32_t lineno;
+    char path[MAXPATHLEN];
+};
+
+/**
+ * Fills in the key for filename. Returns false if the cache is disabled or
+ * the file can't be cached.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(2)
+bool vyrtue_ast_cache_key(zend_string *filename, struct vyrtue_ast_cache_key *key);
+
+/**
+ * Set by the zend_compile_file hook while the file is compiled. On a hit, ast
+ * was read into arena ahead of time and its index records were committed,
+ * and key.lineno is the one stored with it.
+ */
+struct vyrtue_ast_cache_pending
+{
+    struct vyrtue_ast_cache_key key;
+    zend_ast *ast;
+    zend_arena *arena;
+};
+
+/**
+ * Called from zend_ast_process. Replaces ast, which must be CG(ast), with the
+ * cached AST on a hit, or processes and stores it on a miss. Returns false if
+ * the file is not being compiled through the cache.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+bool vyrtue_ast_cache_process(zend_ast *ast);
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_ast_cache_store(const struct vyrtue_ast_cache_key *key, zend_ast *ast, const struct vyrtue_shm_batch *batch);
+
+/**
+ * Processes ast like vyrtue_ast_process_file(), and stores the result under
+ * cache_key unless it is NULL or the file can't be replayed.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(1)
+void vyrtue_ast_process_file_ex(zend_ast *ast, const struct vyrtue_ast_cache_key *cache_key);
+
+#endif
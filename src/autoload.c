@@ -0,0 +1,233 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_compile.h"
+#include "Zend/zend_execute.h"
+#include "Zend/zend_stream.h"
+#include "Zend/zend_virtual_cwd.h"
+#include "main/php.h"
+#include "main/php_streams.h"
+
+#include "php_vyrtue.h"
+#include "context.h"
+#include "shm.h"
+
+/*
+ * Every declared class, interface, trait and enum is recorded in shared
+ * memory with the file it was compiled from. Each process keeps a persistent
+ * copy of the map, which is only rebuilt on a miss after the records in
+ * shared memory changed, so most lookups are a single hash lookup. Files that
+ * no longer exist are dropped from the records when they are looked up.
+ */
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_autoload_class_enter(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_decl *decl = (zend_ast_decl *) ast;
+    zend_string *class_name;
+
+    if (!vyrtue_shm_is_enabled() || decl->name == NULL || (decl->flags & ZEND_ACC_ANON_CLASS)) {
+        return NULL;
+    }
+
+    if (ctx->current_namespace) {
+        class_name = zend_string_concat3(
+            ZSTR_VAL(ctx->current_namespace), ZSTR_LEN(ctx->current_namespace), "\\", 1, ZSTR_VAL(decl->name), ZSTR_LEN(decl->name)
+        );
+    } else {
+        class_name = zend_string_copy(decl->name);
+    }
+
+    struct vyrtue_shm_string argv[1] = {
+        {ZSTR_VAL(class_name), ZSTR_LEN(class_name)},
+    };
+
+    vyrtue_shm_batch_add(&ctx->shm_batch, VYRTUE_SHM_RECORD_CLASS, 1, argv);
+
+    zend_string_release(class_name);
+
+    return NULL;
+}
+
+static void vyrtue_autoload_map_dtor(zval *zv)
+{
+    zend_string_release_ex(Z_PTR_P(zv), 1);
+}
+
+static void vyrtue_autoload_map_record(void *arg, const struct vyrtue_shm_string *filename, uint32_t argc, const struct vyrtue_shm_string *argv)
+{
+    HashTable *map = arg;
+
+    if (argc != 1) {
+        return;
+    }
+
+    char *lc_name = zend_str_tolower_dup(argv[0].val, argv[0].len);
+    zend_hash_str_update_ptr(map, lc_name, argv[0].len, zend_string_init(filename->val, filename->len, 1));
+    efree(lc_name);
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_string *vyrtue_autoload_find(zend_string *lc_name)
+{
+    HashTable *map = VYRTUE_G(class_map);
+    zend_string *filename;
+    uint64_t generation;
+
+    if (map != NULL) {
+        filename = zend_hash_find_ptr(map, lc_name);
+        if (filename != NULL) {
+            return filename;
+        }
+    }
+
+    generation = vyrtue_shm_generation();
+    if (map != NULL && generation == VYRTUE_G(class_map_generation)) {
+        return NULL;
+    }
+
+    if (map == NULL) {
+        map = pemalloc(sizeof(HashTable), 1);
+        zend_hash_init(map, 64, NULL, vyrtue_autoload_map_dtor, 1);
+        VYRTUE_G(class_map) = map;
+    } else {
+        zend_hash_clean(map);
+    }
+
+    VYRTUE_G(class_map_generation) = generation;
+    vyrtue_shm_foreach(VYRTUE_SHM_RECORD_CLASS, vyrtue_autoload_map_record, map);
+
+    return zend_hash_find_ptr(map, lc_name);
+}
+
+/**
+ * Compiles and executes filename, like a plain include.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static void vyrtue_autoload_include(zend_string *filename)
+{
+    zend_file_handle file_handle;
+    zend_op_array *op_array;
+    zval result;
+
+    zend_stream_init_filename_ex(&file_handle, filename);
+
+    if (SUCCESS == php_stream_open_for_zend_ex(&file_handle, USE_PATH | STREAM_OPEN_FOR_INCLUDE)) {
+        if (!file_handle.opened_path) {
+            file_handle.opened_path = zend_string_copy(filename);
+        }
+        zend_hash_add_empty_element(&EG(included_files), file_handle.opened_path);
+
+        op_array = zend_compile_file(&file_handle, ZEND_INCLUDE);
+        if (op_array) {
+            ZVAL_UNDEF(&result);
+            zend_execute(op_array, &result);
+            destroy_op_array(op_array);
+            efree(op_array);
+            if (!EG(exception)) {
+                zval_ptr_dtor(&result);
+            }
+        }
+    }
+
+    zend_destroy_file_handle(&file_handle);
+}
+
+VYRTUE_LOCAL PHP_FUNCTION(vyrtue_autoload)
+{
+    zend_string *class_name;
+    zend_string *filename;
+
+    ZEND_PARSE_PARAMETERS_START(1, 1)
+    Z_PARAM_STR(class_name)
+    ZEND_PARSE_PARAMETERS_END();
+
+    zend_string *lc_name = zend_string_tolower(class_name);
+    if (ZSTR_LEN(lc_name) > 0 && ZSTR_VAL(lc_name)[0] == '\\') {
+        zend_string *tmp = zend_string_init(ZSTR_VAL(lc_name) + 1, ZSTR_LEN(lc_name) - 1, 0);
+        zend_string_release(lc_name);
+        lc_name = tmp;
+    }
+
+    filename = vyrtue_autoload_find(lc_name);
+    zend_string_release(lc_name);
+
+    if (filename == NULL) {
+        return;
+    }
+
+    // the map may be rebuilt by a nested autoload while the file executes
+    filename = zend_string_init(ZSTR_VAL(filename), ZSTR_LEN(filename), 0);
+
+    if (0 == VCWD_ACCESS(ZSTR_VAL(filename), F_OK)) {
+        vyrtue_autoload_include(filename);
+    } else {
+        // removed or renamed since it was compiled, drop its records for every process
+        struct vyrtue_shm_batch batch = {0};
+        vyrtue_shm_commit(filename, &batch);
+    }
+
+    zend_string_release(filename);
+}
+
+VYRTUE_LOCAL PHP_FUNCTION(vyrtue_autoload_register)
+{
+    bool prepend = false;
+    zval function_name;
+    zval retval;
+    zval params[3];
+
+    ZEND_PARSE_PARAMETERS_START(0, 1)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_BOOL(prepend)
+    ZEND_PARSE_PARAMETERS_END();
+
+    if (!vyrtue_shm_is_enabled()) {
+        zend_error(E_WARNING, "vyrtue: the autoloader requires vyrtue.shm_size to be set");
+        RETURN_FALSE;
+    }
+
+    ZVAL_STRINGL(&function_name, "spl_autoload_register", sizeof("spl_autoload_register") - 1);
+    ZVAL_STRINGL(&params[0], "VyrtueExt\\autoload", sizeof("VyrtueExt\\autoload") - 1);
+    ZVAL_TRUE(&params[1]);
+    ZVAL_BOOL(&params[2], prepend);
+
+    if (SUCCESS != call_user_function(NULL, NULL, &function_name, &retval, 3, params)) {
+        ZVAL_FALSE(&retval);
+    }
+
+    zval_ptr_dtor(&function_name);
+    zval_ptr_dtor(&params[0]);
+
+    RETVAL_BOOL(zend_is_true(&retval));
+    zval_ptr_dtor(&retval);
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_autoload)
+{
+    vyrtue_register_kind_visitor("vyrtue internal autoload", ZEND_AST_CLASS, vyrtue_autoload_class_enter, NULL);
+
+    return SUCCESS;
+}
@@ -36,6 +36,8 @@
 #include "php_vyrtue.h"
 #include "context.h"
 #include "compile.h"
+#include "debug_log.h"
+#include "stats.h"
 
 static void str_dtor(zval *zv)
 {
@@ -89,18 +91,21 @@ VYRTUE_ATTR_NONNULL_ALL
 void vyrtue_reset_import_tables(struct vyrtue_context *ctx)
 {
     if (ctx->imports) {
+        vyrtue_alloc_claim_ht(ctx->imports, VYRTUE_ALLOC_IMPORTS);
         zend_hash_destroy(ctx->imports);
         zend_arena_release(&ctx->arena, ctx->imports);
         ctx->imports = NULL;
     }
 
     if (ctx->imports_function) {
+        vyrtue_alloc_claim_ht(ctx->imports_function, VYRTUE_ALLOC_IMPORTS);
         zend_hash_destroy(ctx->imports_function);
         zend_arena_release(&ctx->arena, ctx->imports_function);
         ctx->imports_function = NULL;
     }
 
     if (ctx->imports_const) {
+        vyrtue_alloc_claim_ht(ctx->imports_const, VYRTUE_ALLOC_IMPORTS);
         zend_hash_destroy(ctx->imports_const);
         zend_arena_release(&ctx->arena, ctx->imports_const);
         ctx->imports_const = NULL;
@@ -115,8 +120,10 @@ void vyrtue_end_namespace(struct vyrtue_context *ctx)
     vyrtue_reset_import_tables(ctx);
     if (ctx->current_namespace) {
 #ifdef VYRTUE_DEBUG
-        if (UNEXPECTED(NULL != getenv("PHP_VYRTUE_DEBUG_DUMP_NAMESPACE"))) {
-            fprintf(stderr, "VYRTUE_NAMESPACE: LEFT: %.*s\n", (int) ctx->current_namespace->len, ctx->current_namespace->val);
+        if (VYRTUE_DEBUG_ENABLED(VYRTUE_DEBUG_NAMESPACE)) {
+            vyrtue_debug_log(
+                VYRTUE_DEBUG_NAMESPACE, "VYRTUE_NAMESPACE: LEFT: %.*s\n", (int) ctx->current_namespace->len, ctx->current_namespace->val
+            );
         }
 #endif
         ctx->current_namespace = NULL;
@@ -144,6 +151,8 @@ static zend_string *vyrtue_resolve_non_class_name(
     char *compound;
     *is_fully_qualified = 0;
 
+    VYRTUE_STATS_INC(ctx, name_resolutions);
+
     if (ZSTR_VAL(name)[0] == '\\') {
         /* Remove \ prefix (only relevant if this is a string rather than a label) */
         *is_fully_qualified = 1;
@@ -198,7 +207,21 @@ VYRTUE_ATTR_NONNULL_ALL
 VYRTUE_ATTR_WARN_UNUSED_RESULT
 zend_string *vyrtue_resolve_function_name(zend_string *name, uint32_t type, bool *is_fully_qualified, struct vyrtue_context *ctx)
 {
-    return vyrtue_resolve_non_class_name(name, type, is_fully_qualified, 0, ctx->imports_function, ctx);
+    VYRTUE_ALLOC_ENTER(VYRTUE_ALLOC_NAMES);
+    zend_string *result = vyrtue_resolve_non_class_name(name, type, is_fully_qualified, 0, ctx->imports_function, ctx);
+    VYRTUE_ALLOC_LEAVE();
+    return result;
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+zend_string *vyrtue_resolve_const_name(zend_string *name, uint32_t type, bool *is_fully_qualified, struct vyrtue_context *ctx)
+{
+    VYRTUE_ALLOC_ENTER(VYRTUE_ALLOC_NAMES);
+    zend_string *result = vyrtue_resolve_non_class_name(name, type, is_fully_qualified, 1, ctx->imports_const, ctx);
+    VYRTUE_ALLOC_LEAVE();
+    return result;
 }
 
 VYRTUE_ATTR_NONNULL_ALL
@@ -216,13 +239,14 @@ static uint32_t vyrtue_get_class_fetch_type(zend_string *name)
     }
 }
 
-VYRTUE_LOCAL
 VYRTUE_ATTR_NONNULL(3)
 VYRTUE_ATTR_WARN_UNUSED_RESULT
-zend_string *vyrtue_resolve_class_name(zend_string *name, uint32_t type, struct vyrtue_context *ctx)
+static zend_string *vyrtue_do_resolve_class_name(zend_string *name, uint32_t type, struct vyrtue_context *ctx)
 {
     char *compound;
 
+    VYRTUE_STATS_INC(ctx, name_resolutions);
+
     if (ZEND_FETCH_CLASS_DEFAULT != vyrtue_get_class_fetch_type(name)) {
         if (type == ZEND_NAME_FQ) {
             // zend_error_noreturn(E_COMPILE_ERROR, "'\\%s' is an invalid class name", ZSTR_VAL(name));
@@ -278,6 +302,17 @@ zend_string *vyrtue_resolve_class_name(zend_string *name, uint32_t type, struct
     return vyrtue_prefix_with_ns(name, ctx);
 }
 
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(3)
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+zend_string *vyrtue_resolve_class_name(zend_string *name, uint32_t type, struct vyrtue_context *ctx)
+{
+    VYRTUE_ALLOC_ENTER(VYRTUE_ALLOC_NAMES);
+    zend_string *result = vyrtue_do_resolve_class_name(name, type, ctx);
+    VYRTUE_ALLOC_LEAVE();
+    return result;
+}
+
 VYRTUE_LOCAL
 VYRTUE_ATTR_NONNULL_ALL
 VYRTUE_ATTR_WARN_UNUSED_RESULT
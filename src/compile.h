@@ -50,6 +50,11 @@ VYRTUE_ATTR_NONNULL_ALL
 VYRTUE_ATTR_WARN_UNUSED_RESULT
 zend_string *vyrtue_resolve_function_name(zend_string *name, uint32_t type, bool *is_fully_qualified, struct vyrtue_context *ctx);
 
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+zend_string *vyrtue_resolve_const_name(zend_string *name, uint32_t type, bool *is_fully_qualified, struct vyrtue_context *ctx);
+
 VYRTUE_LOCAL
 VYRTUE_ATTR_NONNULL(3)
 VYRTUE_ATTR_WARN_UNUSED_RESULT
@@ -62,3 +62,12 @@ HashTable *vyrtue_context_scope_stack_top_ht(struct vyrtue_context *ctx)
     }
     return frame->ht;
 }
+
+VYRTUE_PUBLIC
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_RETURNS_NONNULL
+zend_ast *vyrtue_context_create_temporary_var(struct vyrtue_context *ctx)
+{
+    zend_string *name = zend_strpprintf(0, "__vyrtue_tmp%" PRIu32, ctx->temporary_count++);
+    return zend_ast_create(ZEND_AST_VAR, zend_ast_create_zval_from_str(name));
+}
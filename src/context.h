@@ -22,6 +22,8 @@
 #include <Zend/zend_hash.h>
 #include <Zend/zend_errors.h>
 #include "php_vyrtue.h"
+#include "alloc.h"
+#include "shm.h"
 
 #define VYRTUE_STACK_SIZE 128
 
@@ -43,9 +45,23 @@ struct vyrtue_context
     bool in_namespace;
     bool in_group_use;
     zend_string *current_namespace;
+    uint32_t temporary_count;
+    uint32_t macro_expansions;
+    bool stats_enabled;
+    bool trace_enabled;
+    bool budget_exceeded;
+    bool ast_cache_skip;
+    uint64_t budget_deadline;
+    uint64_t budget_nodes;
+    const char *budget_last_replacement;
+    uint64_t *visitor_skip;
+    uint32_t visitor_skip_count;
+    struct vyrtue_stats stats;
     HashTable *imports;
     HashTable *imports_function;
     HashTable *imports_const;
+    HashTable *inline_functions;
+    struct vyrtue_shm_batch shm_batch;
     struct vyrtue_context_stack scope_stack;
     struct vyrtue_context_stack node_stack;
 };
@@ -78,6 +94,7 @@ static inline void vyrtue_context_stack_pop(struct vyrtue_context_stack *stack,
     }
 
     if (stack->data[stack->i].ht) {
+        vyrtue_alloc_claim_ht(stack->data[stack->i].ht, VYRTUE_ALLOC_SCOPE);
         zend_hash_destroy(stack->data[stack->i].ht);
     }
 
@@ -104,4 +121,33 @@ static inline struct vyrtue_context_stack_frame *vyrtue_context_stack_top(struct
     return &stack->data[stack->i - 1];
 }
 
+/**
+ * Calls are not allowed in constant expressions, rewrites must not make them
+ * valid.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static inline bool vyrtue_context_in_const_expr(struct vyrtue_context *ctx)
+{
+    struct vyrtue_context_stack *stack = &ctx->node_stack;
+
+    for (size_t i = stack->i; i > 0; i--) {
+        switch (stack->data[i - 1].ast->kind) {
+            case ZEND_AST_CONST_DECL:
+            case ZEND_AST_CLASS_CONST_DECL:
+            case ZEND_AST_PROP_DECL:
+            case ZEND_AST_PARAM:
+            case ZEND_AST_STATIC:
+            case ZEND_AST_ATTRIBUTE_LIST:
+            case ZEND_AST_ENUM_CASE:
+                return true;
+            case ZEND_AST_STMT_LIST:
+                return false;
+            default:
+                break;
+        }
+    }
+
+    return false;
+}
+
 #endif
@@ -0,0 +1,350 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_smart_str.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "debug_log.h"
+#include "stats.h"
+
+/*
+ * The ring buffer holds variable length records, a header followed by the
+ * formatted message, and both may wrap around the end of the buffer. Records
+ * are only ever read back in order, when the buffer is dumped.
+ */
+
+#define VYRTUE_DEBUG_LOG_MIN_CAPACITY 1024
+
+struct vyrtue_debug_record
+{
+    uint32_t length;
+    uint32_t category;
+    uint64_t time;
+};
+
+struct vyrtue_debug_log
+{
+    size_t capacity;
+    size_t head;
+    size_t used;
+    uint64_t dropped;
+    unsigned char data[];
+};
+
+static const struct
+{
+    const char *name;
+    const char *env;
+    enum vyrtue_debug_category category;
+} vyrtue_debug_category_table[] = {
+    {"replacement", "PHP_VYRTUE_DEBUG_DUMP_REPLACEMENT", VYRTUE_DEBUG_REPLACEMENT},
+    {"namespace", "PHP_VYRTUE_DEBUG_DUMP_NAMESPACE", VYRTUE_DEBUG_NAMESPACE},
+    {"use", "PHP_VYRTUE_DEBUG_DUMP_USE", VYRTUE_DEBUG_USE},
+    {"call", "PHP_VYRTUE_DEBUG_CALL", VYRTUE_DEBUG_CALL},
+    {"ast", "PHP_VYRTUE_DEBUG_DUMP_AST", VYRTUE_DEBUG_AST},
+    {"inline", "PHP_VYRTUE_DEBUG_DUMP_INLINE", VYRTUE_DEBUG_INLINE},
+    {"strip", "PHP_VYRTUE_DEBUG_DUMP_STRIP", VYRTUE_DEBUG_STRIP},
+    {"macro", "PHP_VYRTUE_DEBUG_DUMP_MACRO", VYRTUE_DEBUG_MACRO},
+    {"alloc", "PHP_VYRTUE_DEBUG_ALLOC", VYRTUE_DEBUG_ALLOC},
+};
+
+VYRTUE_LOCAL uint32_t vyrtue_debug_categories = 0;
+
+static void (*vyrtue_debug_original_error_cb)(int type, zend_string *error_filename, const uint32_t error_lineno, zend_string *message);
+
+typedef void (*vyrtue_debug_log_writer)(void *arg, const char *str, size_t len);
+
+static const char *vyrtue_debug_category_name(uint32_t category)
+{
+    for (size_t i = 0; i < sizeof(vyrtue_debug_category_table) / sizeof(vyrtue_debug_category_table[0]); i++) {
+        if (vyrtue_debug_category_table[i].category == category) {
+            return vyrtue_debug_category_table[i].name;
+        }
+    }
+
+    return "unknown";
+}
+
+static uint32_t vyrtue_debug_parse_categories(const char *str)
+{
+    uint32_t categories = 0;
+    const char *end;
+
+    while (*str != '\0') {
+        while (*str == ',' || *str == ' ') {
+            str++;
+        }
+
+        end = str;
+        while (*end != '\0' && *end != ',' && *end != ' ') {
+            end++;
+        }
+
+        size_t len = end - str;
+        if (len == 0) {
+            break;
+        }
+
+        if (len == sizeof("all") - 1 && 0 == strncmp(str, "all", len)) {
+            categories = UINT32_MAX;
+        } else {
+            size_t i;
+            for (i = 0; i < sizeof(vyrtue_debug_category_table) / sizeof(vyrtue_debug_category_table[0]); i++) {
+                if (strlen(vyrtue_debug_category_table[i].name) == len && 0 == strncmp(str, vyrtue_debug_category_table[i].name, len)) {
+                    categories |= vyrtue_debug_category_table[i].category;
+                    break;
+                }
+            }
+            if (i == sizeof(vyrtue_debug_category_table) / sizeof(vyrtue_debug_category_table[0])) {
+                zend_error(E_WARNING, "vyrtue: unknown debug category \"%.*s\"", (int) len, str);
+            }
+        }
+
+        str = end;
+    }
+
+    return categories;
+}
+
+static void vyrtue_debug_log_read(const struct vyrtue_debug_log *log, size_t offset, void *dest, size_t len)
+{
+    offset %= log->capacity;
+    size_t first = MIN(len, log->capacity - offset);
+    memcpy(dest, log->data + offset, first);
+    memcpy((unsigned char *) dest + first, log->data, len - first);
+}
+
+static void vyrtue_debug_log_write(struct vyrtue_debug_log *log, size_t offset, const void *src, size_t len)
+{
+    offset %= log->capacity;
+    size_t first = MIN(len, log->capacity - offset);
+    memcpy(log->data + offset, src, first);
+    memcpy(log->data, (const unsigned char *) src + first, len - first);
+}
+
+static void vyrtue_debug_log_append(enum vyrtue_debug_category category, const char *message, size_t len)
+{
+    struct vyrtue_debug_log *log = VYRTUE_G(debug_log);
+    struct vyrtue_debug_record record;
+
+    if (UNEXPECTED(log == NULL)) {
+        size_t capacity = MAX((size_t) VYRTUE_G(debug_buffer), VYRTUE_DEBUG_LOG_MIN_CAPACITY);
+        log = pecalloc(1, sizeof(struct vyrtue_debug_log) + capacity, 1);
+        log->capacity = capacity;
+        VYRTUE_G(debug_log) = log;
+    }
+
+    len = MIN(len, log->capacity - sizeof(record));
+
+    // drop the oldest records until this one fits
+    while (log->used + sizeof(record) + len > log->capacity) {
+        vyrtue_debug_log_read(log, log->head, &record, sizeof(record));
+        log->head = (log->head + sizeof(record) + record.length) % log->capacity;
+        log->used -= sizeof(record) + record.length;
+        log->dropped++;
+    }
+
+    record = (struct vyrtue_debug_record){
+        .length = (uint32_t) len,
+        .category = (uint32_t) category,
+        .time = vyrtue_stats_now(),
+    };
+
+    vyrtue_debug_log_write(log, log->head + log->used, &record, sizeof(record));
+    vyrtue_debug_log_write(log, log->head + log->used + sizeof(record), message, len);
+    log->used += sizeof(record) + len;
+}
+
+/**
+ * Writes the buffered events in order, each on its own line prefixed with its
+ * category and the microseconds since the first. Nothing is allocated, so
+ * this is safe to call from the error callback.
+ */
+static void vyrtue_debug_log_each(const struct vyrtue_debug_log *log, vyrtue_debug_log_writer writer, void *arg)
+{
+    struct vyrtue_debug_record record;
+    uint64_t start = 0;
+    char prefix[64];
+    size_t offset = 0;
+    int n;
+
+    if (log->dropped > 0) {
+        n = snprintf(prefix, sizeof(prefix), "[vyrtue] %" PRIu64 " events dropped\n", log->dropped);
+        writer(arg, prefix, (size_t) n);
+    }
+
+    while (offset < log->used) {
+        vyrtue_debug_log_read(log, log->head + offset, &record, sizeof(record));
+        if (offset == 0) {
+            start = record.time;
+        }
+
+        n = snprintf(
+            prefix,
+            sizeof(prefix),
+            "[%s +%" PRIu64 "us] ",
+            vyrtue_debug_category_name(record.category),
+            (record.time - start) / 1000
+        );
+        writer(arg, prefix, (size_t) n);
+
+        size_t position = (log->head + offset + sizeof(record)) % log->capacity;
+        size_t first = MIN((size_t) record.length, log->capacity - position);
+        writer(arg, (const char *) log->data + position, first);
+        writer(arg, (const char *) log->data, record.length - first);
+
+        char last = '\0';
+        if (record.length > 0) {
+            vyrtue_debug_log_read(log, position + record.length - 1, &last, 1);
+        }
+        if (last != '\n') {
+            writer(arg, "\n", 1);
+        }
+
+        offset += sizeof(record) + record.length;
+    }
+}
+
+static void vyrtue_debug_log_clear(struct vyrtue_debug_log *log)
+{
+    log->head = 0;
+    log->used = 0;
+    log->dropped = 0;
+}
+
+static void vyrtue_debug_log_write_stderr(void *arg, const char *str, size_t len)
+{
+    if (len > 0) {
+        fwrite(str, 1, len, stderr);
+    }
+}
+
+static void vyrtue_debug_log_write_smart_str(void *arg, const char *str, size_t len)
+{
+    smart_str_appendl((smart_str *) arg, str, len);
+}
+
+static void vyrtue_debug_error_cb(int type, zend_string *error_filename, const uint32_t error_lineno, zend_string *message)
+{
+    struct vyrtue_debug_log *log = VYRTUE_G(debug_log);
+
+    if ((type & E_FATAL_ERRORS) && log != NULL && log->used > 0) {
+        fprintf(stderr, "vyrtue: debug log at fatal error:\n");
+        vyrtue_debug_log_each(log, vyrtue_debug_log_write_stderr, NULL);
+        fflush(stderr);
+        vyrtue_debug_log_clear(log);
+    }
+
+    vyrtue_debug_original_error_cb(type, error_filename, error_lineno, message);
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_debug_log(enum vyrtue_debug_category category, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    zend_string *message = zend_vstrpprintf(0, format, args);
+    va_end(args);
+
+    if (VYRTUE_G(debug_buffer) > 0) {
+        vyrtue_debug_log_append(category, ZSTR_VAL(message), ZSTR_LEN(message));
+    } else {
+        fwrite(ZSTR_VAL(message), 1, ZSTR_LEN(message), stderr);
+        fflush(stderr);
+    }
+
+    zend_string_release(message);
+}
+
+VYRTUE_LOCAL PHP_FUNCTION(vyrtue_debug_dump_log)
+{
+    struct vyrtue_debug_log *log = VYRTUE_G(debug_log);
+    smart_str buf = {0};
+
+    ZEND_PARSE_PARAMETERS_NONE();
+
+    if (log == NULL) {
+        RETURN_EMPTY_STRING();
+    }
+
+    vyrtue_debug_log_each(log, vyrtue_debug_log_write_smart_str, &buf);
+    vyrtue_debug_log_clear(log);
+
+    RETURN_STR(smart_str_extract(&buf));
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_debug_log)
+{
+    const char *env;
+
+    vyrtue_debug_categories = 0;
+
+    if (VYRTUE_G(debug) != NULL) {
+        vyrtue_debug_categories |= vyrtue_debug_parse_categories(VYRTUE_G(debug));
+    }
+
+    if (NULL != (env = getenv("PHP_VYRTUE_DEBUG"))) {
+        vyrtue_debug_categories |= vyrtue_debug_parse_categories(env);
+    }
+
+    for (size_t i = 0; i < sizeof(vyrtue_debug_category_table) / sizeof(vyrtue_debug_category_table[0]); i++) {
+        if (NULL != getenv(vyrtue_debug_category_table[i].env)) {
+            vyrtue_debug_categories |= vyrtue_debug_category_table[i].category;
+        }
+    }
+
+    if (VYRTUE_G(debug_buffer) > 0 && vyrtue_debug_original_error_cb == NULL) {
+        vyrtue_debug_original_error_cb = zend_error_cb;
+        zend_error_cb = vyrtue_debug_error_cb;
+    }
+
+    return SUCCESS;
+}
+
+VYRTUE_LOCAL PHP_MSHUTDOWN_FUNCTION(vyrtue_debug_log)
+{
+    if (vyrtue_debug_original_error_cb != NULL) {
+        zend_error_cb = vyrtue_debug_original_error_cb;
+        vyrtue_debug_original_error_cb = NULL;
+    }
+
+    return SUCCESS;
+}
+
+VYRTUE_LOCAL PHP_RSHUTDOWN_FUNCTION(vyrtue_debug_log)
+{
+    if (VYRTUE_G(debug_log) != NULL) {
+        vyrtue_debug_log_clear(VYRTUE_G(debug_log));
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHP_VYRTUE_DEBUG_LOG_H
+#define PHP_VYRTUE_DEBUG_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <Zend/zend_API.h>
+#include "php_vyrtue.h"
+
+/*
+ * Debug output for debug builds, by category. The enabled categories are read
+ * once at startup from vyrtue.debug, a comma separated list of category names
+ * or "all", from PHP_VYRTUE_DEBUG in the environment, and from the older per
+ * category variables such as PHP_VYRTUE_DEBUG_DUMP_USE, so checking one while
+ * walking is a load and a mask.
+ *
+ * Events are written to stderr as they happen. With vyrtue.debug_buffer set to
+ * a size in bytes they are kept in a ring buffer per thread instead, dropping
+ * the oldest when full, and written out on a fatal error or returned by
+ * VyrtueExt\Debug\dump_log().
+ */
+
+enum vyrtue_debug_category
+{
+    VYRTUE_DEBUG_REPLACEMENT = 1 << 0,
+    VYRTUE_DEBUG_NAMESPACE = 1 << 1,
+    VYRTUE_DEBUG_USE = 1 << 2,
+    VYRTUE_DEBUG_CALL = 1 << 3,
+    VYRTUE_DEBUG_AST = 1 << 4,
+    VYRTUE_DEBUG_INLINE = 1 << 5,
+    VYRTUE_DEBUG_STRIP = 1 << 6,
+    VYRTUE_DEBUG_MACRO = 1 << 7,
+    VYRTUE_DEBUG_ALLOC = 1 << 8,
+};
+
+#ifdef VYRTUE_DEBUG
+
+VYRTUE_LOCAL extern uint32_t vyrtue_debug_categories;
+
+#define VYRTUE_DEBUG_ENABLED(category) UNEXPECTED(0 != (vyrtue_debug_categories & (category)))
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+ZEND_ATTRIBUTE_FORMAT(printf, 2, 3)
+void vyrtue_debug_log(enum vyrtue_debug_category category, const char *format, ...);
+
+#else
+
+#define VYRTUE_DEBUG_ENABLED(category) false
+
+#endif
+
+#endif
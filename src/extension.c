@@ -19,6 +19,7 @@
 #include "config.h"
 #endif
 
+#include <inttypes.h>
 #include <string.h>
 
 #include "Zend/zend_API.h"
@@ -31,6 +32,9 @@
 #include "ext/standard/info.h"
 
 #include "php_vyrtue.h"
+#include "ast_cache.h"
+#include "filter.h"
+#include "fingerprint.h"
 #include "visitor.h"
 #include "private.h"
 
@@ -39,6 +43,25 @@ ZEND_DECLARE_MODULE_GLOBALS(vyrtue);
 static void (*original_ast_process)(zend_ast *ast) = NULL;
 
 PHP_INI_BEGIN()
+STD_PHP_INI_BOOLEAN("vyrtue.process", "1", PHP_INI_SYSTEM, OnUpdateBool, process, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_BOOLEAN("vyrtue.fold_functions", "1", PHP_INI_SYSTEM, OnUpdateBool, fold_functions, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_BOOLEAN("vyrtue.strip_debug", "0", PHP_INI_SYSTEM, OnUpdateBool, strip_debug, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_ENTRY("vyrtue.strip_constants", "", PHP_INI_SYSTEM, OnUpdateString, strip_constants, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_ENTRY("vyrtue.shm_size", "0", PHP_INI_SYSTEM, OnUpdateLong, shm_size, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_ENTRY("vyrtue.strip_functions", "", PHP_INI_SYSTEM, OnUpdateString, strip_functions, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_BOOLEAN("vyrtue.stats", "0", PHP_INI_SYSTEM, OnUpdateBool, stats, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_ENTRY("vyrtue.trace_file", "", PHP_INI_SYSTEM, OnUpdateString, trace_file, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_ENTRY("vyrtue.max_process_ms", "0", PHP_INI_SYSTEM, OnUpdateLong, max_process_ms, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_ENTRY("vyrtue.max_nodes", "0", PHP_INI_SYSTEM, OnUpdateLong, max_nodes, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_ENTRY("vyrtue.include_paths", "", PHP_INI_SYSTEM, OnUpdateString, include_paths, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_ENTRY("vyrtue.exclude_paths", "", PHP_INI_SYSTEM, OnUpdateString, exclude_paths, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_ENTRY("vyrtue.visitor_paths", "", PHP_INI_SYSTEM, OnUpdateString, visitor_paths, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_ENTRY("vyrtue.ast_cache_dir", "", PHP_INI_SYSTEM, OnUpdateString, ast_cache_dir, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_ENTRY("vyrtue.trace_threshold_us", "10", PHP_INI_SYSTEM, OnUpdateLong, trace_threshold_us, zend_vyrtue_globals, vyrtue_globals)
+#ifdef VYRTUE_DEBUG
+STD_PHP_INI_ENTRY("vyrtue.debug", "", PHP_INI_SYSTEM, OnUpdateString, debug, zend_vyrtue_globals, vyrtue_globals)
+STD_PHP_INI_ENTRY("vyrtue.debug_buffer", "0", PHP_INI_SYSTEM, OnUpdateLong, debug_buffer, zend_vyrtue_globals, vyrtue_globals)
+#endif
 PHP_INI_END()
 
 VYRTUE_PUBLIC
@@ -48,7 +71,10 @@ zend_never_inline void vyrtue_ast_process(zend_ast *ast)
         original_ast_process(ast);
     }
 
-    vyrtue_ast_process_file(ast);
+    // code transformed ahead of time is loaded with vyrtue.process=0
+    if (VYRTUE_G(process) && vyrtue_filter_file(zend_get_compiled_filename()) && !vyrtue_ast_cache_process(ast)) {
+        vyrtue_ast_process_file(ast);
+    }
 }
 
 static PHP_RINIT_FUNCTION(vyrtue)
@@ -60,6 +86,18 @@ static PHP_RINIT_FUNCTION(vyrtue)
     return SUCCESS;
 }
 
+static PHP_RSHUTDOWN_FUNCTION(vyrtue)
+{
+    PHP_RSHUTDOWN(vyrtue_stats)(SHUTDOWN_FUNC_ARGS_PASSTHRU);
+    PHP_RSHUTDOWN(vyrtue_trace)(SHUTDOWN_FUNC_ARGS_PASSTHRU);
+    PHP_RSHUTDOWN(vyrtue_userland)(SHUTDOWN_FUNC_ARGS_PASSTHRU);
+#ifdef VYRTUE_DEBUG
+    PHP_RSHUTDOWN(vyrtue_debug_log)(SHUTDOWN_FUNC_ARGS_PASSTHRU);
+#endif
+
+    return SUCCESS;
+}
+
 static PHP_MINIT_FUNCTION(vyrtue)
 {
     int flags = CONST_CS | CONST_PERSISTENT;
@@ -74,12 +112,34 @@ static PHP_MINIT_FUNCTION(vyrtue)
     REGISTER_BOOL_CONSTANT("VyrtueExt\\DEBUG", false, flags);
 #endif
 
+#ifdef VYRTUE_DEBUG
+    PHP_MINIT(vyrtue_debug_log)(INIT_FUNC_ARGS_PASSTHRU);
+#endif
+
     if (NULL == original_ast_process) {
         original_ast_process = zend_ast_process;
         zend_ast_process = vyrtue_ast_process;
     }
 
+    // before anything registers a visitor, so scopes can be resolved
+    PHP_MINIT(vyrtue_filter)(INIT_FUNC_ARGS_PASSTHRU);
     PHP_MINIT(vyrtue_process)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_shm)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_ast_cache)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_autoload)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_fingerprint)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_fold)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_hydrate)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_in_array)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_index)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_inline)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_inject)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_loop)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_macro)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_memoize)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_sprintf)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_strip)(INIT_FUNC_ARGS_PASSTHRU);
+    PHP_MINIT(vyrtue_userland)(INIT_FUNC_ARGS_PASSTHRU);
 #ifdef VYRTUE_DEBUG
     PHP_MINIT(vyrtue_debug)(INIT_FUNC_ARGS_PASSTHRU);
 #endif
@@ -89,6 +149,14 @@ static PHP_MINIT_FUNCTION(vyrtue)
 
 static PHP_MSHUTDOWN_FUNCTION(vyrtue)
 {
+    PHP_MSHUTDOWN(vyrtue_ast_cache)(SHUTDOWN_FUNC_ARGS_PASSTHRU);
+    PHP_MSHUTDOWN(vyrtue_filter)(SHUTDOWN_FUNC_ARGS_PASSTHRU);
+    PHP_MSHUTDOWN(vyrtue_shm)(SHUTDOWN_FUNC_ARGS_PASSTHRU);
+    PHP_MSHUTDOWN(vyrtue_strip)(SHUTDOWN_FUNC_ARGS_PASSTHRU);
+#ifdef VYRTUE_DEBUG
+    PHP_MSHUTDOWN(vyrtue_debug_log)(SHUTDOWN_FUNC_ARGS_PASSTHRU);
+#endif
+
     UNREGISTER_INI_ENTRIES();
 
     return SUCCESS;
@@ -99,10 +167,14 @@ const char *PHP_VYRTUE_MOTD =
 
 static PHP_MINFO_FUNCTION(vyrtue)
 {
+    char fingerprint[17];
+
     php_info_print_table_start();
     php_info_print_table_row(2, "Version", PHP_VYRTUE_VERSION);
     php_info_print_table_row(2, "Released", PHP_VYRTUE_RELEASE);
     php_info_print_table_row(2, "Authors", PHP_VYRTUE_AUTHORS);
+    snprintf(fingerprint, sizeof(fingerprint), "%016" PRIx64, vyrtue_fingerprint());
+    php_info_print_table_row(2, "Fingerprint", fingerprint);
     php_info_print_table_end();
 
     DISPLAY_INI_ENTRIES();
@@ -155,6 +227,8 @@ static PHP_GINIT_FUNCTION(vyrtue)
     zend_hash_init(&vyrtue_globals->attribute_visitors, 16, NULL, NULL, 1);
     zend_hash_init(&vyrtue_globals->function_visitors, 16, NULL, NULL, 1);
     zend_hash_init(&vyrtue_globals->kind_visitors, 16, NULL, NULL, 1);
+    zend_hash_init(&vyrtue_globals->visitor_versions, 16, NULL, NULL, 1);
+    zend_hash_init(&vyrtue_globals->stats_visitor_names, 16, NULL, NULL, 1);
 }
 
 static PHP_GSHUTDOWN_FUNCTION(vyrtue)
@@ -162,10 +236,94 @@ static PHP_GSHUTDOWN_FUNCTION(vyrtue)
     zend_hash_destroy(&vyrtue_globals->attribute_visitors);
     zend_hash_destroy(&vyrtue_globals->function_visitors);
     zend_hash_destroy(&vyrtue_globals->kind_visitors);
+    zend_hash_destroy(&vyrtue_globals->visitor_versions);
+    zend_hash_destroy(&vyrtue_globals->stats_visitor_names);
+
+    if (vyrtue_globals->stats_visitors) {
+        pefree(vyrtue_globals->stats_visitors, 1);
+    }
+
+    if (vyrtue_globals->trace_events) {
+        pefree(vyrtue_globals->trace_events, 1);
+    }
+
+    if (vyrtue_globals->debug_log) {
+        pefree(vyrtue_globals->debug_log, 1);
+    }
+
+    if (vyrtue_globals->attribute_index) {
+        zend_hash_destroy(vyrtue_globals->attribute_index);
+        pefree(vyrtue_globals->attribute_index, 1);
+    }
+
+    if (vyrtue_globals->class_map) {
+        zend_hash_destroy(vyrtue_globals->class_map);
+        pefree(vyrtue_globals->class_map, 1);
+    }
+
+    if (vyrtue_globals->macros) {
+        zend_hash_destroy(vyrtue_globals->macros);
+        pefree(vyrtue_globals->macros, 1);
+    }
+
+    if (vyrtue_globals->debug_only) {
+        zend_hash_destroy(vyrtue_globals->debug_only);
+        pefree(vyrtue_globals->debug_only, 1);
+    }
+
+    if (vyrtue_globals->userland_hooks) {
+        zend_hash_destroy(vyrtue_globals->userland_hooks);
+        pefree(vyrtue_globals->userland_hooks, 1);
+    }
 }
 
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(vyrtue_attribute_index_arginfo, 0, 1, IS_ARRAY, 0)
+    ZEND_ARG_TYPE_INFO(0, attribute, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(vyrtue_autoload_arginfo, 0, 1, IS_VOID, 0)
+    ZEND_ARG_TYPE_INFO(0, class, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(vyrtue_autoload_register_arginfo, 0, 0, _IS_BOOL, 0)
+    ZEND_ARG_TYPE_INFO_WITH_DEFAULT_VALUE(0, prepend, _IS_BOOL, 0, "false")
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(vyrtue_fingerprint_arginfo, 0, 0, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(vyrtue_register_visitor_arginfo, 0, 2, IS_VOID, 0)
+    ZEND_ARG_TYPE_MASK(0, target, MAY_BE_LONG | MAY_BE_STRING, NULL)
+    ZEND_ARG_TYPE_INFO(0, enter, IS_CALLABLE, 1)
+    ZEND_ARG_TYPE_INFO_WITH_DEFAULT_VALUE(0, leave, IS_CALLABLE, 1, "null")
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_MASK_EX(vyrtue_transform_file_arginfo, 0, 1, MAY_BE_STRING | MAY_BE_FALSE)
+    ZEND_ARG_TYPE_INFO(0, filename, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(vyrtue_stats_arginfo, 0, 0, IS_ARRAY, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(vyrtue_stats_reset_arginfo, 0, 0, IS_VOID, 0)
+ZEND_END_ARG_INFO()
+
+#ifdef VYRTUE_DEBUG
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(vyrtue_debug_dump_log_arginfo, 0, 0, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+#endif
+
 const zend_function_entry vyrtue_functions[] = {
+    ZEND_NS_FENTRY("VyrtueExt", attribute_index, ZEND_FN(vyrtue_attribute_index), vyrtue_attribute_index_arginfo, 0)
+    ZEND_NS_FENTRY("VyrtueExt", autoload, ZEND_FN(vyrtue_autoload), vyrtue_autoload_arginfo, 0)
+    ZEND_NS_FENTRY("VyrtueExt", autoload_register, ZEND_FN(vyrtue_autoload_register), vyrtue_autoload_register_arginfo, 0)
+    ZEND_NS_FENTRY("VyrtueExt", fingerprint, ZEND_FN(vyrtue_fingerprint), vyrtue_fingerprint_arginfo, 0)
+    ZEND_NS_FENTRY("VyrtueExt", register_visitor, ZEND_FN(vyrtue_register_visitor), vyrtue_register_visitor_arginfo, 0)
+    ZEND_NS_FENTRY("VyrtueExt", stats, ZEND_FN(vyrtue_stats), vyrtue_stats_arginfo, 0)
+    ZEND_NS_FENTRY("VyrtueExt", stats_reset, ZEND_FN(vyrtue_stats_reset), vyrtue_stats_reset_arginfo, 0)
+    ZEND_NS_FENTRY("VyrtueExt", transform_file, ZEND_FN(vyrtue_transform_file), vyrtue_transform_file_arginfo, 0)
 #ifdef VYRTUE_DEBUG
+    ZEND_NS_FENTRY("VyrtueExt\\Debug", dump_log, ZEND_FN(vyrtue_debug_dump_log), vyrtue_debug_dump_log_arginfo, 0)
 #endif
     PHP_FE_END,
 };
@@ -185,7 +343,7 @@ zend_module_entry vyrtue_module_entry = {
     PHP_MINIT(vyrtue),          /* MINIT */
     PHP_MSHUTDOWN(vyrtue),      /* MSHUTDOWN */
     PHP_RINIT(vyrtue),          /* RINIT */
-    NULL,                       /* RSHUTDOWN */
+    PHP_RSHUTDOWN(vyrtue),      /* RSHUTDOWN */
     PHP_MINFO(vyrtue),          /* MINFO */
     PHP_VYRTUE_VERSION,         /* Version */
     PHP_MODULE_GLOBALS(vyrtue), /* Globals */
@@ -0,0 +1,390 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#ifndef PHP_WIN32
+#include <fnmatch.h>
+#else
+#include "win32/fnmatch.h"
+#endif
+
+#include "Zend/zend_API.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "filter.h"
+
+/*
+ * Path patterns are compiled at startup into radix tries, one per setting and
+ * one per scoped visitor, and are read-only afterwards. A pattern without
+ * wildcards matches every path it is a prefix of. A pattern with wildcards is
+ * matched with fnmatch() against the whole path, and is stored at the trie
+ * node for its literal prefix, so only the globs along the path are tried.
+ *
+ * vyrtue.visitor_paths limits visitors to some paths, as
+ * "visitor name=pattern,pattern;other visitor=pattern". Keep in mind that
+ * "vyrtue internal" resolves names for every other visitor. Scopes are
+ * resolved to stats slots as visitors are registered at startup, rather than
+ * looked up per thread, so they apply to every thread of a ZTS build.
+ */
+
+struct vyrtue_filter_node;
+
+struct vyrtue_filter_edge
+{
+    char *label;
+    size_t len;
+    struct vyrtue_filter_node *node;
+};
+
+struct vyrtue_filter_node
+{
+    bool terminal;
+    uint32_t edges_count;
+    struct vyrtue_filter_edge *edges;
+    uint32_t globs_count;
+    char **globs;
+};
+
+struct vyrtue_filter_scope
+{
+    char *visitor;
+    // stats slot of the visitor, or UINT32_MAX until it is registered
+    uint32_t slot;
+    struct vyrtue_filter_node *trie;
+};
+
+static struct vyrtue_filter_node *vyrtue_filter_include = NULL;
+static struct vyrtue_filter_node *vyrtue_filter_exclude = NULL;
+static struct vyrtue_filter_scope *vyrtue_filter_scopes = NULL;
+static uint32_t vyrtue_filter_scopes_count = 0;
+static uint32_t vyrtue_filter_slots_count = 0;
+
+static struct vyrtue_filter_node *vyrtue_filter_node_create(void)
+{
+    return pecalloc(1, sizeof(struct vyrtue_filter_node), 1);
+}
+
+static void vyrtue_filter_node_destroy(struct vyrtue_filter_node *node)
+{
+    for (uint32_t i = 0; i < node->edges_count; i++) {
+        pefree(node->edges[i].label, 1);
+        vyrtue_filter_node_destroy(node->edges[i].node);
+    }
+    for (uint32_t i = 0; i < node->globs_count; i++) {
+        pefree(node->globs[i], 1);
+    }
+    if (node->edges) {
+        pefree(node->edges, 1);
+    }
+    if (node->globs) {
+        pefree(node->globs, 1);
+    }
+    pefree(node, 1);
+}
+
+static struct vyrtue_filter_edge *vyrtue_filter_find_edge(const struct vyrtue_filter_node *node, char c)
+{
+    for (uint32_t i = 0; i < node->edges_count; i++) {
+        if (node->edges[i].label[0] == c) {
+            return &node->edges[i];
+        }
+    }
+
+    return NULL;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static void vyrtue_filter_insert(struct vyrtue_filter_node *node, const char *pattern, size_t len)
+{
+    size_t prefix_len = 0;
+    while (prefix_len < len && pattern[prefix_len] != '*' && pattern[prefix_len] != '?' && pattern[prefix_len] != '[') {
+        prefix_len++;
+    }
+
+    const char *key = pattern;
+    size_t key_len = prefix_len;
+
+    while (key_len > 0) {
+        struct vyrtue_filter_edge *edge = vyrtue_filter_find_edge(node, key[0]);
+
+        if (edge == NULL) {
+            struct vyrtue_filter_node *child = vyrtue_filter_node_create();
+            node->edges = perealloc(node->edges, sizeof(struct vyrtue_filter_edge) * (node->edges_count + 1), 1);
+            node->edges[node->edges_count++] = (struct vyrtue_filter_edge){
+                .label = pestrndup(key, key_len, 1),
+                .len = key_len,
+                .node = child,
+            };
+            node = child;
+            break;
+        }
+
+        size_t common = 0;
+        while (common < edge->len && common < key_len && edge->label[common] == key[common]) {
+            common++;
+        }
+
+        // split the edge where the pattern diverges from it
+        if (common < edge->len) {
+            struct vyrtue_filter_node *mid = vyrtue_filter_node_create();
+            mid->edges = pemalloc(sizeof(struct vyrtue_filter_edge), 1);
+            mid->edges[0] = (struct vyrtue_filter_edge){
+                .label = pestrndup(edge->label + common, edge->len - common, 1),
+                .len = edge->len - common,
+                .node = edge->node,
+            };
+            mid->edges_count = 1;
+            edge->len = common;
+            edge->node = mid;
+        }
+
+        node = edge->node;
+        key += common;
+        key_len -= common;
+    }
+
+    if (prefix_len == len) {
+        node->terminal = true;
+    } else {
+        node->globs = perealloc(node->globs, sizeof(char *) * (node->globs_count + 1), 1);
+        node->globs[node->globs_count++] = pestrndup(pattern, len, 1);
+    }
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_filter_match(const struct vyrtue_filter_node *node, zend_string *filename)
+{
+    const char *p = ZSTR_VAL(filename);
+    size_t len = ZSTR_LEN(filename);
+
+    for (;;) {
+        if (node->terminal) {
+            return true;
+        }
+
+        for (uint32_t i = 0; i < node->globs_count; i++) {
+            if (0 == fnmatch(node->globs[i], ZSTR_VAL(filename), 0)) {
+                return true;
+            }
+        }
+
+        if (len == 0) {
+            return false;
+        }
+
+        const struct vyrtue_filter_edge *edge = vyrtue_filter_find_edge(node, *p);
+        if (edge == NULL || edge->len > len || 0 != memcmp(edge->label, p, edge->len)) {
+            return false;
+        }
+
+        p += edge->len;
+        len -= edge->len;
+        node = edge->node;
+    }
+}
+
+/**
+ * Compiles a comma-separated list of patterns, returning NULL if it is empty.
+ */
+static struct vyrtue_filter_node *vyrtue_filter_compile(const char *value, size_t value_len)
+{
+    struct vyrtue_filter_node *root = NULL;
+    const char *p = value;
+    const char *limit = value + value_len;
+
+    while (p < limit) {
+        const char *end = memchr(p, ',', limit - p);
+        size_t len = end ? (size_t) (end - p) : (size_t) (limit - p);
+        const char *start = p;
+
+        while (len > 0 && (*start == ' ' || *start == '\t')) {
+            start++;
+            len--;
+        }
+        while (len > 0 && (start[len - 1] == ' ' || start[len - 1] == '\t')) {
+            len--;
+        }
+
+        if (len > 0) {
+            if (root == NULL) {
+                root = vyrtue_filter_node_create();
+            }
+            vyrtue_filter_insert(root, start, len);
+        }
+
+        p = end ? end + 1 : limit;
+    }
+
+    return root;
+}
+
+static void vyrtue_filter_compile_scopes(const char *value)
+{
+    const char *p = value;
+
+    while (p && *p) {
+        const char *end = strchr(p, ';');
+        size_t len = end ? (size_t) (end - p) : strlen(p);
+        const char *eq = memchr(p, '=', len);
+
+        if (eq == NULL) {
+            if (len > 0) {
+                zend_error(E_WARNING, "vyrtue: vyrtue.visitor_paths: expected \"visitor=patterns\", got \"%.*s\"", (int) len, p);
+            }
+        } else {
+            const char *name = p;
+            size_t name_len = eq - p;
+
+            while (name_len > 0 && (*name == ' ' || *name == '\t')) {
+                name++;
+                name_len--;
+            }
+            while (name_len > 0 && (name[name_len - 1] == ' ' || name[name_len - 1] == '\t')) {
+                name_len--;
+            }
+
+            // a visitor with no patterns never runs
+            struct vyrtue_filter_node *trie = vyrtue_filter_compile(eq + 1, len - (eq + 1 - p));
+            if (trie == NULL) {
+                trie = vyrtue_filter_node_create();
+            }
+
+            vyrtue_filter_scopes =
+                perealloc(vyrtue_filter_scopes, sizeof(struct vyrtue_filter_scope) * (vyrtue_filter_scopes_count + 1), 1);
+            vyrtue_filter_scopes[vyrtue_filter_scopes_count++] = (struct vyrtue_filter_scope){
+                .visitor = pestrndup(name, name_len, 1),
+                .slot = UINT32_MAX,
+                .trie = trie,
+            };
+        }
+
+        p = end ? end + 1 : NULL;
+    }
+}
+
+VYRTUE_LOCAL
+bool vyrtue_filter_file(zend_string *filename)
+{
+    if (EXPECTED(vyrtue_filter_include == NULL && vyrtue_filter_exclude == NULL)) {
+        return true;
+    }
+
+    if (filename == NULL) {
+        return vyrtue_filter_include == NULL;
+    }
+
+    if (vyrtue_filter_include != NULL && !vyrtue_filter_match(vyrtue_filter_include, filename)) {
+        return false;
+    }
+
+    return vyrtue_filter_exclude == NULL || !vyrtue_filter_match(vyrtue_filter_exclude, filename);
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(2, 3)
+uint64_t *vyrtue_filter_visitors(zend_string *filename, zend_arena **arena, uint32_t *count)
+{
+    uint64_t *skip = NULL;
+
+    *count = 0;
+
+    if (EXPECTED(vyrtue_filter_scopes_count == 0)) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < vyrtue_filter_scopes_count; i++) {
+        const struct vyrtue_filter_scope *scope = &vyrtue_filter_scopes[i];
+
+        if (filename != NULL && vyrtue_filter_match(scope->trie, filename)) {
+            continue;
+        }
+
+        // visitors are numbered by their stats slot, and may not be registered yet
+        if (scope->slot == UINT32_MAX) {
+            continue;
+        }
+
+        if (skip == NULL) {
+            *count = vyrtue_filter_slots_count;
+            skip = zend_arena_calloc(arena, (*count + 63) / 64, sizeof(uint64_t));
+        }
+
+        skip[scope->slot / 64] |= UINT64_C(1) << (scope->slot % 64);
+    }
+
+    return skip;
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_filter_register_visitor(const char *name, uint32_t slot)
+{
+    for (uint32_t i = 0; i < vyrtue_filter_scopes_count; i++) {
+        if (0 == strcmp(vyrtue_filter_scopes[i].visitor, name)) {
+            vyrtue_filter_scopes[i].slot = slot;
+            vyrtue_filter_slots_count = MAX(vyrtue_filter_slots_count, slot + 1);
+        }
+    }
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_filter)
+{
+    if (VYRTUE_G(include_paths)) {
+        vyrtue_filter_include = vyrtue_filter_compile(VYRTUE_G(include_paths), strlen(VYRTUE_G(include_paths)));
+    }
+
+    if (VYRTUE_G(exclude_paths)) {
+        vyrtue_filter_exclude = vyrtue_filter_compile(VYRTUE_G(exclude_paths), strlen(VYRTUE_G(exclude_paths)));
+    }
+
+    vyrtue_filter_compile_scopes(VYRTUE_G(visitor_paths));
+
+    return SUCCESS;
+}
+
+VYRTUE_LOCAL PHP_MSHUTDOWN_FUNCTION(vyrtue_filter)
+{
+    if (vyrtue_filter_include) {
+        vyrtue_filter_node_destroy(vyrtue_filter_include);
+        vyrtue_filter_include = NULL;
+    }
+
+    if (vyrtue_filter_exclude) {
+        vyrtue_filter_node_destroy(vyrtue_filter_exclude);
+        vyrtue_filter_exclude = NULL;
+    }
+
+    for (uint32_t i = 0; i < vyrtue_filter_scopes_count; i++) {
+        pefree(vyrtue_filter_scopes[i].visitor, 1);
+        vyrtue_filter_node_destroy(vyrtue_filter_scopes[i].trie);
+    }
+    if (vyrtue_filter_scopes) {
+        pefree(vyrtue_filter_scopes, 1);
+        vyrtue_filter_scopes = NULL;
+    }
+    vyrtue_filter_scopes_count = 0;
+    vyrtue_filter_slots_count = 0;
+
+    return SUCCESS;
+}
@@ -0,0 +1,56 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHP_VYRTUE_FILTER_H
+#define PHP_VYRTUE_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <Zend/zend_API.h>
+#include <Zend/zend_arena.h>
+#include "php_vyrtue.h"
+
+/**
+ * Whether a file should be processed at all, according to
+ * vyrtue.include_paths and vyrtue.exclude_paths.
+ */
+VYRTUE_LOCAL
+bool vyrtue_filter_file(zend_string *filename);
+
+/**
+ * Returns a bitset of stats slots, for the visitors whose vyrtue.visitor_paths
+ * scope does not cover filename, or NULL if every visitor runs on it. *count
+ * is set to the number of slots in the bitset.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(2, 3)
+uint64_t *vyrtue_filter_visitors(zend_string *filename, zend_arena **arena, uint32_t *count);
+
+/**
+ * Called for every newly registered stats slot, so that the scopes naming the
+ * visitor apply to it. Must run after MINIT of the filter.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_filter_register_visitor(const char *name, uint32_t slot);
+
+static zend_always_inline bool vyrtue_filter_skip_visitor(const uint64_t *skip, uint32_t count, uint32_t slot)
+{
+    return skip != NULL && slot < count && 0 != (skip[slot / 64] & (UINT64_C(1) << (slot % 64)));
+}
+
+#endif
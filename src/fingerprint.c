@@ -0,0 +1,152 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_extensions.h"
+#include "Zend/zend_smart_str.h"
+#include "Zend/zend_system_id.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "fingerprint.h"
+#include "private.h"
+#include "visitor.h"
+
+static uint64_t vyrtue_fingerprint_value = 0;
+
+static void vyrtue_fingerprint_visitors(smart_str *buf, HashTable *ht)
+{
+    const struct vyrtue_visitor_array *visitors;
+    zend_string *str_key;
+    zend_ulong num_key;
+
+    ZEND_HASH_FOREACH_KEY_PTR(ht, num_key, str_key, visitors)
+    {
+        if (str_key) {
+            smart_str_append(buf, str_key);
+        } else {
+            smart_str_append_unsigned(buf, num_key);
+        }
+        for (size_t i = 0; i < visitors->length; i++) {
+            smart_str_appendc(buf, '\0');
+            smart_str_appends(buf, visitors->data[i].name);
+            smart_str_append_unsigned(buf, visitors->data[i].flags);
+        }
+        smart_str_appendc(buf, '\n');
+    }
+    ZEND_HASH_FOREACH_END();
+}
+
+VYRTUE_LOCAL
+uint64_t vyrtue_fingerprint(void)
+{
+    const char *version;
+    zend_string *name;
+    smart_str buf = {0};
+
+    if (EXPECTED(vyrtue_fingerprint_value != 0)) {
+        return vyrtue_fingerprint_value;
+    }
+
+    smart_str_appends(&buf, PHP_VYRTUE_VERSION);
+    smart_str_append_printf(
+        &buf,
+        "\n%d %d %d\n%s\n%s\n%s\n%s\n%s\n",
+        VYRTUE_G(process),
+        VYRTUE_G(fold_functions),
+        VYRTUE_G(strip_debug),
+        VYRTUE_G(strip_constants) ? VYRTUE_G(strip_constants) : "",
+        VYRTUE_G(strip_functions) ? VYRTUE_G(strip_functions) : "",
+        VYRTUE_G(include_paths) ? VYRTUE_G(include_paths) : "",
+        VYRTUE_G(exclude_paths) ? VYRTUE_G(exclude_paths) : "",
+        VYRTUE_G(visitor_paths) ? VYRTUE_G(visitor_paths) : ""
+    );
+
+    vyrtue_fingerprint_visitors(&buf, &VYRTUE_G(kind_visitors));
+    vyrtue_fingerprint_visitors(&buf, &VYRTUE_G(function_visitors));
+    vyrtue_fingerprint_visitors(&buf, &VYRTUE_G(attribute_visitors));
+
+    ZEND_HASH_FOREACH_STR_KEY_PTR(&VYRTUE_G(visitor_versions), name, version)
+    {
+        smart_str_append(&buf, name);
+        smart_str_appendc(&buf, '=');
+        smart_str_appends(&buf, version);
+        smart_str_appendc(&buf, '\n');
+    }
+    ZEND_HASH_FOREACH_END();
+
+    smart_str_0(&buf);
+
+    // zero means not computed yet
+    vyrtue_fingerprint_value = zend_hash_func(ZSTR_VAL(buf.s), ZSTR_LEN(buf.s)) | 1;
+    smart_str_free(&buf);
+
+    return vyrtue_fingerprint_value;
+}
+
+/**
+ * Zend extensions start after every module's MINIT and before the system id
+ * is finalized, so this sees the visitors of extensions loaded after us.
+ */
+static int vyrtue_fingerprint_startup(zend_extension *extension)
+{
+    uint64_t fingerprint = vyrtue_fingerprint();
+
+    zend_add_system_entropy(PHP_VYRTUE_NAME, "visitors", &fingerprint, sizeof(fingerprint));
+
+    return SUCCESS;
+}
+
+// php -v formats the version, copyright and author without checking for NULL
+static zend_extension vyrtue_fingerprint_extension = {
+    .name = PHP_VYRTUE_NAME,
+    .version = PHP_VYRTUE_VERSION,
+    .author = PHP_VYRTUE_AUTHORS,
+    .URL = PHP_VYRTUE_URL,
+    .copyright = PHP_VYRTUE_COPYRIGHT,
+    .startup = vyrtue_fingerprint_startup,
+};
+
+VYRTUE_LOCAL
+PHP_MINIT_FUNCTION(vyrtue_fingerprint)
+{
+    // the system id is final by the time dl() runs
+    if (type == MODULE_PERSISTENT) {
+        zend_register_extension(&vyrtue_fingerprint_extension, NULL);
+    }
+
+    return SUCCESS;
+}
+
+VYRTUE_LOCAL
+PHP_FUNCTION(vyrtue_fingerprint)
+{
+    char buf[17];
+
+    ZEND_PARSE_PARAMETERS_NONE();
+
+    snprintf(buf, sizeof(buf), "%016" PRIx64, vyrtue_fingerprint());
+
+    RETURN_STRINGL(buf, 16);
+}
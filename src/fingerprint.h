@@ -0,0 +1,40 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHP_VYRTUE_FINGERPRINT_H
+#define PHP_VYRTUE_FINGERPRINT_H
+
+#include <stdint.h>
+#include "php_vyrtue.h"
+
+/*
+ * A hash of everything besides the source that decides what processing a file
+ * produces: the extension version, the registered visitors with their flags
+ * and declared versions, and the vyrtue settings that change their output.
+ *
+ * It is computed once, after every extension has registered its visitors at
+ * startup, and added to the engine's system id, which opcache uses to name
+ * and validate its shared memory and opcache.file_cache entries. Deploying a
+ * new visitor or changing a setting therefore starts with an empty cache
+ * rather than serving code transformed by the old ones. Userland visitors
+ * are registered per request and are not covered.
+ */
+
+VYRTUE_LOCAL
+uint64_t vyrtue_fingerprint(void);
+
+#endif
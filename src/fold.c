@@ -0,0 +1,234 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_exceptions.h"
+#include "Zend/zend_type_info.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "ast.h"
+#include "context.h"
+
+// Folded results are stored as literals in the op array (and opcache SHM)
+#define VYRTUE_FOLD_MAX_STRING_LEN 4096
+#define VYRTUE_FOLD_MAX_ARRAY_SIZE 256
+#define VYRTUE_FOLD_MAX_ARGS 2
+
+#define VYRTUE_FOLD_SCALAR (MAY_BE_NULL | MAY_BE_BOOL | MAY_BE_LONG | MAY_BE_STRING)
+
+typedef bool (*vyrtue_fold_check_fn)(zval *args, uint32_t argc);
+
+/**
+ * Arguments must match arg_types exactly so that no coercion (and therefore
+ * no deprecation or warning) can happen at compile time. Array arguments must
+ * be flat and their values must match elem_types. Doubles are never accepted
+ * since their string conversion depends on INI settings.
+ */
+struct vyrtue_fold_function
+{
+    const char *name;
+    uint32_t min_args;
+    uint32_t max_args;
+    uint32_t arg_types[VYRTUE_FOLD_MAX_ARGS];
+    uint32_t elem_types;
+    vyrtue_fold_check_fn check;
+};
+
+static bool vyrtue_fold_check_str_repeat(zval *args, uint32_t argc)
+{
+    // don't let the call itself allocate an unbounded string
+    return Z_LVAL(args[1]) >= 0 && (Z_LVAL(args[1]) == 0 || Z_STRLEN(args[0]) <= VYRTUE_FOLD_MAX_STRING_LEN / (size_t) Z_LVAL(args[1]));
+}
+
+// clang-format off
+static const struct vyrtue_fold_function VYRTUE_FOLD_FUNCTIONS[] = {
+    {"strlen",        1, 1, {MAY_BE_STRING}},
+    {"str_repeat",    2, 2, {MAY_BE_STRING, MAY_BE_LONG}, 0, vyrtue_fold_check_str_repeat},
+    {"strrev",        1, 1, {MAY_BE_STRING}},
+    {"trim",          1, 1, {MAY_BE_STRING}},
+    {"ltrim",         1, 1, {MAY_BE_STRING}},
+    {"rtrim",         1, 1, {MAY_BE_STRING}},
+    {"bin2hex",       1, 1, {MAY_BE_STRING}},
+    {"base64_encode", 1, 1, {MAY_BE_STRING}},
+    {"md5",           1, 1, {MAY_BE_STRING}},
+    {"sha1",          1, 1, {MAY_BE_STRING}},
+    {"crc32",         1, 1, {MAY_BE_STRING}},
+#if PHP_VERSION_ID >= 80200
+    // locale-sensitive before PHP 8.2
+    {"strtolower",    1, 1, {MAY_BE_STRING}},
+    {"strtoupper",    1, 1, {MAY_BE_STRING}},
+    {"ucfirst",       1, 1, {MAY_BE_STRING}},
+    {"lcfirst",       1, 1, {MAY_BE_STRING}},
+#endif
+    {"explode",       2, 2, {MAY_BE_STRING, MAY_BE_STRING}},
+    {"implode",       2, 2, {MAY_BE_STRING, MAY_BE_ARRAY}, VYRTUE_FOLD_SCALAR},
+    {"join",          2, 2, {MAY_BE_STRING, MAY_BE_ARRAY}, VYRTUE_FOLD_SCALAR},
+    {"count",         1, 1, {MAY_BE_ARRAY}, VYRTUE_FOLD_SCALAR},
+    {"sizeof",        1, 1, {MAY_BE_ARRAY}, VYRTUE_FOLD_SCALAR},
+    {"array_flip",    1, 1, {MAY_BE_ARRAY}, MAY_BE_LONG | MAY_BE_STRING},
+    {"array_keys",    1, 1, {MAY_BE_ARRAY}, VYRTUE_FOLD_SCALAR},
+    {"array_values",  1, 1, {MAY_BE_ARRAY}, VYRTUE_FOLD_SCALAR},
+    // note: a folded json_encode() does not reset json_last_error()
+    {"json_encode",   1, 2, {VYRTUE_FOLD_SCALAR | MAY_BE_ARRAY, MAY_BE_LONG}, VYRTUE_FOLD_SCALAR},
+};
+// clang-format on
+
+VYRTUE_ATTR_NONNULL_ALL
+static const struct vyrtue_fold_function *vyrtue_fold_find_function(zend_string *name)
+{
+    for (size_t i = 0; i < sizeof(VYRTUE_FOLD_FUNCTIONS) / sizeof(VYRTUE_FOLD_FUNCTIONS[0]); i++) {
+        const char *fn_name = VYRTUE_FOLD_FUNCTIONS[i].name;
+        if (ZSTR_LEN(name) == strlen(fn_name) && 0 == memcmp(ZSTR_VAL(name), fn_name, ZSTR_LEN(name))) {
+            return &VYRTUE_FOLD_FUNCTIONS[i];
+        }
+    }
+
+    return NULL;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_fold_array_matches(zval *arr, uint32_t elem_types)
+{
+    zval *val;
+
+    if (zend_hash_num_elements(Z_ARRVAL_P(arr)) > VYRTUE_FOLD_MAX_ARRAY_SIZE) {
+        return false;
+    }
+
+    ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(arr), val)
+    {
+        if (!((1u << Z_TYPE_P(val)) & elem_types)) {
+            return false;
+        }
+    }
+    ZEND_HASH_FOREACH_END();
+
+    return true;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_fold_result_ok(zval *result)
+{
+    switch (Z_TYPE_P(result)) {
+        case IS_NULL:
+        case IS_FALSE:
+        case IS_TRUE:
+        case IS_LONG:
+            return true;
+        case IS_STRING:
+            return Z_STRLEN_P(result) <= VYRTUE_FOLD_MAX_STRING_LEN;
+        case IS_ARRAY:
+            return vyrtue_fold_array_matches(result, VYRTUE_FOLD_SCALAR);
+        default:
+            return false;
+    }
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_fold_call_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zval args[VYRTUE_FOLD_MAX_ARGS];
+    zval retval;
+    uint32_t argc = 0;
+    uint32_t i;
+    zend_ast *replace = NULL;
+
+    zend_ast_list *args_list = vyrtue_ast_get_call_args(ast);
+    if (NULL == args_list) {
+        return NULL;
+    }
+
+    zend_string *name = vyrtue_ast_get_call_name(ast, ctx);
+    if (NULL == name) {
+        return NULL;
+    }
+
+    const struct vyrtue_fold_function *spec = vyrtue_fold_find_function(name);
+    zend_string_release(name);
+    if (NULL == spec || args_list->children < spec->min_args || args_list->children > spec->max_args) {
+        return NULL;
+    }
+
+    for (i = 0; i < args_list->children; i++) {
+        if (!vyrtue_ast_eval_const(args_list->child[i], &args[argc])) {
+            goto done;
+        }
+        argc++;
+
+        if (!((1u << Z_TYPE(args[i])) & spec->arg_types[i])) {
+            goto done;
+        }
+
+        if (Z_TYPE(args[i]) == IS_ARRAY && !vyrtue_fold_array_matches(&args[i], spec->elem_types)) {
+            goto done;
+        }
+    }
+
+    if (spec->check && !spec->check(args, argc)) {
+        goto done;
+    }
+
+    zend_function *fn = zend_hash_str_find_ptr(CG(function_table), spec->name, strlen(spec->name));
+    if (NULL == fn || fn->type != ZEND_INTERNAL_FUNCTION || EG(exception)) {
+        goto done;
+    }
+
+    ZVAL_UNDEF(&retval);
+    zend_call_known_function(fn, NULL, NULL, &retval, argc, args, NULL);
+
+    if (UNEXPECTED(EG(exception))) {
+        // leave it to throw at runtime
+        zend_clear_exception();
+    } else if (vyrtue_fold_result_ok(&retval)) {
+        replace = zend_ast_create_zval_with_lineno(&retval, zend_ast_get_lineno(ast));
+        ZVAL_UNDEF(&retval);
+    }
+
+    zval_ptr_dtor(&retval);
+
+done:
+    for (i = 0; i < argc; i++) {
+        zval_ptr_dtor(&args[i]);
+    }
+
+    return replace;
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_fold)
+{
+    zend_string *tmp;
+
+    if (!VYRTUE_G(fold_functions)) {
+        return SUCCESS;
+    }
+
+    for (size_t i = 0; i < sizeof(VYRTUE_FOLD_FUNCTIONS) / sizeof(VYRTUE_FOLD_FUNCTIONS[0]); i++) {
+        tmp = zend_string_init_interned(VYRTUE_FOLD_FUNCTIONS[i].name, strlen(VYRTUE_FOLD_FUNCTIONS[i].name), 1);
+        vyrtue_register_function_visitor_ex("vyrtue internal fold", tmp, NULL, vyrtue_fold_call_leave, VYRTUE_VISITOR_OPTIONAL);
+        zend_string_release(tmp);
+    }
+
+    return SUCCESS;
+}
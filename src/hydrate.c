@@ -0,0 +1,330 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_compile.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "ast.h"
+#include "context.h"
+
+#define VYRTUE_HYDRATE_DATA_VAR "data"
+#define VYRTUE_HYDRATE_OBJECT_VAR "object"
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_hydrate_has_method(zend_ast_list *stmts, const char *name, size_t name_len)
+{
+    for (uint32_t i = 0; i < stmts->children; i++) {
+        zend_ast_decl *method = (zend_ast_decl *) stmts->child[i];
+        if (method != NULL && method->kind == ZEND_AST_METHOD &&
+            0 == zend_binary_strcasecmp(ZSTR_VAL(method->name), ZSTR_LEN(method->name), name, name_len)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast_decl *vyrtue_hydrate_find_constructor(zend_ast_list *stmts)
+{
+    for (uint32_t i = 0; i < stmts->children; i++) {
+        zend_ast_decl *method = (zend_ast_decl *) stmts->child[i];
+        if (method != NULL && method->kind == ZEND_AST_METHOD && zend_string_equals_literal_ci(method->name, "__construct")) {
+            return method;
+        }
+    }
+
+    return NULL;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_hydrate_create_var(const char *name, size_t name_len)
+{
+    return zend_ast_create(ZEND_AST_VAR, zend_ast_create_zval_from_str(zend_string_init(name, name_len, 0)));
+}
+
+/**
+ * $data['name']
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_hydrate_create_fetch(zend_string *name)
+{
+    return zend_ast_create(
+        ZEND_AST_DIM, vyrtue_hydrate_create_var(ZEND_STRL(VYRTUE_HYDRATE_DATA_VAR)), zend_ast_create_zval_from_str(zend_string_copy(name))
+    );
+}
+
+/**
+ * \array_key_exists('name', $data)
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_hydrate_create_exists(zend_string *name)
+{
+    return vyrtue_ast_create_call(
+        ZEND_STRL("array_key_exists"),
+        zend_ast_create_list(
+            2, ZEND_AST_ARG_LIST, zend_ast_create_zval_from_str(zend_string_copy(name)), vyrtue_hydrate_create_var(ZEND_STRL(VYRTUE_HYDRATE_DATA_VAR))
+        )
+    );
+}
+
+/**
+ * Returns the cast matching a scalar declared type, or IS_UNDEF if the value
+ * is passed on as-is.
+ */
+static uint32_t vyrtue_hydrate_get_cast_type(zend_ast *type_ast)
+{
+    if (type_ast == NULL || type_ast->kind != ZEND_AST_ZVAL || (type_ast->attr & ~ZEND_TYPE_NULLABLE) != ZEND_NAME_NOT_FQ) {
+        return IS_UNDEF;
+    }
+
+    zend_string *name = zend_ast_get_str(type_ast);
+
+    if (zend_string_equals_literal_ci(name, "int")) {
+        return IS_LONG;
+    } else if (zend_string_equals_literal_ci(name, "float")) {
+        return IS_DOUBLE;
+    } else if (zend_string_equals_literal_ci(name, "string")) {
+        return IS_STRING;
+    } else if (zend_string_equals_literal_ci(name, "bool")) {
+        return _IS_BOOL;
+    }
+
+    return IS_UNDEF;
+}
+
+/**
+ * (int) $data['name'], or null === $data['name'] ? null : (int) $data['name']
+ * for nullable types.
+ */
+VYRTUE_ATTR_NONNULL(2)
+static zend_ast *vyrtue_hydrate_create_value(zend_ast *type_ast, zend_string *name, bool nullable)
+{
+    uint32_t cast_type = vyrtue_hydrate_get_cast_type(type_ast);
+    zval tmp;
+
+    if (cast_type == IS_UNDEF) {
+        return vyrtue_hydrate_create_fetch(name);
+    }
+
+    zend_ast *cast = zend_ast_create_cast(cast_type, vyrtue_hydrate_create_fetch(name));
+
+    if (!nullable && !(type_ast->attr & ZEND_TYPE_NULLABLE)) {
+        return cast;
+    }
+
+    ZVAL_NULL(&tmp);
+    zend_ast *is_null = zend_ast_create_binary_op(ZEND_IS_IDENTICAL, zend_ast_create_zval(&tmp), vyrtue_hydrate_create_fetch(name));
+    ZVAL_NULL(&tmp);
+    return zend_ast_create(ZEND_AST_CONDITIONAL, is_null, zend_ast_create_zval(&tmp), cast);
+}
+
+/**
+ * A default of null makes a parameter implicitly nullable.
+ */
+static bool vyrtue_hydrate_is_null_default(zend_ast *default_ast)
+{
+    return default_ast != NULL && default_ast->kind == ZEND_AST_CONST &&
+        zend_string_equals_literal_ci(zend_ast_get_str(default_ast->child[0]), "null");
+}
+
+/**
+ * Builds `new self(...)`, taking each constructor argument from the array,
+ * falling back to the parameter's default when the key is missing.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_hydrate_create_new(zend_ast_decl *ctor)
+{
+    zend_ast *args = zend_ast_create_list(0, ZEND_AST_ARG_LIST);
+    zend_ast *self_ast = zend_ast_create_zval_from_str(zend_string_init(ZEND_STRL("self"), 0));
+    self_ast->attr = ZEND_NAME_NOT_FQ;
+
+    if (ctor) {
+        zend_ast_list *params = zend_ast_get_list(ctor->child[0]);
+
+        for (uint32_t i = 0; i < params->children; i++) {
+            zend_ast *param = params->child[i];
+            zend_string *name = zend_ast_get_str(param->child[1]);
+            zend_ast *default_ast = param->child[2] ? vyrtue_ast_dup(param->child[2]) : NULL;
+            zend_ast *value;
+
+            if (param->attr & ZEND_PARAM_VARIADIC) {
+                break;
+            }
+
+            value = vyrtue_hydrate_create_value(param->child[0], name, vyrtue_hydrate_is_null_default(param->child[2]));
+
+            if (default_ast) {
+                value = zend_ast_create(ZEND_AST_CONDITIONAL, vyrtue_hydrate_create_exists(name), value, default_ast);
+            }
+
+            args = zend_ast_list_add(args, value);
+        }
+    }
+
+    return zend_ast_create(ZEND_AST_NEW, self_ast, args);
+}
+
+/**
+ * Appends to classes marked #[VyrtueExt\Hydratable]
+ *
+ *     public static function fromArray(array $data) {
+ *         $object = new self(\array_key_exists('a', $data) ? (int) $data['a'] : 1);
+ *         if (\array_key_exists('b', $data)) {
+ *             $object->b = (string) $data['b'];
+ *         }
+ *         return $object;
+ *     }
+ *
+ *     public function toArray() {
+ *         return ['a' => $this->a, 'b' => $this->b];
+ *     }
+ *
+ * covering promoted constructor parameters and declared instance properties.
+ * Scalar declared types are cast, anything else is assigned as-is.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_hydrate_class_enter(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_decl *decl = (zend_ast_decl *) ast;
+    zend_ast_list *stmts;
+    zend_ast_decl *ctor;
+    uint32_t i;
+    uint32_t j;
+
+    if (decl->kind != ZEND_AST_CLASS || decl->child[2] == NULL ||
+        (decl->flags & (ZEND_ACC_INTERFACE | ZEND_ACC_TRAIT | ZEND_ACC_ENUM | ZEND_ACC_EXPLICIT_ABSTRACT_CLASS))) {
+        zend_error(E_COMPILE_WARNING, "vyrtue: #[VyrtueExt\\Hydratable] is only supported on concrete classes");
+        return NULL;
+    }
+
+    stmts = zend_ast_get_list(decl->child[2]);
+    ctor = vyrtue_hydrate_find_constructor(stmts);
+
+    bool generate_from = !vyrtue_hydrate_has_method(stmts, ZEND_STRL("fromArray"));
+    bool generate_to = !vyrtue_hydrate_has_method(stmts, ZEND_STRL("toArray"));
+
+    zend_ast *from_stmts = zend_ast_create_list(
+        1, ZEND_AST_STMT_LIST, zend_ast_create(ZEND_AST_ASSIGN, vyrtue_hydrate_create_var(ZEND_STRL(VYRTUE_HYDRATE_OBJECT_VAR)), vyrtue_hydrate_create_new(ctor))
+    );
+    zend_ast *to_array = zend_ast_create_list(0, ZEND_AST_ARRAY);
+    to_array->attr = ZEND_ARRAY_SYNTAX_SHORT;
+
+    // promoted constructor parameters are already set by new self(...)
+    if (ctor) {
+        zend_ast_list *params = zend_ast_get_list(ctor->child[0]);
+        for (i = 0; i < params->children; i++) {
+            zend_ast *param = params->child[i];
+            if (param->attr & ZEND_ACC_PPP_MASK) {
+                zend_string *name = zend_ast_get_str(param->child[1]);
+                zend_ast *prop = zend_ast_create(
+                    ZEND_AST_PROP, vyrtue_hydrate_create_var(ZEND_STRL("this")), zend_ast_create_zval_from_str(zend_string_copy(name))
+                );
+                to_array = zend_ast_list_add(to_array, zend_ast_create(ZEND_AST_ARRAY_ELEM, prop, zend_ast_create_zval_from_str(zend_string_copy(name))));
+            }
+        }
+    }
+
+    for (i = 0; i < stmts->children; i++) {
+        zend_ast *group = stmts->child[i];
+
+        if (group == NULL || group->kind != ZEND_AST_PROP_GROUP || (group->attr & ZEND_ACC_STATIC)) {
+            continue;
+        }
+
+        zend_ast *type_ast = group->child[0];
+        zend_ast_list *props = zend_ast_get_list(group->child[1]);
+
+        for (j = 0; j < props->children; j++) {
+            zend_ast *elem = props->child[j];
+            zend_string *name = zend_ast_get_str(elem->child[0]);
+
+            // if (\array_key_exists('name', $data)) { $object->name = (int) $data['name']; }
+            zend_ast *assign = zend_ast_create(
+                ZEND_AST_ASSIGN,
+                zend_ast_create(
+                    ZEND_AST_PROP, vyrtue_hydrate_create_var(ZEND_STRL(VYRTUE_HYDRATE_OBJECT_VAR)), zend_ast_create_zval_from_str(zend_string_copy(name))
+                ),
+                vyrtue_hydrate_create_value(type_ast, name, false)
+            );
+            zend_ast *if_stmt = zend_ast_create_list(
+                1,
+                ZEND_AST_IF,
+                zend_ast_create(ZEND_AST_IF_ELEM, vyrtue_hydrate_create_exists(name), zend_ast_create_list(1, ZEND_AST_STMT_LIST, assign))
+            );
+            from_stmts = zend_ast_list_add(from_stmts, if_stmt);
+
+            zend_ast *prop = zend_ast_create(
+                ZEND_AST_PROP, vyrtue_hydrate_create_var(ZEND_STRL("this")), zend_ast_create_zval_from_str(zend_string_copy(name))
+            );
+            to_array = zend_ast_list_add(to_array, zend_ast_create(ZEND_AST_ARRAY_ELEM, prop, zend_ast_create_zval_from_str(zend_string_copy(name))));
+        }
+    }
+
+    from_stmts = zend_ast_list_add(from_stmts, zend_ast_create(ZEND_AST_RETURN, vyrtue_hydrate_create_var(ZEND_STRL(VYRTUE_HYDRATE_OBJECT_VAR))));
+
+    if (generate_from) {
+        zend_ast *params = zend_ast_create_list(
+            1,
+            ZEND_AST_PARAM_LIST,
+            vyrtue_ast_create_param(zend_ast_create_ex(ZEND_AST_TYPE, IS_ARRAY), ZEND_STRL(VYRTUE_HYDRATE_DATA_VAR))
+        );
+        decl->child[2] = zend_ast_list_add(
+            decl->child[2], vyrtue_ast_create_method(ZEND_ACC_PUBLIC | ZEND_ACC_STATIC, ZEND_STRL("fromArray"), params, from_stmts, NULL)
+        );
+    } else {
+        zend_ast_destroy(from_stmts);
+    }
+
+    if (generate_to) {
+        zend_ast *return_type = zend_ast_create_ex(ZEND_AST_TYPE, IS_ARRAY);
+        decl->child[2] = zend_ast_list_add(
+            decl->child[2],
+            vyrtue_ast_create_method(
+                ZEND_ACC_PUBLIC,
+                ZEND_STRL("toArray"),
+                zend_ast_create_list(0, ZEND_AST_PARAM_LIST),
+                zend_ast_create_list(1, ZEND_AST_STMT_LIST, zend_ast_create(ZEND_AST_RETURN, to_array)),
+                return_type
+            )
+        );
+    } else {
+        zend_ast_destroy(to_array);
+    }
+
+    return NULL;
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_hydrate)
+{
+    zend_string *tmp;
+
+    tmp = zend_string_init_interned(ZEND_STRL("VyrtueExt\\Hydratable"), 1);
+    vyrtue_register_attribute_visitor("vyrtue internal hydrate", tmp, vyrtue_hydrate_class_enter, NULL);
+    zend_string_release(tmp);
+
+    return SUCCESS;
+}
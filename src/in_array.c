@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "ast.h"
+#include "context.h"
+
+/**
+ * zend_compile already lowers resolvable in_array() calls with a literal
+ * array haystack and a literal strict flag into ZEND_IN_ARRAY, which is a
+ * hash lookup (see zend_compile_func_in_array). It only recognizes
+ * ZEND_AST_ARRAY haystacks though, so a haystack that was turned into a
+ * constant ZEND_AST_ZVAL by another visitor (e.g. a folded explode()) would
+ * fall back to a linear scan. Turn those back into array literals.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_in_array_call_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_list *args = vyrtue_ast_get_call_args(ast);
+    if (NULL == args || args->children < 2 || args->children > 3) {
+        return NULL;
+    }
+
+    zend_ast *haystack_ast = args->child[1];
+    if (haystack_ast->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(haystack_ast)) != IS_ARRAY) {
+        return NULL;
+    }
+
+    args->child[1] = vyrtue_ast_create_array_from_zval(zend_ast_get_zval(haystack_ast));
+    zend_ast_destroy(haystack_ast);
+
+    return NULL;
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_in_array)
+{
+    zend_string *tmp;
+
+    tmp = zend_string_init_interned(ZEND_STRL("in_array"), 1);
+    vyrtue_register_function_visitor_ex("vyrtue internal in_array", tmp, NULL, vyrtue_in_array_call_leave, VYRTUE_VISITOR_OPTIONAL);
+    zend_string_release(tmp);
+
+    return SUCCESS;
+}
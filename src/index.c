@@ -0,0 +1,467 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_compile.h"
+#include "Zend/zend_smart_str.h"
+#include "main/php.h"
+#include "ext/standard/php_var.h"
+
+#include "php_vyrtue.h"
+#include "ast.h"
+#include "compile.h"
+#include "context.h"
+#include "shm.h"
+
+/*
+ * Every attribute of a named class, its members, or a function is recorded in
+ * shared memory as the strings below, so that VyrtueExt\attribute_index() can
+ * find them without loading the declaring classes.
+ */
+enum
+{
+    VYRTUE_INDEX_ATTRIBUTE = 0,
+    VYRTUE_INDEX_CLASS,
+    VYRTUE_INDEX_MEMBER,
+    VYRTUE_INDEX_TARGET,
+    VYRTUE_INDEX_ARGUMENTS,
+    VYRTUE_INDEX_COUNT,
+};
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_string *vyrtue_index_qualify(zend_string *name, struct vyrtue_context *ctx)
+{
+    if (ctx->current_namespace == NULL) {
+        return zend_string_copy(name);
+    }
+
+    return zend_string_concat3(
+        ZSTR_VAL(ctx->current_namespace), ZSTR_LEN(ctx->current_namespace), "\\", 1, ZSTR_VAL(name), ZSTR_LEN(name)
+    );
+}
+
+/**
+ * Evaluates a single attribute argument, also resolving `Foo::class`.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_index_eval_arg(zend_ast *arg, zval *result, struct vyrtue_context *ctx)
+{
+    if (arg->kind == ZEND_AST_CLASS_NAME && arg->child[0]->kind == ZEND_AST_ZVAL) {
+        zend_string *name = zend_ast_get_str(arg->child[0]);
+        if (zend_string_equals_literal_ci(name, "self") || zend_string_equals_literal_ci(name, "static") ||
+            zend_string_equals_literal_ci(name, "parent")) {
+            return false;
+        }
+
+        zend_string *resolved = vyrtue_resolve_class_name_ast(arg->child[0], ctx);
+        if (resolved == NULL) {
+            return false;
+        }
+
+        ZVAL_STR(result, resolved);
+        return true;
+    }
+
+    return vyrtue_ast_eval_const(arg, result);
+}
+
+/**
+ * Serializes the arguments of an attribute, or returns NULL if any of them is
+ * not a compile-time literal.
+ */
+VYRTUE_ATTR_NONNULL(2)
+static zend_string *vyrtue_index_serialize_args(zend_ast *args_ast, struct vyrtue_context *ctx)
+{
+    php_serialize_data_t var_hash;
+    smart_str buf = {0};
+    zval args;
+    zval tmp;
+
+    array_init(&args);
+
+    if (args_ast != NULL) {
+        zend_ast_list *list = zend_ast_get_list(args_ast);
+
+        for (uint32_t i = 0; i < list->children; i++) {
+            zend_ast *arg = list->child[i];
+            zend_string *name = NULL;
+
+            if (arg->kind == ZEND_AST_NAMED_ARG) {
+                name = zend_ast_get_str(arg->child[0]);
+                arg = arg->child[1];
+            }
+
+            if (!vyrtue_index_eval_arg(arg, &tmp, ctx)) {
+                zval_ptr_dtor(&args);
+                return NULL;
+            }
+
+            if (name != NULL) {
+                zend_hash_update(Z_ARRVAL(args), name, &tmp);
+            } else {
+                zend_hash_next_index_insert(Z_ARRVAL(args), &tmp);
+            }
+        }
+    }
+
+    PHP_VAR_SERIALIZE_INIT(var_hash);
+    php_var_serialize(&buf, &args, &var_hash);
+    PHP_VAR_SERIALIZE_DESTROY(var_hash);
+
+    zval_ptr_dtor(&args);
+
+    return smart_str_extract(&buf);
+}
+
+VYRTUE_ATTR_NONNULL(4, 5)
+static void vyrtue_index_add_attributes(
+    zend_ast *attr_list, zend_string *class_name, zend_string *member, const char *target, struct vyrtue_context *ctx
+)
+{
+    zend_ast_list *list;
+
+    if (attr_list == NULL) {
+        return;
+    }
+
+    list = zend_ast_get_list(attr_list);
+
+    for (uint32_t g = 0; g < list->children; g++) {
+        zend_ast_list *group = zend_ast_get_list(list->child[g]);
+
+        for (uint32_t i = 0; i < group->children; i++) {
+            zend_ast *el = group->child[i];
+            zend_string *attr_name = vyrtue_resolve_class_name_ast(el->child[0], ctx);
+            if (attr_name == NULL) {
+                continue;
+            }
+
+            zend_string *args = vyrtue_index_serialize_args(el->child[1], ctx);
+
+            struct vyrtue_shm_string argv[VYRTUE_INDEX_COUNT] = {
+                [VYRTUE_INDEX_ATTRIBUTE] = {ZSTR_VAL(attr_name), ZSTR_LEN(attr_name)},
+                [VYRTUE_INDEX_CLASS] = {class_name ? ZSTR_VAL(class_name) : "", class_name ? ZSTR_LEN(class_name) : 0},
+                [VYRTUE_INDEX_MEMBER] = {member ? ZSTR_VAL(member) : "", member ? ZSTR_LEN(member) : 0},
+                [VYRTUE_INDEX_TARGET] = {target, strlen(target)},
+                [VYRTUE_INDEX_ARGUMENTS] = {args ? ZSTR_VAL(args) : "", args ? ZSTR_LEN(args) : 0},
+            };
+
+            vyrtue_shm_batch_add(&ctx->shm_batch, VYRTUE_SHM_RECORD_ATTRIBUTE, VYRTUE_INDEX_COUNT, argv);
+
+            if (args) {
+                zend_string_release(args);
+            }
+            zend_string_release(attr_name);
+        }
+    }
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static void vyrtue_index_add_members(zend_ast_list *stmts, zend_string *class_name, struct vyrtue_context *ctx)
+{
+    for (uint32_t i = 0; i < stmts->children; i++) {
+        zend_ast *stmt = stmts->child[i];
+        zend_ast_list *elems;
+
+        if (stmt == NULL) {
+            continue;
+        }
+
+        switch (stmt->kind) {
+            case ZEND_AST_METHOD: {
+                zend_ast_decl *method = (zend_ast_decl *) stmt;
+                vyrtue_index_add_attributes(method->child[4], class_name, method->name, "method", ctx);
+
+                // promoted constructor parameters are properties too
+                if (method->child[0] && zend_string_equals_literal_ci(method->name, "__construct")) {
+                    zend_ast_list *params = zend_ast_get_list(method->child[0]);
+                    for (uint32_t j = 0; j < params->children; j++) {
+                        zend_ast *param = params->child[j];
+                        if (param->attr & (ZEND_ACC_PPP_MASK | ZEND_ACC_READONLY)) {
+                            vyrtue_index_add_attributes(param->child[3], class_name, zend_ast_get_str(param->child[1]), "property", ctx);
+                        }
+                    }
+                }
+                break;
+            }
+
+            case ZEND_AST_PROP_GROUP:
+                elems = zend_ast_get_list(stmt->child[1]);
+                for (uint32_t j = 0; j < elems->children; j++) {
+                    zend_string *name = zend_ast_get_str(elems->child[j]->child[0]);
+                    vyrtue_index_add_attributes(stmt->child[2], class_name, name, "property", ctx);
+                }
+                break;
+
+            case ZEND_AST_CLASS_CONST_GROUP:
+                elems = zend_ast_get_list(stmt->child[0]);
+                for (uint32_t j = 0; j < elems->children; j++) {
+                    zend_string *name = zend_ast_get_str(elems->child[j]->child[0]);
+                    vyrtue_index_add_attributes(stmt->child[1], class_name, name, "constant", ctx);
+                }
+                break;
+
+            case ZEND_AST_ENUM_CASE:
+                vyrtue_index_add_attributes(stmt->child[3], class_name, zend_ast_get_str(stmt->child[0]), "case", ctx);
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_index_class_enter(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_decl *decl = (zend_ast_decl *) ast;
+
+    if (!vyrtue_shm_is_enabled() || decl->name == NULL || (decl->flags & ZEND_ACC_ANON_CLASS)) {
+        return NULL;
+    }
+
+    zend_string *class_name = vyrtue_index_qualify(decl->name, ctx);
+
+    vyrtue_index_add_attributes(decl->child[3], class_name, NULL, "class", ctx);
+    if (decl->child[2]) {
+        vyrtue_index_add_members(zend_ast_get_list(decl->child[2]), class_name, ctx);
+    }
+
+    zend_string_release(class_name);
+
+    return NULL;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_index_function_enter(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_decl *decl = (zend_ast_decl *) ast;
+
+    if (!vyrtue_shm_is_enabled() || decl->child[4] == NULL) {
+        return NULL;
+    }
+
+    zend_string *function_name = vyrtue_index_qualify(decl->name, ctx);
+    vyrtue_index_add_attributes(decl->child[4], NULL, function_name, "function", ctx);
+    zend_string_release(function_name);
+
+    return NULL;
+}
+
+/**
+ * A record as kept in the per-process index. Strings are persistent, and
+ * NULL where the record had an empty string.
+ */
+struct vyrtue_index_entry
+{
+    zend_string *attribute;
+    zend_string *class_name;
+    zend_string *member;
+    zend_string *target;
+    zend_string *file;
+    zend_string *arguments;
+};
+
+static zend_string *vyrtue_index_string(const char *val, size_t len)
+{
+    return len > 0 ? zend_string_init(val, len, 1) : NULL;
+}
+
+static void vyrtue_index_release(zend_string *str)
+{
+    if (str != NULL) {
+        zend_string_release_ex(str, 1);
+    }
+}
+
+static void vyrtue_index_entry_dtor(zval *zv)
+{
+    struct vyrtue_index_entry *entry = Z_PTR_P(zv);
+
+    vyrtue_index_release(entry->attribute);
+    vyrtue_index_release(entry->class_name);
+    vyrtue_index_release(entry->member);
+    vyrtue_index_release(entry->target);
+    vyrtue_index_release(entry->file);
+    vyrtue_index_release(entry->arguments);
+    pefree(entry, 1);
+}
+
+static void vyrtue_index_list_dtor(zval *zv)
+{
+    HashTable *list = Z_PTR_P(zv);
+
+    zend_hash_destroy(list);
+    pefree(list, 1);
+}
+
+/**
+ * Adds a record to the per-process index, grouped by lowercased attribute.
+ * Arguments are kept serialized and only unserialized for the records a
+ * query returns.
+ */
+static void vyrtue_index_cache_record(void *arg, const struct vyrtue_shm_string *filename, uint32_t argc, const struct vyrtue_shm_string *argv)
+{
+    HashTable *cache = arg;
+    struct vyrtue_index_entry *entry;
+    HashTable *list;
+
+    if (argc != VYRTUE_INDEX_COUNT) {
+        return;
+    }
+
+    char *lc_name = zend_str_tolower_dup(argv[VYRTUE_INDEX_ATTRIBUTE].val, argv[VYRTUE_INDEX_ATTRIBUTE].len);
+    list = zend_hash_str_find_ptr(cache, lc_name, argv[VYRTUE_INDEX_ATTRIBUTE].len);
+    if (list == NULL) {
+        list = pemalloc(sizeof(HashTable), 1);
+        zend_hash_init(list, 8, NULL, vyrtue_index_entry_dtor, 1);
+        zend_hash_str_add_new_ptr(cache, lc_name, argv[VYRTUE_INDEX_ATTRIBUTE].len, list);
+    }
+    efree(lc_name);
+
+    entry = pemalloc(sizeof(*entry), 1);
+    entry->attribute = zend_string_init(argv[VYRTUE_INDEX_ATTRIBUTE].val, argv[VYRTUE_INDEX_ATTRIBUTE].len, 1);
+    entry->class_name = vyrtue_index_string(argv[VYRTUE_INDEX_CLASS].val, argv[VYRTUE_INDEX_CLASS].len);
+    entry->member = vyrtue_index_string(argv[VYRTUE_INDEX_MEMBER].val, argv[VYRTUE_INDEX_MEMBER].len);
+    entry->target = zend_string_init(argv[VYRTUE_INDEX_TARGET].val, argv[VYRTUE_INDEX_TARGET].len, 1);
+    entry->file = zend_string_init(filename->val, filename->len, 1);
+    entry->arguments = vyrtue_index_string(argv[VYRTUE_INDEX_ARGUMENTS].val, argv[VYRTUE_INDEX_ARGUMENTS].len);
+
+    zend_hash_next_index_insert_ptr(list, entry);
+}
+
+/**
+ * The index lives as long as the process and is rebuilt with a single scan
+ * of the shared memory only when a file was (re)compiled by any process
+ * since it was last built, like the class map of src/autoload.c.
+ */
+static HashTable *vyrtue_index_get_cache(void)
+{
+    HashTable *cache = VYRTUE_G(attribute_index);
+    uint64_t generation = vyrtue_shm_generation();
+
+    if (cache != NULL && VYRTUE_G(attribute_index_generation) == generation) {
+        return cache;
+    }
+
+    if (cache == NULL) {
+        cache = pemalloc(sizeof(HashTable), 1);
+        zend_hash_init(cache, 16, NULL, vyrtue_index_list_dtor, 1);
+        VYRTUE_G(attribute_index) = cache;
+    } else {
+        zend_hash_clean(cache);
+    }
+
+    VYRTUE_G(attribute_index_generation) = generation;
+    vyrtue_shm_foreach(VYRTUE_SHM_RECORD_ATTRIBUTE, vyrtue_index_cache_record, cache);
+
+    return cache;
+}
+
+static void vyrtue_index_string_or_null(zval *result, const char *key, size_t key_len, zend_string *str)
+{
+    if (str != NULL) {
+        add_assoc_str_ex(result, key, key_len, zend_string_init(ZSTR_VAL(str), ZSTR_LEN(str), 0));
+    } else {
+        add_assoc_null_ex(result, key, key_len);
+    }
+}
+
+/**
+ * Only arrays of scalars are ever serialized into the index, so this never
+ * calls into userland.
+ */
+static void vyrtue_index_entry_to_array(zval *result, const struct vyrtue_index_entry *entry)
+{
+    zval arguments;
+
+    ZVAL_NULL(&arguments);
+    if (entry->arguments != NULL) {
+        php_unserialize_data_t var_hash;
+        const unsigned char *p = (const unsigned char *) ZSTR_VAL(entry->arguments);
+
+        PHP_VAR_UNSERIALIZE_INIT(var_hash);
+        if (!php_var_unserialize(&arguments, &p, p + ZSTR_LEN(entry->arguments), &var_hash)) {
+            zval_ptr_dtor(&arguments);
+            ZVAL_NULL(&arguments);
+        }
+        PHP_VAR_UNSERIALIZE_DESTROY(var_hash);
+    }
+
+    array_init_size(result, 6);
+    vyrtue_index_string_or_null(result, ZEND_STRL("attribute"), entry->attribute);
+    vyrtue_index_string_or_null(result, ZEND_STRL("class"), entry->class_name);
+    vyrtue_index_string_or_null(result, ZEND_STRL("member"), entry->member);
+    vyrtue_index_string_or_null(result, ZEND_STRL("target"), entry->target);
+    vyrtue_index_string_or_null(result, ZEND_STRL("file"), entry->file);
+    add_assoc_zval_ex(result, ZEND_STRL("arguments"), &arguments);
+}
+
+VYRTUE_LOCAL PHP_FUNCTION(vyrtue_attribute_index)
+{
+    zend_string *attribute;
+    const struct vyrtue_index_entry *entry;
+    HashTable *list;
+
+    ZEND_PARSE_PARAMETERS_START(1, 1)
+    Z_PARAM_STR(attribute)
+    ZEND_PARSE_PARAMETERS_END();
+
+    if (!vyrtue_shm_is_enabled()) {
+        zend_error(E_WARNING, "vyrtue: the attribute index requires vyrtue.shm_size to be set");
+        RETURN_EMPTY_ARRAY();
+    }
+
+    const char *name = ZSTR_VAL(attribute);
+    size_t name_len = ZSTR_LEN(attribute);
+    if (name_len > 0 && name[0] == '\\') {
+        name++;
+        name_len--;
+    }
+
+    char *lc_name = zend_str_tolower_dup(name, name_len);
+    list = zend_hash_str_find_ptr(vyrtue_index_get_cache(), lc_name, name_len);
+    efree(lc_name);
+
+    if (list == NULL) {
+        RETURN_EMPTY_ARRAY();
+    }
+
+    array_init_size(return_value, zend_hash_num_elements(list));
+    ZEND_HASH_FOREACH_PTR(list, entry)
+    {
+        zval tmp;
+        vyrtue_index_entry_to_array(&tmp, entry);
+        add_next_index_zval(return_value, &tmp);
+    }
+    ZEND_HASH_FOREACH_END();
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_index)
+{
+    vyrtue_register_kind_visitor("vyrtue internal index", ZEND_AST_CLASS, vyrtue_index_class_enter, NULL);
+    vyrtue_register_kind_visitor("vyrtue internal index", ZEND_AST_FUNC_DECL, vyrtue_index_function_enter, NULL);
+
+    return SUCCESS;
+}
@@ -0,0 +1,291 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_compile.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "ast.h"
+#include "compile.h"
+#include "context.h"
+
+#define VYRTUE_INJECT_DEFAULT_FACTORY "createFromContainer"
+#define VYRTUE_INJECT_CONTAINER_VAR "container"
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_inject_find_method(zend_ast_list *stmts, const char *name, size_t name_len)
+{
+    for (uint32_t i = 0; i < stmts->children; i++) {
+        zend_ast_decl *method = (zend_ast_decl *) stmts->child[i];
+        if (method != NULL && method->kind == ZEND_AST_METHOD &&
+            0 == zend_binary_strcasecmp(ZSTR_VAL(method->name), ZSTR_LEN(method->name), name, name_len)) {
+            return (zend_ast *) method;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Returns the single literal string argument of an attribute (positional or
+ * named), NULL if there are no arguments, or sets *invalid.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_string *vyrtue_inject_get_string_arg(zend_ast *attr, const char *arg_name, bool *invalid)
+{
+    zend_ast *args_ast = attr->child[1];
+    zend_ast *arg;
+
+    *invalid = false;
+
+    if (args_ast == NULL || zend_ast_get_list(args_ast)->children == 0) {
+        return NULL;
+    }
+
+    arg = zend_ast_get_list(args_ast)->child[0];
+    if (arg->kind == ZEND_AST_NAMED_ARG) {
+        zend_string *name = zend_ast_get_str(arg->child[0]);
+        if (ZSTR_LEN(name) != strlen(arg_name) || 0 != memcmp(ZSTR_VAL(name), arg_name, ZSTR_LEN(name))) {
+            *invalid = true;
+            return NULL;
+        }
+        arg = arg->child[1];
+    }
+
+    if (zend_ast_get_list(args_ast)->children > 1 || arg->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(arg)) != IS_STRING) {
+        *invalid = true;
+        return NULL;
+    }
+
+    return zend_ast_get_str(arg);
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_inject_is_builtin_type(zend_string *name)
+{
+    static const char *const types[] = {
+        "int", "float", "string", "bool", "false", "true", "null", "mixed", "iterable", "object", "parent",
+    };
+
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (0 == zend_binary_strcasecmp(ZSTR_VAL(name), ZSTR_LEN(name), types[i], strlen(types[i]))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Returns the service id for an injected parameter: the attribute argument if
+ * given, otherwise its resolved class type.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_string *vyrtue_inject_get_service_id(zend_ast *param, zend_ast *attr, zend_string *class_name, struct vyrtue_context *ctx)
+{
+    zend_ast *type_ast = param->child[0];
+    zend_string *id;
+    bool invalid;
+
+    id = vyrtue_inject_get_string_arg(attr, "id", &invalid);
+    if (invalid) {
+        return NULL;
+    } else if (id != NULL) {
+        return zend_string_copy(id);
+    }
+
+    if (type_ast == NULL || type_ast->kind != ZEND_AST_ZVAL) {
+        return NULL;
+    }
+
+    zend_string *type_name = zend_ast_get_str(type_ast);
+    uint32_t fetch_type = type_ast->attr & ~ZEND_TYPE_NULLABLE;
+
+    if (fetch_type == ZEND_NAME_NOT_FQ && zend_string_equals_literal_ci(type_name, "self")) {
+        return zend_string_copy(class_name);
+    }
+
+    // builtin types need an explicit id
+    if (fetch_type == ZEND_NAME_NOT_FQ && vyrtue_inject_is_builtin_type(type_name)) {
+        return NULL;
+    }
+
+    return vyrtue_resolve_class_name(type_name, fetch_type, ctx);
+}
+
+/**
+ * Builds the argument list for `new self(...)`, or returns NULL if a
+ * required constructor parameter can't be injected.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_inject_create_args(zend_ast_decl *ctor, zend_string *class_name, struct vyrtue_context *ctx)
+{
+    zend_ast_list *params = zend_ast_get_list(ctor->child[0]);
+    zend_ast *args = zend_ast_create_list(0, ZEND_AST_ARG_LIST);
+    bool skipped = false;
+
+    for (uint32_t i = 0; i < params->children; i++) {
+        zend_ast *param = params->child[i];
+        zend_string *param_name = zend_ast_get_str(param->child[1]);
+        zend_ast *attr = param->child[3] ? vyrtue_ast_find_attribute(param->child[3], ZEND_STRL("VyrtueExt\\Inject"), ctx) : NULL;
+
+        if (attr == NULL) {
+            if (param->child[2] == NULL && !(param->attr & ZEND_PARAM_VARIADIC)) {
+                zend_error(
+                    E_COMPILE_WARNING,
+                    "vyrtue: cannot generate factory for %s: parameter $%s is neither injected nor optional",
+                    ZSTR_VAL(class_name),
+                    ZSTR_VAL(param_name)
+                );
+                goto fail;
+            }
+            skipped = true;
+            continue;
+        }
+
+        zend_string *id = vyrtue_inject_get_service_id(param, attr, class_name, ctx);
+        if (id == NULL || (param->attr & (ZEND_PARAM_REF | ZEND_PARAM_VARIADIC))) {
+            zend_error(
+                E_COMPILE_WARNING,
+                "vyrtue: cannot generate factory for %s: cannot determine the service for parameter $%s",
+                ZSTR_VAL(class_name),
+                ZSTR_VAL(param_name)
+            );
+            if (id) {
+                zend_string_release(id);
+            }
+            goto fail;
+        }
+
+        // $container->get('Foo')
+        zend_ast *get = zend_ast_create(
+            ZEND_AST_METHOD_CALL,
+            zend_ast_create(ZEND_AST_VAR, zend_ast_create_zval_from_str(zend_string_init(ZEND_STRL(VYRTUE_INJECT_CONTAINER_VAR), 0))),
+            zend_ast_create_zval_from_str(zend_string_init(ZEND_STRL("get"), 0)),
+            zend_ast_create_list(1, ZEND_AST_ARG_LIST, zend_ast_create_zval_from_str(id))
+        );
+
+        // after an omitted optional parameter, the remaining ones are passed by name
+        if (skipped) {
+            get = zend_ast_create(ZEND_AST_NAMED_ARG, zend_ast_create_zval_from_str(zend_string_copy(param_name)), get);
+        }
+
+        args = zend_ast_list_add(args, get);
+    }
+
+    return args;
+
+fail:
+    zend_ast_destroy(args);
+    return NULL;
+}
+
+/**
+ * Appends to classes marked #[VyrtueExt\Injectable]
+ *
+ *     public static function createFromContainer($container) {
+ *         return new self($container->get(Foo::class), ...);
+ *     }
+ *
+ * for the constructor parameters marked #[VyrtueExt\Inject]. The service id is
+ * the parameter's class type, or the attribute argument, e.g. #[Inject('db')].
+ * The method name can be changed with #[Injectable(factory: 'create')].
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_inject_class_enter(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_decl *decl = (zend_ast_decl *) ast;
+    zend_ast *attr;
+    zend_ast *ctor;
+    zend_ast *args;
+    zend_string *factory_name;
+    bool invalid;
+
+    if (decl->kind != ZEND_AST_CLASS || decl->name == NULL || decl->child[2] == NULL ||
+        (decl->flags & (ZEND_ACC_ANON_CLASS | ZEND_ACC_INTERFACE | ZEND_ACC_TRAIT | ZEND_ACC_ENUM | ZEND_ACC_EXPLICIT_ABSTRACT_CLASS))) {
+        zend_error(E_COMPILE_WARNING, "vyrtue: #[VyrtueExt\\Injectable] is only supported on named, concrete classes");
+        return NULL;
+    }
+
+    attr = vyrtue_ast_find_attribute(decl->child[3], ZEND_STRL("VyrtueExt\\Injectable"), ctx);
+    ZEND_ASSERT(attr != NULL);
+
+    factory_name = vyrtue_inject_get_string_arg(attr, "factory", &invalid);
+    if (invalid) {
+        zend_error(E_COMPILE_WARNING, "vyrtue: #[VyrtueExt\\Injectable] factory must be a string literal");
+        return NULL;
+    }
+
+    const char *name = factory_name ? ZSTR_VAL(factory_name) : VYRTUE_INJECT_DEFAULT_FACTORY;
+    size_t name_len = factory_name ? ZSTR_LEN(factory_name) : sizeof(VYRTUE_INJECT_DEFAULT_FACTORY) - 1;
+    zend_ast_list *stmts = zend_ast_get_list(decl->child[2]);
+
+    if (vyrtue_inject_find_method(stmts, name, name_len)) {
+        zend_error(E_COMPILE_WARNING, "vyrtue: cannot generate factory for %s: method %s already exists", ZSTR_VAL(decl->name), name);
+        return NULL;
+    }
+
+    zend_string *class_name = ctx->current_namespace ? zend_string_concat3(
+                                                           ZSTR_VAL(ctx->current_namespace),
+                                                           ZSTR_LEN(ctx->current_namespace),
+                                                           "\\",
+                                                           1,
+                                                           ZSTR_VAL(decl->name),
+                                                           ZSTR_LEN(decl->name)
+                                                       )
+                                                     : zend_string_copy(decl->name);
+
+    ctor = vyrtue_inject_find_method(stmts, ZEND_STRL("__construct"));
+    args = ctor ? vyrtue_inject_create_args((zend_ast_decl *) ctor, class_name, ctx) : zend_ast_create_list(0, ZEND_AST_ARG_LIST);
+    zend_string_release(class_name);
+
+    if (args == NULL) {
+        return NULL;
+    }
+
+    zend_ast *self_ast = zend_ast_create_zval_from_str(zend_string_init(ZEND_STRL("self"), 0));
+    self_ast->attr = ZEND_NAME_NOT_FQ;
+
+    zend_ast *stmt = zend_ast_create(ZEND_AST_RETURN, zend_ast_create(ZEND_AST_NEW, self_ast, args));
+    zend_ast *params = zend_ast_create_list(1, ZEND_AST_PARAM_LIST, vyrtue_ast_create_param(NULL, ZEND_STRL(VYRTUE_INJECT_CONTAINER_VAR)));
+    zend_ast *method = vyrtue_ast_create_method(
+        ZEND_ACC_PUBLIC | ZEND_ACC_STATIC, name, name_len, params, zend_ast_create_list(1, ZEND_AST_STMT_LIST, stmt), NULL
+    );
+
+    decl->child[2] = zend_ast_list_add(decl->child[2], method);
+
+    return NULL;
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_inject)
+{
+    zend_string *tmp;
+
+    tmp = zend_string_init_interned(ZEND_STRL("VyrtueExt\\Injectable"), 1);
+    vyrtue_register_attribute_visitor("vyrtue internal inject", tmp, vyrtue_inject_class_enter, NULL);
+    zend_string_release(tmp);
+
+    return SUCCESS;
+}
@@ -0,0 +1,528 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_compile.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "ast.h"
+#include "compile.h"
+#include "context.h"
+#include "debug_log.h"
+
+#define VYRTUE_INLINE_MAX_PARAMS 16
+
+/**
+ * The template is copied out of the declaration, so that other visitors are
+ * free to rewrite the function itself afterwards.
+ */
+struct vyrtue_inline_function
+{
+    zend_string *name;
+    zend_ast *expr;
+    zend_string *ns;
+    uint32_t num_imports;
+    uint32_t num_params;
+    // parameters that are written to can only be bound to a temporary
+    uint32_t param_writes;
+    zend_string *params[VYRTUE_INLINE_MAX_PARAMS];
+    zend_ast *defaults[VYRTUE_INLINE_MAX_PARAMS];
+};
+
+static void vyrtue_inline_function_dtor(zval *zv)
+{
+    struct vyrtue_inline_function *fn = Z_PTR_P(zv);
+
+    zend_string_release(fn->name);
+    zend_ast_destroy(fn->expr);
+
+    for (uint32_t i = 0; i < fn->num_params; i++) {
+        zend_string_release(fn->params[i]);
+        if (fn->defaults[i]) {
+            zend_ast_destroy(fn->defaults[i]);
+        }
+    }
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static uint32_t vyrtue_inline_count_imports(struct vyrtue_context *ctx)
+{
+    return (ctx->imports ? zend_hash_num_elements(ctx->imports) : 0) +
+        (ctx->imports_function ? zend_hash_num_elements(ctx->imports_function) : 0) +
+        (ctx->imports_const ? zend_hash_num_elements(ctx->imports_const) : 0);
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static int vyrtue_inline_find_param(struct vyrtue_inline_function *fn, zend_string *name)
+{
+    for (uint32_t i = 0; i < fn->num_params; i++) {
+        if (zend_string_equals(fn->params[i], name)) {
+            return (int) i;
+        }
+    }
+
+    return -1;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_inline_is_forbidden_call(zend_ast *name_ast, struct vyrtue_inline_function *fn)
+{
+    static const char *const functions[] = {
+        "func_get_args",
+        "func_get_arg",
+        "func_num_args",
+        "get_defined_vars",
+        "compact",
+        "extract",
+        "debug_backtrace",
+        "debug_print_backtrace",
+    };
+    const char *name;
+    size_t name_len;
+
+    if (name_ast->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(name_ast)) != IS_STRING) {
+        return true;
+    }
+
+    // these may be reached through namespace fallback, so compare the unqualified name
+    if (!zend_get_unqualified_name(zend_ast_get_str(name_ast), &name, &name_len)) {
+        name = ZSTR_VAL(zend_ast_get_str(name_ast));
+        name_len = ZSTR_LEN(zend_ast_get_str(name_ast));
+    }
+
+    // recursion would be expanded forever
+    if (0 == zend_binary_strcasecmp(name, name_len, ZSTR_VAL(fn->name), ZSTR_LEN(fn->name))) {
+        return true;
+    }
+
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        if (0 == zend_binary_strcasecmp(name, name_len, functions[i], strlen(functions[i]))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_inline_is_scope_name(zend_ast *name_ast)
+{
+    if (name_ast->kind != ZEND_AST_ZVAL) {
+        return true;
+    }
+
+    // self, static and parent have no meaning outside of the declaring scope
+    return name_ast->attr == ZEND_NAME_NOT_FQ &&
+        (zend_string_equals_literal_ci(zend_ast_get_str(name_ast), "self") ||
+         zend_string_equals_literal_ci(zend_ast_get_str(name_ast), "static") ||
+         zend_string_equals_literal_ci(zend_ast_get_str(name_ast), "parent"));
+}
+
+/**
+ * Checks that the expression only depends on its parameters. Anything below
+ * an assignment target or a call argument is treated as being written to,
+ * since arguments may be passed by reference, as is anything in a position
+ * that requires a variable (isset(), empty(), unset(), &$x), where a literal
+ * argument would not compile.
+ */
+static bool vyrtue_inline_check_expr(zend_ast *ast, struct vyrtue_inline_function *fn, bool write)
+{
+    uint32_t i;
+
+    if (ast == NULL || ast->kind == ZEND_AST_ZVAL) {
+        return true;
+    }
+
+    switch (ast->kind) {
+        case ZEND_AST_VAR: {
+            if (ast->child[0]->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(ast->child[0])) != IS_STRING) {
+                return false;
+            }
+            int param = vyrtue_inline_find_param(fn, zend_ast_get_str(ast->child[0]));
+            if (param < 0) {
+                return false;
+            }
+            if (write) {
+                fn->param_writes |= 1u << param;
+            }
+            return true;
+        }
+
+        case ZEND_AST_MAGIC_CONST:
+        case ZEND_AST_YIELD:
+        case ZEND_AST_YIELD_FROM:
+        case ZEND_AST_INCLUDE_OR_EVAL:
+            return false;
+
+        case ZEND_AST_ASSIGN:
+        case ZEND_AST_ASSIGN_REF:
+        case ZEND_AST_ASSIGN_OP:
+        case ZEND_AST_ASSIGN_COALESCE:
+            return vyrtue_inline_check_expr(ast->child[0], fn, true) && vyrtue_inline_check_expr(ast->child[1], fn, write);
+
+        case ZEND_AST_PRE_INC:
+        case ZEND_AST_PRE_DEC:
+        case ZEND_AST_POST_INC:
+        case ZEND_AST_POST_DEC:
+        case ZEND_AST_ISSET:
+        case ZEND_AST_EMPTY:
+        case ZEND_AST_UNSET:
+        case ZEND_AST_REF:
+            return vyrtue_inline_check_expr(ast->child[0], fn, true);
+
+        case ZEND_AST_ARRAY_ELEM:
+            // [&$x]
+            if (ast->attr) {
+                return vyrtue_inline_check_expr(ast->child[0], fn, true) && vyrtue_inline_check_expr(ast->child[1], fn, write);
+            }
+            break;
+
+        case ZEND_AST_CALL:
+            if (vyrtue_inline_is_forbidden_call(ast->child[0], fn)) {
+                return false;
+            }
+            return vyrtue_inline_check_expr(ast->child[1], fn, true);
+
+        case ZEND_AST_STATIC_CALL:
+        case ZEND_AST_NEW:
+            if (vyrtue_inline_is_scope_name(ast->child[0])) {
+                return false;
+            }
+            return vyrtue_inline_check_expr(ast->child[ast->kind == ZEND_AST_NEW ? 1 : 2], fn, true) &&
+                (ast->kind == ZEND_AST_NEW || vyrtue_inline_check_expr(ast->child[1], fn, write));
+
+        case ZEND_AST_METHOD_CALL:
+        case ZEND_AST_NULLSAFE_METHOD_CALL:
+            return vyrtue_inline_check_expr(ast->child[0], fn, write) && vyrtue_inline_check_expr(ast->child[1], fn, write) &&
+                vyrtue_inline_check_expr(ast->child[2], fn, true);
+
+        case ZEND_AST_STATIC_PROP:
+        case ZEND_AST_CLASS_CONST:
+        case ZEND_AST_CLASS_NAME:
+            if (vyrtue_inline_is_scope_name(ast->child[0])) {
+                return false;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if (zend_ast_is_special(ast)) {
+        // closures, arrow functions, anonymous classes
+        return false;
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        for (i = 0; i < list->children; i++) {
+            if (!vyrtue_inline_check_expr(list->child[i], fn, write)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint32_t children = zend_ast_get_num_children(ast);
+    for (i = 0; i < children; i++) {
+        if (!vyrtue_inline_check_expr(ast->child[i], fn, write)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Only unconditionally declared functions are bound as soon as their file
+ * is compiled, so calls elsewhere in the file are guaranteed to reach them.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_inline_is_toplevel(struct vyrtue_context *ctx)
+{
+    struct vyrtue_context_stack *stack = &ctx->node_stack;
+    size_t i = stack->i;
+
+    if (i < 2 || stack->data[i - 2].ast->kind != ZEND_AST_STMT_LIST) {
+        return false;
+    }
+
+    return i == 2 || (i == 4 && stack->data[i - 3].ast->kind == ZEND_AST_NAMESPACE);
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_inline_attribute_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_decl *decl = (zend_ast_decl *) ast;
+    struct vyrtue_inline_function *fn;
+    zend_ast_list *stmts;
+    zend_ast_list *params;
+    uint32_t i;
+
+    if (ast->kind != ZEND_AST_FUNC_DECL || !vyrtue_inline_is_toplevel(ctx)) {
+        zend_error(E_COMPILE_WARNING, "vyrtue: #[VyrtueExt\\Inline] is only supported on unconditionally declared functions");
+        return NULL;
+    }
+
+    // no return type coercion, no reference returns
+    if (decl->child[3] != NULL || (decl->flags & ZEND_ACC_RETURN_REFERENCE) || decl->child[2] == NULL) {
+        return NULL;
+    }
+
+    stmts = zend_ast_get_list(decl->child[2]);
+    if (stmts->children != 1 || stmts->child[0]->kind != ZEND_AST_RETURN || stmts->child[0]->child[0] == NULL) {
+        return NULL;
+    }
+
+    params = zend_ast_get_list(decl->child[0]);
+    if (params->children > VYRTUE_INLINE_MAX_PARAMS) {
+        return NULL;
+    }
+
+    // no type coercion, no references, no variadics
+    for (i = 0; i < params->children; i++) {
+        zend_ast *param = params->child[i];
+        if (param->child[0] != NULL || (param->attr & (ZEND_PARAM_REF | ZEND_PARAM_VARIADIC))) {
+            return NULL;
+        }
+    }
+
+    fn = zend_arena_calloc(&ctx->arena, 1, sizeof(*fn));
+    fn->name = decl->name;
+
+    for (i = 0; i < params->children; i++) {
+        fn->params[i] = zend_ast_get_str(params->child[i]->child[1]);
+    }
+    fn->num_params = params->children;
+
+    if (!vyrtue_inline_check_expr(stmts->child[0]->child[0], fn, false)) {
+        return NULL;
+    }
+
+    for (i = 0; i < params->children; i++) {
+        zend_ast *default_ast = params->child[i]->child[2];
+        if (default_ast && NULL == (fn->defaults[i] = vyrtue_ast_dup(default_ast))) {
+            goto fail;
+        }
+    }
+
+    fn->expr = vyrtue_ast_dup(stmts->child[0]->child[0]);
+    if (fn->expr == NULL) {
+        goto fail;
+    }
+
+    fn->name = zend_string_copy(fn->name);
+    fn->ns = ctx->current_namespace;
+    fn->num_imports = vyrtue_inline_count_imports(ctx);
+
+    for (i = 0; i < params->children; i++) {
+        fn->params[i] = zend_string_copy(fn->params[i]);
+    }
+
+    if (!ctx->inline_functions) {
+        ctx->inline_functions = zend_arena_calloc(&ctx->arena, 1, sizeof(HashTable));
+        zend_hash_init(ctx->inline_functions, 8, NULL, vyrtue_inline_function_dtor, 0);
+    }
+
+    zend_string *name = ctx->current_namespace ? zend_string_concat3(
+                                                     ZSTR_VAL(ctx->current_namespace),
+                                                     ZSTR_LEN(ctx->current_namespace),
+                                                     "\\",
+                                                     1,
+                                                     ZSTR_VAL(decl->name),
+                                                     ZSTR_LEN(decl->name)
+                                                 )
+                                               : zend_string_copy(decl->name);
+    zend_string *lcname = zend_string_tolower(name);
+    zend_hash_update_ptr(ctx->inline_functions, lcname, fn);
+    zend_string_release(lcname);
+    zend_string_release(name);
+
+    return NULL;
+
+fail:
+    for (i = 0; i < params->children; i++) {
+        if (fn->defaults[i]) {
+            zend_ast_destroy(fn->defaults[i]);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Replaces the variables in ast that refer to parameters with copies of
+ * their bound values.
+ */
+static void vyrtue_inline_substitute(zend_ast **ast_ptr, struct vyrtue_inline_function *fn, zend_ast **bound)
+{
+    zend_ast *ast = *ast_ptr;
+    uint32_t i;
+
+    if (ast == NULL || zend_ast_is_special(ast)) {
+        return;
+    }
+
+    if (ast->kind == ZEND_AST_VAR) {
+        int param = vyrtue_inline_find_param(fn, zend_ast_get_str(ast->child[0]));
+        ZEND_ASSERT(param >= 0);
+        *ast_ptr = vyrtue_ast_dup(bound[param]);
+        zend_ast_destroy(ast);
+        return;
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        for (i = 0; i < list->children; i++) {
+            vyrtue_inline_substitute(&list->child[i], fn, bound);
+        }
+    } else {
+        uint32_t children = zend_ast_get_num_children(ast);
+        for (i = 0; i < children; i++) {
+            vyrtue_inline_substitute(&ast->child[i], fn, bound);
+        }
+    }
+}
+
+/**
+ * Literals can be repeated freely. Anything else, including plain variables
+ * (which the body may change through a reference), is bound to a temporary.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_inline_can_substitute(zend_ast *arg)
+{
+    zval tmp;
+
+    if (arg->kind == ZEND_AST_ZVAL) {
+        return true;
+    } else if (arg->kind == ZEND_AST_CONST && vyrtue_ast_eval_const(arg, &tmp)) {
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Rewrites f($a, 2) for #[Inline] function f($x, $y) { return $x + $y; } into
+ *
+ *     (($__vyrtue_tmp0 = $a) || true) ? $__vyrtue_tmp0 + 2 : null
+ *
+ * so that arguments are still evaluated exactly once and in order.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_inline_call_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast *bound[VYRTUE_INLINE_MAX_PARAMS] = {NULL};
+    zend_ast *prelude = NULL;
+    zend_ast *name_ast = ast->child[0];
+    struct vyrtue_inline_function *fn;
+    zend_ast_list *args;
+    bool is_fully_qualified;
+    uint32_t i;
+    zval tmp;
+
+    if (EXPECTED(ctx->inline_functions == NULL)) {
+        return NULL;
+    }
+
+    if (name_ast->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(name_ast)) != IS_STRING) {
+        return NULL;
+    }
+
+    // unlike vyrtue_ast_get_call_name(), an unqualified call is fine: it finds the namespaced function first
+    zend_string *name = vyrtue_resolve_function_name(zend_ast_get_str(name_ast), name_ast->attr, &is_fully_qualified, ctx);
+    zend_string *lcname = zend_string_tolower(name);
+    fn = zend_hash_find_ptr(ctx->inline_functions, lcname);
+    zend_string_release(lcname);
+    zend_string_release(name);
+
+    // names in the body must resolve the same way as in the declaration
+    if (fn == NULL || fn->ns != ctx->current_namespace || fn->num_imports != vyrtue_inline_count_imports(ctx)) {
+        return NULL;
+    }
+
+    args = vyrtue_ast_get_call_args(ast);
+    if (args == NULL || args->children > fn->num_params || vyrtue_context_in_const_expr(ctx)) {
+        return NULL;
+    }
+
+    for (i = args->children; i < fn->num_params; i++) {
+        // missing argument, let the runtime throw
+        if (fn->defaults[i] == NULL) {
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < fn->num_params; i++) {
+        zend_ast *arg = i < args->children ? args->child[i] : fn->defaults[i];
+
+        if (!(fn->param_writes & (1u << i)) && vyrtue_inline_can_substitute(arg)) {
+            bound[i] = arg;
+            continue;
+        }
+
+        if (i < args->children) {
+            args->child[i] = NULL;
+        } else {
+            arg = vyrtue_ast_dup(arg);
+        }
+
+        zend_ast *tmp_var = vyrtue_context_create_temporary_var(ctx);
+        ZVAL_TRUE(&tmp);
+        zend_ast *cond = zend_ast_create(ZEND_AST_OR, zend_ast_create(ZEND_AST_ASSIGN, tmp_var, arg), zend_ast_create_zval(&tmp));
+
+        bound[i] = tmp_var;
+        prelude = prelude ? zend_ast_create(ZEND_AST_AND, prelude, cond) : cond;
+    }
+
+    zend_ast *expr = vyrtue_ast_dup(fn->expr);
+    ZEND_ASSERT(expr != NULL);
+    vyrtue_inline_substitute(&expr, fn, bound);
+
+#ifdef VYRTUE_DEBUG
+    if (VYRTUE_DEBUG_ENABLED(VYRTUE_DEBUG_INLINE)) {
+        vyrtue_debug_log(VYRTUE_DEBUG_INLINE, "VYRTUE_INLINE: %.*s\n", (int) ZSTR_LEN(fn->name), ZSTR_VAL(fn->name));
+    }
+#endif
+
+    if (prelude) {
+        ZVAL_NULL(&tmp);
+        return zend_ast_create(ZEND_AST_CONDITIONAL, prelude, expr, zend_ast_create_zval(&tmp));
+    }
+
+    return expr;
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_inline)
+{
+    zend_string *tmp;
+
+    tmp = zend_string_init_interned(ZEND_STRL("VyrtueExt\\Inline"), 1);
+    vyrtue_register_attribute_visitor_ex("vyrtue internal inline", tmp, NULL, vyrtue_inline_attribute_leave, VYRTUE_VISITOR_OPTIONAL);
+    zend_string_release(tmp);
+
+    vyrtue_register_kind_visitor_ex("vyrtue internal inline", ZEND_AST_CALL, NULL, vyrtue_inline_call_leave, VYRTUE_VISITOR_OPTIONAL);
+
+    return SUCCESS;
+}
@@ -0,0 +1,407 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_compile.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "ast.h"
+#include "context.h"
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_string *vyrtue_loop_get_var_name(zend_ast *ast)
+{
+    if (ast->kind != ZEND_AST_VAR || ast->child[0]->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(ast->child[0])) != IS_STRING) {
+        return NULL;
+    }
+
+    return zend_ast_get_str(ast->child[0]);
+}
+
+/**
+ * Whether ast references the variable at all, in any position.
+ */
+static bool vyrtue_loop_mentions_var(zend_ast *ast, zend_string *name)
+{
+    if (ast == NULL || ast->kind == ZEND_AST_ZVAL || ast->kind == ZEND_AST_CONSTANT || ast->kind == ZEND_AST_ZNODE) {
+        return false;
+    }
+
+    if (zend_ast_is_special(ast)) {
+        // declarations: closures capture by value unless bound by reference
+        return false;
+    }
+
+    if (ast->kind == ZEND_AST_VAR) {
+        zend_string *var_name = vyrtue_loop_get_var_name(ast);
+        return var_name == NULL || zend_string_equals(var_name, name);
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        for (uint32_t i = 0; i < list->children; i++) {
+            if (vyrtue_loop_mentions_var(list->child[i], name)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t children = zend_ast_get_num_children(ast);
+    for (uint32_t i = 0; i < children; i++) {
+        if (vyrtue_loop_mentions_var(ast->child[i], name)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Whether ast is the name of the variable as written in static and catch,
+ * without the $.
+ */
+static bool vyrtue_loop_is_var_name(zend_ast *ast, zend_string *name)
+{
+    return ast != NULL && ast->kind == ZEND_AST_ZVAL && Z_TYPE_P(zend_ast_get_zval(ast)) == IS_STRING &&
+           zend_string_equals(zend_ast_get_str(ast), name);
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_loop_is_by_value_function(zend_string *name)
+{
+    static const char *const functions[] = {"count", "sizeof", "strlen", "in_array", "array_key_exists", "implode", "is_array", "is_string"};
+
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        if (ZSTR_LEN(name) == strlen(functions[i]) && 0 == memcmp(ZSTR_VAL(name), functions[i], ZSTR_LEN(name))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Conservatively determines whether the variable may be modified by the code
+ * in ast: assignments, increments, unset(), references, by-reference closure
+ * bindings, global/static declarations, catch variables, foreach targets,
+ * passing it to a call that may take it by reference, extract(), include/eval
+ * and variable-variables.
+ */
+static bool vyrtue_loop_may_write_var(zend_ast *ast, zend_string *name, struct vyrtue_context *ctx)
+{
+    if (ast == NULL || ast->kind == ZEND_AST_ZVAL || ast->kind == ZEND_AST_CONSTANT || ast->kind == ZEND_AST_ZNODE) {
+        return false;
+    }
+
+    switch (ast->kind) {
+        case ZEND_AST_CLOSURE: {
+            zend_ast_decl *decl = (zend_ast_decl *) ast;
+            if (decl->child[1]) {
+                zend_ast_list *uses = zend_ast_get_list(decl->child[1]);
+                for (uint32_t i = 0; i < uses->children; i++) {
+                    if ((uses->child[i]->attr & ZEND_BIND_REF) && zend_string_equals(zend_ast_get_str(uses->child[i]), name)) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        case ZEND_AST_FUNC_DECL:
+        case ZEND_AST_METHOD:
+        case ZEND_AST_CLASS:
+        case ZEND_AST_ARROW_FUNC:
+            // separate scope, or captured by value
+            return false;
+
+        case ZEND_AST_VAR:
+            // variable-variables may alias anything
+            return vyrtue_loop_get_var_name(ast) == NULL;
+
+        case ZEND_AST_INCLUDE_OR_EVAL:
+            return true;
+
+        case ZEND_AST_ASSIGN:
+        case ZEND_AST_ASSIGN_OP:
+        case ZEND_AST_ASSIGN_COALESCE:
+            if (vyrtue_loop_mentions_var(ast->child[0], name)) {
+                return true;
+            }
+            break;
+
+        case ZEND_AST_ASSIGN_REF:
+            if (vyrtue_loop_mentions_var(ast->child[0], name) || vyrtue_loop_mentions_var(ast->child[1], name)) {
+                return true;
+            }
+            break;
+
+        case ZEND_AST_PRE_INC:
+        case ZEND_AST_PRE_DEC:
+        case ZEND_AST_POST_INC:
+        case ZEND_AST_POST_DEC:
+        case ZEND_AST_UNSET:
+        case ZEND_AST_REF:
+        case ZEND_AST_GLOBAL:
+            if (vyrtue_loop_mentions_var(ast->child[0], name)) {
+                return true;
+            }
+            break;
+
+        case ZEND_AST_STATIC:
+            // the variable is a bare name here, not a ZEND_AST_VAR
+            if (vyrtue_loop_is_var_name(ast->child[0], name)) {
+                return true;
+            }
+            break;
+
+        case ZEND_AST_CATCH:
+            if (vyrtue_loop_is_var_name(ast->child[1], name)) {
+                return true;
+            }
+            break;
+
+        case ZEND_AST_ARRAY_ELEM:
+            if (ast->attr && vyrtue_loop_mentions_var(ast->child[0], name)) {
+                return true;
+            }
+            break;
+
+        case ZEND_AST_FOREACH:
+            if (vyrtue_loop_mentions_var(ast->child[1], name) || vyrtue_loop_mentions_var(ast->child[2], name)) {
+                return true;
+            }
+            if (ast->child[1]->kind == ZEND_AST_REF && vyrtue_loop_mentions_var(ast->child[0], name)) {
+                return true;
+            }
+            break;
+
+        case ZEND_AST_CALL: {
+            zend_ast *name_ast = ast->child[0];
+            // extract() may be reached through namespace fallback, so check the name as written
+            if (name_ast->kind == ZEND_AST_ZVAL && Z_TYPE_P(zend_ast_get_zval(name_ast)) == IS_STRING &&
+                zend_string_equals_literal_ci(zend_ast_get_str(name_ast), "extract")) {
+                return true;
+            }
+
+            zend_string *fn_name = vyrtue_ast_get_call_name(ast, ctx);
+            bool by_value = false;
+            if (fn_name) {
+                by_value = vyrtue_loop_is_by_value_function(fn_name);
+                zend_string_release(fn_name);
+            }
+            if (!by_value && vyrtue_loop_mentions_var(ast->child[1], name)) {
+                return true;
+            }
+            break;
+        }
+
+        case ZEND_AST_METHOD_CALL:
+        case ZEND_AST_NULLSAFE_METHOD_CALL:
+        case ZEND_AST_STATIC_CALL:
+            if (vyrtue_loop_mentions_var(ast->child[2], name)) {
+                return true;
+            }
+            break;
+
+        case ZEND_AST_NEW:
+            if (vyrtue_loop_mentions_var(ast->child[1], name)) {
+                return true;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if (zend_ast_is_special(ast)) {
+        return false;
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        for (uint32_t i = 0; i < list->children; i++) {
+            if (vyrtue_loop_may_write_var(list->child[i], name, ctx)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t children = zend_ast_get_num_children(ast);
+    for (uint32_t i = 0; i < children; i++) {
+        if (vyrtue_loop_may_write_var(ast->child[i], name, ctx)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Finds the by-value parameter declaration for the variable in the enclosing
+ * function, if it has exactly the given type (no nullable or union types).
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_loop_is_typed_param(zend_ast_decl *decl, zend_string *name, uint32_t type)
+{
+    zend_ast_list *params;
+
+    if (decl->child[0] == NULL) {
+        return false;
+    }
+
+    params = zend_ast_get_list(decl->child[0]);
+
+    for (uint32_t i = 0; i < params->children; i++) {
+        zend_ast *param = params->child[i];
+        zend_ast *type_ast = param->child[0];
+
+        if (!zend_string_equals(zend_ast_get_str(param->child[1]), name)) {
+            continue;
+        }
+
+        if ((param->attr & (ZEND_PARAM_REF | ZEND_PARAM_VARIADIC)) || type_ast == NULL) {
+            return false;
+        }
+
+        // a null default makes the type implicitly nullable
+        if (param->child[2] && param->child[2]->kind == ZEND_AST_CONST) {
+            return false;
+        }
+
+        if (type == IS_ARRAY) {
+            return type_ast->kind == ZEND_AST_TYPE && type_ast->attr == IS_ARRAY;
+        }
+
+        return type_ast->kind == ZEND_AST_ZVAL && type_ast->attr == ZEND_NAME_NOT_FQ &&
+            zend_string_equals_literal_ci(zend_ast_get_str(type_ast), "string");
+    }
+
+    return false;
+}
+
+/**
+ * Whether ast is count($param)/sizeof($param) of an array parameter or
+ * strlen($param) of a string parameter that the function never modifies.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_loop_is_invariant_call(zend_ast *ast, zend_ast_decl *decl, struct vyrtue_context *ctx)
+{
+    uint32_t type;
+
+    zend_ast_list *args = vyrtue_ast_get_call_args(ast);
+    if (NULL == args || args->children != 1) {
+        return false;
+    }
+
+    zend_string *var_name = vyrtue_loop_get_var_name(args->child[0]);
+    if (NULL == var_name || zend_string_equals_literal(var_name, "this")) {
+        return false;
+    }
+
+    zend_string *fn_name = vyrtue_ast_get_call_name(ast, ctx);
+    if (NULL == fn_name) {
+        return false;
+    }
+
+    if (zend_string_equals_literal_ci(fn_name, "count") || zend_string_equals_literal_ci(fn_name, "sizeof")) {
+        type = IS_ARRAY;
+    } else if (zend_string_equals_literal_ci(fn_name, "strlen")) {
+        type = IS_STRING;
+    } else {
+        type = IS_UNDEF;
+    }
+
+    zend_string_release(fn_name);
+
+    return type != IS_UNDEF && vyrtue_loop_is_typed_param(decl, var_name, type) && !vyrtue_loop_may_write_var(decl->child[2], var_name, ctx);
+}
+
+static void vyrtue_loop_hoist(zend_ast **ast_ptr, zend_ast *for_ast, zend_ast_decl *decl, struct vyrtue_context *ctx)
+{
+    zend_ast *ast = *ast_ptr;
+
+    if (ast == NULL || zend_ast_is_special(ast)) {
+        return;
+    }
+
+    if (ast->kind == ZEND_AST_CALL && vyrtue_loop_is_invariant_call(ast, decl, ctx)) {
+        zend_ast *tmp_var = vyrtue_context_create_temporary_var(ctx);
+        zend_ast *assign = zend_ast_create(ZEND_AST_ASSIGN, tmp_var, ast);
+
+        if (for_ast->child[0]) {
+            for_ast->child[0] = zend_ast_list_add(for_ast->child[0], assign);
+        } else {
+            for_ast->child[0] = zend_ast_create_list(1, ZEND_AST_EXPR_LIST, assign);
+        }
+
+        *ast_ptr = zend_ast_create(ZEND_AST_VAR, zend_ast_create_zval_from_str(zend_string_copy(zend_ast_get_str(tmp_var->child[0]))));
+        return;
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        for (uint32_t i = 0; i < list->children; i++) {
+            vyrtue_loop_hoist(&list->child[i], for_ast, decl, ctx);
+        }
+    } else {
+        uint32_t children = zend_ast_get_num_children(ast);
+        for (uint32_t i = 0; i < children; i++) {
+            vyrtue_loop_hoist(&ast->child[i], for_ast, decl, ctx);
+        }
+    }
+}
+
+/**
+ * Hoists loop-invariant count()/sizeof()/strlen() calls out of for-loop
+ * conditions into the init list:
+ *
+ *     for ($i = 0; $i < count($items); $i++)
+ *     for ($i = 0, $__vyrtue_tmp0 = count($items); $i < $__vyrtue_tmp0; $i++)
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_loop_for_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    if (ast->child[1] == NULL || vyrtue_context_stack_count(&ctx->scope_stack) <= 1) {
+        return NULL;
+    }
+
+    zend_ast *scope_ast = vyrtue_context_scope_stack_top_ast(ctx);
+    if (scope_ast->kind != ZEND_AST_FUNC_DECL && scope_ast->kind != ZEND_AST_METHOD && scope_ast->kind != ZEND_AST_CLOSURE) {
+        return NULL;
+    }
+
+    vyrtue_loop_hoist(&ast->child[1], ast, (zend_ast_decl *) scope_ast, ctx);
+
+    return NULL;
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_loop)
+{
+    vyrtue_register_kind_visitor_ex("vyrtue internal loop", ZEND_AST_FOR, NULL, vyrtue_loop_for_leave, VYRTUE_VISITOR_OPTIONAL);
+
+    return SUCCESS;
+}
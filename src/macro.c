@@ -0,0 +1,927 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_compile.h"
+#include "Zend/zend_constants.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "ast.h"
+#include "compile.h"
+#include "context.h"
+#include "debug_log.h"
+
+#define VYRTUE_MACRO_MAX_PARAMS 16
+#define VYRTUE_MACRO_MAX_EXPANSIONS 4096
+
+#define VYRTUE_MACRO_AST_SIZE(children) (sizeof(zend_ast) - sizeof(zend_ast *) + sizeof(zend_ast *) * MAX(children, 1))
+#define VYRTUE_MACRO_LIST_SIZE(children) (sizeof(zend_ast_list) - sizeof(zend_ast *) + sizeof(zend_ast *) * MAX(children, 1))
+
+/**
+ * Macros outlive the file that declares them, so the template is kept in
+ * persistent memory with all names fully qualified.
+ */
+struct vyrtue_macro
+{
+    zend_string *name;
+    // an expression, or a statement list for macros that don't return a value
+    zend_ast *body;
+    bool is_stmt;
+    uint32_t num_params;
+    // parameters declared by reference, which only accept variables
+    uint32_t by_ref;
+    zend_string *params[VYRTUE_MACRO_MAX_PARAMS];
+    zend_ast *defaults[VYRTUE_MACRO_MAX_PARAMS];
+};
+
+static void vyrtue_macro_ast_free(zend_ast *ast)
+{
+    uint32_t i;
+
+    if (ast == NULL) {
+        return;
+    }
+
+    if (ast->kind == ZEND_AST_ZVAL) {
+        zval *zv = zend_ast_get_zval(ast);
+        if (Z_TYPE_P(zv) == IS_STRING) {
+            zend_string_release_ex(Z_STR_P(zv), 1);
+        }
+    } else if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        for (i = 0; i < list->children; i++) {
+            vyrtue_macro_ast_free(list->child[i]);
+        }
+    } else {
+        uint32_t children = zend_ast_get_num_children(ast);
+        for (i = 0; i < children; i++) {
+            vyrtue_macro_ast_free(ast->child[i]);
+        }
+    }
+
+    pefree(ast, 1);
+}
+
+/**
+ * Copies an AST into persistent memory, or returns NULL if it contains
+ * anything other than scalar literals and plain nodes.
+ */
+static zend_ast *vyrtue_macro_ast_persist(zend_ast *ast)
+{
+    uint32_t i;
+
+    if (ast->kind == ZEND_AST_ZVAL) {
+        zval *zv = zend_ast_get_zval(ast);
+        if (Z_TYPE_P(zv) > IS_STRING) {
+            return NULL;
+        }
+
+        zend_ast_zval *copy = pemalloc(sizeof(zend_ast_zval), 1);
+        memcpy(copy, ast, sizeof(zend_ast_zval));
+        if (Z_TYPE_P(zv) == IS_STRING) {
+            // ZVAL_STR() leaves the line number in u2 alone
+            ZVAL_STR(&copy->val, zend_string_init(Z_STRVAL_P(zv), Z_STRLEN_P(zv), 1));
+        }
+        return (zend_ast *) copy;
+    }
+
+    if (zend_ast_is_special(ast)) {
+        return NULL;
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        zend_ast_list *copy = pecalloc(1, VYRTUE_MACRO_LIST_SIZE(list->children), 1);
+        copy->kind = list->kind;
+        copy->attr = list->attr;
+        copy->lineno = list->lineno;
+        copy->children = list->children;
+        for (i = 0; i < list->children; i++) {
+            if (list->child[i] && NULL == (copy->child[i] = vyrtue_macro_ast_persist(list->child[i]))) {
+                vyrtue_macro_ast_free((zend_ast *) copy);
+                return NULL;
+            }
+        }
+        return (zend_ast *) copy;
+    }
+
+    uint32_t children = zend_ast_get_num_children(ast);
+    zend_ast *copy = pecalloc(1, VYRTUE_MACRO_AST_SIZE(children), 1);
+    copy->kind = ast->kind;
+    copy->attr = ast->attr;
+    copy->lineno = ast->lineno;
+    for (i = 0; i < children; i++) {
+        if (ast->child[i] && NULL == (copy->child[i] = vyrtue_macro_ast_persist(ast->child[i]))) {
+            vyrtue_macro_ast_free(copy);
+            return NULL;
+        }
+    }
+    return copy;
+}
+
+/**
+ * Copies a persistent template back into the AST arena of the file being
+ * compiled.
+ */
+static zend_ast *vyrtue_macro_ast_materialize(zend_ast *ast)
+{
+    zend_ast *children[4] = {NULL};
+    zend_ast *copy;
+    uint32_t i;
+
+    if (ast == NULL) {
+        return NULL;
+    }
+
+    if (ast->kind == ZEND_AST_ZVAL) {
+        zval tmp;
+        ZVAL_COPY_VALUE(&tmp, zend_ast_get_zval(ast));
+        if (Z_TYPE(tmp) == IS_STRING) {
+            ZVAL_STR(&tmp, zend_string_init(Z_STRVAL(tmp), Z_STRLEN(tmp), 0));
+        }
+        copy = zend_ast_create_zval_with_lineno(&tmp, zend_ast_get_lineno(ast));
+        copy->attr = ast->attr;
+        return copy;
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        copy = zend_ast_create_list(0, ast->kind);
+        for (i = 0; i < list->children; i++) {
+            copy = zend_ast_list_add(copy, vyrtue_macro_ast_materialize(list->child[i]));
+        }
+        copy->attr = ast->attr;
+        ((zend_ast_list *) copy)->lineno = list->lineno;
+        return copy;
+    }
+
+    // templates are made by vyrtue_ast_dup(), which has the same limit
+    uint32_t num_children = zend_ast_get_num_children(ast);
+    ZEND_ASSERT(num_children <= sizeof(children) / sizeof(children[0]));
+
+    for (i = 0; i < num_children; i++) {
+        children[i] = vyrtue_macro_ast_materialize(ast->child[i]);
+    }
+
+    switch (num_children) {
+        case 0:
+            copy = zend_ast_create_0(ast->kind);
+            break;
+        case 1:
+            copy = zend_ast_create_1(ast->kind, children[0]);
+            break;
+        case 2:
+            copy = zend_ast_create_2(ast->kind, children[0], children[1]);
+            break;
+        case 3:
+            copy = zend_ast_create_3(ast->kind, children[0], children[1], children[2]);
+            break;
+        default:
+            copy = zend_ast_create_4(ast->kind, children[0], children[1], children[2], children[3]);
+            break;
+    }
+
+    copy->attr = ast->attr;
+    copy->lineno = ast->lineno;
+    return copy;
+}
+
+static void vyrtue_macro_dtor(zval *zv)
+{
+    struct vyrtue_macro *macro = Z_PTR_P(zv);
+
+    zend_string_release_ex(macro->name, 1);
+    vyrtue_macro_ast_free(macro->body);
+
+    for (uint32_t i = 0; i < macro->num_params; i++) {
+        zend_string_release_ex(macro->params[i], 1);
+        vyrtue_macro_ast_free(macro->defaults[i]);
+    }
+
+    pefree(macro, 1);
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static void vyrtue_macro_set_name(zend_ast *name_ast, zend_string *name)
+{
+    zval *zv = zend_ast_get_zval(name_ast);
+
+    zval_ptr_dtor_nogc(zv);
+    ZVAL_STR(zv, name);
+    name_ast->attr = ZEND_NAME_FQ;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_macro_qualify_class(zend_ast *name_ast, struct vyrtue_context *ctx)
+{
+    zend_string *name;
+
+    // dynamic class names are checked like any other expression
+    if (name_ast->kind != ZEND_AST_ZVAL) {
+        return true;
+    }
+
+    name = zend_ast_get_str(name_ast);
+
+    // self, static and parent have no meaning outside of the declaring scope
+    if (name_ast->attr == ZEND_NAME_NOT_FQ &&
+        (zend_string_equals_literal_ci(name, "self") || zend_string_equals_literal_ci(name, "static") ||
+         zend_string_equals_literal_ci(name, "parent"))) {
+        return false;
+    }
+
+    name = vyrtue_resolve_class_name(name, name_ast->attr, ctx);
+    if (name == NULL) {
+        return false;
+    }
+
+    vyrtue_macro_set_name(name_ast, name);
+    return true;
+}
+
+/**
+ * An unqualified function or constant in a namespace falls back to the
+ * global one at runtime. That can only be decided in advance for names that
+ * already exist.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_macro_qualify_function(zend_ast *name_ast, struct vyrtue_context *ctx)
+{
+    zend_string *orig = zend_ast_get_str(name_ast);
+    bool is_fully_qualified;
+
+    zend_string *name = vyrtue_resolve_function_name(orig, name_ast->attr, &is_fully_qualified, ctx);
+
+    if (!is_fully_qualified && ctx->current_namespace != NULL && NULL == zend_hash_find_ptr_lc(EG(function_table), name)) {
+        zend_string_release(name);
+        if (NULL == zend_hash_find_ptr_lc(EG(function_table), orig)) {
+            return false;
+        }
+        name = zend_string_copy(orig);
+    }
+
+    vyrtue_macro_set_name(name_ast, name);
+    return true;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_macro_qualify_const(zend_ast *name_ast, struct vyrtue_context *ctx)
+{
+    zend_string *orig = zend_ast_get_str(name_ast);
+    bool is_fully_qualified;
+
+    if (name_ast->attr == ZEND_NAME_NOT_FQ &&
+        (zend_string_equals_literal_ci(orig, "true") || zend_string_equals_literal_ci(orig, "false") ||
+         zend_string_equals_literal_ci(orig, "null"))) {
+        return true;
+    }
+
+    zend_string *name = vyrtue_resolve_const_name(orig, name_ast->attr, &is_fully_qualified, ctx);
+
+    if (!is_fully_qualified && ctx->current_namespace != NULL &&
+        NULL == zend_get_constant_ex(name, NULL, ZEND_FETCH_CLASS_SILENT)) {
+        zend_string_release(name);
+        if (NULL == zend_get_constant_ex(orig, NULL, ZEND_FETCH_CLASS_SILENT)) {
+            return false;
+        }
+        name = zend_string_copy(orig);
+    }
+
+    vyrtue_macro_set_name(name_ast, name);
+    return true;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_macro_is_forbidden_call(zend_string *name, zend_string *macro_name)
+{
+    // these see the variables of the caller, which would defeat renaming
+    static const char *const functions[] = {
+        "func_get_args",
+        "func_get_arg",
+        "func_num_args",
+        "get_defined_vars",
+        "compact",
+        "extract",
+    };
+
+    // recursion would be expanded forever
+    if (zend_string_equals_ci(name, macro_name)) {
+        return true;
+    }
+
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        if (0 == zend_binary_strcasecmp(ZSTR_VAL(name), ZSTR_LEN(name), functions[i], strlen(functions[i]))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Checks that a copy of the macro body can be expanded anywhere, and fully
+ * qualifies the names in it.
+ */
+static bool vyrtue_macro_prepare(zend_ast *ast, zend_string *macro_name, uint32_t loop_depth, struct vyrtue_context *ctx)
+{
+    uint32_t i;
+
+    if (ast == NULL || ast->kind == ZEND_AST_ZVAL) {
+        return true;
+    }
+
+    switch (ast->kind) {
+        case ZEND_AST_VAR:
+            return ast->child[0]->kind == ZEND_AST_ZVAL && Z_TYPE_P(zend_ast_get_zval(ast->child[0])) == IS_STRING &&
+                !zend_string_equals_literal(zend_ast_get_str(ast->child[0]), "this");
+
+        case ZEND_AST_MAGIC_CONST:
+        case ZEND_AST_YIELD:
+        case ZEND_AST_YIELD_FROM:
+        case ZEND_AST_INCLUDE_OR_EVAL:
+        case ZEND_AST_RETURN:
+        case ZEND_AST_STATIC:
+        case ZEND_AST_GLOBAL:
+        case ZEND_AST_GOTO:
+        case ZEND_AST_LABEL:
+        case ZEND_AST_HALT_COMPILER:
+            return false;
+
+        case ZEND_AST_BREAK:
+        case ZEND_AST_CONTINUE: {
+            // must not leave the expansion
+            zend_long depth = 1;
+            if (ast->child[0] != NULL) {
+                if (ast->child[0]->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(ast->child[0])) != IS_LONG) {
+                    return false;
+                }
+                depth = Z_LVAL_P(zend_ast_get_zval(ast->child[0]));
+            }
+            return depth >= 1 && (zend_ulong) depth <= loop_depth;
+        }
+
+        case ZEND_AST_WHILE:
+        case ZEND_AST_DO_WHILE:
+        case ZEND_AST_FOR:
+        case ZEND_AST_FOREACH:
+        case ZEND_AST_SWITCH:
+            loop_depth++;
+            break;
+
+        case ZEND_AST_CALL:
+            if (ast->child[0]->kind == ZEND_AST_ZVAL) {
+                if (!vyrtue_macro_qualify_function(ast->child[0], ctx) ||
+                    vyrtue_macro_is_forbidden_call(zend_ast_get_str(ast->child[0]), macro_name)) {
+                    return false;
+                }
+            }
+            break;
+
+        case ZEND_AST_CONST:
+            if (!vyrtue_macro_qualify_const(ast->child[0], ctx)) {
+                return false;
+            }
+            break;
+
+        case ZEND_AST_NEW:
+        case ZEND_AST_STATIC_CALL:
+        case ZEND_AST_STATIC_PROP:
+        case ZEND_AST_CLASS_CONST:
+        case ZEND_AST_CLASS_NAME:
+            if (!vyrtue_macro_qualify_class(ast->child[0], ctx)) {
+                return false;
+            }
+            break;
+
+        case ZEND_AST_INSTANCEOF:
+            if (!vyrtue_macro_qualify_class(ast->child[1], ctx)) {
+                return false;
+            }
+            break;
+
+        case ZEND_AST_CATCH: {
+            zend_ast_list *classes = zend_ast_get_list(ast->child[0]);
+            for (i = 0; i < classes->children; i++) {
+                if (!vyrtue_macro_qualify_class(classes->child[i], ctx)) {
+                    return false;
+                }
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        for (i = 0; i < list->children; i++) {
+            if (!vyrtue_macro_prepare(list->child[i], macro_name, loop_depth, ctx)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint32_t children = zend_ast_get_num_children(ast);
+    for (i = 0; i < children; i++) {
+        if (!vyrtue_macro_prepare(ast->child[i], macro_name, loop_depth, ctx)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static int vyrtue_macro_find_param(struct vyrtue_macro *macro, zend_string *name)
+{
+    for (uint32_t i = 0; i < macro->num_params; i++) {
+        if (zend_string_equals(macro->params[i], name)) {
+            return (int) i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Finds the parameters the body writes to. An expanded macro writes to the
+ * caller's variables, so each of them has to be declared by reference for
+ * the function to behave the same when it is called instead, e.g. from a
+ * file compiled before the macro was declared. Arguments of calls that can't
+ * be resolved here may be passed by reference and count as writes.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static uint32_t vyrtue_macro_find_writes(zend_ast *ast, struct vyrtue_macro *macro, bool write)
+{
+    uint32_t writes = 0;
+    uint32_t i;
+
+    if (ast->kind == ZEND_AST_ZVAL) {
+        return 0;
+    }
+
+    switch (ast->kind) {
+        case ZEND_AST_VAR:
+            if (write && ast->child[0]->kind == ZEND_AST_ZVAL) {
+                int param = vyrtue_macro_find_param(macro, zend_ast_get_str(ast->child[0]));
+                return param >= 0 ? 1u << param : 0;
+            }
+            break;
+
+        case ZEND_AST_ASSIGN:
+        case ZEND_AST_ASSIGN_REF:
+        case ZEND_AST_ASSIGN_OP:
+        case ZEND_AST_ASSIGN_COALESCE:
+            return vyrtue_macro_find_writes(ast->child[0], macro, true) | vyrtue_macro_find_writes(ast->child[1], macro, false);
+
+        case ZEND_AST_PRE_INC:
+        case ZEND_AST_PRE_DEC:
+        case ZEND_AST_POST_INC:
+        case ZEND_AST_POST_DEC:
+        case ZEND_AST_UNSET:
+        case ZEND_AST_REF:
+            return vyrtue_macro_find_writes(ast->child[0], macro, true);
+
+        case ZEND_AST_DIM:
+        case ZEND_AST_PROP:
+            // $a[$i] = 1 writes to $a, but not to $i
+            return vyrtue_macro_find_writes(ast->child[0], macro, write) |
+                (ast->child[1] ? vyrtue_macro_find_writes(ast->child[1], macro, false) : 0);
+
+        case ZEND_AST_ARRAY_ELEM:
+            // [&$x]
+            if (ast->attr) {
+                return vyrtue_macro_find_writes(ast->child[0], macro, true) |
+                    (ast->child[1] ? vyrtue_macro_find_writes(ast->child[1], macro, false) : 0);
+            }
+            break;
+
+        case ZEND_AST_FOREACH:
+            // foreach ($a as &$v) writes to $a
+            writes = vyrtue_macro_find_writes(ast->child[0], macro, ast->child[1]->kind == ZEND_AST_REF) |
+                vyrtue_macro_find_writes(ast->child[1], macro, true);
+            if (ast->child[2]) {
+                writes |= vyrtue_macro_find_writes(ast->child[2], macro, true);
+            }
+            return writes | vyrtue_macro_find_writes(ast->child[3], macro, false);
+
+        case ZEND_AST_CATCH:
+            if (ast->child[1]) {
+                int param = vyrtue_macro_find_param(macro, zend_ast_get_str(ast->child[1]));
+                writes = param >= 0 ? 1u << param : 0;
+            }
+            return writes | vyrtue_macro_find_writes(ast->child[2], macro, false);
+
+        case ZEND_AST_CALL: {
+            zend_function *fbc = NULL;
+            zend_ast_list *args;
+
+            if (ast->child[0]->kind == ZEND_AST_ZVAL) {
+                fbc = zend_hash_find_ptr_lc(EG(function_table), zend_ast_get_str(ast->child[0]));
+            } else {
+                writes = vyrtue_macro_find_writes(ast->child[0], macro, false);
+            }
+
+            if (ast->child[1]->kind != ZEND_AST_ARG_LIST) {
+                return writes;
+            }
+
+            args = zend_ast_get_list(ast->child[1]);
+            for (i = 0; i < args->children; i++) {
+                bool by_ref = fbc == NULL || args->child[i]->kind == ZEND_AST_NAMED_ARG ||
+                    args->child[i]->kind == ZEND_AST_UNPACK || ARG_MAY_BE_SENT_BY_REF(fbc, i + 1) ||
+                    ARG_SHOULD_BE_SENT_BY_REF(fbc, i + 1);
+                writes |= vyrtue_macro_find_writes(args->child[i], macro, by_ref);
+            }
+            return writes;
+        }
+
+        case ZEND_AST_STATIC_CALL:
+        case ZEND_AST_METHOD_CALL:
+        case ZEND_AST_NULLSAFE_METHOD_CALL:
+        case ZEND_AST_NEW: {
+            // the argument list comes last
+            uint32_t children = zend_ast_get_num_children(ast);
+            for (i = 0; i < children; i++) {
+                if (ast->child[i] != NULL) {
+                    writes |= vyrtue_macro_find_writes(ast->child[i], macro, i == children - 1);
+                }
+            }
+            return writes;
+        }
+
+        default:
+            break;
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        for (i = 0; i < list->children; i++) {
+            if (list->child[i] != NULL) {
+                writes |= vyrtue_macro_find_writes(list->child[i], macro, write);
+            }
+        }
+        return writes;
+    }
+
+    uint32_t children = zend_ast_get_num_children(ast);
+    for (i = 0; i < children; i++) {
+        if (ast->child[i] != NULL) {
+            writes |= vyrtue_macro_find_writes(ast->child[i], macro, write);
+        }
+    }
+
+    return writes;
+}
+
+/**
+ * Copies, prepares and persists part of the declaration.
+ */
+static zend_ast *vyrtue_macro_capture(zend_ast *ast, zend_string *macro_name, struct vyrtue_context *ctx)
+{
+    zend_ast *copy = vyrtue_ast_dup(ast);
+    zend_ast *result = NULL;
+
+    if (copy == NULL) {
+        return NULL;
+    }
+
+    if (vyrtue_macro_prepare(copy, macro_name, 0, ctx)) {
+        result = vyrtue_macro_ast_persist(copy);
+    }
+
+    zend_ast_destroy(copy);
+
+    return result;
+}
+
+/**
+ * Captures functions marked #[VyrtueExt\Macro]. The body is either a single
+ * return statement, whose expression replaces calls anywhere, or statements
+ * without a return, which replace calls used as statements. Parameters the
+ * body writes to must be declared by reference, so that calls compiled
+ * before the declaration, which still reach the function, behave the same.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_macro_attribute_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_decl *decl = (zend_ast_decl *) ast;
+    struct vyrtue_macro *macro;
+    zend_ast_list *stmts;
+    zend_ast_list *params;
+    uint32_t i;
+
+    if (ast->kind != ZEND_AST_FUNC_DECL) {
+        zend_error(E_COMPILE_WARNING, "vyrtue: #[VyrtueExt\\Macro] is only supported on functions");
+        return NULL;
+    }
+
+    zend_string *name = ctx->current_namespace ? zend_string_concat3(
+                                                     ZSTR_VAL(ctx->current_namespace),
+                                                     ZSTR_LEN(ctx->current_namespace),
+                                                     "\\",
+                                                     1,
+                                                     ZSTR_VAL(decl->name),
+                                                     ZSTR_LEN(decl->name)
+                                                 )
+                                               : zend_string_copy(decl->name);
+
+    params = zend_ast_get_list(decl->child[0]);
+    if ((decl->flags & ZEND_ACC_RETURN_REFERENCE) || decl->child[2] == NULL || params->children > VYRTUE_MACRO_MAX_PARAMS) {
+        goto unsupported;
+    }
+
+    for (i = 0; i < params->children; i++) {
+        if (params->child[i]->attr & ZEND_PARAM_VARIADIC) {
+            goto unsupported;
+        }
+    }
+
+    macro = pecalloc(1, sizeof(*macro), 1);
+    macro->name = zend_string_init(ZSTR_VAL(name), ZSTR_LEN(name), 1);
+    macro->num_params = params->children;
+
+    for (i = 0; i < params->children; i++) {
+        zend_string *param_name = zend_ast_get_str(params->child[i]->child[1]);
+        zend_ast *default_ast = params->child[i]->child[2];
+
+        macro->params[i] = zend_string_init(ZSTR_VAL(param_name), ZSTR_LEN(param_name), 1);
+        if (params->child[i]->attr & ZEND_PARAM_REF) {
+            macro->by_ref |= 1u << i;
+        }
+        if (default_ast && NULL == (macro->defaults[i] = vyrtue_macro_capture(default_ast, name, ctx))) {
+            goto fail;
+        }
+    }
+
+    stmts = zend_ast_get_list(decl->child[2]);
+    if (stmts->children == 1 && stmts->child[0]->kind == ZEND_AST_RETURN && stmts->child[0]->child[0] != NULL) {
+        macro->body = vyrtue_macro_capture(stmts->child[0]->child[0], name, ctx);
+    } else {
+        macro->is_stmt = true;
+        macro->body = vyrtue_macro_capture(decl->child[2], name, ctx);
+    }
+
+    if (macro->body == NULL) {
+        goto fail;
+    }
+
+    uint32_t writes = vyrtue_macro_find_writes(macro->body, macro, false) & ~macro->by_ref;
+    for (i = 0; i < macro->num_params; i++) {
+        if (writes & (1u << i)) {
+            zend_error(
+                E_COMPILE_WARNING,
+                "vyrtue: cannot use %s() as a macro, parameter $%s is written to and must be declared by reference",
+                ZSTR_VAL(name),
+                ZSTR_VAL(macro->params[i])
+            );
+            zval tmp;
+            ZVAL_PTR(&tmp, macro);
+            vyrtue_macro_dtor(&tmp);
+            zend_string_release(name);
+            return NULL;
+        }
+    }
+
+    if (VYRTUE_G(macros) == NULL) {
+        VYRTUE_G(macros) = pemalloc(sizeof(HashTable), 1);
+        zend_hash_init(VYRTUE_G(macros), 8, NULL, vyrtue_macro_dtor, 1);
+    }
+
+    // registering is a side effect a cached AST would not repeat
+    ctx->ast_cache_skip = true;
+
+    // a recompiled file replaces its macros
+    zend_string *lcname = zend_string_tolower(name);
+    zend_hash_str_update_ptr(VYRTUE_G(macros), ZSTR_VAL(lcname), ZSTR_LEN(lcname), macro);
+    zend_string_release(lcname);
+    zend_string_release(name);
+
+    return NULL;
+
+fail: {
+    zval tmp;
+    ZVAL_PTR(&tmp, macro);
+    vyrtue_macro_dtor(&tmp);
+}
+
+unsupported:
+    zend_error(E_COMPILE_WARNING, "vyrtue: cannot use %s() as a macro", ZSTR_VAL(name));
+    zend_string_release(name);
+    return NULL;
+}
+
+/**
+ * Replaces parameters with copies of their arguments, and renames all other
+ * local variables to temporaries so they can't clash with the caller's.
+ */
+static void vyrtue_macro_substitute(
+    zend_ast **ast_ptr, struct vyrtue_macro *macro, zend_ast **bound, HashTable *locals, struct vyrtue_context *ctx
+)
+{
+    zend_ast *ast = *ast_ptr;
+    uint32_t i;
+
+    if (ast == NULL || ast->kind == ZEND_AST_ZVAL) {
+        return;
+    }
+
+    if (ast->kind == ZEND_AST_VAR) {
+        zend_string *name = zend_ast_get_str(ast->child[0]);
+        int param = vyrtue_macro_find_param(macro, name);
+
+        if (param >= 0) {
+            *ast_ptr = vyrtue_ast_dup(bound[param]);
+        } else if (zend_is_auto_global(name)) {
+            return;
+        } else {
+            zend_string *tmp_name = zend_hash_find_ptr(locals, name);
+            if (tmp_name == NULL) {
+                *ast_ptr = vyrtue_context_create_temporary_var(ctx);
+                zend_hash_add_new_ptr(locals, name, zend_ast_get_str((*ast_ptr)->child[0]));
+            } else {
+                *ast_ptr = zend_ast_create(ZEND_AST_VAR, zend_ast_create_zval_from_str(zend_string_copy(tmp_name)));
+            }
+        }
+
+        zend_ast_destroy(ast);
+        return;
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        for (i = 0; i < list->children; i++) {
+            vyrtue_macro_substitute(&list->child[i], macro, bound, locals, ctx);
+        }
+    } else {
+        uint32_t children = zend_ast_get_num_children(ast);
+        for (i = 0; i < children; i++) {
+            vyrtue_macro_substitute(&ast->child[i], macro, bound, locals, ctx);
+        }
+    }
+}
+
+/**
+ * Checks for the expressions PHP accepts as a by-reference argument.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_macro_is_variable(zend_ast *ast)
+{
+    return ast->kind == ZEND_AST_VAR || ast->kind == ZEND_AST_DIM || ast->kind == ZEND_AST_PROP ||
+        ast->kind == ZEND_AST_STATIC_PROP;
+}
+
+/**
+ * Expands calls to macros. Arguments are substituted as written, like the
+ * parameters of a C macro, so they are evaluated once per use.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_macro_call_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast *bound[VYRTUE_MACRO_MAX_PARAMS] = {NULL};
+    zend_ast *name_ast = ast->child[0];
+    struct vyrtue_macro *macro;
+    zend_ast_list *args;
+    bool is_fully_qualified;
+    HashTable locals;
+    uint32_t i;
+
+    if (EXPECTED(VYRTUE_G(macros) == NULL)) {
+        return NULL;
+    }
+
+    if (name_ast->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(name_ast)) != IS_STRING) {
+        return NULL;
+    }
+
+    zend_string *name = vyrtue_resolve_function_name(zend_ast_get_str(name_ast), name_ast->attr, &is_fully_qualified, ctx);
+    macro = zend_hash_find_ptr_lc(VYRTUE_G(macros), name);
+    if (macro == NULL && !is_fully_qualified && ctx->current_namespace != NULL) {
+        macro = zend_hash_find_ptr_lc(VYRTUE_G(macros), zend_ast_get_str(name_ast));
+    }
+    zend_string_release(name);
+
+    if (macro == NULL) {
+        return NULL;
+    }
+
+    args = vyrtue_ast_get_call_args(ast);
+    if (args == NULL || args->children > macro->num_params || vyrtue_context_in_const_expr(ctx)) {
+        return NULL;
+    }
+
+    for (i = args->children; i < macro->num_params; i++) {
+        // missing argument, let the runtime throw
+        if (macro->defaults[i] == NULL) {
+            return NULL;
+        }
+    }
+
+    if (macro->is_stmt) {
+        struct vyrtue_context_stack *stack = &ctx->node_stack;
+        if (stack->i < 2 || stack->data[stack->i - 2].ast->kind != ZEND_AST_STMT_LIST) {
+            zend_error(E_COMPILE_WARNING, "vyrtue: macro %s() has no value and can only be used as a statement", ZSTR_VAL(macro->name));
+            return NULL;
+        }
+    }
+
+    if (UNEXPECTED(ctx->macro_expansions >= VYRTUE_MACRO_MAX_EXPANSIONS)) {
+        if (ctx->macro_expansions++ == VYRTUE_MACRO_MAX_EXPANSIONS) {
+            zend_error(E_COMPILE_WARNING, "vyrtue: too many macro expansions, remaining calls are left as they are");
+        }
+        return NULL;
+    }
+
+    for (i = 0; i < macro->num_params; i++) {
+        if (!(macro->by_ref & (1u << i))) {
+            continue;
+        }
+        // defaults are literals, so the function has to be called to get a variable to bind them to
+        if (i >= args->children) {
+            return NULL;
+        }
+        if (!vyrtue_macro_is_variable(args->child[i])) {
+            zend_error(
+                E_COMPILE_WARNING,
+                "vyrtue: argument #%" PRIu32 " of macro %s() is passed by reference and must be a variable",
+                i + 1,
+                ZSTR_VAL(macro->name)
+            );
+            return NULL;
+        }
+    }
+
+    // closures and anonymous classes can't be copied into every use
+    for (i = 0; i < macro->num_params; i++) {
+        bound[i] = i < args->children ? vyrtue_ast_dup(args->child[i]) : vyrtue_macro_ast_materialize(macro->defaults[i]);
+        if (bound[i] == NULL) {
+            goto done;
+        }
+    }
+
+    ctx->macro_expansions++;
+
+    zend_ast *body = vyrtue_macro_ast_materialize(macro->body);
+
+    zend_hash_init(&locals, 8, NULL, NULL, 0);
+    vyrtue_macro_substitute(&body, macro, bound, &locals, ctx);
+    zend_hash_destroy(&locals);
+
+#ifdef VYRTUE_DEBUG
+    if (VYRTUE_DEBUG_ENABLED(VYRTUE_DEBUG_MACRO)) {
+        vyrtue_debug_log(VYRTUE_DEBUG_MACRO, "VYRTUE_MACRO: %.*s\n", (int) ZSTR_LEN(macro->name), ZSTR_VAL(macro->name));
+    }
+#endif
+
+    for (i = 0; i < macro->num_params; i++) {
+        zend_ast_destroy(bound[i]);
+    }
+
+    return body;
+
+done:
+    for (i = 0; i < macro->num_params; i++) {
+        if (bound[i]) {
+            zend_ast_destroy(bound[i]);
+        }
+    }
+
+    return NULL;
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_macro)
+{
+    zend_string *tmp;
+
+    tmp = zend_string_init_interned(ZEND_STRL("VyrtueExt\\Macro"), 1);
+    vyrtue_register_attribute_visitor("vyrtue internal macro", tmp, NULL, vyrtue_macro_attribute_leave);
+    zend_string_release(tmp);
+
+    vyrtue_register_kind_visitor("vyrtue internal macro", ZEND_AST_CALL, NULL, vyrtue_macro_call_leave);
+
+    return SUCCESS;
+}
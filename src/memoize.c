@@ -0,0 +1,418 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_compile.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "ast.h"
+#include "context.h"
+
+enum vyrtue_memoize_param_type
+{
+    // untyped or union typed, checked at runtime
+    VYRTUE_MEMOIZE_PARAM_ANY,
+    // a scalar builtin type, possibly nullable
+    VYRTUE_MEMOIZE_PARAM_SCALAR,
+    // exactly int or string, usable as an array key as-is
+    VYRTUE_MEMOIZE_PARAM_KEY,
+    VYRTUE_MEMOIZE_PARAM_INVALID,
+};
+
+VYRTUE_ATTR_NONNULL_ALL
+static enum vyrtue_memoize_param_type vyrtue_memoize_get_param_type(zend_ast *param)
+{
+    zend_ast *type_ast = param->child[0];
+    zend_ast *default_ast = param->child[2];
+    static const char *const scalar_types[] = {"bool", "float", "false", "true", "null"};
+
+    if (type_ast == NULL || type_ast->kind == ZEND_AST_TYPE_UNION) {
+        return VYRTUE_MEMOIZE_PARAM_ANY;
+    }
+
+    if (type_ast->kind != ZEND_AST_ZVAL || (type_ast->attr & ~ZEND_TYPE_NULLABLE) != ZEND_NAME_NOT_FQ) {
+        return VYRTUE_MEMOIZE_PARAM_INVALID;
+    }
+
+    zend_string *name = zend_ast_get_str(type_ast);
+
+    if (zend_string_equals_literal_ci(name, "int") || zend_string_equals_literal_ci(name, "string")) {
+        // a null default makes the type implicitly nullable
+        bool nullable = (type_ast->attr & ZEND_TYPE_NULLABLE) || (default_ast && default_ast->kind == ZEND_AST_CONST);
+        return nullable ? VYRTUE_MEMOIZE_PARAM_SCALAR : VYRTUE_MEMOIZE_PARAM_KEY;
+    }
+
+    if (zend_string_equals_literal_ci(name, "mixed")) {
+        return VYRTUE_MEMOIZE_PARAM_ANY;
+    }
+
+    for (size_t i = 0; i < sizeof(scalar_types) / sizeof(scalar_types[0]); i++) {
+        if (zend_binary_strcasecmp(ZSTR_VAL(name), ZSTR_LEN(name), scalar_types[i], strlen(scalar_types[i])) == 0) {
+            return VYRTUE_MEMOIZE_PARAM_SCALAR;
+        }
+    }
+
+    return VYRTUE_MEMOIZE_PARAM_INVALID;
+}
+
+/**
+ * Returns false for bodies that can't be memoized: generators, bare return
+ * statements and functions inspecting their actual arguments.
+ */
+static bool vyrtue_memoize_check_body(zend_ast *ast)
+{
+    uint32_t i;
+
+    if (ast == NULL || zend_ast_is_special(ast)) {
+        // nested declarations have their own returns
+        return true;
+    }
+
+    switch (ast->kind) {
+        case ZEND_AST_YIELD:
+        case ZEND_AST_YIELD_FROM:
+            return false;
+
+        case ZEND_AST_RETURN:
+            if (ast->child[0] == NULL) {
+                return false;
+            }
+            break;
+
+        case ZEND_AST_CALL: {
+            zend_ast *name_ast = ast->child[0];
+            if (name_ast->kind == ZEND_AST_ZVAL && Z_TYPE_P(zend_ast_get_zval(name_ast)) == IS_STRING) {
+                zend_string *name = zend_ast_get_str(name_ast);
+                if (zend_string_equals_literal_ci(name, "func_get_args") || zend_string_equals_literal_ci(name, "func_get_arg") ||
+                    zend_string_equals_literal_ci(name, "func_num_args")) {
+                    return false;
+                }
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        for (i = 0; i < list->children; i++) {
+            if (!vyrtue_memoize_check_body(list->child[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint32_t children = zend_ast_get_num_children(ast);
+    for (i = 0; i < children; i++) {
+        if (!vyrtue_memoize_check_body(ast->child[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_memoize_create_dim(zend_ast *var, zend_ast *dim)
+{
+    return zend_ast_create(ZEND_AST_DIM, vyrtue_ast_dup(var), dim);
+}
+
+/**
+ * Rewrites every `return expr;` into `return $cache[$key] = expr;`.
+ */
+static void vyrtue_memoize_rewrite_returns(zend_ast *ast, zend_ast *cache_var, zend_ast *key_var)
+{
+    uint32_t i;
+
+    if (ast == NULL || zend_ast_is_special(ast)) {
+        return;
+    }
+
+    if (ast->kind == ZEND_AST_RETURN) {
+        zend_ast *target = vyrtue_memoize_create_dim(cache_var, vyrtue_ast_dup(key_var));
+        ast->child[0] = zend_ast_create(ZEND_AST_ASSIGN, target, ast->child[0]);
+        return;
+    }
+
+    if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        for (i = 0; i < list->children; i++) {
+            vyrtue_memoize_rewrite_returns(list->child[i], cache_var, key_var);
+        }
+    } else {
+        uint32_t children = zend_ast_get_num_children(ast);
+        for (i = 0; i < children; i++) {
+            vyrtue_memoize_rewrite_returns(ast->child[i], cache_var, key_var);
+        }
+    }
+}
+
+/**
+ * Reads the optional max entries from #[Memoize(100)] or
+ * #[Memoize(maxEntries: 100)]. Returns -1 if the argument is invalid.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_long vyrtue_memoize_get_max_entries(zend_ast *attr)
+{
+    zend_ast *args_ast = attr->child[1];
+    zend_ast *arg;
+
+    if (args_ast == NULL || zend_ast_get_list(args_ast)->children == 0) {
+        return 0;
+    }
+
+    if (zend_ast_get_list(args_ast)->children > 1) {
+        return -1;
+    }
+
+    arg = zend_ast_get_list(args_ast)->child[0];
+    if (arg->kind == ZEND_AST_NAMED_ARG) {
+        if (!zend_string_equals_literal(zend_ast_get_str(arg->child[0]), "maxEntries")) {
+            return -1;
+        }
+        arg = arg->child[1];
+    }
+
+    if (arg->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(arg)) != IS_LONG || Z_LVAL_P(zend_ast_get_zval(arg)) <= 0) {
+        return -1;
+    }
+
+    return Z_LVAL_P(zend_ast_get_zval(arg));
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_memoize_create_param_var(zend_ast *param)
+{
+    return zend_ast_create(ZEND_AST_VAR, zend_ast_create_zval_from_str(zend_string_copy(zend_ast_get_str(param->child[1]))));
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_memoize_create_stmt_list(zend_ast *stmt)
+{
+    return zend_ast_create_list(1, ZEND_AST_STMT_LIST, stmt);
+}
+
+/**
+ * Rewrites the body of
+ *
+ *     #[Memoize(100)] function f($a) { ... return $x; }
+ *
+ * into
+ *
+ *     static $memo = [];
+ *     if (\is_scalar($a) || null === $a) {
+ *         $key = \serialize([$a]);
+ *         if (isset($memo[$key]) || \array_key_exists($key, $memo)) {
+ *             return $memo[$key];
+ *         }
+ *         if (\count($memo) >= 100) {
+ *             unset($memo[\array_key_first($memo)]);
+ *         }
+ *         $cache = &$memo;
+ *     } else {
+ *         $key = 0;
+ *         $cache = [];
+ *     }
+ *     ... return $cache[$key] = $x;
+ *
+ * A single int or string parameter is used as the key directly, and the
+ * runtime check is omitted if all parameters have scalar types.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_memoize_attribute_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_decl *decl = (zend_ast_decl *) ast;
+    zend_ast_list *params;
+    zend_ast *attr;
+    zend_ast *check = NULL;
+    zend_ast *key_expr;
+    zend_ast *return_type = decl->child[3];
+    bool all_keys = true;
+    zend_long max_entries;
+    uint32_t i;
+    zval tmp;
+
+    if (ast->kind != ZEND_AST_FUNC_DECL && !(ast->kind == ZEND_AST_METHOD && (decl->flags & ZEND_ACC_STATIC))) {
+        zend_error(E_COMPILE_WARNING, "vyrtue: #[VyrtueExt\\Memoize] is only supported on functions and static methods");
+        return NULL;
+    }
+
+    attr = vyrtue_ast_find_attribute(decl->child[4], ZEND_STRL("VyrtueExt\\Memoize"), ctx);
+    ZEND_ASSERT(attr != NULL);
+
+    max_entries = vyrtue_memoize_get_max_entries(attr);
+    if (max_entries < 0) {
+        zend_error(E_COMPILE_WARNING, "vyrtue: #[VyrtueExt\\Memoize] max entries must be a positive integer literal");
+        return NULL;
+    }
+
+    if (decl->child[2] == NULL || (decl->flags & ZEND_ACC_RETURN_REFERENCE)) {
+        return NULL;
+    }
+
+    if (return_type && return_type->kind == ZEND_AST_ZVAL &&
+        (zend_string_equals_literal_ci(zend_ast_get_str(return_type), "void") ||
+         zend_string_equals_literal_ci(zend_ast_get_str(return_type), "never"))) {
+        return NULL;
+    }
+
+    if (!vyrtue_memoize_check_body(decl->child[2])) {
+        zend_error(E_COMPILE_WARNING, "vyrtue: #[VyrtueExt\\Memoize] function %s cannot be memoized", ZSTR_VAL(decl->name));
+        return NULL;
+    }
+
+    params = zend_ast_get_list(decl->child[0]);
+
+    for (i = 0; i < params->children; i++) {
+        zend_ast *param = params->child[i];
+        enum vyrtue_memoize_param_type type = vyrtue_memoize_get_param_type(param);
+
+        if (type == VYRTUE_MEMOIZE_PARAM_INVALID || (param->attr & (ZEND_PARAM_REF | ZEND_PARAM_VARIADIC))) {
+            zend_error(E_COMPILE_WARNING, "vyrtue: #[VyrtueExt\\Memoize] function %s must only take scalar parameters by value", ZSTR_VAL(decl->name));
+            if (check) {
+                zend_ast_destroy(check);
+            }
+            return NULL;
+        }
+
+        if (type != VYRTUE_MEMOIZE_PARAM_KEY) {
+            all_keys = false;
+        }
+
+        if (type == VYRTUE_MEMOIZE_PARAM_ANY) {
+            ZVAL_NULL(&tmp);
+            zend_ast *is_null = zend_ast_create_binary_op(ZEND_IS_IDENTICAL, zend_ast_create_zval(&tmp), vyrtue_memoize_create_param_var(param));
+            zend_ast *is_scalar = vyrtue_ast_create_call(ZEND_STRL("is_scalar"), zend_ast_create_list(1, ZEND_AST_ARG_LIST, vyrtue_memoize_create_param_var(param)));
+            zend_ast *cond = zend_ast_create(ZEND_AST_OR, is_scalar, is_null);
+            check = check ? zend_ast_create(ZEND_AST_AND, check, cond) : cond;
+        }
+    }
+
+    if (params->children == 1 && all_keys) {
+        key_expr = vyrtue_memoize_create_param_var(params->child[0]);
+    } else {
+        zend_ast *arr = zend_ast_create_list(0, ZEND_AST_ARRAY);
+        arr->attr = ZEND_ARRAY_SYNTAX_SHORT;
+        for (i = 0; i < params->children; i++) {
+            arr = zend_ast_list_add(arr, zend_ast_create(ZEND_AST_ARRAY_ELEM, vyrtue_memoize_create_param_var(params->child[i]), NULL));
+        }
+        key_expr = vyrtue_ast_create_call(ZEND_STRL("serialize"), zend_ast_create_list(1, ZEND_AST_ARG_LIST, arr));
+    }
+
+    zend_ast *memo_var = vyrtue_context_create_temporary_var(ctx);
+    zend_ast *key_var = vyrtue_context_create_temporary_var(ctx);
+    zend_ast *cache_var = vyrtue_context_create_temporary_var(ctx);
+
+    // static $memo = [];
+    zend_ast *empty = zend_ast_create_list(0, ZEND_AST_ARRAY);
+    empty->attr = ZEND_ARRAY_SYNTAX_SHORT;
+    zend_ast *static_stmt = zend_ast_create(
+        ZEND_AST_STATIC, zend_ast_create_zval_from_str(zend_string_copy(zend_ast_get_str(memo_var->child[0]))), empty
+    );
+
+    // if (isset($memo[$key]) || \array_key_exists($key, $memo)) return $memo[$key];
+    zend_ast *hit_cond = zend_ast_create(
+        ZEND_AST_OR,
+        zend_ast_create(ZEND_AST_ISSET, vyrtue_memoize_create_dim(memo_var, vyrtue_ast_dup(key_var))),
+        vyrtue_ast_create_call(
+            ZEND_STRL("array_key_exists"), zend_ast_create_list(2, ZEND_AST_ARG_LIST, vyrtue_ast_dup(key_var), vyrtue_ast_dup(memo_var))
+        )
+    );
+    zend_ast *hit_stmt = zend_ast_create_list(
+        1,
+        ZEND_AST_IF,
+        zend_ast_create(
+            ZEND_AST_IF_ELEM,
+            hit_cond,
+            vyrtue_memoize_create_stmt_list(zend_ast_create(ZEND_AST_RETURN, vyrtue_memoize_create_dim(memo_var, vyrtue_ast_dup(key_var))))
+        )
+    );
+
+    zend_ast *memo_stmts = zend_ast_create_list(2, ZEND_AST_STMT_LIST, zend_ast_create(ZEND_AST_ASSIGN, vyrtue_ast_dup(key_var), key_expr), hit_stmt);
+
+    if (max_entries > 0) {
+        // if (\count($memo) >= N) unset($memo[\array_key_first($memo)]);
+        zend_ast *count = vyrtue_ast_create_call(ZEND_STRL("count"), zend_ast_create_list(1, ZEND_AST_ARG_LIST, vyrtue_ast_dup(memo_var)));
+        zend_ast *first = vyrtue_ast_create_call(ZEND_STRL("array_key_first"), zend_ast_create_list(1, ZEND_AST_ARG_LIST, vyrtue_ast_dup(memo_var)));
+        zend_ast *evict_stmt = zend_ast_create_list(
+            1,
+            ZEND_AST_IF,
+            zend_ast_create(
+                ZEND_AST_IF_ELEM,
+                zend_ast_create(ZEND_AST_GREATER_EQUAL, count, zend_ast_create_zval_from_long(max_entries)),
+                vyrtue_memoize_create_stmt_list(zend_ast_create(ZEND_AST_UNSET, vyrtue_memoize_create_dim(memo_var, first)))
+            )
+        );
+        memo_stmts = zend_ast_list_add(memo_stmts, evict_stmt);
+    }
+
+    // $cache = &$memo;
+    memo_stmts = zend_ast_list_add(memo_stmts, zend_ast_create(ZEND_AST_ASSIGN_REF, vyrtue_ast_dup(cache_var), vyrtue_ast_dup(memo_var)));
+
+    vyrtue_memoize_rewrite_returns(decl->child[2], cache_var, key_var);
+
+    zend_ast *body = zend_ast_create_list(1, ZEND_AST_STMT_LIST, static_stmt);
+
+    if (check) {
+        // non-scalar arguments write into a throwaway array instead
+        zend_ast *empty_cache = zend_ast_create_list(0, ZEND_AST_ARRAY);
+        empty_cache->attr = ZEND_ARRAY_SYNTAX_SHORT;
+        zend_ast *bypass_stmts = zend_ast_create_list(
+            2,
+            ZEND_AST_STMT_LIST,
+            zend_ast_create(ZEND_AST_ASSIGN, vyrtue_ast_dup(key_var), zend_ast_create_zval_from_long(0)),
+            zend_ast_create(ZEND_AST_ASSIGN, vyrtue_ast_dup(cache_var), empty_cache)
+        );
+        zend_ast *if_stmt = zend_ast_create_list(
+            2, ZEND_AST_IF, zend_ast_create(ZEND_AST_IF_ELEM, check, memo_stmts), zend_ast_create(ZEND_AST_IF_ELEM, NULL, bypass_stmts)
+        );
+        body = zend_ast_list_add(body, if_stmt);
+    } else {
+        body = zend_ast_list_add(body, memo_stmts);
+    }
+
+    decl->child[2] = zend_ast_list_add(body, decl->child[2]);
+
+    zend_ast_destroy(memo_var);
+    zend_ast_destroy(key_var);
+    zend_ast_destroy(cache_var);
+
+    return NULL;
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_memoize)
+{
+    zend_string *tmp;
+
+    tmp = zend_string_init_interned(ZEND_STRL("VyrtueExt\\Memoize"), 1);
+    vyrtue_register_attribute_visitor_ex("vyrtue internal memoize", tmp, NULL, vyrtue_memoize_attribute_leave, VYRTUE_VISITOR_OPTIONAL);
+    zend_string_release(tmp);
+
+    return SUCCESS;
+}
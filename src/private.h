@@ -21,5 +21,41 @@ struct vyrtue_context;
 
 #ifdef VYRTUE_DEBUG
 VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_debug);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_debug_log);
+VYRTUE_LOCAL extern PHP_MSHUTDOWN_FUNCTION(vyrtue_debug_log);
+VYRTUE_LOCAL extern PHP_RSHUTDOWN_FUNCTION(vyrtue_debug_log);
+VYRTUE_LOCAL extern PHP_FUNCTION(vyrtue_debug_dump_log);
 #endif
+VYRTUE_LOCAL extern PHP_FUNCTION(vyrtue_transform_file);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_ast_cache);
+VYRTUE_LOCAL extern PHP_MSHUTDOWN_FUNCTION(vyrtue_ast_cache);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_autoload);
+VYRTUE_LOCAL extern PHP_FUNCTION(vyrtue_autoload);
+VYRTUE_LOCAL extern PHP_FUNCTION(vyrtue_autoload_register);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_filter);
+VYRTUE_LOCAL extern PHP_MSHUTDOWN_FUNCTION(vyrtue_filter);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_fingerprint);
+VYRTUE_LOCAL extern PHP_FUNCTION(vyrtue_fingerprint);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_fold);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_hydrate);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_in_array);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_index);
+VYRTUE_LOCAL extern PHP_FUNCTION(vyrtue_attribute_index);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_inline);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_inject);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_loop);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_macro);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_memoize);
 VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_process);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_shm);
+VYRTUE_LOCAL extern PHP_MSHUTDOWN_FUNCTION(vyrtue_shm);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_sprintf);
+VYRTUE_LOCAL extern PHP_FUNCTION(vyrtue_stats);
+VYRTUE_LOCAL extern PHP_FUNCTION(vyrtue_stats_reset);
+VYRTUE_LOCAL extern PHP_RSHUTDOWN_FUNCTION(vyrtue_stats);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_strip);
+VYRTUE_LOCAL extern PHP_MSHUTDOWN_FUNCTION(vyrtue_strip);
+VYRTUE_LOCAL extern PHP_RSHUTDOWN_FUNCTION(vyrtue_trace);
+VYRTUE_LOCAL extern PHP_MINIT_FUNCTION(vyrtue_userland);
+VYRTUE_LOCAL extern PHP_FUNCTION(vyrtue_register_visitor);
+VYRTUE_LOCAL extern PHP_RSHUTDOWN_FUNCTION(vyrtue_userland);
@@ -0,0 +1,61 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHP_VYRTUE_PROBES_H
+#define PHP_VYRTUE_PROBES_H
+
+/*
+ * USDT probes of the "vyrtue" provider, built with --enable-vyrtue-dtrace.
+ * Each is a single nop until a tracer attaches, e.g.:
+ *
+ *   bpftrace -e 'usdt:./modules/vyrtue.so:vyrtue:file__end { printf("%s %d\n", str(arg0), arg1); }'
+ *
+ * file__start(char *filename)
+ * file__end(char *filename, uint64_t nodes)
+ * visitor__enter(char *visitor, int kind)    before an enter callback
+ * visitor__leave(char *visitor, int kind)    before a leave callback
+ * visitor__return(char *visitor, int kind)   after either
+ * node__replace(char *visitor, int kind, int replacement_kind)
+ *
+ * The filename is "-" when there is no compiled filename.
+ */
+
+#ifdef HAVE_VYRTUE_DTRACE
+#include <sys/sdt.h>
+#include <Zend/zend_types.h>
+
+static inline const char *vyrtue_probe_filename(zend_string *filename)
+{
+    return filename ? ZSTR_VAL(filename) : "-";
+}
+
+#define VYRTUE_PROBE_FILE_START(filename) DTRACE_PROBE1(vyrtue, file__start, filename)
+#define VYRTUE_PROBE_FILE_END(filename, nodes) DTRACE_PROBE2(vyrtue, file__end, filename, nodes)
+#define VYRTUE_PROBE_VISITOR_ENTER(visitor, kind) DTRACE_PROBE2(vyrtue, visitor__enter, visitor, kind)
+#define VYRTUE_PROBE_VISITOR_LEAVE(visitor, kind) DTRACE_PROBE2(vyrtue, visitor__leave, visitor, kind)
+#define VYRTUE_PROBE_VISITOR_RETURN(visitor, kind) DTRACE_PROBE2(vyrtue, visitor__return, visitor, kind)
+#define VYRTUE_PROBE_NODE_REPLACE(visitor, kind, replacement_kind) DTRACE_PROBE3(vyrtue, node__replace, visitor, kind, replacement_kind)
+#else
+#define VYRTUE_PROBE_FILE_START(filename)
+#define VYRTUE_PROBE_FILE_END(filename, nodes)
+#define VYRTUE_PROBE_VISITOR_ENTER(visitor, kind)
+#define VYRTUE_PROBE_VISITOR_LEAVE(visitor, kind)
+#define VYRTUE_PROBE_VISITOR_RETURN(visitor, kind)
+#define VYRTUE_PROBE_NODE_REPLACE(visitor, kind, replacement_kind)
+#endif
+
+#endif
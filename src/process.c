@@ -25,13 +25,22 @@
 #include <Zend/zend_API.h>
 #include <Zend/zend_arena.h>
 #include <Zend/zend_exceptions.h>
+#include <Zend/zend_virtual_cwd.h>
 #include <main/php.h>
 #include <main/php_streams.h>
 #include <ext/standard/php_var.h>
 
 #include "php_vyrtue.h"
+#include "alloc.h"
+#include "ast.h"
+#include "ast_cache.h"
 #include "compile.h"
 #include "context.h"
+#include "debug_log.h"
+#include "filter.h"
+#include "probes.h"
+#include "stats.h"
+#include "trace.h"
 #include "visitor.h"
 
 static zend_ast *vyrtue_ast_walk(zend_ast *ast, struct vyrtue_context *ctx);
@@ -46,27 +55,24 @@ static void dump_ht(HashTable *ht)
 #endif
 
 #ifdef VYRTUE_DEBUG
-static inline void vyrtue_ast_process_debug_dump_ast(zend_ast *ast)
-{
-    zend_string *str = zend_ast_export("", ast, "");
-    fprintf(stderr, "%.*s", (int) str->len, str->val);
-    fflush(stderr);
-    zend_string_release(str);
-}
-
 static void vyrtue_ast_process_debug_replacement(zend_ast *before, zend_ast *after)
 {
-    if (UNEXPECTED(NULL != getenv("PHP_VYRTUE_DEBUG_DUMP_REPLACEMENT"))) {
-        fprintf(stderr, "BEFORE: ");
-        fflush(stderr);
-        vyrtue_ast_process_debug_dump_ast(before);
-        fprintf(stderr, "AFTER: ");
-        fflush(stderr);
-        vyrtue_ast_process_debug_dump_ast(after);
+    if (VYRTUE_DEBUG_ENABLED(VYRTUE_DEBUG_REPLACEMENT)) {
+        zend_string *before_str = zend_ast_export("", before, "");
+        zend_string *after_str = zend_ast_export("", after, "");
+        vyrtue_debug_log(
+            VYRTUE_DEBUG_REPLACEMENT,
+            "BEFORE: %.*sAFTER: %.*s",
+            (int) ZSTR_LEN(before_str),
+            ZSTR_VAL(before_str),
+            (int) ZSTR_LEN(after_str),
+            ZSTR_VAL(after_str)
+        );
+        zend_string_release(before_str);
+        zend_string_release(after_str);
     }
 }
 #else
-#define vyrtue_ast_process_debug_dump_ast(ast)
 #define vyrtue_ast_process_debug_replacement(before, after)
 #endif
 
@@ -113,8 +119,13 @@ static zend_ast *vyrtue_ast_process_namespace_enter(zend_ast *ast, struct vyrtue
     }
 
 #ifdef VYRTUE_DEBUG
-    if (UNEXPECTED(NULL != getenv("PHP_VYRTUE_DEBUG_DUMP_NAMESPACE"))) {
-        fprintf(stderr, "VYRTUE_NAMESPACE: ENTER: %.*s\n", (int) ctx->current_namespace->len, ctx->current_namespace->val);
+    if (VYRTUE_DEBUG_ENABLED(VYRTUE_DEBUG_NAMESPACE)) {
+        vyrtue_debug_log(
+            VYRTUE_DEBUG_NAMESPACE,
+            "VYRTUE_NAMESPACE: ENTER: %.*s\n",
+            ctx->current_namespace ? (int) ZSTR_LEN(ctx->current_namespace) : 0,
+            ctx->current_namespace ? ZSTR_VAL(ctx->current_namespace) : ""
+        );
     }
 #endif
 
@@ -152,6 +163,8 @@ static zend_ast *vyrtue_ast_process_use_enter(zend_ast *ast, struct vyrtue_conte
         return NULL;
     }
 
+    VYRTUE_ALLOC_ENTER(VYRTUE_ALLOC_IMPORTS);
+
     for (i = 0; i < list->children; ++i) {
         zend_ast *use_ast = list->child[i];
         zend_ast *old_name_ast = use_ast->child[0];
@@ -193,8 +206,10 @@ static zend_ast *vyrtue_ast_process_use_enter(zend_ast *ast, struct vyrtue_conte
         }
 
 #ifdef VYRTUE_DEBUG
-        if (UNEXPECTED(NULL != getenv("PHP_VYRTUE_DEBUG_DUMP_USE"))) {
-            fprintf(stderr, "VYRTUE_USE: %.*s => %.*s\n", (int) old_name->len, old_name->val, (int) new_name->len, new_name->val);
+        if (VYRTUE_DEBUG_ENABLED(VYRTUE_DEBUG_USE)) {
+            vyrtue_debug_log(
+                VYRTUE_DEBUG_USE, "VYRTUE_USE: %.*s => %.*s\n", (int) old_name->len, old_name->val, (int) new_name->len, new_name->val
+            );
         }
 #endif
 
@@ -202,6 +217,8 @@ static zend_ast *vyrtue_ast_process_use_enter(zend_ast *ast, struct vyrtue_conte
         zend_string_release_ex(new_name, 0);
     }
 
+    VYRTUE_ALLOC_LEAVE();
+
     return NULL;
 }
 
@@ -217,15 +234,21 @@ static zend_ast *vyrtue_ast_process_group_use_enter(zend_ast *ast, struct vyrtue
     zend_ast_list *list = zend_ast_get_list(ast->child[1]);
 
     for (i = 0; i < list->children; i++) {
-        zend_ast *inline_use, *use = list->child[i];
+        zend_ast *use = list->child[i];
         zval *name_zval = zend_ast_get_zval(use->child[0]);
         zend_string *name = Z_STR_P(name_zval);
         zend_string *compound_ns = zend_concat_names(ZSTR_VAL(ns), ZSTR_LEN(ns), ZSTR_VAL(name), ZSTR_LEN(name));
         zend_string_release_ex(name, 0);
         ZVAL_STR(name_zval, compound_ns);
-        inline_use = zend_ast_create_list(1, ZEND_AST_USE, use);
-        inline_use->attr = ast->attr ? ast->attr : use->attr;
-        zend_ast *replace = vyrtue_ast_process_use_enter(inline_use, ctx);
+
+        // only read by use_enter, so it doesn't need to outlive the call or take space in the arena
+        zend_ast_list inline_use = {
+            .kind = ZEND_AST_USE,
+            .attr = ast->attr ? ast->attr : use->attr,
+            .children = 1,
+            .child = {use},
+        };
+        zend_ast *replace = vyrtue_ast_process_use_enter((zend_ast *) &inline_use, ctx);
 
         if (UNEXPECTED(replace != NULL)) {
             zend_throw_exception(zend_ce_parse_error, "vyrtue visitor attempted to replace invalid AST node", 0);
@@ -247,6 +270,74 @@ static zend_ast *vyrtue_ast_process_group_use_leave(zend_ast *ast, struct vyrtue
     return NULL;
 }
 
+/**
+ * Called once per file, when it first exceeds vyrtue.max_process_ms or
+ * vyrtue.max_nodes. From then on only mandatory visitors run.
+ */
+VYRTUE_ATTR_NONNULL(1, 2)
+static zend_never_inline void vyrtue_ast_budget_exceeded(struct vyrtue_context *ctx, const char *setting, const char *visitor)
+{
+    zend_string *filename = zend_get_compiled_filename();
+
+    ctx->budget_exceeded = true;
+
+    if (visitor) {
+        zend_error(
+            E_WARNING,
+            "vyrtue: %s exceeded %s in visitor \"%s\", skipping optional visitors for the rest of the file",
+            filename ? ZSTR_VAL(filename) : "-",
+            setting,
+            visitor
+        );
+    } else {
+        zend_error(
+            E_WARNING, "vyrtue: %s exceeded %s, skipping optional visitors for the rest of the file", filename ? ZSTR_VAL(filename) : "-", setting
+        );
+    }
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+static zend_always_inline zend_ast *
+vyrtue_ast_call_visitor(const struct vyrtue_visitor *visitor, vyrtue_ast_callback fn, bool enter, zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast *rv;
+    zend_ast_kind kind = ast->kind;
+
+    if (enter) {
+        VYRTUE_PROBE_VISITOR_ENTER(visitor->name, kind);
+    } else {
+        VYRTUE_PROBE_VISITOR_LEAVE(visitor->name, kind);
+    }
+
+    if (EXPECTED(!ctx->stats_enabled && !ctx->trace_enabled && !ctx->budget_deadline)) {
+        rv = fn(ast, ctx);
+    } else {
+        // inclusive, the internal call visitor's time includes that of the function visitors it dispatches to
+        uint64_t start = vyrtue_stats_now();
+        rv = fn(ast, ctx);
+        uint64_t duration = vyrtue_stats_now() - start;
+
+        if (ctx->stats_enabled) {
+            vyrtue_stats_visitor_call(&ctx->stats, visitor->stats_slot, enter, rv != NULL && rv != ast, duration);
+        }
+        if (ctx->trace_enabled) {
+            vyrtue_trace_visitor(visitor->name, enter, start, duration);
+        }
+        if (ctx->budget_deadline && !ctx->budget_exceeded && start + duration > ctx->budget_deadline) {
+            vyrtue_ast_budget_exceeded(ctx, "vyrtue.max_process_ms", visitor->name);
+        }
+    }
+
+    VYRTUE_PROBE_VISITOR_RETURN(visitor->name, kind);
+    if (rv != NULL && rv != ast) {
+        VYRTUE_PROBE_NODE_REPLACE(visitor->name, kind, rv->kind);
+        ctx->budget_last_replacement = visitor->name;
+    }
+
+    return rv;
+}
+
 VYRTUE_ATTR_NONNULL_ALL
 VYRTUE_ATTR_WARN_UNUSED_RESULT
 static zend_ast *vyrtue_ast_enter_node(zend_ast *ast, const struct vyrtue_visitor_array *visitors, struct vyrtue_context *ctx)
@@ -254,8 +345,14 @@ static zend_ast *vyrtue_ast_enter_node(zend_ast *ast, const struct vyrtue_visito
     zend_ast *rv = NULL;
 
     for (size_t i = 0; i < visitors->length; i++) {
+        if (UNEXPECTED(ctx->budget_exceeded) && (visitors->data[i].flags & VYRTUE_VISITOR_OPTIONAL)) {
+            continue;
+        }
+        if (UNEXPECTED(vyrtue_filter_skip_visitor(ctx->visitor_skip, ctx->visitor_skip_count, visitors->data[i].stats_slot))) {
+            continue;
+        }
         if (visitors->data[i].enter) {
-            rv = visitors->data[i].enter(ast, ctx);
+            rv = vyrtue_ast_call_visitor(&visitors->data[i], visitors->data[i].enter, true, ast, ctx);
             if (rv && ast != rv) {
                 // We can't guarantee the same kind of node will be returned ...
                 return rv;
@@ -273,8 +370,14 @@ static zend_ast *vyrtue_ast_leave_node(zend_ast *ast, const struct vyrtue_visito
     zend_ast *rv = NULL;
 
     for (size_t i = visitors->length; i-- > 0;) {
+        if (UNEXPECTED(ctx->budget_exceeded) && (visitors->data[i].flags & VYRTUE_VISITOR_OPTIONAL)) {
+            continue;
+        }
+        if (UNEXPECTED(vyrtue_filter_skip_visitor(ctx->visitor_skip, ctx->visitor_skip_count, visitors->data[i].stats_slot))) {
+            continue;
+        }
         if (visitors->data[i].leave) {
-            rv = visitors->data[i].leave(ast, ctx);
+            rv = vyrtue_ast_call_visitor(&visitors->data[i], visitors->data[i].leave, false, ast, ctx);
             if (rv && ast != rv) {
                 // We can't guarantee the same kind of node will be returned ...
                 return rv;
@@ -289,25 +392,13 @@ VYRTUE_ATTR_NONNULL_ALL
 VYRTUE_ATTR_WARN_UNUSED_RESULT
 static zend_ast *vyrtue_ast_process_call_enter(zend_ast *ast, struct vyrtue_context *ctx)
 {
-    zend_ast *name_ast = ast->child[0];
-
-    // ignore dynamic calls
-    if (name_ast->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(name_ast)) != IS_STRING) {
-#ifdef VYRTUE_DEBUG
-        if (UNEXPECTED(NULL != getenv("PHP_VYRTUE_DEBUG_CALL"))) {
-            php_error_docref(NULL, E_WARNING, "vyrtue: Dynamic function call");
-        }
-#endif
-        return NULL;
-    }
+    zend_string *name_str = vyrtue_ast_get_call_name(ast, ctx);
 
-    bool is_fully_qualified;
-    zend_string *name_str = vyrtue_resolve_function_name(Z_STR_P(zend_ast_get_zval(name_ast)), name_ast->attr, &is_fully_qualified, ctx);
-    if (!is_fully_qualified) {
-        // ignore unqualified function calls
+    // ignore dynamic calls and unqualified calls that may fall back to the global namespace
+    if (NULL == name_str) {
 #ifdef VYRTUE_DEBUG
-        if (UNEXPECTED(NULL != getenv("PHP_VYRTUE_DEBUG_CALL"))) {
-            php_error_docref(NULL, E_WARNING, "vyrtue: Unqualified function call: %.*s", (int) name_str->len, name_str->val);
+        if (VYRTUE_DEBUG_ENABLED(VYRTUE_DEBUG_CALL)) {
+            vyrtue_debug_log(VYRTUE_DEBUG_CALL, "VYRTUE_CALL: dynamic or unqualified call on line %u\n", zend_ast_get_lineno(ast));
         }
 #endif
         return NULL;
@@ -315,6 +406,8 @@ static zend_ast *vyrtue_ast_process_call_enter(zend_ast *ast, struct vyrtue_cont
 
     const struct vyrtue_visitor_array *visitors = vyrtue_get_function_visitors(name_str);
 
+    zend_string_release(name_str);
+
     return vyrtue_ast_enter_node(ast, visitors, ctx);
 }
 
@@ -322,25 +415,13 @@ VYRTUE_ATTR_NONNULL_ALL
 VYRTUE_ATTR_WARN_UNUSED_RESULT
 static zend_ast *vyrtue_ast_process_call_leave(zend_ast *ast, struct vyrtue_context *ctx)
 {
-    zend_ast *name_ast = ast->child[0];
+    zend_string *name_str = vyrtue_ast_get_call_name(ast, ctx);
 
-    // ignore dynamic calls
-    if (name_ast->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(name_ast)) != IS_STRING) {
+    // ignore dynamic calls and unqualified calls that may fall back to the global namespace
+    if (NULL == name_str) {
 #ifdef VYRTUE_DEBUG
-        if (UNEXPECTED(NULL != getenv("PHP_VYRTUE_DEBUG_CALL"))) {
-            php_error_docref(NULL, E_WARNING, "vyrtue: Dynamic function call");
-        }
-#endif
-        return NULL;
-    }
-
-    bool is_fully_qualified;
-    zend_string *name_str = vyrtue_resolve_function_name(Z_STR_P(zend_ast_get_zval(name_ast)), name_ast->attr, &is_fully_qualified, ctx);
-    if (!is_fully_qualified) {
-        // ignore unqualified function calls
-#ifdef VYRTUE_DEBUG
-        if (UNEXPECTED(NULL != getenv("PHP_VYRTUE_DEBUG_CALL"))) {
-            php_error_docref(NULL, E_WARNING, "vyrtue: Unqualified function call: %.*s", (int) name_str->len, name_str->val);
+        if (VYRTUE_DEBUG_ENABLED(VYRTUE_DEBUG_CALL)) {
+            vyrtue_debug_log(VYRTUE_DEBUG_CALL, "VYRTUE_CALL: dynamic or unqualified call on line %u\n", zend_ast_get_lineno(ast));
         }
 #endif
         return NULL;
@@ -348,6 +429,8 @@ static zend_ast *vyrtue_ast_process_call_leave(zend_ast *ast, struct vyrtue_cont
 
     const struct vyrtue_visitor_array *visitors = vyrtue_get_function_visitors(name_str);
 
+    zend_string_release(name_str);
+
     return vyrtue_ast_leave_node(ast, visitors, ctx);
 }
 
@@ -426,6 +509,7 @@ static zend_ast *vyrtue_ast_process_attributes(zend_ast *ast, zend_ast *parent_a
             }
 
             const struct vyrtue_visitor_array *visitors = vyrtue_get_attribute_visitors(name);
+            zend_string_release(name);
             zend_ast *replace = fn(parent_ast, visitors, ctx);
 
             if (UNEXPECTED(replace != NULL)) {
@@ -469,6 +553,38 @@ static zend_ast *vyrtue_ast_process_class_leave(zend_ast *ast, struct vyrtue_con
     return NULL;
 }
 
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+static zend_ast *vyrtue_ast_process_function_enter(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_decl *decl = (zend_ast_decl *) ast;
+
+    if (decl->child[4]) {
+        zend_ast *replace = vyrtue_ast_process_attributes(decl->child[4], ast, vyrtue_ast_enter_node, ctx);
+        if (UNEXPECTED(replace != NULL)) {
+            return replace;
+        }
+    }
+
+    return NULL;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+VYRTUE_ATTR_WARN_UNUSED_RESULT
+static zend_ast *vyrtue_ast_process_function_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_decl *decl = (zend_ast_decl *) ast;
+
+    if (decl->child[4]) {
+        zend_ast *replace = vyrtue_ast_process_attributes(decl->child[4], ast, vyrtue_ast_leave_node, ctx);
+        if (UNEXPECTED(replace != NULL)) {
+            return replace;
+        }
+    }
+
+    return NULL;
+}
+
 VYRTUE_ATTR_NONNULL_ALL
 VYRTUE_ATTR_WARN_UNUSED_RESULT
 static zend_ast *vyrtue_ast_walk(zend_ast *ast, struct vyrtue_context *ctx)
@@ -477,6 +593,18 @@ static zend_ast *vyrtue_ast_walk(zend_ast *ast, struct vyrtue_context *ctx)
     bool is_scope_ast = vyrtue_process_is_scope_ast(ast);
     const struct vyrtue_visitor_array *visitors = vyrtue_get_kind_visitors(ast->kind);
 
+    // always counted, it's also reported by the file__end probe
+    ctx->stats.nodes++;
+
+    if (UNEXPECTED(ctx->stats.nodes > ctx->budget_nodes) && !ctx->budget_exceeded) {
+        // a file that is large to begin with has no visitor to blame
+        vyrtue_ast_budget_exceeded(ctx, "vyrtue.max_nodes", ctx->budget_last_replacement);
+    } else if (UNEXPECTED(ctx->budget_deadline) && (ctx->stats.nodes & 1023) == 0 && !ctx->budget_exceeded &&
+               vyrtue_stats_now() > ctx->budget_deadline) {
+        // time spent walking, rather than in any one visitor
+        vyrtue_ast_budget_exceeded(ctx, "vyrtue.max_process_ms", NULL);
+    }
+
     // Push stacks
     vyrtue_context_stack_push(&ctx->node_stack, ast);
     if (is_scope_ast) {
@@ -490,10 +618,17 @@ static zend_ast *vyrtue_ast_walk(zend_ast *ast, struct vyrtue_context *ctx)
     }
 
     // Recurse
-    if (vyrtue_process_is_scope_ast(ast)) {
+    if (is_scope_ast) {
+        // the body itself is walked too, so statement list visitors see function and method bodies
         zend_ast_decl *decl = (zend_ast_decl *) ast;
-        if (EXPECTED(decl->child[2])) {
-            vyrtue_ast_walk_recurse(decl->child[2], ctx);
+        zend_ast *body = decl->child[2];
+        if (EXPECTED(body)) {
+            zend_ast *replace_body = vyrtue_ast_walk(body, ctx);
+            if (UNEXPECTED(replace_body != NULL && replace_body != body)) {
+                vyrtue_ast_process_debug_replacement(body, replace_body);
+                zend_ast_destroy(body);
+                decl->child[2] = replace_body;
+            }
         }
     } else {
         vyrtue_ast_walk_recurse(ast, ctx);
@@ -521,17 +656,51 @@ done:
     return NULL;
 }
 
-VYRTUE_PUBLIC
-VYRTUE_ATTR_NONNULL_ALL
-void vyrtue_ast_process_file(zend_ast *ast)
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(1)
+void vyrtue_ast_process_file_ex(zend_ast *ast, const struct vyrtue_ast_cache_key *cache_key)
 {
+    // before the context, so its arena is accounted for
+    bool alloc_tracking = vyrtue_alloc_begin();
     struct vyrtue_context ctx = {
         .arena = zend_arena_create(8 * 1024),
+        .stats_enabled = VYRTUE_G(stats),
+        .trace_enabled = vyrtue_trace_is_enabled(),
+        .budget_nodes = VYRTUE_G(max_nodes) > 0 ? (uint64_t) VYRTUE_G(max_nodes) : UINT64_MAX,
     };
+    uint64_t stats_start = 0;
+    size_t stats_ast_arena_start = 0;
+
+    VYRTUE_PROBE_FILE_START(vyrtue_probe_filename(zend_get_compiled_filename()));
+
+    ctx.visitor_skip = vyrtue_filter_visitors(zend_get_compiled_filename(), &ctx.arena, &ctx.visitor_skip_count);
+
+    if (VYRTUE_G(max_process_ms) > 0) {
+        ctx.budget_deadline = vyrtue_stats_now() + (uint64_t) VYRTUE_G(max_process_ms) * 1000000;
+    }
+
+    if (UNEXPECTED(ctx.stats_enabled || ctx.trace_enabled)) {
+        stats_start = vyrtue_stats_now();
+        stats_ast_arena_start = vyrtue_stats_arena_used(CG(ast_arena));
+    }
 
     vyrtue_context_stack_push(&ctx.scope_stack, ast);
 
-    zend_ast *replace = vyrtue_ast_walk(ast, &ctx);
+    zend_ast *replace = NULL;
+    zend_try
+    {
+        replace = vyrtue_ast_walk(ast, &ctx);
+    }
+    zend_catch
+    {
+        // a fatal error in a visitor, everything else is released with the request
+        if (alloc_tracking) {
+            vyrtue_alloc_abort();
+        }
+        zend_bailout();
+    }
+    zend_end_try();
+
     if (replace != NULL) {
         zend_throw_exception(zend_ce_parse_error, "vyrtue: visitor attempted to replace the root AST node which is unsupported", 0);
     }
@@ -539,15 +708,32 @@ void vyrtue_ast_process_file(zend_ast *ast)
     vyrtue_context_stack_pop(&ctx.scope_stack, ast);
 
 #ifdef VYRTUE_DEBUG
-    if (UNEXPECTED(NULL != getenv("PHP_VYRTUE_DEBUG_DUMP_AST"))) {
+    if (VYRTUE_DEBUG_ENABLED(VYRTUE_DEBUG_AST)) {
         zend_string *str = zend_ast_export("<?php\n", ast, "");
-        fprintf(stderr, "%.*s", (int) str->len, str->val);
+        vyrtue_debug_log(VYRTUE_DEBUG_AST, "%.*s", (int) str->len, str->val);
         zend_string_release(str);
     }
 #endif
 
     vyrtue_end_namespace(&ctx);
 
+    if (ctx.inline_functions) {
+        zend_hash_destroy(ctx.inline_functions);
+    }
+
+    // eval()'d and stdin code can't be invalidated, so only real files are recorded
+    zend_string *filename = zend_get_compiled_filename();
+    if (filename != NULL && IS_ABSOLUTE_PATH(ZSTR_VAL(filename), ZSTR_LEN(filename)) &&
+        NULL == zend_memnstr(ZSTR_VAL(filename), ZEND_STRL("eval()'d code"), ZSTR_VAL(filename) + ZSTR_LEN(filename))) {
+        // an AST cut short or depending on macros from other files can't be replayed
+        if (cache_key != NULL && !ctx.ast_cache_skip && ctx.macro_expansions == 0 && !ctx.budget_exceeded && !EG(exception)) {
+            vyrtue_ast_cache_store(cache_key, ast, &ctx.shm_batch);
+        }
+        vyrtue_shm_commit(filename, &ctx.shm_batch);
+    } else {
+        smart_str_free(&ctx.shm_batch.buf);
+    }
+
     if (UNEXPECTED(vyrtue_context_stack_count(&ctx.scope_stack) > 0)) {
         zend_error(E_WARNING, "vyrtue: ast process ended with %lu items on the scope stack", vyrtue_context_stack_count(&ctx.scope_stack));
     }
@@ -555,7 +741,33 @@ void vyrtue_ast_process_file(zend_ast *ast)
         zend_error(E_WARNING, "vyrtue: ast process ended with %lu items on the node stack", vyrtue_context_stack_count(&ctx.node_stack));
     }
 
+    if (UNEXPECTED(ctx.stats_enabled)) {
+        // nodes created in the compiler's arena, and scratch space in our own
+        ctx.stats.arena_bytes = vyrtue_stats_arena_used(CG(ast_arena)) - stats_ast_arena_start + vyrtue_stats_arena_used(ctx.arena);
+        ctx.stats.time_ns = vyrtue_stats_now() - stats_start;
+        ctx.stats.files = 1;
+        vyrtue_stats_add_file(&ctx.stats, filename);
+    }
+
+    if (UNEXPECTED(ctx.trace_enabled)) {
+        vyrtue_trace_file(filename, stats_start, vyrtue_stats_now() - stats_start);
+    }
+
+    VYRTUE_PROBE_FILE_END(vyrtue_probe_filename(filename), ctx.stats.nodes);
+
+    vyrtue_alloc_claim_arena(ctx.arena);
     zend_arena_destroy(ctx.arena);
+
+    if (alloc_tracking) {
+        vyrtue_alloc_end(ast);
+    }
+}
+
+VYRTUE_PUBLIC
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_ast_process_file(zend_ast *ast)
+{
+    vyrtue_ast_process_file_ex(ast, NULL);
 }
 
 VYRTUE_LOCAL
@@ -566,6 +778,8 @@ PHP_MINIT_FUNCTION(vyrtue_process)
     vyrtue_register_kind_visitor("vyrtue internal", ZEND_AST_NAMESPACE, vyrtue_ast_process_namespace_enter, vyrtue_ast_process_namespace_leave);
     vyrtue_register_kind_visitor("vyrtue internal", ZEND_AST_CALL, vyrtue_ast_process_call_enter, vyrtue_ast_process_call_leave);
     vyrtue_register_kind_visitor("vyrtue internal", ZEND_AST_CLASS, vyrtue_ast_process_class_enter, vyrtue_ast_process_class_leave);
+    vyrtue_register_kind_visitor("vyrtue internal", ZEND_AST_FUNC_DECL, vyrtue_ast_process_function_enter, vyrtue_ast_process_function_leave);
+    vyrtue_register_kind_visitor("vyrtue internal", ZEND_AST_METHOD, vyrtue_ast_process_function_enter, vyrtue_ast_process_function_leave);
 
     return SUCCESS;
 }
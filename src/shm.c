@@ -0,0 +1,517 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+
+#ifndef PHP_WIN32
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_smart_str.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "shm.h"
+
+/*
+ * The segment is an append-only log of records, mapped before the SAPI forks
+ * its workers so that every process shares it. Records of a recompiled file
+ * are marked dead and the log is compacted when it runs out of space.
+ */
+
+#define VYRTUE_SHM_ALIGN(size) ZEND_MM_ALIGNED_SIZE_EX(size, 8)
+
+// PTHREAD_MUTEX_ROBUST is an enum constant in glibc, so it can't be tested with #ifdef
+#if defined(HAVE_PTHREAD_MUTEXATTR_SETROBUST) && defined(HAVE_PTHREAD_MUTEX_CONSISTENT)
+#define VYRTUE_SHM_ROBUST 1
+#endif
+
+struct vyrtue_shm_record
+{
+    uint32_t size;
+    uint8_t type;
+    uint8_t dead;
+    uint16_t argc;
+    // followed by the filename and argc strings, each a uint32_t length and the bytes
+};
+
+#ifndef PHP_WIN32
+struct vyrtue_shm_header
+{
+    pthread_mutex_t lock;
+    size_t size;
+    size_t used;
+    // written under the lock, read without it
+    uint64_t generation;
+    bool full;
+    // set while the log is being modified
+    bool writing;
+};
+
+static struct vyrtue_shm_header *vyrtue_shm = NULL;
+
+static inline char *vyrtue_shm_data(void)
+{
+    return (char *) vyrtue_shm + VYRTUE_SHM_ALIGN(sizeof(struct vyrtue_shm_header));
+}
+
+static inline size_t vyrtue_shm_capacity(void)
+{
+    return vyrtue_shm->size - VYRTUE_SHM_ALIGN(sizeof(struct vyrtue_shm_header));
+}
+
+#ifdef VYRTUE_SHM_ROBUST
+/**
+ * Whether every record of the log lies within it and holds the strings its
+ * header announces.
+ */
+static bool vyrtue_shm_is_valid(void)
+{
+    const char *data = vyrtue_shm_data();
+    size_t pos = 0;
+
+    if (vyrtue_shm->used > vyrtue_shm_capacity()) {
+        return false;
+    }
+
+    while (pos < vyrtue_shm->used) {
+        const struct vyrtue_shm_record *record = (const struct vyrtue_shm_record *) (data + pos);
+        size_t end;
+        size_t p = sizeof(*record);
+
+        if (vyrtue_shm->used - pos < sizeof(*record) || record->size < sizeof(*record) || record->size % 8 != 0 ||
+            record->size > vyrtue_shm->used - pos || record->argc > VYRTUE_SHM_MAX_STRINGS) {
+            return false;
+        }
+
+        end = record->size;
+
+        // the filename, then argc strings
+        for (uint32_t i = 0; i <= record->argc; i++) {
+            uint32_t len;
+            if (end - p < sizeof(len)) {
+                return false;
+            }
+            memcpy(&len, data + pos + p, sizeof(len));
+            p += sizeof(len);
+            if (end - p < len) {
+                return false;
+            }
+            p += len;
+        }
+
+        pos += record->size;
+    }
+
+    return true;
+}
+#endif
+
+static void vyrtue_shm_lock(void)
+{
+    int rv = pthread_mutex_lock(&vyrtue_shm->lock);
+#ifdef VYRTUE_SHM_ROBUST
+    // a process died while holding the lock, possibly halfway through a compaction or an append
+    if (rv == EOWNERDEAD) {
+        if (vyrtue_shm->writing || !vyrtue_shm_is_valid()) {
+            vyrtue_shm->used = 0;
+            vyrtue_shm->full = false;
+            vyrtue_shm->writing = false;
+            __atomic_store_n(&vyrtue_shm->generation, vyrtue_shm->generation + 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_consistent(&vyrtue_shm->lock);
+    }
+#else
+    (void) rv;
+#endif
+}
+
+static void vyrtue_shm_unlock(void)
+{
+    pthread_mutex_unlock(&vyrtue_shm->lock);
+}
+#endif
+
+VYRTUE_ATTR_NONNULL_ALL
+static const char *vyrtue_shm_read_string(const char *p, struct vyrtue_shm_string *str)
+{
+    uint32_t len;
+    memcpy(&len, p, sizeof(len));
+    str->val = p + sizeof(len);
+    str->len = len;
+    return str->val + len;
+}
+
+static void vyrtue_shm_append_string(smart_str *buf, const char *val, size_t len)
+{
+    uint32_t len32 = (uint32_t) len;
+    smart_str_appendl(buf, (const char *) &len32, sizeof(len32));
+    smart_str_appendl(buf, val, len);
+}
+
+VYRTUE_LOCAL
+bool vyrtue_shm_is_enabled(void)
+{
+#ifndef PHP_WIN32
+    return vyrtue_shm != NULL;
+#else
+    return false;
+#endif
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_shm_batch_add(struct vyrtue_shm_batch *batch, uint8_t type, uint32_t argc, const struct vyrtue_shm_string *argv)
+{
+    struct vyrtue_shm_record record = {
+        .type = type,
+        .argc = (uint16_t) argc,
+    };
+
+    ZEND_ASSERT(argc <= VYRTUE_SHM_MAX_STRINGS);
+
+    // the size and filename are filled in on commit
+    smart_str_appendl(&batch->buf, (const char *) &record, sizeof(record));
+    for (uint32_t i = 0; i < argc; i++) {
+        vyrtue_shm_append_string(&batch->buf, argv[i].val, argv[i].len);
+    }
+}
+
+#ifndef PHP_WIN32
+static void vyrtue_shm_compact(void)
+{
+    char *data = vyrtue_shm_data();
+    size_t read = 0;
+    size_t write = 0;
+
+    while (read < vyrtue_shm->used) {
+        struct vyrtue_shm_record *record = (struct vyrtue_shm_record *) (data + read);
+        uint32_t size = record->size;
+
+        if (!record->dead) {
+            if (write != read) {
+                memmove(data + write, data + read, size);
+            }
+            write += size;
+        }
+
+        read += size;
+    }
+
+    vyrtue_shm->used = write;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_shm_is_record_of(const struct vyrtue_shm_record *record, zend_string *filename)
+{
+    struct vyrtue_shm_string record_filename;
+
+    vyrtue_shm_read_string((const char *) (record + 1), &record_filename);
+
+    return record_filename.len == ZSTR_LEN(filename) && 0 == memcmp(record_filename.val, ZSTR_VAL(filename), record_filename.len);
+}
+
+/**
+ * Whether the live records of filename are exactly the len bytes in buf. The
+ * records of a file are always written together, and compaction keeps their
+ * order, so they are contiguous.
+ */
+VYRTUE_ATTR_NONNULL(1)
+static bool vyrtue_shm_is_unchanged(zend_string *filename, const char *buf, size_t len)
+{
+    char *data = vyrtue_shm_data();
+    size_t first = 0;
+    size_t total = 0;
+    size_t pos = 0;
+
+    while (pos < vyrtue_shm->used) {
+        struct vyrtue_shm_record *record = (struct vyrtue_shm_record *) (data + pos);
+
+        if (!record->dead && vyrtue_shm_is_record_of(record, filename)) {
+            if (total == 0) {
+                first = pos;
+            }
+            total += record->size;
+        }
+
+        pos += record->size;
+    }
+
+    return total == len && (len == 0 || 0 == memcmp(data + first, buf, len));
+}
+
+/**
+ * Marks all live records of filename as dead. Returns whether there were any.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_shm_invalidate(zend_string *filename)
+{
+    char *data = vyrtue_shm_data();
+    size_t pos = 0;
+    bool invalidated = false;
+
+    while (pos < vyrtue_shm->used) {
+        struct vyrtue_shm_record *record = (struct vyrtue_shm_record *) (data + pos);
+
+        if (!record->dead && vyrtue_shm_is_record_of(record, filename)) {
+            record->dead = 1;
+            invalidated = true;
+        }
+
+        pos += record->size;
+    }
+
+    return invalidated;
+}
+#endif
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_shm_commit(zend_string *filename, struct vyrtue_shm_batch *batch)
+{
+#ifndef PHP_WIN32
+    smart_str buf = {0};
+    const char *p;
+    const char *end;
+
+    if (!vyrtue_shm_is_enabled()) {
+        smart_str_free(&batch->buf);
+        return;
+    }
+
+    // re-encode with the filename in front of every record, so they can be invalidated individually
+    if (batch->buf.s) {
+        p = ZSTR_VAL(batch->buf.s);
+        end = p + ZSTR_LEN(batch->buf.s);
+
+        while (p < end) {
+            struct vyrtue_shm_record record;
+            struct vyrtue_shm_string str;
+            size_t start = buf.s ? ZSTR_LEN(buf.s) : 0;
+
+            memcpy(&record, p, sizeof(record));
+            p += sizeof(record);
+
+            smart_str_appendl(&buf, (const char *) &record, sizeof(record));
+            vyrtue_shm_append_string(&buf, ZSTR_VAL(filename), ZSTR_LEN(filename));
+            for (uint16_t i = 0; i < record.argc; i++) {
+                p = vyrtue_shm_read_string(p, &str);
+                vyrtue_shm_append_string(&buf, str.val, str.len);
+            }
+
+            size_t size = VYRTUE_SHM_ALIGN(ZSTR_LEN(buf.s) - start);
+            while (ZSTR_LEN(buf.s) - start < size) {
+                smart_str_appendc(&buf, '\0');
+            }
+            ((struct vyrtue_shm_record *) (ZSTR_VAL(buf.s) + start))->size = (uint32_t) size;
+        }
+    }
+
+    smart_str_free(&batch->buf);
+
+    size_t len = buf.s ? ZSTR_LEN(buf.s) : 0;
+    bool warn_full = false;
+
+    vyrtue_shm_lock();
+
+    // recompiling a file usually yields the same records, which must not invalidate every process's cache
+    if (!vyrtue_shm_is_unchanged(filename, len > 0 ? ZSTR_VAL(buf.s) : NULL, len)) {
+        vyrtue_shm->writing = true;
+        vyrtue_shm_invalidate(filename);
+
+        if (vyrtue_shm->used + len > vyrtue_shm_capacity()) {
+            vyrtue_shm_compact();
+        }
+
+        if (vyrtue_shm->used + len > vyrtue_shm_capacity()) {
+            warn_full = !vyrtue_shm->full;
+            vyrtue_shm->full = true;
+        } else if (len > 0) {
+            memcpy(vyrtue_shm_data() + vyrtue_shm->used, ZSTR_VAL(buf.s), len);
+            vyrtue_shm->used += len;
+        }
+
+        vyrtue_shm->writing = false;
+        __atomic_store_n(&vyrtue_shm->generation, vyrtue_shm->generation + 1, __ATOMIC_RELEASE);
+    }
+
+    vyrtue_shm_unlock();
+
+    smart_str_free(&buf);
+
+    // not while holding the lock, an error handler might compile another file
+    if (warn_full) {
+        zend_error(E_WARNING, "vyrtue: shared memory is full, increase vyrtue.shm_size");
+    }
+#else
+    smart_str_free(&batch->buf);
+#endif
+}
+
+#ifndef PHP_WIN32
+/**
+ * Copies the live records of the given type to buf, if they fit in size
+ * bytes. Returns the number of bytes they take.
+ */
+static size_t vyrtue_shm_copy_records(uint8_t type, char *buf, size_t size)
+{
+    char *data = vyrtue_shm_data();
+    size_t needed = 0;
+    size_t pos = 0;
+
+    while (pos < vyrtue_shm->used) {
+        struct vyrtue_shm_record *record = (struct vyrtue_shm_record *) (data + pos);
+
+        if (!record->dead && record->type == type) {
+            if (buf != NULL && needed + record->size <= size) {
+                memcpy(buf + needed, record, record->size);
+            }
+            needed += record->size;
+        }
+
+        pos += record->size;
+    }
+
+    return needed;
+}
+#endif
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(2)
+void vyrtue_shm_foreach(uint8_t type, vyrtue_shm_record_fn fn, void *arg)
+{
+#ifndef PHP_WIN32
+    struct vyrtue_shm_string argv[VYRTUE_SHM_MAX_STRINGS];
+    struct vyrtue_shm_string filename;
+    char *buf = NULL;
+    size_t size = 0;
+    size_t needed;
+    size_t pos = 0;
+
+    if (!vyrtue_shm_is_enabled()) {
+        return;
+    }
+
+    /*
+     * The records are copied out, and the callbacks run, without the lock
+     * held: they allocate, and a bailout (memory_limit) must not leave the
+     * lock held for every other process. Allocating happens between two
+     * rounds of locking, until the buffer is large enough.
+     */
+    for (;;) {
+        vyrtue_shm_lock();
+        needed = vyrtue_shm_copy_records(type, buf, size);
+        vyrtue_shm_unlock();
+
+        if (needed <= size) {
+            break;
+        }
+
+        if (buf) {
+            efree(buf);
+        }
+        size = needed;
+        buf = emalloc(size);
+    }
+
+    while (pos < needed) {
+        struct vyrtue_shm_record *record = (struct vyrtue_shm_record *) (buf + pos);
+        const char *p = vyrtue_shm_read_string((const char *) (record + 1), &filename);
+
+        for (uint16_t i = 0; i < record->argc; i++) {
+            p = vyrtue_shm_read_string(p, &argv[i]);
+        }
+        fn(arg, &filename, record->argc, argv);
+
+        pos += record->size;
+    }
+
+    if (buf) {
+        efree(buf);
+    }
+#endif
+}
+
+VYRTUE_LOCAL
+uint64_t vyrtue_shm_generation(void)
+{
+#ifndef PHP_WIN32
+    if (!vyrtue_shm_is_enabled()) {
+        return 0;
+    }
+
+    return __atomic_load_n(&vyrtue_shm->generation, __ATOMIC_ACQUIRE);
+#else
+    return 0;
+#endif
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_shm)
+{
+#ifndef PHP_WIN32
+    pthread_mutexattr_t attr;
+    size_t size = (size_t) VYRTUE_G(shm_size);
+
+    if (size == 0) {
+        return SUCCESS;
+    }
+
+    if (size < 64 * 1024) {
+        size = 64 * 1024;
+    }
+
+    void *segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED) {
+        zend_error(E_WARNING, "vyrtue: failed to map %zu bytes of shared memory", size);
+        return SUCCESS;
+    }
+
+    vyrtue_shm = segment;
+    memset(vyrtue_shm, 0, sizeof(*vyrtue_shm));
+    vyrtue_shm->size = size;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef VYRTUE_SHM_ROBUST
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+    pthread_mutex_init(&vyrtue_shm->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+#endif
+
+    return SUCCESS;
+}
+
+VYRTUE_LOCAL PHP_MSHUTDOWN_FUNCTION(vyrtue_shm)
+{
+#ifndef PHP_WIN32
+    if (vyrtue_shm) {
+        munmap(vyrtue_shm, vyrtue_shm->size);
+        vyrtue_shm = NULL;
+    }
+#endif
+
+    return SUCCESS;
+}
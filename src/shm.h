@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHP_VYRTUE_SHM_H
+#define PHP_VYRTUE_SHM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <Zend/zend_smart_str.h>
+#include "php_vyrtue.h"
+
+#define VYRTUE_SHM_RECORD_ATTRIBUTE 1
+#define VYRTUE_SHM_RECORD_CLASS 2
+
+#define VYRTUE_SHM_MAX_STRINGS 8
+
+/**
+ * Records collected while processing a single file. They replace all records
+ * previously stored for the same file when committed.
+ */
+struct vyrtue_shm_batch
+{
+    smart_str buf;
+};
+
+struct vyrtue_shm_string
+{
+    const char *val;
+    size_t len;
+};
+
+typedef void (*vyrtue_shm_record_fn)(void *arg, const struct vyrtue_shm_string *filename, uint32_t argc, const struct vyrtue_shm_string *argv);
+
+VYRTUE_LOCAL
+bool vyrtue_shm_is_enabled(void);
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_shm_batch_add(struct vyrtue_shm_batch *batch, uint8_t type, uint32_t argc, const struct vyrtue_shm_string *argv);
+
+/**
+ * Atomically replaces the records of filename with those in batch, and frees
+ * the batch.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_shm_commit(zend_string *filename, struct vyrtue_shm_batch *batch);
+
+/**
+ * Calls fn for every live record of the given type. The records are copied
+ * first, so fn runs without the lock held and may allocate or bail out.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(2)
+void vyrtue_shm_foreach(uint8_t type, vyrtue_shm_record_fn fn, void *arg);
+
+/**
+ * Returns a counter that changes whenever records are committed.
+ */
+VYRTUE_LOCAL
+uint64_t vyrtue_shm_generation(void);
+
+#endif
@@ -0,0 +1,254 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_smart_str.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "ast.h"
+#include "context.h"
+
+#define VYRTUE_SPRINTF_MAX_ARGS 32
+
+/**
+ * Only arguments whose evaluation has no side effects are accepted, since the
+ * rope reads each argument right before converting it, whereas sprintf()
+ * receives all of them before converting any.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_sprintf_is_simple_arg(zend_ast *ast)
+{
+    switch (ast->kind) {
+        case ZEND_AST_ZVAL:
+        case ZEND_AST_CONST:
+            return true;
+        case ZEND_AST_VAR:
+            // no variable-variables
+            return ast->child[0]->kind == ZEND_AST_ZVAL;
+        default:
+            return false;
+    }
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static void vyrtue_sprintf_flush_literal(zend_ast **parts, uint32_t *nparts, smart_str *buf)
+{
+    if (buf->s && ZSTR_LEN(buf->s) > 0) {
+        parts[(*nparts)++] = zend_ast_create_zval_from_str(smart_str_extract(buf));
+    } else {
+        smart_str_free(buf);
+    }
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_sprintf_is_string_literal(zend_ast *ast)
+{
+    return ast->kind == ZEND_AST_ZVAL && Z_TYPE_P(zend_ast_get_zval(ast)) == IS_STRING;
+}
+
+/**
+ * Rewrites sprintf('%s:%s', $a, $b) into "{$a}:{$b}". An encaps list may only
+ * hold variables and string literals, or zend_ast_export() (used for assert()
+ * messages and transform_file()) can't print it, so any other argument or a
+ * %d conversion makes it 'x' . FOO . ':' . (int) $b instead. Returns NULL if
+ * the format uses anything but %s, %d and %%, or if the number of arguments
+ * doesn't match the number of conversions.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_sprintf_create_rope(zend_string *format, zend_ast **args, uint32_t argc)
+{
+    const char *p = ZSTR_VAL(format);
+    const char *end = p + ZSTR_LEN(format);
+    zend_ast *parts[VYRTUE_SPRINTF_MAX_ARGS * 2 + 1];
+    uint32_t nparts = 0;
+    uint32_t argn = 0;
+    bool is_rope = true;
+
+    // validate before touching any of the arguments
+    for (; p < end; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        if (++p >= end) {
+            return NULL;
+        }
+        if (*p == 's' || *p == 'd') {
+            if (argn < argc && (*p == 'd' || args[argn]->kind != ZEND_AST_VAR)) {
+                is_rope = false;
+            }
+            argn++;
+        } else if (*p != '%') {
+            return NULL;
+        }
+    }
+
+    if (argn != argc) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < argc; i++) {
+        if (!vyrtue_sprintf_is_simple_arg(args[i])) {
+            return NULL;
+        }
+    }
+
+    smart_str buf = {0};
+
+    argn = 0;
+    for (p = ZSTR_VAL(format); p < end; p++) {
+        if (*p != '%') {
+            smart_str_appendc(&buf, *p);
+            continue;
+        }
+
+        p++;
+        if (*p == '%') {
+            smart_str_appendc(&buf, '%');
+            continue;
+        }
+
+        vyrtue_sprintf_flush_literal(parts, &nparts, &buf);
+
+        zend_ast *arg = args[argn];
+        args[argn] = NULL;
+        argn++;
+
+        if (*p == 'd') {
+            arg = zend_ast_create_cast(IS_LONG, arg);
+        }
+
+        parts[nparts++] = arg;
+    }
+
+    vyrtue_sprintf_flush_literal(parts, &nparts, &buf);
+
+    if (nparts == 0) {
+        return zend_ast_create_zval_from_str(ZSTR_EMPTY_ALLOC());
+    }
+
+    // the rope must contain at least one expression to be compiled as such
+    if (argc > 0 && is_rope) {
+        zend_ast *rope = zend_ast_create_list(0, ZEND_AST_ENCAPS_LIST);
+        for (uint32_t i = 0; i < nparts; i++) {
+            rope = zend_ast_list_add(rope, parts[i]);
+        }
+        return rope;
+    }
+
+    zend_ast *concat = parts[0];
+    if (nparts == 1 && !vyrtue_sprintf_is_string_literal(concat)) {
+        return zend_ast_create_cast(IS_STRING, concat);
+    }
+    for (uint32_t i = 1; i < nparts; i++) {
+        concat = zend_ast_create_binary_op(ZEND_CONCAT, concat, parts[i]);
+    }
+
+    return concat;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_string *vyrtue_sprintf_get_format(zend_ast *ast)
+{
+    if (ast->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(ast)) != IS_STRING) {
+        return NULL;
+    }
+
+    return Z_STR_P(zend_ast_get_zval(ast));
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_sprintf_call_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_list *args = vyrtue_ast_get_call_args(ast);
+    if (NULL == args || args->children < 1 || args->children > VYRTUE_SPRINTF_MAX_ARGS + 1) {
+        return NULL;
+    }
+
+    zend_string *format = vyrtue_sprintf_get_format(args->child[0]);
+    if (NULL == format) {
+        return NULL;
+    }
+
+    return vyrtue_sprintf_create_rope(format, &args->child[1], args->children - 1);
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_vsprintf_call_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast *values[VYRTUE_SPRINTF_MAX_ARGS];
+    zend_ast_list *array;
+    zend_ast *replace;
+    uint32_t i;
+
+    zend_ast_list *args = vyrtue_ast_get_call_args(ast);
+    if (NULL == args || args->children != 2 || args->child[1]->kind != ZEND_AST_ARRAY) {
+        return NULL;
+    }
+
+    zend_string *format = vyrtue_sprintf_get_format(args->child[0]);
+    if (NULL == format) {
+        return NULL;
+    }
+
+    array = zend_ast_get_list(args->child[1]);
+    if (array->children > VYRTUE_SPRINTF_MAX_ARGS) {
+        return NULL;
+    }
+
+    // only plain lists: no keys, references or unpacking
+    for (i = 0; i < array->children; i++) {
+        zend_ast *elem = array->child[i];
+        if (elem == NULL || elem->kind != ZEND_AST_ARRAY_ELEM || elem->attr || elem->child[1] != NULL) {
+            return NULL;
+        }
+        values[i] = elem->child[0];
+    }
+
+    replace = vyrtue_sprintf_create_rope(format, values, array->children);
+
+    if (replace) {
+        // the values now belong to the rope
+        for (i = 0; i < array->children; i++) {
+            array->child[i]->child[0] = NULL;
+        }
+    }
+
+    return replace;
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_sprintf)
+{
+    zend_string *tmp;
+
+    tmp = zend_string_init_interned(ZEND_STRL("sprintf"), 1);
+    vyrtue_register_function_visitor_ex("vyrtue internal sprintf", tmp, NULL, vyrtue_sprintf_call_leave, VYRTUE_VISITOR_OPTIONAL);
+    zend_string_release(tmp);
+
+    tmp = zend_string_init_interned(ZEND_STRL("vsprintf"), 1);
+    vyrtue_register_function_visitor_ex("vyrtue internal sprintf", tmp, NULL, vyrtue_vsprintf_call_leave, VYRTUE_VISITOR_OPTIONAL);
+    zend_string_release(tmp);
+
+    return SUCCESS;
+}
@@ -0,0 +1,211 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "filter.h"
+#include "stats.h"
+
+/*
+ * Totals and per-visitor statistics are kept for the lifetime of the process,
+ * so that they can be collected from long running workers. Per-file
+ * statistics are only kept for the files compiled during the current request.
+ */
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+uint32_t vyrtue_stats_register_visitor(const char *name)
+{
+    zval *slot = zend_hash_str_find(&VYRTUE_G(stats_visitor_names), name, strlen(name));
+    zval tmp;
+
+    if (slot != NULL) {
+        return (uint32_t) Z_LVAL_P(slot);
+    }
+
+    uint32_t count = VYRTUE_G(stats_visitors_count);
+
+    VYRTUE_G(stats_visitors) = perealloc(VYRTUE_G(stats_visitors), sizeof(struct vyrtue_stats_visitor) * (count + 1), 1);
+    memset(&VYRTUE_G(stats_visitors)[count], 0, sizeof(struct vyrtue_stats_visitor));
+    VYRTUE_G(stats_visitors)[count].name = name;
+    VYRTUE_G(stats_visitors_count) = count + 1;
+
+    ZVAL_LONG(&tmp, count);
+    zend_hash_str_add_new(&VYRTUE_G(stats_visitor_names), name, strlen(name), &tmp);
+
+    vyrtue_filter_register_visitor(name, count);
+
+    return count;
+}
+
+static void vyrtue_stats_file_dtor(zval *zv)
+{
+    efree(Z_PTR_P(zv));
+}
+
+static void vyrtue_stats_add(struct vyrtue_stats *dest, const struct vyrtue_stats *src)
+{
+    dest->files += src->files;
+    dest->nodes += src->nodes;
+    dest->visitor_calls += src->visitor_calls;
+    dest->replacements += src->replacements;
+    dest->name_resolutions += src->name_resolutions;
+    dest->arena_bytes += src->arena_bytes;
+    dest->time_ns += src->time_ns;
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(1)
+void vyrtue_stats_add_file(const struct vyrtue_stats *stats, zend_string *filename)
+{
+    struct vyrtue_stats *file_stats;
+
+    vyrtue_stats_add(&VYRTUE_G(stats_totals), stats);
+
+    if (filename == NULL) {
+        return;
+    }
+
+    if (VYRTUE_G(stats_files) == NULL) {
+        ALLOC_HASHTABLE(VYRTUE_G(stats_files));
+        zend_hash_init(VYRTUE_G(stats_files), 8, NULL, vyrtue_stats_file_dtor, 0);
+    }
+
+    // a file may be compiled more than once per request, e.g. without opcache
+    file_stats = zend_hash_find_ptr(VYRTUE_G(stats_files), filename);
+    if (file_stats == NULL) {
+        file_stats = ecalloc(1, sizeof(*file_stats));
+        zend_hash_add_new_ptr(VYRTUE_G(stats_files), filename, file_stats);
+    }
+
+    vyrtue_stats_add(file_stats, stats);
+}
+
+VYRTUE_PUBLIC
+VYRTUE_ATTR_RETURNS_NONNULL
+const struct vyrtue_stats *vyrtue_stats_get(const struct vyrtue_stats_visitor **visitors, uint32_t *visitors_count)
+{
+    if (visitors != NULL) {
+        *visitors = VYRTUE_G(stats_visitors);
+    }
+    if (visitors_count != NULL) {
+        *visitors_count = VYRTUE_G(stats_visitors_count);
+    }
+
+    return &VYRTUE_G(stats_totals);
+}
+
+VYRTUE_PUBLIC
+void vyrtue_stats_reset(void)
+{
+    memset(&VYRTUE_G(stats_totals), 0, sizeof(VYRTUE_G(stats_totals)));
+
+    for (uint32_t i = 0; i < VYRTUE_G(stats_visitors_count); i++) {
+        struct vyrtue_stats_visitor *visitor = &VYRTUE_G(stats_visitors)[i];
+        visitor->enter_calls = 0;
+        visitor->leave_calls = 0;
+        visitor->replacements = 0;
+        visitor->time_ns = 0;
+    }
+
+    if (VYRTUE_G(stats_files) != NULL) {
+        zend_hash_clean(VYRTUE_G(stats_files));
+    }
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static void vyrtue_stats_to_array(zval *result, const struct vyrtue_stats *stats, bool with_files)
+{
+    array_init(result);
+    if (with_files) {
+        add_assoc_long(result, "files", (zend_long) stats->files);
+    }
+    add_assoc_long(result, "nodes", (zend_long) stats->nodes);
+    add_assoc_long(result, "visitor_calls", (zend_long) stats->visitor_calls);
+    add_assoc_long(result, "replacements", (zend_long) stats->replacements);
+    add_assoc_long(result, "name_resolutions", (zend_long) stats->name_resolutions);
+    add_assoc_long(result, "arena_bytes", (zend_long) stats->arena_bytes);
+    add_assoc_long(result, "time_ns", (zend_long) stats->time_ns);
+}
+
+VYRTUE_LOCAL PHP_FUNCTION(vyrtue_stats)
+{
+    zval totals;
+    zval visitors;
+    zval files;
+    zval tmp;
+    zend_string *filename;
+    struct vyrtue_stats *file_stats;
+
+    ZEND_PARSE_PARAMETERS_NONE();
+
+    vyrtue_stats_to_array(&totals, &VYRTUE_G(stats_totals), true);
+
+    array_init(&visitors);
+    for (uint32_t i = 0; i < VYRTUE_G(stats_visitors_count); i++) {
+        const struct vyrtue_stats_visitor *visitor = &VYRTUE_G(stats_visitors)[i];
+        array_init(&tmp);
+        add_assoc_long(&tmp, "enter_calls", (zend_long) visitor->enter_calls);
+        add_assoc_long(&tmp, "leave_calls", (zend_long) visitor->leave_calls);
+        add_assoc_long(&tmp, "replacements", (zend_long) visitor->replacements);
+        add_assoc_long(&tmp, "time_ns", (zend_long) visitor->time_ns);
+        add_assoc_zval(&visitors, visitor->name, &tmp);
+    }
+
+    array_init(&files);
+    if (VYRTUE_G(stats_files) != NULL) {
+        ZEND_HASH_FOREACH_STR_KEY_PTR(VYRTUE_G(stats_files), filename, file_stats)
+        {
+            vyrtue_stats_to_array(&tmp, file_stats, false);
+            zend_hash_add_new(Z_ARRVAL(files), filename, &tmp);
+        }
+        ZEND_HASH_FOREACH_END();
+    }
+
+    array_init_size(return_value, 4);
+    add_assoc_bool(return_value, "enabled", VYRTUE_G(stats));
+    add_assoc_zval(return_value, "totals", &totals);
+    add_assoc_zval(return_value, "visitors", &visitors);
+    add_assoc_zval(return_value, "files", &files);
+}
+
+VYRTUE_LOCAL PHP_FUNCTION(vyrtue_stats_reset)
+{
+    ZEND_PARSE_PARAMETERS_NONE();
+
+    vyrtue_stats_reset();
+}
+
+VYRTUE_LOCAL PHP_RSHUTDOWN_FUNCTION(vyrtue_stats)
+{
+    if (VYRTUE_G(stats_files) != NULL) {
+        zend_hash_destroy(VYRTUE_G(stats_files));
+        FREE_HASHTABLE(VYRTUE_G(stats_files));
+        VYRTUE_G(stats_files) = NULL;
+    }
+
+    return SUCCESS;
+}
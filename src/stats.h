@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHP_VYRTUE_STATS_H
+#define PHP_VYRTUE_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <Zend/zend_API.h>
+#include <Zend/zend_arena.h>
+#include "php_vyrtue.h"
+
+#if PHP_VERSION_ID >= 80300
+#include <Zend/zend_hrtime.h>
+#define vyrtue_stats_now() ((uint64_t) zend_hrtime())
+#else
+#include <ext/standard/hrtime.h>
+#define vyrtue_stats_now() ((uint64_t) php_hrtime_current())
+#endif
+
+/**
+ * Counts into the statistics of the file being processed. Everything behind
+ * it is skipped unless vyrtue.stats is enabled.
+ */
+#define VYRTUE_STATS_INC(ctx, field)            \
+    do {                                        \
+        if (UNEXPECTED((ctx)->stats_enabled)) { \
+            (ctx)->stats.field++;               \
+        }                                       \
+    } while (0)
+
+/**
+ * Returns the slot of the statistics of the visitors with the given name.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+uint32_t vyrtue_stats_register_visitor(const char *name);
+
+VYRTUE_ATTR_NONNULL_ALL
+static inline void vyrtue_stats_visitor_call(struct vyrtue_stats *stats, uint32_t slot, bool enter, bool replaced, uint64_t time_ns)
+{
+    struct vyrtue_stats_visitor *visitor = &VYRTUE_G(stats_visitors)[slot];
+
+    if (enter) {
+        visitor->enter_calls++;
+    } else {
+        visitor->leave_calls++;
+    }
+    visitor->time_ns += time_ns;
+    stats->visitor_calls++;
+
+    if (replaced) {
+        visitor->replacements++;
+        stats->replacements++;
+    }
+}
+
+/**
+ * Returns the number of bytes allocated from an arena and its predecessors.
+ */
+static inline size_t vyrtue_stats_arena_used(zend_arena *arena)
+{
+    size_t used = 0;
+
+    for (; arena != NULL; arena = arena->prev) {
+        used += (size_t) (arena->ptr - ((char *) arena + ZEND_MM_ALIGNED_SIZE(sizeof(zend_arena))));
+    }
+
+    return used;
+}
+
+/**
+ * Adds the statistics of a processed file to the totals, and to those of the
+ * file returned by VyrtueExt\stats() for the current request.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL(1)
+void vyrtue_stats_add_file(const struct vyrtue_stats *stats, zend_string *filename);
+
+#endif
@@ -0,0 +1,423 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_compile.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "ast.h"
+#include "compile.h"
+#include "context.h"
+#include "debug_log.h"
+
+// Parsed from vyrtue.strip_constants and vyrtue.strip_functions, read-only after MINIT
+static HashTable vyrtue_strip_constants;
+static HashTable vyrtue_strip_functions;
+
+/**
+ * Splits a comma-separated INI value into a set of names, without leading
+ * backslashes.
+ */
+static void vyrtue_strip_parse_list(HashTable *ht, const char *value, bool lowercase)
+{
+    const char *p = value;
+
+    zend_hash_init(ht, 8, NULL, NULL, 1);
+
+    while (p && *p) {
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t) (end - p) : strlen(p);
+        const char *start = p;
+
+        while (len > 0 && (*start == ' ' || *start == '\t' || *start == '\\')) {
+            start++;
+            len--;
+        }
+        while (len > 0 && (start[len - 1] == ' ' || start[len - 1] == '\t')) {
+            len--;
+        }
+
+        if (len > 0) {
+            zend_string *name = zend_string_init(start, len, 1);
+            if (lowercase) {
+                zend_str_tolower(ZSTR_VAL(name), len);
+            }
+            zend_hash_add_empty_element(ht, name);
+            zend_string_release(name);
+        }
+
+        p = end ? end + 1 : NULL;
+    }
+}
+
+/**
+ * Debug-only names outlive the request, like macros, so that calls compiled
+ * later from any file are removed too.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static void vyrtue_strip_add_debug_only(zend_string *name, struct vyrtue_context *ctx)
+{
+    if (VYRTUE_G(debug_only) == NULL) {
+        VYRTUE_G(debug_only) = pemalloc(sizeof(HashTable), 1);
+        zend_hash_init(VYRTUE_G(debug_only), 8, NULL, NULL, 1);
+    }
+
+    // registering is a side effect a cached AST would not repeat
+    ctx->ast_cache_skip = true;
+
+    zend_string *lcname = zend_string_tolower(name);
+    zend_hash_str_add_empty_element(VYRTUE_G(debug_only), ZSTR_VAL(lcname), ZSTR_LEN(lcname));
+    zend_string_release(lcname);
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_string *vyrtue_strip_prefix_with_ns(zend_string *name, struct vyrtue_context *ctx)
+{
+    if (ctx->current_namespace) {
+        return zend_string_concat3(
+            ZSTR_VAL(ctx->current_namespace), ZSTR_LEN(ctx->current_namespace), "\\", 1, ZSTR_VAL(name), ZSTR_LEN(name)
+        );
+    }
+
+    return zend_string_copy(name);
+}
+
+/**
+ * Debug-only functions keep their declaration, so that calls from other
+ * files still work, but lose their body.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static void vyrtue_strip_empty_body(zend_ast_decl *decl)
+{
+    zend_ast *return_type = decl->child[3];
+
+    if (decl->child[2] == NULL) {
+        return;
+    }
+
+    if (return_type != NULL &&
+        !(return_type->kind == ZEND_AST_ZVAL && zend_string_equals_literal_ci(zend_ast_get_str(return_type), "void"))) {
+        zend_error(E_COMPILE_WARNING, "vyrtue: #[VyrtueExt\\DebugOnly] function %s must not return a value", ZSTR_VAL(decl->name));
+        return;
+    }
+
+    zend_ast_destroy(decl->child[2]);
+    decl->child[2] = zend_ast_create_list(0, ZEND_AST_STMT_LIST);
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_strip_function_enter(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_decl *decl = (zend_ast_decl *) ast;
+
+    // methods are handled when entering their class
+    if (ast->kind != ZEND_AST_FUNC_DECL) {
+        return NULL;
+    }
+
+    zend_string *name = vyrtue_strip_prefix_with_ns(decl->name, ctx);
+    vyrtue_strip_add_debug_only(name, ctx);
+    zend_string_release(name);
+
+    vyrtue_strip_empty_body(decl);
+
+    return NULL;
+}
+
+/**
+ * Methods are collected up front, so that calls from any method of the class
+ * can be removed regardless of declaration order.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_strip_class_enter(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_decl *decl = (zend_ast_decl *) ast;
+    zend_ast_list *stmts;
+
+    if (decl->name == NULL || (decl->flags & ZEND_ACC_ANON_CLASS) || decl->child[2] == NULL) {
+        return NULL;
+    }
+
+    zend_string *class_name = vyrtue_strip_prefix_with_ns(decl->name, ctx);
+    stmts = zend_ast_get_list(decl->child[2]);
+
+    for (uint32_t i = 0; i < stmts->children; i++) {
+        zend_ast_decl *method = (zend_ast_decl *) stmts->child[i];
+
+        if (method == NULL || method->kind != ZEND_AST_METHOD || method->child[4] == NULL) {
+            continue;
+        }
+
+        if (NULL == vyrtue_ast_find_attribute(method->child[4], ZEND_STRL("VyrtueExt\\DebugOnly"), ctx)) {
+            continue;
+        }
+
+        zend_string *key = zend_string_concat3(
+            ZSTR_VAL(class_name), ZSTR_LEN(class_name), "::", 2, ZSTR_VAL(method->name), ZSTR_LEN(method->name)
+        );
+        vyrtue_strip_add_debug_only(key, ctx);
+        zend_string_release(key);
+
+        vyrtue_strip_empty_body(method);
+    }
+
+    zend_string_release(class_name);
+
+    return NULL;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_string *vyrtue_strip_current_class_name(struct vyrtue_context *ctx)
+{
+    struct vyrtue_context_stack *stack = &ctx->scope_stack;
+
+    for (size_t i = stack->i; i > 0; i--) {
+        zend_ast_decl *decl = (zend_ast_decl *) stack->data[i - 1].ast;
+        if (decl->kind == ZEND_AST_CLASS) {
+            if (decl->name == NULL || (decl->flags & ZEND_ACC_ANON_CLASS)) {
+                return NULL;
+            }
+            return vyrtue_strip_prefix_with_ns(decl->name, ctx);
+        }
+    }
+
+    return NULL;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_strip_exists_lc(HashTable *ht, zend_string *name)
+{
+    zend_string *lcname = zend_string_tolower(name);
+    bool rv = zend_hash_exists(ht, lcname);
+    zend_string_release(lcname);
+    return rv;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_strip_is_debug_only(zend_string *name)
+{
+    return VYRTUE_G(debug_only) != NULL && vyrtue_strip_exists_lc(VYRTUE_G(debug_only), name);
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_strip_is_method_call(zend_ast *stmt, struct vyrtue_context *ctx)
+{
+    zend_ast *method_ast = stmt->child[1];
+    zend_string *class_name = NULL;
+    bool rv;
+
+    if (VYRTUE_G(debug_only) == NULL || method_ast->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(method_ast)) != IS_STRING) {
+        return false;
+    }
+
+    if (stmt->kind == ZEND_AST_METHOD_CALL) {
+        zend_ast *obj = stmt->child[0];
+        if (obj->kind == ZEND_AST_VAR && obj->child[0]->kind == ZEND_AST_ZVAL &&
+            zend_string_equals_literal(zend_ast_get_str(obj->child[0]), "this")) {
+            class_name = vyrtue_strip_current_class_name(ctx);
+        }
+    } else if (stmt->child[0]->kind == ZEND_AST_ZVAL) {
+        zend_string *name = zend_ast_get_str(stmt->child[0]);
+        if (stmt->child[0]->attr == ZEND_NAME_NOT_FQ &&
+            (zend_string_equals_literal_ci(name, "self") || zend_string_equals_literal_ci(name, "static"))) {
+            class_name = vyrtue_strip_current_class_name(ctx);
+        } else {
+            class_name = vyrtue_resolve_class_name_ast(stmt->child[0], ctx);
+        }
+    }
+
+    if (class_name == NULL) {
+        return false;
+    }
+
+    zend_string *method_name = zend_ast_get_str(method_ast);
+    zend_string *key = zend_string_concat3(
+        ZSTR_VAL(class_name), ZSTR_LEN(class_name), "::", 2, ZSTR_VAL(method_name), ZSTR_LEN(method_name)
+    );
+    rv = vyrtue_strip_is_debug_only(key);
+    zend_string_release(key);
+    zend_string_release(class_name);
+
+    return rv;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_strip_is_function_call(zend_ast *stmt, struct vyrtue_context *ctx)
+{
+    zend_ast *name_ast = stmt->child[0];
+    bool is_fully_qualified;
+    bool rv;
+
+    if (name_ast->kind != ZEND_AST_ZVAL || Z_TYPE_P(zend_ast_get_zval(name_ast)) != IS_STRING) {
+        return false;
+    }
+
+    zend_string *name = vyrtue_resolve_function_name(zend_ast_get_str(name_ast), name_ast->attr, &is_fully_qualified, ctx);
+    rv = vyrtue_strip_is_debug_only(name) || vyrtue_strip_exists_lc(&vyrtue_strip_functions, name);
+    zend_string_release(name);
+
+    // an unqualified call inside a namespace may also reach the global function
+    if (!rv && !is_fully_qualified) {
+        rv = vyrtue_strip_exists_lc(&vyrtue_strip_functions, zend_ast_get_str(name_ast));
+    }
+
+    return rv;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_strip_is_debug_constant(zend_ast *cond, struct vyrtue_context *ctx)
+{
+    zend_ast *name_ast;
+    bool is_fully_qualified;
+    bool rv;
+
+    if (cond->kind != ZEND_AST_CONST || zend_hash_num_elements(&vyrtue_strip_constants) == 0) {
+        return false;
+    }
+
+    name_ast = cond->child[0];
+    zend_string *name = vyrtue_resolve_const_name(zend_ast_get_str(name_ast), name_ast->attr, &is_fully_qualified, ctx);
+    rv = zend_hash_exists(&vyrtue_strip_constants, name);
+    zend_string_release(name);
+
+    if (!rv && !is_fully_qualified) {
+        rv = zend_hash_exists(&vyrtue_strip_constants, zend_ast_get_str(name_ast));
+    }
+
+    return rv;
+}
+
+/**
+ * Removes the leading `if (DEBUG)` branch of an if statement. Returns the
+ * statement to splice in its place, which may be NULL or a statement list.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_strip_if(zend_ast *stmt, struct vyrtue_context *ctx)
+{
+    zend_ast_list *list = zend_ast_get_list(stmt);
+    zend_ast *elem = list->child[0];
+    zend_ast *rest;
+
+    if (elem->child[0] == NULL || !vyrtue_strip_is_debug_constant(elem->child[0], ctx)) {
+        return stmt;
+    }
+
+    if (list->children == 1) {
+        zend_ast_destroy(stmt);
+        return NULL;
+    }
+
+    // a plain else takes the place of the whole statement
+    if (list->children == 2 && list->child[1]->child[0] == NULL) {
+        rest = list->child[1]->child[1];
+        list->child[1]->child[1] = NULL;
+        zend_ast_destroy(stmt);
+        return rest;
+    }
+
+    // the first elseif becomes the if
+    zend_ast_destroy(elem);
+    memmove(&list->child[0], &list->child[1], (list->children - 1) * sizeof(zend_ast *));
+    list->children--;
+
+    return stmt;
+}
+
+/**
+ * Removes debug statements from the list in place.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_strip_stmt_list_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    zend_ast_list *list = zend_ast_get_list(ast);
+    uint32_t i;
+    uint32_t j = 0;
+
+    for (i = 0; i < list->children; i++) {
+        zend_ast *stmt = list->child[i];
+        bool strip = false;
+
+        if (stmt != NULL) {
+            switch (stmt->kind) {
+                case ZEND_AST_CALL:
+                    strip = vyrtue_strip_is_function_call(stmt, ctx);
+                    break;
+                case ZEND_AST_METHOD_CALL:
+                case ZEND_AST_STATIC_CALL:
+                    strip = vyrtue_strip_is_method_call(stmt, ctx);
+                    break;
+                case ZEND_AST_IF:
+                    stmt = vyrtue_strip_if(stmt, ctx);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (strip) {
+#ifdef VYRTUE_DEBUG
+            if (VYRTUE_DEBUG_ENABLED(VYRTUE_DEBUG_STRIP)) {
+                vyrtue_debug_log(VYRTUE_DEBUG_STRIP, "VYRTUE_STRIP: line %u\n", zend_ast_get_lineno(stmt));
+            }
+#endif
+            zend_ast_destroy(stmt);
+        } else if (stmt != NULL || list->child[i] == NULL) {
+            list->child[j++] = stmt;
+        }
+    }
+
+    list->children = j;
+
+    return NULL;
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_strip)
+{
+    zend_string *tmp;
+
+    vyrtue_strip_parse_list(&vyrtue_strip_constants, VYRTUE_G(strip_constants), false);
+    vyrtue_strip_parse_list(&vyrtue_strip_functions, VYRTUE_G(strip_functions), true);
+
+    if (!VYRTUE_G(strip_debug)) {
+        return SUCCESS;
+    }
+
+    tmp = zend_string_init_interned(ZEND_STRL("VyrtueExt\\DebugOnly"), 1);
+    vyrtue_register_attribute_visitor("vyrtue internal strip", tmp, vyrtue_strip_function_enter, NULL);
+    zend_string_release(tmp);
+
+    vyrtue_register_kind_visitor("vyrtue internal strip", ZEND_AST_CLASS, vyrtue_strip_class_enter, NULL);
+    vyrtue_register_kind_visitor("vyrtue internal strip", ZEND_AST_STMT_LIST, NULL, vyrtue_strip_stmt_list_leave);
+
+    return SUCCESS;
+}
+
+VYRTUE_LOCAL PHP_MSHUTDOWN_FUNCTION(vyrtue_strip)
+{
+    zend_hash_destroy(&vyrtue_strip_constants);
+    zend_hash_destroy(&vyrtue_strip_functions);
+
+    return SUCCESS;
+}
@@ -0,0 +1,239 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#ifndef PHP_WIN32
+#include <unistd.h>
+#else
+#include <io.h>
+#include <process.h>
+#endif
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_smart_str.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "trace.h"
+
+/*
+ * Events go into a fixed size ring buffer in the module globals, so each
+ * thread records into its own without locking, and nothing but the event is
+ * written while compiling. The buffer is written out as trace event JSON at
+ * the end of the request; when it wraps, the oldest events are dropped.
+ *
+ * The file is appended to by every process, starting with "[" when empty. The
+ * trace event format allows the closing bracket to be left out.
+ */
+
+#define VYRTUE_TRACE_CAPACITY 16384
+
+enum vyrtue_trace_event_type
+{
+    VYRTUE_TRACE_FILE,
+    VYRTUE_TRACE_ENTER,
+    VYRTUE_TRACE_LEAVE,
+};
+
+struct vyrtue_trace_event
+{
+    uint64_t start;
+    uint64_t duration;
+    const char *name;
+    zend_string *filename;
+    enum vyrtue_trace_event_type type;
+};
+
+static struct vyrtue_trace_event *vyrtue_trace_next(void)
+{
+    struct vyrtue_trace_event *event;
+
+    if (UNEXPECTED(VYRTUE_G(trace_events) == NULL)) {
+        VYRTUE_G(trace_events) = pecalloc(VYRTUE_TRACE_CAPACITY, sizeof(struct vyrtue_trace_event), 1);
+    }
+
+    event = &VYRTUE_G(trace_events)[(VYRTUE_G(trace_head) + VYRTUE_G(trace_count)) % VYRTUE_TRACE_CAPACITY];
+
+    if (VYRTUE_G(trace_count) < VYRTUE_TRACE_CAPACITY) {
+        VYRTUE_G(trace_count)++;
+    } else {
+        VYRTUE_G(trace_head) = (VYRTUE_G(trace_head) + 1) % VYRTUE_TRACE_CAPACITY;
+        VYRTUE_G(trace_dropped)++;
+        if (event->filename) {
+            zend_string_release(event->filename);
+        }
+    }
+
+    return event;
+}
+
+VYRTUE_LOCAL
+void vyrtue_trace_file(zend_string *filename, uint64_t start, uint64_t duration)
+{
+    struct vyrtue_trace_event *event = vyrtue_trace_next();
+
+    *event = (struct vyrtue_trace_event){
+        .start = start,
+        .duration = duration,
+        .name = NULL,
+        .filename = filename ? zend_string_copy(filename) : NULL,
+        .type = VYRTUE_TRACE_FILE,
+    };
+}
+
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_trace_visitor(const char *name, bool enter, uint64_t start, uint64_t duration)
+{
+    if (duration < (uint64_t) VYRTUE_G(trace_threshold_us) * 1000) {
+        return;
+    }
+
+    struct vyrtue_trace_event *event = vyrtue_trace_next();
+
+    *event = (struct vyrtue_trace_event){
+        .start = start,
+        .duration = duration,
+        .name = name,
+        .filename = NULL,
+        .type = enter ? VYRTUE_TRACE_ENTER : VYRTUE_TRACE_LEAVE,
+    };
+}
+
+static void vyrtue_trace_append_json_string(smart_str *buf, const char *str, size_t len)
+{
+    smart_str_appendc(buf, '"');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char) str[i];
+        if (c == '"' || c == '\\') {
+            smart_str_appendc(buf, '\\');
+            smart_str_appendc(buf, c);
+        } else if (c < 0x20) {
+            smart_str_append_printf(buf, "\\u%04x", c);
+        } else {
+            smart_str_appendc(buf, c);
+        }
+    }
+    smart_str_appendc(buf, '"');
+}
+
+static void vyrtue_trace_append_event(smart_str *buf, const struct vyrtue_trace_event *event, zend_long pid, zend_ulong tid)
+{
+    smart_str_appends(buf, "{\"name\":");
+    if (event->type == VYRTUE_TRACE_FILE) {
+        if (event->filename) {
+            vyrtue_trace_append_json_string(buf, ZSTR_VAL(event->filename), ZSTR_LEN(event->filename));
+        } else {
+            smart_str_appends(buf, "\"-\"");
+        }
+        smart_str_appends(buf, ",\"cat\":\"file\"");
+    } else {
+        vyrtue_trace_append_json_string(buf, event->name, strlen(event->name));
+        smart_str_appends(buf, event->type == VYRTUE_TRACE_ENTER ? ",\"cat\":\"enter\"" : ",\"cat\":\"leave\"");
+    }
+
+    // microseconds, with the nanoseconds kept as fractions
+    smart_str_append_printf(
+        buf,
+        ",\"ph\":\"X\",\"ts\":%" PRIu64 ".%03u,\"dur\":%" PRIu64 ".%03u,\"pid\":" ZEND_LONG_FMT ",\"tid\":" ZEND_ULONG_FMT "},\n",
+        event->start / 1000,
+        (unsigned) (event->start % 1000),
+        event->duration / 1000,
+        (unsigned) (event->duration % 1000),
+        pid,
+        tid
+    );
+}
+
+static void vyrtue_trace_flush(void)
+{
+    smart_str buf = {0};
+    zend_long pid = (zend_long) getpid();
+    zend_ulong tid;
+    struct stat sb;
+    int fd;
+
+#ifdef ZTS
+    tid = (zend_ulong) tsrm_thread_id();
+#else
+    tid = (zend_ulong) pid;
+#endif
+
+    fd = open(VYRTUE_G(trace_file), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) {
+        zend_error(E_WARNING, "vyrtue: failed to open trace file %s", VYRTUE_G(trace_file));
+    } else if (0 == fstat(fd, &sb) && sb.st_size == 0) {
+        smart_str_appends(&buf, "[\n");
+    }
+
+    for (uint32_t i = 0; i < VYRTUE_G(trace_count); i++) {
+        struct vyrtue_trace_event *event = &VYRTUE_G(trace_events)[(VYRTUE_G(trace_head) + i) % VYRTUE_TRACE_CAPACITY];
+        if (fd >= 0) {
+            vyrtue_trace_append_event(&buf, event, pid, tid);
+        }
+        if (event->filename) {
+            zend_string_release(event->filename);
+            event->filename = NULL;
+        }
+    }
+
+    if (fd >= 0 && VYRTUE_G(trace_dropped) > 0) {
+        smart_str_append_printf(
+            &buf,
+            "{\"name\":\"vyrtue: %" PRIu64 " events dropped\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%" PRIu64 ",\"pid\":" ZEND_LONG_FMT
+            ",\"tid\":" ZEND_ULONG_FMT "},\n",
+            VYRTUE_G(trace_dropped),
+            VYRTUE_G(trace_events)[VYRTUE_G(trace_head)].start / 1000,
+            pid,
+            tid
+        );
+    }
+
+    VYRTUE_G(trace_head) = 0;
+    VYRTUE_G(trace_count) = 0;
+    VYRTUE_G(trace_dropped) = 0;
+
+    if (fd < 0) {
+        return;
+    }
+
+    // a single write, so that processes appending to the same file don't interleave
+    if (buf.s != NULL && write(fd, ZSTR_VAL(buf.s), ZSTR_LEN(buf.s)) != (ssize_t) ZSTR_LEN(buf.s)) {
+        zend_error(E_WARNING, "vyrtue: failed to write trace file %s", VYRTUE_G(trace_file));
+    }
+
+    close(fd);
+    smart_str_free(&buf);
+}
+
+VYRTUE_LOCAL PHP_RSHUTDOWN_FUNCTION(vyrtue_trace)
+{
+    if (VYRTUE_G(trace_count) > 0) {
+        vyrtue_trace_flush();
+    }
+
+    return SUCCESS;
+}
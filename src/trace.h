@@ -0,0 +1,46 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHP_VYRTUE_TRACE_H
+#define PHP_VYRTUE_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <Zend/zend_API.h>
+#include "php_vyrtue.h"
+
+static inline bool vyrtue_trace_is_enabled(void)
+{
+    return VYRTUE_G(trace_file) != NULL && VYRTUE_G(trace_file)[0] != '\0';
+}
+
+/**
+ * Records a span for the processing of a file. Times are from
+ * vyrtue_stats_now().
+ */
+VYRTUE_LOCAL
+void vyrtue_trace_file(zend_string *filename, uint64_t start, uint64_t duration);
+
+/**
+ * Records a span for a visitor call, if it took at least
+ * vyrtue.trace_threshold_us.
+ */
+VYRTUE_LOCAL
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_trace_visitor(const char *name, bool enter, uint64_t start, uint64_t duration);
+
+#endif
@@ -0,0 +1,1233 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "Zend/zend_API.h"
+#include "Zend/zend_compile.h"
+#include "Zend/zend_exceptions.h"
+#include "Zend/zend_language_parser.h"
+#include "main/php.h"
+
+#include "php_vyrtue.h"
+#include "ast.h"
+#include "context.h"
+
+/*
+ * Userland visitors are kept per request. A native visitor is registered once
+ * per subscribed kind or function name and stays registered, so the walker
+ * never calls into this file for anything nobody subscribed to.
+ *
+ * Visited nodes are passed as VyrtueExt\Node, whose kind, flags and lineno
+ * are set eagerly. Its children are only converted when they are read, and
+ * the node is detached once the callback returns.
+ */
+
+#define VYRTUE_USERLAND_VISITOR_NAME "vyrtue userland"
+
+#define VYRTUE_NODE_PROP_KIND 0
+#define VYRTUE_NODE_PROP_FLAGS 1
+#define VYRTUE_NODE_PROP_LINENO 2
+#define VYRTUE_NODE_PROP_CHILDREN 3
+
+// kinds exported as VyrtueExt\AST_*, named like the constants of php-ast
+#define VYRTUE_USERLAND_KINDS(X) \
+    X(ZVAL)                      \
+    X(ARG_LIST)                  \
+    X(ARRAY)                     \
+    X(ENCAPS_LIST)               \
+    X(EXPR_LIST)                 \
+    X(STMT_LIST)                 \
+    X(IF)                        \
+    X(SWITCH_LIST)               \
+    X(CATCH_LIST)                \
+    X(PARAM_LIST)                \
+    X(CLOSURE_USES)              \
+    X(PROP_DECL)                 \
+    X(CONST_DECL)                \
+    X(CLASS_CONST_DECL)          \
+    X(NAME_LIST)                 \
+    X(TRAIT_ADAPTATIONS)         \
+    X(USE)                       \
+    X(FUNC_DECL)                 \
+    X(CLOSURE)                   \
+    X(METHOD)                    \
+    X(CLASS)                     \
+    X(ARROW_FUNC)                \
+    X(MAGIC_CONST)               \
+    X(TYPE)                      \
+    X(VAR)                       \
+    X(CONST)                     \
+    X(UNPACK)                    \
+    X(UNARY_PLUS)                \
+    X(UNARY_MINUS)               \
+    X(CAST)                      \
+    X(EMPTY)                     \
+    X(ISSET)                     \
+    X(SILENCE)                   \
+    X(SHELL_EXEC)                \
+    X(CLONE)                     \
+    X(EXIT)                      \
+    X(PRINT)                     \
+    X(INCLUDE_OR_EVAL)           \
+    X(UNARY_OP)                  \
+    X(PRE_INC)                   \
+    X(PRE_DEC)                   \
+    X(POST_INC)                  \
+    X(POST_DEC)                  \
+    X(YIELD_FROM)                \
+    X(CLASS_NAME)                \
+    X(GLOBAL)                    \
+    X(UNSET)                     \
+    X(RETURN)                    \
+    X(LABEL)                     \
+    X(REF)                       \
+    X(HALT_COMPILER)             \
+    X(ECHO)                      \
+    X(THROW)                     \
+    X(GOTO)                      \
+    X(BREAK)                     \
+    X(CONTINUE)                  \
+    X(DIM)                       \
+    X(PROP)                      \
+    X(NULLSAFE_PROP)             \
+    X(STATIC_PROP)               \
+    X(CALL)                      \
+    X(CLASS_CONST)               \
+    X(ASSIGN)                    \
+    X(ASSIGN_REF)                \
+    X(ASSIGN_OP)                 \
+    X(BINARY_OP)                 \
+    X(GREATER)                   \
+    X(GREATER_EQUAL)             \
+    X(AND)                       \
+    X(OR)                        \
+    X(ARRAY_ELEM)                \
+    X(NEW)                       \
+    X(INSTANCEOF)                \
+    X(YIELD)                     \
+    X(COALESCE)                  \
+    X(ASSIGN_COALESCE)           \
+    X(STATIC)                    \
+    X(WHILE)                     \
+    X(DO_WHILE)                  \
+    X(IF_ELEM)                   \
+    X(SWITCH)                    \
+    X(SWITCH_CASE)               \
+    X(DECLARE)                   \
+    X(USE_TRAIT)                 \
+    X(TRAIT_PRECEDENCE)          \
+    X(METHOD_REFERENCE)          \
+    X(NAMESPACE)                 \
+    X(USE_ELEM)                  \
+    X(TRAIT_ALIAS)               \
+    X(GROUP_USE)                 \
+    X(ATTRIBUTE)                 \
+    X(MATCH)                     \
+    X(MATCH_ARM)                 \
+    X(NAMED_ARG)                 \
+    X(METHOD_CALL)               \
+    X(NULLSAFE_METHOD_CALL)      \
+    X(STATIC_CALL)               \
+    X(CONDITIONAL)               \
+    X(TRY)                       \
+    X(CATCH)                     \
+    X(PROP_GROUP)                \
+    X(PROP_ELEM)                 \
+    X(CONST_ELEM)                \
+    X(CLASS_CONST_GROUP)         \
+    X(CONST_ENUM_INIT)           \
+    X(FOR)                       \
+    X(FOREACH)                   \
+    X(ENUM_CASE)                 \
+    X(PARAM)
+
+struct vyrtue_userland_visitor
+{
+    zend_fcall_info enter_fci;
+    zend_fcall_info_cache enter_fcc;
+    zend_fcall_info leave_fci;
+    zend_fcall_info_cache leave_fcc;
+};
+
+struct vyrtue_node
+{
+    zend_ast *ast;
+    uint64_t epoch;
+    zend_object std;
+};
+
+static zend_class_entry *vyrtue_node_ce;
+static zend_object_handlers vyrtue_node_handlers;
+
+static inline struct vyrtue_node *vyrtue_node_from_obj(zend_object *obj)
+{
+    return (struct vyrtue_node *) ((char *) obj - XtOffsetOf(struct vyrtue_node, std));
+}
+
+static zend_object *vyrtue_node_create(zend_class_entry *ce)
+{
+    struct vyrtue_node *node = zend_object_alloc(sizeof(struct vyrtue_node), ce);
+
+    node->ast = NULL;
+    node->epoch = 0;
+
+    zend_object_std_init(&node->std, ce);
+    object_properties_init(&node->std, ce);
+    node->std.handlers = &vyrtue_node_handlers;
+
+    return &node->std;
+}
+
+static bool vyrtue_node_is_attached(struct vyrtue_node *node)
+{
+    return node->ast != NULL && node->epoch == VYRTUE_G(userland_epoch);
+}
+
+/**
+ * Wraps ast, leaving the children to be converted by __get().
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static void vyrtue_node_wrap(zval *result, zend_ast *ast)
+{
+    struct vyrtue_node *node;
+    zend_object *obj;
+
+    object_init_ex(result, vyrtue_node_ce);
+    obj = Z_OBJ_P(result);
+    node = vyrtue_node_from_obj(obj);
+    node->ast = ast;
+    node->epoch = VYRTUE_G(userland_epoch);
+
+    ZVAL_LONG(OBJ_PROP_NUM(obj, VYRTUE_NODE_PROP_KIND), ast->kind);
+    ZVAL_LONG(
+        OBJ_PROP_NUM(obj, VYRTUE_NODE_PROP_FLAGS), zend_ast_is_decl(ast) ? ((zend_ast_decl *) ast)->flags : ast->attr
+    );
+    ZVAL_LONG(OBJ_PROP_NUM(obj, VYRTUE_NODE_PROP_LINENO), zend_ast_get_lineno(ast));
+    zval_ptr_dtor(OBJ_PROP_NUM(obj, VYRTUE_NODE_PROP_CHILDREN));
+    ZVAL_UNDEF(OBJ_PROP_NUM(obj, VYRTUE_NODE_PROP_CHILDREN));
+}
+
+/**
+ * Values are passed as is, unless they carry flags (e.g. whether a name is
+ * fully qualified), in which case they are wrapped in an AST_ZVAL node.
+ */
+static void vyrtue_node_wrap_child(zval *result, zend_ast *ast)
+{
+    if (ast == NULL) {
+        ZVAL_NULL(result);
+    } else if (ast->kind == ZEND_AST_ZVAL && ast->attr == 0) {
+        ZVAL_COPY(result, zend_ast_get_zval(ast));
+    } else {
+        vyrtue_node_wrap(result, ast);
+    }
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static void vyrtue_node_get_children(zval *result, zend_ast *ast)
+{
+    zval tmp;
+    uint32_t i;
+
+    if (ast->kind == ZEND_AST_ZVAL) {
+        array_init_size(result, 1);
+        ZVAL_COPY(&tmp, zend_ast_get_zval(ast));
+        add_next_index_zval(result, &tmp);
+    } else if (zend_ast_is_decl(ast)) {
+        zend_ast_decl *decl = (zend_ast_decl *) ast;
+        array_init_size(result, 6);
+        if (decl->name) {
+            add_assoc_str(result, "name", zend_string_copy(decl->name));
+        } else {
+            add_assoc_null(result, "name");
+        }
+        for (i = 0; i < 5; i++) {
+            vyrtue_node_wrap_child(&tmp, decl->child[i]);
+            add_next_index_zval(result, &tmp);
+        }
+    } else if (zend_ast_is_list(ast)) {
+        zend_ast_list *list = zend_ast_get_list(ast);
+        array_init_size(result, list->children);
+        for (i = 0; i < list->children; i++) {
+            vyrtue_node_wrap_child(&tmp, list->child[i]);
+            add_next_index_zval(result, &tmp);
+        }
+    } else {
+        uint32_t children = zend_ast_get_num_children(ast);
+        array_init_size(result, children);
+        for (i = 0; i < children; i++) {
+            vyrtue_node_wrap_child(&tmp, ast->child[i]);
+            add_next_index_zval(result, &tmp);
+        }
+    }
+}
+
+PHP_METHOD(VyrtueExt_Node, __construct)
+{
+    zend_long kind;
+    zend_long flags = 0;
+    HashTable *children = NULL;
+    zend_long lineno = 0;
+    bool lineno_is_null = true;
+    zend_object *obj = Z_OBJ_P(ZEND_THIS);
+
+    ZEND_PARSE_PARAMETERS_START(1, 4)
+    Z_PARAM_LONG(kind)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_LONG(flags)
+    Z_PARAM_ARRAY_HT(children)
+    Z_PARAM_LONG_OR_NULL(lineno, lineno_is_null)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ZVAL_LONG(OBJ_PROP_NUM(obj, VYRTUE_NODE_PROP_KIND), kind);
+    ZVAL_LONG(OBJ_PROP_NUM(obj, VYRTUE_NODE_PROP_FLAGS), flags);
+    ZVAL_LONG(OBJ_PROP_NUM(obj, VYRTUE_NODE_PROP_LINENO), lineno_is_null ? (zend_long) CG(zend_lineno) : lineno);
+
+    zval_ptr_dtor(OBJ_PROP_NUM(obj, VYRTUE_NODE_PROP_CHILDREN));
+    if (children) {
+        ZVAL_ARR(OBJ_PROP_NUM(obj, VYRTUE_NODE_PROP_CHILDREN), zend_array_dup(children));
+    } else {
+        ZVAL_EMPTY_ARRAY(OBJ_PROP_NUM(obj, VYRTUE_NODE_PROP_CHILDREN));
+    }
+}
+
+PHP_METHOD(VyrtueExt_Node, __get)
+{
+    zend_string *name;
+    zend_object *obj = Z_OBJ_P(ZEND_THIS);
+    struct vyrtue_node *node = vyrtue_node_from_obj(obj);
+
+    ZEND_PARSE_PARAMETERS_START(1, 1)
+    Z_PARAM_STR(name)
+    ZEND_PARSE_PARAMETERS_END();
+
+    if (!zend_string_equals_literal(name, "children")) {
+        zend_error(E_WARNING, "Undefined property: %s::$%s", ZSTR_VAL(obj->ce->name), ZSTR_VAL(name));
+        RETURN_NULL();
+    }
+
+    if (!vyrtue_node_is_attached(node)) {
+        zend_throw_error(NULL, "VyrtueExt\\Node is no longer attached to the AST being compiled");
+        RETURN_THROWS();
+    }
+
+    vyrtue_node_get_children(OBJ_PROP_NUM(obj, VYRTUE_NODE_PROP_CHILDREN), node->ast);
+
+    RETURN_COPY(OBJ_PROP_NUM(obj, VYRTUE_NODE_PROP_CHILDREN));
+}
+
+ZEND_BEGIN_ARG_INFO_EX(vyrtue_node_construct_arginfo, 0, 0, 1)
+    ZEND_ARG_TYPE_INFO(0, kind, IS_LONG, 0)
+    ZEND_ARG_TYPE_INFO_WITH_DEFAULT_VALUE(0, flags, IS_LONG, 0, "0")
+    ZEND_ARG_TYPE_INFO_WITH_DEFAULT_VALUE(0, children, IS_ARRAY, 0, "[]")
+    ZEND_ARG_TYPE_INFO_WITH_DEFAULT_VALUE(0, lineno, IS_LONG, 1, "null")
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(vyrtue_node_get_arginfo, 0, 1, IS_MIXED, 0)
+    ZEND_ARG_TYPE_INFO(0, name, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
+static const zend_function_entry vyrtue_node_methods[] = {
+    PHP_ME(VyrtueExt_Node, __construct, vyrtue_node_construct_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(VyrtueExt_Node, __get, vyrtue_node_get_arginfo, ZEND_ACC_PUBLIC)
+    PHP_FE_END,
+};
+
+static zend_ast *vyrtue_userland_to_ast(zval *zv, bool *error);
+
+static bool vyrtue_userland_is_kind(zend_long kind)
+{
+    switch (kind) {
+#define VYRTUE_USERLAND_CASE_KIND(name) case ZEND_AST_##name:
+        VYRTUE_USERLAND_KINDS(VYRTUE_USERLAND_CASE_KIND)
+#undef VYRTUE_USERLAND_CASE_KIND
+        return true;
+
+        default:
+            return false;
+    }
+}
+
+/*
+ * What a child of a node built in userland may be: a node of one given kind,
+ * or one of the classes below. Kinds start at 1 << ZEND_AST_SPECIAL_SHIFT, so
+ * the two never collide.
+ */
+enum vyrtue_userland_slot
+{
+    VYRTUE_USERLAND_SLOT_NONE = 0,
+    VYRTUE_USERLAND_SLOT_EXPR,
+    // a statement or an expression
+    VYRTUE_USERLAND_SLOT_STMT,
+    // a ZVAL holding a string, read as is by the compiler
+    VYRTUE_USERLAND_SLOT_NAME,
+    // anything unset() accepts
+    VYRTUE_USERLAND_SLOT_VARIABLE,
+    // the arguments of a call, or the ... of a first-class callable
+    VYRTUE_USERLAND_SLOT_ARGS,
+    VYRTUE_USERLAND_SLOT_ARG,
+    VYRTUE_USERLAND_SLOT_ARRAY_ELEM,
+    // the class of new, which may also be an anonymous class
+    VYRTUE_USERLAND_SLOT_NEW_CLASS,
+    // a foreach value, maybe by reference
+    VYRTUE_USERLAND_SLOT_FOREACH_VALUE,
+};
+
+struct vyrtue_userland_shape
+{
+    zend_ast_kind kind;
+    // a bit per child that must not be NULL, for lists whether no element may be
+    uint8_t required;
+    // lists only use the first, for every element
+    uint16_t children[4];
+};
+
+#define VYRTUE_USERLAND_SHAPE(name, required, ...) {ZEND_AST_##name, required, {__VA_ARGS__}}
+#define E VYRTUE_USERLAND_SLOT_EXPR
+#define S VYRTUE_USERLAND_SLOT_STMT
+#define N VYRTUE_USERLAND_SLOT_NAME
+
+/**
+ * The kinds that can be built from userland. The rest either only make sense
+ * inside declarations, which can't be built, or at the top of a file.
+ */
+static const struct vyrtue_userland_shape vyrtue_userland_shapes[] = {
+    VYRTUE_USERLAND_SHAPE(ARG_LIST, 1, VYRTUE_USERLAND_SLOT_ARG),
+    VYRTUE_USERLAND_SHAPE(ARRAY, 0, VYRTUE_USERLAND_SLOT_ARRAY_ELEM),
+    VYRTUE_USERLAND_SHAPE(ENCAPS_LIST, 1, E),
+    VYRTUE_USERLAND_SHAPE(EXPR_LIST, 1, E),
+    VYRTUE_USERLAND_SHAPE(STMT_LIST, 0, S),
+    VYRTUE_USERLAND_SHAPE(IF, 1, ZEND_AST_IF_ELEM),
+    VYRTUE_USERLAND_SHAPE(SWITCH_LIST, 1, ZEND_AST_SWITCH_CASE),
+    VYRTUE_USERLAND_SHAPE(CATCH_LIST, 1, ZEND_AST_CATCH),
+    VYRTUE_USERLAND_SHAPE(NAME_LIST, 1, N),
+    VYRTUE_USERLAND_SHAPE(MAGIC_CONST, 0, 0),
+    VYRTUE_USERLAND_SHAPE(VAR, 1, E),
+    VYRTUE_USERLAND_SHAPE(CONST, 1, N),
+    VYRTUE_USERLAND_SHAPE(UNPACK, 1, E),
+    VYRTUE_USERLAND_SHAPE(UNARY_PLUS, 1, E),
+    VYRTUE_USERLAND_SHAPE(UNARY_MINUS, 1, E),
+    VYRTUE_USERLAND_SHAPE(CAST, 1, E),
+    VYRTUE_USERLAND_SHAPE(EMPTY, 1, E),
+    VYRTUE_USERLAND_SHAPE(ISSET, 1, E),
+    VYRTUE_USERLAND_SHAPE(SILENCE, 1, E),
+    VYRTUE_USERLAND_SHAPE(SHELL_EXEC, 1, E),
+    VYRTUE_USERLAND_SHAPE(CLONE, 1, E),
+    VYRTUE_USERLAND_SHAPE(EXIT, 0, E),
+    VYRTUE_USERLAND_SHAPE(PRINT, 1, E),
+    VYRTUE_USERLAND_SHAPE(INCLUDE_OR_EVAL, 1, E),
+    VYRTUE_USERLAND_SHAPE(UNARY_OP, 1, E),
+    VYRTUE_USERLAND_SHAPE(PRE_INC, 1, E),
+    VYRTUE_USERLAND_SHAPE(PRE_DEC, 1, E),
+    VYRTUE_USERLAND_SHAPE(POST_INC, 1, E),
+    VYRTUE_USERLAND_SHAPE(POST_DEC, 1, E),
+    VYRTUE_USERLAND_SHAPE(YIELD_FROM, 1, E),
+    VYRTUE_USERLAND_SHAPE(CLASS_NAME, 1, E),
+    VYRTUE_USERLAND_SHAPE(GLOBAL, 1, ZEND_AST_VAR),
+    VYRTUE_USERLAND_SHAPE(UNSET, 1, VYRTUE_USERLAND_SLOT_VARIABLE),
+    VYRTUE_USERLAND_SHAPE(RETURN, 0, E),
+    VYRTUE_USERLAND_SHAPE(REF, 1, E),
+    VYRTUE_USERLAND_SHAPE(LABEL, 1, N),
+    VYRTUE_USERLAND_SHAPE(ECHO, 1, E),
+    VYRTUE_USERLAND_SHAPE(THROW, 1, E),
+    VYRTUE_USERLAND_SHAPE(GOTO, 1, N),
+    VYRTUE_USERLAND_SHAPE(BREAK, 0, E),
+    VYRTUE_USERLAND_SHAPE(CONTINUE, 0, E),
+    VYRTUE_USERLAND_SHAPE(DIM, 1, E, E),
+    VYRTUE_USERLAND_SHAPE(PROP, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(NULLSAFE_PROP, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(STATIC_PROP, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(CALL, 3, E, VYRTUE_USERLAND_SLOT_ARGS),
+    VYRTUE_USERLAND_SHAPE(CLASS_CONST, 3, E, N),
+    VYRTUE_USERLAND_SHAPE(ASSIGN, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(ASSIGN_REF, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(ASSIGN_OP, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(BINARY_OP, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(GREATER, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(GREATER_EQUAL, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(AND, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(OR, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(ARRAY_ELEM, 1, E, E),
+    VYRTUE_USERLAND_SHAPE(NEW, 3, VYRTUE_USERLAND_SLOT_NEW_CLASS, VYRTUE_USERLAND_SLOT_ARGS),
+    VYRTUE_USERLAND_SHAPE(INSTANCEOF, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(YIELD, 0, E, E),
+    VYRTUE_USERLAND_SHAPE(COALESCE, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(ASSIGN_COALESCE, 3, E, E),
+    VYRTUE_USERLAND_SHAPE(STATIC, 1, N, E),
+    VYRTUE_USERLAND_SHAPE(WHILE, 1, E, S),
+    VYRTUE_USERLAND_SHAPE(DO_WHILE, 2, S, E),
+    VYRTUE_USERLAND_SHAPE(IF_ELEM, 0, E, S),
+    VYRTUE_USERLAND_SHAPE(SWITCH, 3, E, ZEND_AST_SWITCH_LIST),
+    VYRTUE_USERLAND_SHAPE(SWITCH_CASE, 0, E, S),
+    VYRTUE_USERLAND_SHAPE(MATCH, 3, E, ZEND_AST_MATCH_ARM_LIST),
+    VYRTUE_USERLAND_SHAPE(MATCH_ARM, 2, ZEND_AST_EXPR_LIST, E),
+    VYRTUE_USERLAND_SHAPE(NAMED_ARG, 3, N, E),
+    VYRTUE_USERLAND_SHAPE(METHOD_CALL, 7, E, E, VYRTUE_USERLAND_SLOT_ARGS),
+    VYRTUE_USERLAND_SHAPE(NULLSAFE_METHOD_CALL, 7, E, E, VYRTUE_USERLAND_SLOT_ARGS),
+    VYRTUE_USERLAND_SHAPE(STATIC_CALL, 7, E, E, VYRTUE_USERLAND_SLOT_ARGS),
+    VYRTUE_USERLAND_SHAPE(CONDITIONAL, 5, E, E, E),
+    VYRTUE_USERLAND_SHAPE(TRY, 2, S, ZEND_AST_CATCH_LIST, S),
+    VYRTUE_USERLAND_SHAPE(CATCH, 1, ZEND_AST_NAME_LIST, N, S),
+    VYRTUE_USERLAND_SHAPE(FOR, 0, ZEND_AST_EXPR_LIST, ZEND_AST_EXPR_LIST, ZEND_AST_EXPR_LIST, S),
+    VYRTUE_USERLAND_SHAPE(FOREACH, 3, E, VYRTUE_USERLAND_SLOT_FOREACH_VALUE, E, S),
+};
+
+#undef VYRTUE_USERLAND_SHAPE
+#undef E
+#undef S
+#undef N
+
+static const struct vyrtue_userland_shape *vyrtue_userland_find_shape(zend_long kind)
+{
+    for (size_t i = 0; i < sizeof(vyrtue_userland_shapes) / sizeof(vyrtue_userland_shapes[0]); i++) {
+        if (vyrtue_userland_shapes[i].kind == kind) {
+            return &vyrtue_userland_shapes[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool vyrtue_userland_is_expr(zend_ast_kind kind)
+{
+    switch (kind) {
+        case ZEND_AST_ZVAL:
+        case ZEND_AST_CONST:
+        case ZEND_AST_VAR:
+        case ZEND_AST_DIM:
+        case ZEND_AST_PROP:
+        case ZEND_AST_NULLSAFE_PROP:
+        case ZEND_AST_STATIC_PROP:
+        case ZEND_AST_CALL:
+        case ZEND_AST_METHOD_CALL:
+        case ZEND_AST_NULLSAFE_METHOD_CALL:
+        case ZEND_AST_STATIC_CALL:
+        case ZEND_AST_CLASS_CONST:
+        case ZEND_AST_CLASS_NAME:
+        case ZEND_AST_ASSIGN:
+        case ZEND_AST_ASSIGN_REF:
+        case ZEND_AST_ASSIGN_OP:
+        case ZEND_AST_ASSIGN_COALESCE:
+        case ZEND_AST_BINARY_OP:
+        case ZEND_AST_GREATER:
+        case ZEND_AST_GREATER_EQUAL:
+        case ZEND_AST_AND:
+        case ZEND_AST_OR:
+        case ZEND_AST_COALESCE:
+        case ZEND_AST_UNARY_OP:
+        case ZEND_AST_UNARY_PLUS:
+        case ZEND_AST_UNARY_MINUS:
+        case ZEND_AST_CAST:
+        case ZEND_AST_EMPTY:
+        case ZEND_AST_ISSET:
+        case ZEND_AST_SILENCE:
+        case ZEND_AST_SHELL_EXEC:
+        case ZEND_AST_CLONE:
+        case ZEND_AST_EXIT:
+        case ZEND_AST_PRINT:
+        case ZEND_AST_INCLUDE_OR_EVAL:
+        case ZEND_AST_PRE_INC:
+        case ZEND_AST_PRE_DEC:
+        case ZEND_AST_POST_INC:
+        case ZEND_AST_POST_DEC:
+        case ZEND_AST_YIELD:
+        case ZEND_AST_YIELD_FROM:
+        case ZEND_AST_NEW:
+        case ZEND_AST_INSTANCEOF:
+        case ZEND_AST_CONDITIONAL:
+        case ZEND_AST_ARRAY:
+        case ZEND_AST_ENCAPS_LIST:
+        case ZEND_AST_MAGIC_CONST:
+        case ZEND_AST_CLOSURE:
+        case ZEND_AST_ARROW_FUNC:
+        case ZEND_AST_MATCH:
+        case ZEND_AST_THROW:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static bool vyrtue_userland_is_stmt(zend_ast_kind kind)
+{
+    switch (kind) {
+        case ZEND_AST_STMT_LIST:
+        case ZEND_AST_ECHO:
+        case ZEND_AST_GLOBAL:
+        case ZEND_AST_UNSET:
+        case ZEND_AST_RETURN:
+        case ZEND_AST_LABEL:
+        case ZEND_AST_GOTO:
+        case ZEND_AST_BREAK:
+        case ZEND_AST_CONTINUE:
+        case ZEND_AST_STATIC:
+        case ZEND_AST_WHILE:
+        case ZEND_AST_DO_WHILE:
+        case ZEND_AST_IF:
+        case ZEND_AST_SWITCH:
+        case ZEND_AST_TRY:
+        case ZEND_AST_FOR:
+        case ZEND_AST_FOREACH:
+        case ZEND_AST_FUNC_DECL:
+        case ZEND_AST_CLASS:
+            return true;
+
+        default:
+            return vyrtue_userland_is_expr(kind);
+    }
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_userland_fits(uint16_t slot, zend_ast *child)
+{
+    zend_ast_kind kind = child->kind;
+
+    switch (slot) {
+        case VYRTUE_USERLAND_SLOT_EXPR:
+            return vyrtue_userland_is_expr(kind);
+        case VYRTUE_USERLAND_SLOT_STMT:
+            return vyrtue_userland_is_stmt(kind);
+        case VYRTUE_USERLAND_SLOT_NAME:
+            return kind == ZEND_AST_ZVAL && Z_TYPE_P(zend_ast_get_zval(child)) == IS_STRING;
+        case VYRTUE_USERLAND_SLOT_VARIABLE:
+            return kind == ZEND_AST_VAR || kind == ZEND_AST_DIM || kind == ZEND_AST_PROP || kind == ZEND_AST_NULLSAFE_PROP ||
+                kind == ZEND_AST_STATIC_PROP;
+        case VYRTUE_USERLAND_SLOT_ARGS:
+            return kind == ZEND_AST_ARG_LIST || kind == ZEND_AST_CALLABLE_CONVERT;
+        case VYRTUE_USERLAND_SLOT_ARG:
+            return kind == ZEND_AST_UNPACK || kind == ZEND_AST_NAMED_ARG || vyrtue_userland_is_expr(kind);
+        case VYRTUE_USERLAND_SLOT_ARRAY_ELEM:
+            return kind == ZEND_AST_ARRAY_ELEM || kind == ZEND_AST_UNPACK;
+        case VYRTUE_USERLAND_SLOT_NEW_CLASS:
+            return kind == ZEND_AST_CLASS || vyrtue_userland_is_expr(kind);
+        case VYRTUE_USERLAND_SLOT_FOREACH_VALUE:
+            return kind == ZEND_AST_REF || vyrtue_userland_is_expr(kind);
+        default:
+            return kind == slot;
+    }
+}
+
+/**
+ * The opcodes of compound assignments, which binary operations share.
+ */
+static bool vyrtue_userland_is_assign_op(zend_long opcode)
+{
+    switch (opcode) {
+        case ZEND_ADD:
+        case ZEND_SUB:
+        case ZEND_MUL:
+        case ZEND_DIV:
+        case ZEND_MOD:
+        case ZEND_SL:
+        case ZEND_SR:
+        case ZEND_CONCAT:
+        case ZEND_BW_OR:
+        case ZEND_BW_AND:
+        case ZEND_BW_XOR:
+        case ZEND_POW:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * Whether attr is a value the compiler handles for kind, where it reads it
+ * at all. Anything else must be zero.
+ */
+static bool vyrtue_userland_is_valid_attr(zend_long kind, zend_long attr)
+{
+    switch (kind) {
+        case ZEND_AST_ZVAL:
+            return attr == ZEND_NAME_FQ || attr == ZEND_NAME_NOT_FQ || attr == ZEND_NAME_RELATIVE;
+
+        case ZEND_AST_BINARY_OP:
+            return vyrtue_userland_is_assign_op(attr) || attr == ZEND_IS_IDENTICAL || attr == ZEND_IS_NOT_IDENTICAL ||
+                attr == ZEND_IS_EQUAL || attr == ZEND_IS_NOT_EQUAL || attr == ZEND_IS_SMALLER || attr == ZEND_IS_SMALLER_OR_EQUAL ||
+                attr == ZEND_SPACESHIP || attr == ZEND_BOOL_XOR;
+
+        case ZEND_AST_ASSIGN_OP:
+            return vyrtue_userland_is_assign_op(attr);
+
+        case ZEND_AST_UNARY_OP:
+            return attr == ZEND_BW_NOT || attr == ZEND_BOOL_NOT;
+
+        case ZEND_AST_CAST:
+            return attr == IS_NULL || attr == _IS_BOOL || attr == IS_LONG || attr == IS_DOUBLE || attr == IS_STRING ||
+                attr == IS_ARRAY || attr == IS_OBJECT;
+
+        case ZEND_AST_INCLUDE_OR_EVAL:
+            return attr == ZEND_INCLUDE_ONCE || attr == ZEND_REQUIRE_ONCE || attr == ZEND_INCLUDE || attr == ZEND_REQUIRE ||
+                attr == ZEND_EVAL;
+
+        case ZEND_AST_MAGIC_CONST:
+            switch (attr) {
+                case T_LINE:
+                case T_FILE:
+                case T_DIR:
+                case T_TRAIT_C:
+                case T_METHOD_C:
+                case T_FUNC_C:
+                case T_NS_C:
+                case T_CLASS_C:
+#if PHP_VERSION_ID >= 80400
+                case T_PROPERTY_C:
+#endif
+                    return true;
+                default:
+                    return false;
+            }
+
+        case ZEND_AST_ARRAY:
+            return attr == 0 || attr == ZEND_ARRAY_SYNTAX_LIST || attr == ZEND_ARRAY_SYNTAX_LONG || attr == ZEND_ARRAY_SYNTAX_SHORT;
+
+        case ZEND_AST_ARRAY_ELEM:
+            // by reference
+            return attr == 0 || attr == 1;
+
+        case ZEND_AST_CONDITIONAL:
+            return attr == 0 || attr == ZEND_PARENTHESIZED_CONDITIONAL;
+
+        default:
+            return attr == 0;
+    }
+}
+
+/**
+ * A replacement must fit where the visited node was: an expression can only
+ * be replaced by an expression, a statement by a statement or an expression,
+ * and anything else, including a ZVAL that may be a name, by its own kind.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static bool vyrtue_userland_can_replace(zend_ast *ast, zend_ast *replace)
+{
+    if (replace->kind == ast->kind) {
+        return true;
+    } else if (ast->kind == ZEND_AST_ZVAL) {
+        return false;
+    } else if (vyrtue_userland_is_expr(ast->kind)) {
+        return vyrtue_userland_is_expr(replace->kind);
+    } else if (vyrtue_userland_is_stmt(ast->kind)) {
+        return vyrtue_userland_is_stmt(replace->kind);
+    }
+
+    return false;
+}
+
+/**
+ * Nodes are checked against vyrtue_userland_shapes as they are built, so the
+ * compiler never sees a child or flag the parser could not have produced.
+ * Partially built trees are abandoned on error rather than destroyed, they
+ * live in the compiler's arena and are released along with it.
+ */
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_userland_create_ast(zend_long kind, zend_long flags, uint32_t lineno, HashTable *children_ht, bool *error)
+{
+    const struct vyrtue_userland_shape *shape;
+    zend_ast *children[4] = {NULL};
+    zend_ast *ast;
+    uint32_t num_children;
+    uint32_t i;
+
+    // anything else could be a kind the compiler doesn't expect from the parser
+    if (!vyrtue_userland_is_kind(kind) || !vyrtue_userland_is_valid_attr(kind, flags)) {
+        goto fail;
+    }
+
+    if (kind == ZEND_AST_ZVAL) {
+        zval *value = zend_hash_index_find(children_ht, 0);
+        if (value == NULL) {
+            goto fail;
+        }
+        ZVAL_DEREF(value);
+        if (Z_TYPE_P(value) == IS_OBJECT || Z_TYPE_P(value) == IS_RESOURCE) {
+            goto fail;
+        }
+        ast = zend_ast_create_zval_with_lineno(value, lineno);
+        Z_TRY_ADDREF_P(value);
+        ast->attr = (zend_ast_attr) flags;
+        return ast;
+    }
+
+    // declarations and compiler internal nodes have no shape, they can't be built
+    shape = vyrtue_userland_find_shape(kind);
+    if (shape == NULL) {
+        goto fail;
+    }
+
+    if ((kind >> ZEND_AST_IS_LIST_SHIFT) & 1) {
+        zval *child_zv;
+        ast = zend_ast_create_list(0, (zend_ast_kind) kind);
+        ZEND_HASH_FOREACH_VAL(children_ht, child_zv)
+        {
+            zend_ast *child = vyrtue_userland_to_ast(child_zv, error);
+            if (*error) {
+                return NULL;
+            }
+            if (child == NULL ? shape->required : !vyrtue_userland_fits(shape->children[0], child)) {
+                goto fail;
+            }
+            ast = zend_ast_list_add(ast, child);
+        }
+        ZEND_HASH_FOREACH_END();
+        ast->attr = (zend_ast_attr) flags;
+        ((zend_ast_list *) ast)->lineno = lineno;
+        return ast;
+    }
+
+    num_children = (uint32_t) (kind >> ZEND_AST_NUM_CHILDREN_SHIFT);
+    if (num_children > sizeof(children) / sizeof(children[0])) {
+        goto fail;
+    }
+
+    for (i = 0; i < num_children; i++) {
+        zval *child_zv = zend_hash_index_find(children_ht, i);
+        if (child_zv != NULL) {
+            children[i] = vyrtue_userland_to_ast(child_zv, error);
+            if (*error) {
+                return NULL;
+            }
+        }
+        if (children[i] == NULL ? (shape->required & (1u << i)) : !vyrtue_userland_fits(shape->children[i], children[i])) {
+            goto fail;
+        }
+    }
+
+    switch (num_children) {
+        case 0:
+            ast = zend_ast_create_0((zend_ast_kind) kind);
+            break;
+        case 1:
+            ast = zend_ast_create_1((zend_ast_kind) kind, children[0]);
+            break;
+        case 2:
+            ast = zend_ast_create_2((zend_ast_kind) kind, children[0], children[1]);
+            break;
+        case 3:
+            ast = zend_ast_create_3((zend_ast_kind) kind, children[0], children[1], children[2]);
+            break;
+        default:
+            ast = zend_ast_create_4((zend_ast_kind) kind, children[0], children[1], children[2], children[3]);
+            break;
+    }
+
+    ast->attr = (zend_ast_attr) flags;
+    ast->lineno = lineno;
+    return ast;
+
+fail:
+    *error = true;
+    return NULL;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_userland_node_to_ast(zend_object *obj, bool *error)
+{
+    zval rv;
+    zval children_rv;
+    zval *kind_zv;
+    zval *flags_zv;
+    zval *lineno_zv;
+    zval *children_zv;
+    zend_ast *ast;
+    zend_long kind;
+    zend_long flags;
+    uint32_t lineno;
+
+    if (obj->ce == vyrtue_node_ce) {
+        struct vyrtue_node *node = vyrtue_node_from_obj(obj);
+        if (vyrtue_node_is_attached(node)) {
+            // the subtree still belongs to the node being replaced, which is destroyed
+            ast = vyrtue_ast_dup(node->ast);
+            if (ast == NULL) {
+                goto fail;
+            }
+            return ast;
+        } else if (node->ast != NULL) {
+            // a node kept from an earlier visit, its children may be gone
+            goto fail;
+        }
+    }
+
+    // anything shaped like ast\Node will do
+    kind_zv = zend_read_property(obj->ce, obj, ZEND_STRL("kind"), 1, &rv);
+    if (Z_TYPE_P(kind_zv) != IS_LONG) {
+        goto fail;
+    }
+    kind = Z_LVAL_P(kind_zv);
+
+    flags_zv = zend_read_property(obj->ce, obj, ZEND_STRL("flags"), 1, &rv);
+    flags = Z_TYPE_P(flags_zv) == IS_LONG ? Z_LVAL_P(flags_zv) : 0;
+
+    lineno_zv = zend_read_property(obj->ce, obj, ZEND_STRL("lineno"), 1, &rv);
+    lineno = Z_TYPE_P(lineno_zv) == IS_LONG ? (uint32_t) Z_LVAL_P(lineno_zv) : CG(zend_lineno);
+
+    if (kind < 0 || kind > 0xffff) {
+        goto fail;
+    }
+
+    ZVAL_UNDEF(&children_rv);
+    children_zv = zend_read_property(obj->ce, obj, ZEND_STRL("children"), 1, &children_rv);
+    if (Z_TYPE_P(children_zv) != IS_ARRAY) {
+        zval_ptr_dtor(&children_rv);
+        goto fail;
+    }
+    ast = vyrtue_userland_create_ast(kind, flags, lineno, Z_ARRVAL_P(children_zv), error);
+    zval_ptr_dtor(&children_rv);
+
+    return ast;
+
+fail:
+    *error = true;
+    return NULL;
+}
+
+/**
+ * Converts a value returned by a visitor back into an AST.
+ */
+static zend_ast *vyrtue_userland_to_ast(zval *zv, bool *error)
+{
+    ZVAL_DEREF(zv);
+
+    switch (Z_TYPE_P(zv)) {
+        case IS_NULL:
+            return NULL;
+
+        case IS_FALSE:
+        case IS_TRUE:
+        case IS_LONG:
+        case IS_DOUBLE:
+        case IS_STRING:
+        case IS_ARRAY: {
+            zval tmp;
+            ZVAL_COPY(&tmp, zv);
+            return zend_ast_create_zval_with_lineno(&tmp, CG(zend_lineno));
+        }
+
+        case IS_OBJECT:
+            return vyrtue_userland_node_to_ast(Z_OBJ_P(zv), error);
+
+        default:
+            *error = true;
+            return NULL;
+    }
+}
+
+/**
+ * Exceptions can't propagate out of the compiler, so they are reported as
+ * warnings instead.
+ */
+static void vyrtue_userland_report_exception(void)
+{
+    zend_object *ex = EG(exception);
+
+    GC_ADDREF(ex);
+    zend_clear_exception();
+    zend_exception_error(ex, E_WARNING);
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_userland_dispatch(HashTable *visitors, zend_ast *ast, bool enter)
+{
+    struct vyrtue_userland_visitor *visitor;
+    zend_ast *replace = NULL;
+    zval node;
+    zval retval;
+
+    ZVAL_UNDEF(&node);
+    VYRTUE_G(userland_depth)++;
+
+    ZEND_HASH_FOREACH_PTR(visitors, visitor)
+    {
+        zend_fcall_info *fci = enter ? &visitor->enter_fci : &visitor->leave_fci;
+        zend_fcall_info_cache *fcc = enter ? &visitor->enter_fcc : &visitor->leave_fcc;
+        bool error = false;
+
+        if (!ZEND_FCI_INITIALIZED(*fci)) {
+            continue;
+        }
+
+        if (Z_ISUNDEF(node)) {
+            vyrtue_node_wrap(&node, ast);
+        }
+
+        fci->retval = &retval;
+        fci->params = &node;
+        fci->param_count = 1;
+
+        if (SUCCESS != zend_call_function(fci, fcc) || EG(exception)) {
+            if (EG(exception)) {
+                vyrtue_userland_report_exception();
+            }
+            break;
+        }
+
+        // returning the visited node means no change, anything else is walked again
+        if (Z_TYPE(retval) == IS_OBJECT && Z_OBJ(retval) == Z_OBJ(node)) {
+            zval_ptr_dtor(&retval);
+            continue;
+        }
+
+        replace = vyrtue_userland_to_ast(&retval, &error);
+        zval_ptr_dtor(&retval);
+
+        if (replace != NULL && !vyrtue_userland_can_replace(ast, replace)) {
+            error = true;
+        }
+
+        if (error) {
+            zend_error(E_WARNING, "vyrtue: visitor must return null, a scalar, an array or a valid node");
+            replace = NULL;
+        }
+
+        if (replace != NULL) {
+            break;
+        }
+    }
+    ZEND_HASH_FOREACH_END();
+
+    // detaches every node created during this visit
+    VYRTUE_G(userland_epoch)++;
+    VYRTUE_G(userland_depth)--;
+
+    zval_ptr_dtor(&node);
+
+    return replace;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static HashTable *vyrtue_userland_find_function_visitors(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    HashTable *visitors = NULL;
+
+    if (EXPECTED(VYRTUE_G(userland_visitors) == NULL)) {
+        return NULL;
+    }
+
+    zend_string *name = vyrtue_ast_get_call_name(ast, ctx);
+    if (name != NULL) {
+        visitors = zend_hash_find_ptr_lc(VYRTUE_G(userland_visitors), name);
+        zend_string_release(name);
+    }
+
+    return visitors;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_userland_kind_enter(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    HashTable *visitors = VYRTUE_G(userland_visitors) ? zend_hash_index_find_ptr(VYRTUE_G(userland_visitors), ast->kind) : NULL;
+    return visitors ? vyrtue_userland_dispatch(visitors, ast, true) : NULL;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_userland_kind_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    HashTable *visitors = VYRTUE_G(userland_visitors) ? zend_hash_index_find_ptr(VYRTUE_G(userland_visitors), ast->kind) : NULL;
+    return visitors ? vyrtue_userland_dispatch(visitors, ast, false) : NULL;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_userland_function_enter(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    HashTable *visitors = vyrtue_userland_find_function_visitors(ast, ctx);
+    return visitors ? vyrtue_userland_dispatch(visitors, ast, true) : NULL;
+}
+
+VYRTUE_ATTR_NONNULL_ALL
+static zend_ast *vyrtue_userland_function_leave(zend_ast *ast, struct vyrtue_context *ctx)
+{
+    HashTable *visitors = vyrtue_userland_find_function_visitors(ast, ctx);
+    return visitors ? vyrtue_userland_dispatch(visitors, ast, false) : NULL;
+}
+
+static void vyrtue_userland_visitor_dtor(zval *zv)
+{
+    struct vyrtue_userland_visitor *visitor = Z_PTR_P(zv);
+
+    if (ZEND_FCI_INITIALIZED(visitor->enter_fci)) {
+        zval_ptr_dtor(&visitor->enter_fci.function_name);
+    }
+    if (ZEND_FCI_INITIALIZED(visitor->leave_fci)) {
+        zval_ptr_dtor(&visitor->leave_fci.function_name);
+    }
+
+    efree(visitor);
+}
+
+static void vyrtue_userland_visitors_dtor(zval *zv)
+{
+    zend_hash_destroy(Z_PTR_P(zv));
+    FREE_HASHTABLE(Z_PTR_P(zv));
+}
+
+/**
+ * Returns the visitor list for a kind or function name, registering the
+ * native visitor the first time it is subscribed to in this process.
+ */
+static HashTable *vyrtue_userland_get_visitors(zend_long kind, zend_string *name)
+{
+    HashTable *visitors;
+    zval tmp;
+
+    if (VYRTUE_G(userland_hooks) == NULL) {
+        VYRTUE_G(userland_hooks) = pemalloc(sizeof(HashTable), 1);
+        zend_hash_init(VYRTUE_G(userland_hooks), 8, NULL, NULL, 1);
+    }
+
+    ZVAL_TRUE(&tmp);
+    if (name != NULL) {
+        if (!zend_hash_exists(VYRTUE_G(userland_hooks), name)) {
+            zend_string *pname = zend_string_init(ZSTR_VAL(name), ZSTR_LEN(name), 1);
+            zend_hash_add_new(VYRTUE_G(userland_hooks), pname, &tmp);
+            vyrtue_register_function_visitor(
+                VYRTUE_USERLAND_VISITOR_NAME, pname, vyrtue_userland_function_enter, vyrtue_userland_function_leave
+            );
+            zend_string_release_ex(pname, 1);
+        }
+    } else if (zend_hash_index_add(VYRTUE_G(userland_hooks), (zend_ulong) kind, &tmp)) {
+        vyrtue_register_kind_visitor(VYRTUE_USERLAND_VISITOR_NAME, (enum _zend_ast_kind) kind, vyrtue_userland_kind_enter, vyrtue_userland_kind_leave);
+    }
+
+    if (VYRTUE_G(userland_visitors) == NULL) {
+        ALLOC_HASHTABLE(VYRTUE_G(userland_visitors));
+        zend_hash_init(VYRTUE_G(userland_visitors), 8, NULL, vyrtue_userland_visitors_dtor, 0);
+    }
+
+    visitors = name ? zend_hash_find_ptr_lc(VYRTUE_G(userland_visitors), name)
+                    : zend_hash_index_find_ptr(VYRTUE_G(userland_visitors), (zend_ulong) kind);
+    if (visitors == NULL) {
+        ALLOC_HASHTABLE(visitors);
+        zend_hash_init(visitors, 1, NULL, vyrtue_userland_visitor_dtor, 0);
+        if (name) {
+            zend_string *lcname = zend_string_tolower(name);
+            zend_hash_add_new_ptr(VYRTUE_G(userland_visitors), lcname, visitors);
+            zend_string_release(lcname);
+        } else {
+            zend_hash_index_add_new_ptr(VYRTUE_G(userland_visitors), (zend_ulong) kind, visitors);
+        }
+    }
+
+    return visitors;
+}
+
+/**
+ * VyrtueExt\register_visitor(int|string $target, ?callable $enter, ?callable $leave = null): void
+ *
+ * Calls $enter and $leave with a VyrtueExt\Node for every node of the given
+ * kind, or every call to the given function, in files compiled afterwards
+ * during this request. A callback returns null to keep the node, or a
+ * replacement, which is walked again.
+ */
+VYRTUE_LOCAL PHP_FUNCTION(vyrtue_register_visitor)
+{
+    zend_long kind = 0;
+    zend_string *name = NULL;
+    zend_fcall_info enter_fci = empty_fcall_info;
+    zend_fcall_info_cache enter_fcc = empty_fcall_info_cache;
+    zend_fcall_info leave_fci = empty_fcall_info;
+    zend_fcall_info_cache leave_fcc = empty_fcall_info_cache;
+
+    ZEND_PARSE_PARAMETERS_START(2, 3)
+    Z_PARAM_STR_OR_LONG(name, kind)
+    Z_PARAM_FUNC_OR_NULL(enter_fci, enter_fcc)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_FUNC_OR_NULL(leave_fci, leave_fcc)
+    ZEND_PARSE_PARAMETERS_END();
+
+    if (VYRTUE_G(userland_depth) > 0) {
+        zend_throw_error(NULL, "Visitors cannot be registered while a visitor is running");
+        RETURN_THROWS();
+    }
+
+    if (name != NULL) {
+        if (ZSTR_LEN(name) > 0 && ZSTR_VAL(name)[0] == '\\') {
+            name = zend_string_init(ZSTR_VAL(name) + 1, ZSTR_LEN(name) - 1, 0);
+        } else {
+            name = zend_string_copy(name);
+        }
+    } else if (kind < 0 || kind > 0xffff) {
+        zend_argument_value_error(1, "must be a valid AST kind");
+        RETURN_THROWS();
+    }
+
+    struct vyrtue_userland_visitor *visitor = ecalloc(1, sizeof(*visitor));
+
+    if (ZEND_FCI_INITIALIZED(enter_fci)) {
+        visitor->enter_fci = enter_fci;
+        visitor->enter_fcc = enter_fcc;
+        Z_TRY_ADDREF(visitor->enter_fci.function_name);
+    }
+    if (ZEND_FCI_INITIALIZED(leave_fci)) {
+        visitor->leave_fci = leave_fci;
+        visitor->leave_fcc = leave_fcc;
+        Z_TRY_ADDREF(visitor->leave_fci.function_name);
+    }
+
+    zend_hash_next_index_insert_ptr(vyrtue_userland_get_visitors(kind, name), visitor);
+
+    if (name) {
+        zend_string_release(name);
+    }
+}
+
+VYRTUE_LOCAL PHP_MINIT_FUNCTION(vyrtue_userland)
+{
+    zend_class_entry ce;
+    zval tmp;
+    int flags = CONST_CS | CONST_PERSISTENT;
+
+    INIT_NS_CLASS_ENTRY(ce, "VyrtueExt", "Node", vyrtue_node_methods);
+    vyrtue_node_ce = zend_register_internal_class(&ce);
+    vyrtue_node_ce->ce_flags |= ZEND_ACC_FINAL;
+    vyrtue_node_ce->create_object = vyrtue_node_create;
+
+    memcpy(&vyrtue_node_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+    vyrtue_node_handlers.offset = XtOffsetOf(struct vyrtue_node, std);
+
+    // the order must match VYRTUE_NODE_PROP_*
+    ZVAL_LONG(&tmp, 0);
+    zend_declare_property_ex(vyrtue_node_ce, zend_string_init_interned(ZEND_STRL("kind"), 1), &tmp, ZEND_ACC_PUBLIC, NULL);
+    zend_declare_property_ex(vyrtue_node_ce, zend_string_init_interned(ZEND_STRL("flags"), 1), &tmp, ZEND_ACC_PUBLIC, NULL);
+    zend_declare_property_ex(vyrtue_node_ce, zend_string_init_interned(ZEND_STRL("lineno"), 1), &tmp, ZEND_ACC_PUBLIC, NULL);
+    ZVAL_NULL(&tmp);
+    zend_declare_property_ex(vyrtue_node_ce, zend_string_init_interned(ZEND_STRL("children"), 1), &tmp, ZEND_ACC_PUBLIC, NULL);
+
+#define VYRTUE_USERLAND_REGISTER_KIND(name) REGISTER_LONG_CONSTANT("VyrtueExt\\AST_" #name, ZEND_AST_##name, flags);
+    VYRTUE_USERLAND_KINDS(VYRTUE_USERLAND_REGISTER_KIND)
+#undef VYRTUE_USERLAND_REGISTER_KIND
+
+    return SUCCESS;
+}
+
+VYRTUE_LOCAL PHP_RSHUTDOWN_FUNCTION(vyrtue_userland)
+{
+    if (VYRTUE_G(userland_visitors) != NULL) {
+        zend_hash_destroy(VYRTUE_G(userland_visitors));
+        FREE_HASHTABLE(VYRTUE_G(userland_visitors));
+        VYRTUE_G(userland_visitors) = NULL;
+    }
+
+    return SUCCESS;
+}
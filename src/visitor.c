@@ -28,6 +28,7 @@
 #include "main/php_streams.h"
 
 #include "php_vyrtue.h"
+#include "stats.h"
 #include "visitor.h"
 
 static const struct vyrtue_visitor_array EMPTY_VISITOR_ARRAY = {
@@ -37,11 +38,21 @@ static const struct vyrtue_visitor_array EMPTY_VISITOR_ARRAY = {
 
 VYRTUE_PUBLIC
 void vyrtue_register_attribute_visitor(const char *visitor_name, zend_string *attribute_name, vyrtue_ast_callback enter, vyrtue_ast_callback leave)
+{
+    vyrtue_register_attribute_visitor_ex(visitor_name, attribute_name, enter, leave, 0);
+}
+
+VYRTUE_PUBLIC
+void vyrtue_register_attribute_visitor_ex(
+    const char *visitor_name, zend_string *attribute_name, vyrtue_ast_callback enter, vyrtue_ast_callback leave, uint32_t flags
+)
 {
     struct vyrtue_visitor visitor = {
         .name = visitor_name,
         .enter = enter,
         .leave = leave,
+        .flags = flags,
+        .stats_slot = vyrtue_stats_register_visitor(visitor_name),
     };
 
     struct vyrtue_visitor_array *arr = zend_hash_find_ptr(&VYRTUE_G(attribute_visitors), attribute_name);
@@ -51,7 +62,7 @@ void vyrtue_register_attribute_visitor(const char *visitor_name, zend_string *at
         memset(arr, 0, size);
         arr->size = size;
     } else {
-        size_t size = sizeof(*arr) + sizeof(arr->data[0]) * arr->length + 1;
+        size_t size = sizeof(*arr) + sizeof(arr->data[0]) * (arr->length + 1);
         arr = perealloc(arr, size, 1);
         arr->size = size;
     }
@@ -64,11 +75,21 @@ void vyrtue_register_attribute_visitor(const char *visitor_name, zend_string *at
 
 VYRTUE_PUBLIC
 void vyrtue_register_function_visitor(const char *visitor_name, zend_string *function_name, vyrtue_ast_callback enter, vyrtue_ast_callback leave)
+{
+    vyrtue_register_function_visitor_ex(visitor_name, function_name, enter, leave, 0);
+}
+
+VYRTUE_PUBLIC
+void vyrtue_register_function_visitor_ex(
+    const char *visitor_name, zend_string *function_name, vyrtue_ast_callback enter, vyrtue_ast_callback leave, uint32_t flags
+)
 {
     struct vyrtue_visitor visitor = {
         .name = visitor_name,
         .enter = enter,
         .leave = leave,
+        .flags = flags,
+        .stats_slot = vyrtue_stats_register_visitor(visitor_name),
     };
 
     struct vyrtue_visitor_array *arr = zend_hash_find_ptr(&VYRTUE_G(function_visitors), function_name);
@@ -78,7 +99,7 @@ void vyrtue_register_function_visitor(const char *visitor_name, zend_string *fun
         memset(arr, 0, size);
         arr->size = size;
     } else {
-        size_t size = sizeof(*arr) + sizeof(arr->data[0]) * arr->length + 1;
+        size_t size = sizeof(*arr) + sizeof(arr->data[0]) * (arr->length + 1);
         arr = perealloc(arr, size, 1);
         arr->size = size;
     }
@@ -91,11 +112,21 @@ void vyrtue_register_function_visitor(const char *visitor_name, zend_string *fun
 
 VYRTUE_PUBLIC
 void vyrtue_register_kind_visitor(const char *visitor_name, enum _zend_ast_kind kind, vyrtue_ast_callback enter, vyrtue_ast_callback leave)
+{
+    vyrtue_register_kind_visitor_ex(visitor_name, kind, enter, leave, 0);
+}
+
+VYRTUE_PUBLIC
+void vyrtue_register_kind_visitor_ex(
+    const char *visitor_name, enum _zend_ast_kind kind, vyrtue_ast_callback enter, vyrtue_ast_callback leave, uint32_t flags
+)
 {
     struct vyrtue_visitor visitor = {
         .name = visitor_name,
         .enter = enter,
         .leave = leave,
+        .flags = flags,
+        .stats_slot = vyrtue_stats_register_visitor(visitor_name),
     };
 
     struct vyrtue_visitor_array *arr = zend_hash_index_find_ptr(&VYRTUE_G(kind_visitors), (zend_ulong) kind);
@@ -105,7 +136,7 @@ void vyrtue_register_kind_visitor(const char *visitor_name, enum _zend_ast_kind
         memset(arr, 0, size);
         arr->size = size;
     } else {
-        size_t size = sizeof(*arr) + sizeof(arr->data[0]) * arr->length + 1;
+        size_t size = sizeof(*arr) + sizeof(arr->data[0]) * (arr->length + 1);
         arr = perealloc(arr, size, 1);
         arr->size = size;
     }
@@ -116,6 +147,13 @@ void vyrtue_register_kind_visitor(const char *visitor_name, enum _zend_ast_kind
     zend_hash_index_update_ptr(&VYRTUE_G(kind_visitors), (zend_ulong) kind, arr);
 }
 
+VYRTUE_PUBLIC
+VYRTUE_ATTR_NONNULL_ALL
+void vyrtue_register_visitor_version(const char *visitor_name, const char *version)
+{
+    zend_hash_str_update_ptr(&VYRTUE_G(visitor_versions), visitor_name, strlen(visitor_name), (void *) version);
+}
+
 VYRTUE_PUBLIC
 VYRTUE_ATTR_NONNULL_ALL
 VYRTUE_ATTR_RETURNS_NONNULL
@@ -26,6 +26,8 @@ struct vyrtue_visitor
     const char *name;
     vyrtue_ast_callback enter;
     vyrtue_ast_callback leave;
+    uint32_t flags;
+    uint32_t stats_slot;
 };
 
 struct vyrtue_visitor_array
@@ -0,0 +1,16 @@
+--TEST--
+alloc 01
+--EXTENSIONS--
+vyrtue
+--ENV--
+PHP_VYRTUE_DEBUG_ALLOC=1
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+<?php if (getenv('USE_ZEND_ALLOC') === '0') die("skip: requires the zend memory manager"); ?>
+--FILE--
+<?php
+echo include __DIR__ . '/alloc-01.inc';
+--EXPECTF--
+VYRTUE_ALLOC: %salloc-01.php other=%d/%dB names=%d/%dB imports=%d/%dB scope=%d/%dB arena=%d/%dB
+VYRTUE_ALLOC: %salloc-01.inc other=%d/%dB names=%d/%dB imports=%d/%dB scope=%d/%dB arena=%d/%dB
+9
@@ -0,0 +1,27 @@
+--TEST--
+alloc 02
+--EXTENSIONS--
+vyrtue
+--ENV--
+PHP_VYRTUE_DEBUG_ALLOC=1
+--INI--
+memory_limit=32M
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+<?php if (getenv('USE_ZEND_ALLOC') === '0') die("skip: requires the zend memory manager"); ?>
+--FILE--
+<?php
+// a fatal error in a visitor must not leave accounting running
+VyrtueExt\register_visitor('explode_here', function () {
+    return str_repeat('x', 64 * 1024 * 1024);
+});
+register_shutdown_function(function () {
+    echo include __DIR__ . '/alloc-01.inc';
+});
+include __DIR__ . '/alloc-02.inc';
+--EXPECTF--
+VYRTUE_ALLOC: %salloc-02.php other=%d/%dB names=%d/%dB imports=%d/%dB scope=%d/%dB arena=%d/%dB
+
+Fatal error: Allowed memory size of %d bytes exhausted%s
+VYRTUE_ALLOC: %salloc-01.inc other=%d/%dB names=%d/%dB imports=%d/%dB scope=%d/%dB arena=%d/%dB
+9
@@ -0,0 +1,20 @@
+--TEST--
+aot 01
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+$code = VyrtueExt\transform_file(__DIR__ . '/aot-01.inc');
+var_dump(str_starts_with($code, "<?php\n"));
+var_dump(str_contains($code, 'strlen'), str_contains($code, 'str_repeat'));
+var_dump(eval('?>' . $code));
+--EXPECT--
+bool(true)
+bool(false)
+bool(false)
+array(2) {
+  [0]=>
+  int(3)
+  [1]=>
+  string(4) "----"
+}
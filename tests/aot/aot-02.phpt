@@ -0,0 +1,15 @@
+--TEST--
+aot 02
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+try {
+    VyrtueExt\transform_file(__DIR__ . '/aot-02.inc');
+} catch (ParseError $e) {
+    echo get_class($e), ': ', $e->getMessage(), "\n";
+}
+var_dump(@VyrtueExt\transform_file(__DIR__ . '/missing.inc'));
+--EXPECT--
+ParseError: syntax error, unexpected token ";"
+bool(false)
@@ -0,0 +1,69 @@
+--TEST--
+aot 03
+--EXTENSIONS--
+vyrtue
+--SKIPIF--
+<?php if (!function_exists('proc_open')) die("skip: proc_open not available"); ?>
+--FILE--
+<?php
+$dir = sys_get_temp_dir() . '/vyrtue-aot-03-' . getmypid();
+@mkdir("$dir/src/sub", 0777, true);
+file_put_contents("$dir/src/a.php", "<?php\nreturn strlen('abc');\n");
+file_put_contents("$dir/src/sub/b.php", "<?php\nreturn str_repeat('-', 4);\n");
+file_put_contents("$dir/src/sub/c.txt", "text\n");
+
+function run(string $dir, string ...$args): void
+{
+    $cmd = [
+        PHP_BINARY,
+        '-n',
+        '-d', 'extension_dir=' . ini_get('extension_dir'),
+        '-d', 'extension=vyrtue',
+        dirname(__DIR__, 2) . '/bin/vyrtue-aot.php',
+        '--jobs=2',
+        ...$args,
+        "$dir/src",
+        "$dir/out",
+    ];
+    $proc = proc_open($cmd, [1 => ['pipe', 'w'], 2 => ['pipe', 'w']], $pipes);
+    echo stream_get_contents($pipes[1]);
+    echo preg_replace('/ in [0-9.]+s$/', '', stream_get_contents($pipes[2]));
+    fclose($pipes[1]);
+    fclose($pipes[2]);
+    echo 'exit ', proc_close($proc), "\n";
+}
+
+run($dir);
+var_dump(include "$dir/out/a.php", include "$dir/out/sub/b.php", file_get_contents("$dir/out/sub/c.txt"));
+var_dump(str_contains(file_get_contents("$dir/out/a.php"), 'strlen'));
+
+run($dir);
+
+unlink("$dir/src/sub/c.txt");
+file_put_contents("$dir/src/a.php", "<?php\nreturn strlen('abcd');\n");
+run($dir);
+var_dump(include "$dir/out/a.php", file_exists("$dir/out/sub/c.txt"));
+--CLEAN--
+<?php
+$dir = sys_get_temp_dir() . '/vyrtue-aot-03-';
+foreach (glob($dir . '*') as $root) {
+    foreach (new RecursiveIteratorIterator(new RecursiveDirectoryIterator($root, FilesystemIterator::SKIP_DOTS), RecursiveIteratorIterator::CHILD_FIRST) as $file) {
+        $file->isDir() ? rmdir($file) : unlink($file);
+    }
+    rmdir($root);
+}
+?>
+--EXPECT--
+vyrtue-aot: 3 files, 3 written, 0 skipped, 0 errors
+exit 0
+int(3)
+string(4) "----"
+string(5) "text
+"
+bool(false)
+vyrtue-aot: 3 files, 0 written, 3 skipped, 0 errors
+exit 0
+vyrtue-aot: 2 files, 1 written, 1 skipped, 0 errors
+exit 0
+int(4)
+bool(false)
@@ -0,0 +1,30 @@
+--TEST--
+aot 04
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+// rewritten calls must survive being exported and parsed again
+$code = VyrtueExt\transform_file(__DIR__ . '/aot-04.inc');
+var_dump(str_contains($code, 'sprintf'));
+var_dump(eval('?>' . $code));
+
+// the data after __halt_compiler() is kept as is
+$file = sys_get_temp_dir() . '/vyrtue-aot-04-' . getmypid() . '.php';
+$source = "<?php\nreturn strlen('abc');\n__halt_compiler();\x00raw\ndata";
+file_put_contents($file, $source);
+var_dump(VyrtueExt\transform_file($file) === $source);
+unlink($file);
+--EXPECT--
+bool(false)
+array(4) {
+  [0]=>
+  string(3) "x-5"
+  [1]=>
+  string(3) "x:7"
+  [2]=>
+  string(1) "7"
+  [3]=>
+  string(10) "x.7 apples"
+}
+bool(true)
@@ -0,0 +1,59 @@
+--TEST--
+aot 05
+--EXTENSIONS--
+vyrtue
+--SKIPIF--
+<?php
+if (!function_exists('proc_open')) die("skip: proc_open not available");
+$check = 'echo function_exists("pcntl_fork") && function_exists("posix_kill") ? "yes" : "no";';
+if (shell_exec(escapeshellarg(PHP_BINARY) . ' -n -r ' . escapeshellarg($check)) !== 'yes') die("skip: pcntl and posix not built in");
+?>
+--FILE--
+<?php
+$dir = sys_get_temp_dir() . '/vyrtue-aot-05-' . getmypid();
+@mkdir("$dir/src", 0777, true);
+file_put_contents("$dir/src/boom.php", "<?php\nreturn die_here();\n");
+file_put_contents("$dir/src/ok.php", "<?php\nreturn strlen('abc');\n");
+// kills the worker that transforms boom.php
+file_put_contents("$dir/prepend.php", '<?php VyrtueExt\register_visitor("die_here", function () { posix_kill(posix_getpid(), 9); });');
+
+$cmd = [
+    PHP_BINARY,
+    '-n',
+    '-d', 'extension_dir=' . ini_get('extension_dir'),
+    '-d', 'extension=vyrtue',
+    '-d', "auto_prepend_file=$dir/prepend.php",
+    dirname(__DIR__, 2) . '/bin/vyrtue-aot.php',
+    '--jobs=2',
+    "$dir/src",
+    "$dir/out",
+];
+$proc = proc_open($cmd, [1 => ['pipe', 'w'], 2 => ['pipe', 'w']], $pipes);
+echo stream_get_contents($pipes[1]);
+echo preg_replace('/ in [0-9.]+s$/', '', stream_get_contents($pipes[2]));
+fclose($pipes[1]);
+fclose($pipes[2]);
+echo 'exit ', proc_close($proc), "\n";
+
+var_dump(include "$dir/out/ok.php", file_exists("$dir/out/boom.php"));
+var_dump(array_keys(json_decode(file_get_contents("$dir/out/.vyrtue-aot.json"), true)['files']));
+--CLEAN--
+<?php
+$dir = sys_get_temp_dir() . '/vyrtue-aot-05-';
+foreach (glob($dir . '*') as $root) {
+    foreach (new RecursiveIteratorIterator(new RecursiveDirectoryIterator($root, FilesystemIterator::SKIP_DOTS), RecursiveIteratorIterator::CHILD_FIRST) as $file) {
+        $file->isDir() ? rmdir($file) : unlink($file);
+    }
+    rmdir($root);
+}
+?>
+--EXPECT--
+vyrtue-aot: boom.php: worker exited while transforming it
+vyrtue-aot: 2 files, 1 written, 0 skipped, 1 errors
+exit 1
+int(3)
+bool(false)
+array(1) {
+  [0]=>
+  string(6) "ok.php"
+}
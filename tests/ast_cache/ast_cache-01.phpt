@@ -0,0 +1,87 @@
+--TEST--
+ast_cache 01
+--EXTENSIONS--
+vyrtue
+--SKIPIF--
+<?php if (!function_exists('proc_open')) die("skip: proc_open not available"); ?>
+--FILE--
+<?php
+$dir = sys_get_temp_dir() . '/vyrtue-ast-cache-01-' . getmypid();
+@mkdir("$dir/cache", 0777, true);
+file_put_contents("$dir/a.php", <<<'PHP'
+<?php
+namespace Foo;
+include __DIR__ . '/b.php';
+require_once __DIR__ . '/b.php';
+function f(array $a = ['x' => 1.5, 2 => null]) { return $a; }
+echo strlen('abc'), ' ', json_encode(f()), ' ', (fn() => __LINE__)(), ' ', \b(), "\n";
+echo count(array_filter(get_included_files(), fn($file) => basename($file) === 'b.php')), "\n";
+// only files that were walked have statistics, so a hit shows none
+echo implode(' ', array_map('basename', array_keys(\VyrtueExt\stats()['files']))), "\n";
+
+PHP);
+// compiled again by require_once, it would redeclare b()
+file_put_contents("$dir/b.php", "<?php\nfunction b() {\n    return 'b';\n}\n");
+file_put_contents("$dir/macro.php", "<?php\n#[VyrtueExt\\Macro]\nfunction twice(\$x) {\n    return \$x * 2;\n}\n");
+
+function run(string $dir, string ...$args): void
+{
+    $cmd = [
+        PHP_BINARY,
+        '-n',
+        '-d', 'extension_dir=' . ini_get('extension_dir'),
+        '-d', 'extension=vyrtue',
+        '-d', "vyrtue.ast_cache_dir=$dir/cache",
+        '-d', 'vyrtue.stats=1',
+        ...$args,
+        "$dir/a.php",
+    ];
+    $proc = proc_open($cmd, [1 => ['pipe', 'w'], 2 => ['pipe', 'w']], $pipes);
+    echo stream_get_contents($pipes[1]), stream_get_contents($pipes[2]);
+    fclose($pipes[1]);
+    fclose($pipes[2]);
+    proc_close($proc);
+}
+
+run($dir);
+var_dump(count(glob("$dir/cache/*.ast")));
+run($dir);
+
+file_put_contents("$dir/a.php", str_replace("'abc'", "'abcd'", file_get_contents("$dir/a.php")));
+run($dir);
+run($dir);
+var_dump(count(glob("$dir/cache/*.ast")));
+
+// nothing is cached while macros are registered
+run($dir, '-d', "auto_prepend_file=$dir/macro.php");
+var_dump(count(glob("$dir/cache/*.ast")));
+--CLEAN--
+<?php
+foreach (glob(sys_get_temp_dir() . '/vyrtue-ast-cache-01-*') as $root) {
+    array_map('unlink', glob("$root/cache/*"));
+    @rmdir("$root/cache");
+    @unlink("$root/a.php");
+    @unlink("$root/b.php");
+    @unlink("$root/macro.php");
+    @rmdir($root);
+}
+?>
+--EXPECT--
+3 {"x":1.5,"2":null} 6 b
+1
+a.php b.php
+int(2)
+3 {"x":1.5,"2":null} 6 b
+1
+
+4 {"x":1.5,"2":null} 6 b
+1
+a.php
+4 {"x":1.5,"2":null} 6 b
+1
+
+int(2)
+4 {"x":1.5,"2":null} 6 b
+1
+macro.php a.php b.php
+int(2)
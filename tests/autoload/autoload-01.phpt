@@ -0,0 +1,18 @@
+--TEST--
+autoload 01
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.shm_size=1048576
+--FILE--
+<?php
+var_dump(VyrtueExt\autoload_register());
+include __DIR__ . '/autoload-01.inc';
+var_dump(class_exists('Autoload01\\Foo', false));
+var_dump(class_exists('autoload01\\foo'));
+var_dump(class_exists('Autoload01\\Missing'));
+--EXPECT--
+bool(true)
+bool(false)
+bool(true)
+bool(false)
@@ -0,0 +1,26 @@
+--TEST--
+autoload 02 (removed file)
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.shm_size=1048576
+--FILE--
+<?php
+VyrtueExt\autoload_register();
+$file = sys_get_temp_dir() . '/vyrtue-autoload-02-' . getmypid() . '.php';
+file_put_contents($file, "<?php\nif (!empty(\$GLOBALS['declare'])) {\n    class Autoload02 {}\n}\n");
+include $file;
+unlink($file);
+var_dump(class_exists('Autoload02'));
+var_dump(class_exists('Autoload02'));
+
+// the same path compiled again is found again
+file_put_contents($file, "<?php\nif (!empty(\$GLOBALS['declare'])) {\n    class Autoload02 {}\n}\n");
+include $file;
+$GLOBALS['declare'] = true;
+var_dump(class_exists('Autoload02'));
+unlink($file);
+--EXPECT--
+bool(false)
+bool(false)
+bool(true)
@@ -0,0 +1,22 @@
+--TEST--
+budget 01
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.max_nodes=5
+vyrtue.stats=1
+--FILE--
+<?php
+VyrtueExt\stats_reset();
+var_dump(include __DIR__ . '/budget-01.inc');
+$stats = VyrtueExt\stats();
+// strlen() is no longer folded, but namespaces and imports are still tracked
+var_dump($stats['visitors']['vyrtue internal fold']['leave_calls']);
+var_dump($stats['visitors']['vyrtue internal']['leave_calls'] > 0);
+--EXPECTF--
+Warning: vyrtue: %sbudget-01.php exceeded vyrtue.max_nodes, skipping optional visitors for the rest of the file in %sbudget-01.php on line %d
+
+Warning: vyrtue: %sbudget-01.inc exceeded vyrtue.max_nodes, skipping optional visitors for the rest of the file in %sbudget-01.inc on line %d
+int(3)
+int(0)
+bool(true)
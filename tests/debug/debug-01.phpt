@@ -0,0 +1,25 @@
+--TEST--
+debug 01
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.debug=namespace,use
+vyrtue.debug_buffer=4096
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+namespace FooBar;
+use function Foo\bar;
+use function Foo\bat as booyah;
+echo \VyrtueExt\Debug\dump_log();
+echo "--\n";
+echo \VyrtueExt\Debug\dump_log();
+echo "--\n";
+--EXPECTF--
+[namespace +%dus] VYRTUE_NAMESPACE: ENTER: FooBar
+[use +%dus] VYRTUE_USE: Foo\bar => bar
+[use +%dus] VYRTUE_USE: Foo\bat => booyah
+[namespace +%dus] VYRTUE_NAMESPACE: LEFT: FooBar
+--
+--
@@ -0,0 +1,17 @@
+--TEST--
+debug 02
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.debug=use,namespace
+vyrtue.debug_buffer=1024
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+include __DIR__ . '/debug-02.inc';
+echo \VyrtueExt\Debug\dump_log();
+--EXPECTF--
+[vyrtue] %d events dropped
+%A[use +%dus] VYRTUE_USE: Foo\fn80 => fn80
+[namespace +%dus] VYRTUE_NAMESPACE: LEFT: Bar
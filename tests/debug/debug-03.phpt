@@ -0,0 +1,23 @@
+--TEST--
+debug 03
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.debug=all
+vyrtue.debug_buffer=4096
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+namespace FooBar;
+use function Foo\bar;
+\undefined_function();
+--EXPECTF--
+vyrtue: debug log at fatal error:
+[namespace +%dus] VYRTUE_NAMESPACE: ENTER: FooBar
+[use +%dus] VYRTUE_USE: Foo\bar => bar
+%A
+Fatal error: Uncaught Error: Call to undefined function undefined_function() in %s:%d
+Stack trace:
+#0 {main}
+  thrown in %s on line %d
@@ -0,0 +1,13 @@
+--TEST--
+filter 01
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.exclude_paths=/nonexistent/, {PWD}/filter.inc
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+var_dump(include __DIR__ . '/filter.inc');
+--EXPECT--
+string(72) "Call to undefined function VyrtueExt\Debug\sample_replacement_function()"
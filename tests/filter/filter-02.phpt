@@ -0,0 +1,21 @@
+--TEST--
+filter 02
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.include_paths={PWD}/*.inc
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+var_dump(include __DIR__ . '/filter.inc');
+// this file is not included
+try {
+    var_dump(VyrtueExt\Debug\sample_replacement_function());
+} catch (Error $e) {
+    var_dump($e->getMessage());
+}
+--EXPECT--
+entering sample function
+int(12345)
+string(72) "Call to undefined function VyrtueExt\Debug\sample_replacement_function()"
@@ -0,0 +1,21 @@
+--TEST--
+filter 03
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.visitor_paths=vyrtue internal debug={PWD}/filter.inc; vyrtue internal fold=
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+// the debug visitor is limited to the included file
+try {
+    var_dump(VyrtueExt\Debug\sample_replacement_function());
+} catch (Error $e) {
+    var_dump($e->getMessage());
+}
+var_dump(include __DIR__ . '/filter.inc');
+--EXPECT--
+string(72) "Call to undefined function VyrtueExt\Debug\sample_replacement_function()"
+entering sample function
+int(12345)
@@ -0,0 +1,28 @@
+--TEST--
+filter 04
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.include_paths={PWD}/filter-0?.php, {PWD}/filter.inc
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+// the prefix splits the trie edge leading to the glob, both must still match
+try {
+    var_dump(VyrtueExt\Debug\sample_replacement_function());
+} catch (Error $e) {
+    var_dump($e->getMessage());
+}
+var_dump(include __DIR__ . '/filter.inc');
+var_dump(eval('try {
+    return VyrtueExt\Debug\sample_replacement_function();
+} catch (Error $e) {
+    return $e->getMessage();
+}'));
+--EXPECT--
+entering sample function
+int(12345)
+entering sample function
+int(12345)
+string(72) "Call to undefined function VyrtueExt\Debug\sample_replacement_function()"
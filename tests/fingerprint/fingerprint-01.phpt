@@ -0,0 +1,40 @@
+--TEST--
+fingerprint 01
+--EXTENSIONS--
+vyrtue
+--SKIPIF--
+<?php if (!function_exists('proc_open')) die("skip: proc_open not available"); ?>
+--FILE--
+<?php
+function fingerprint(string ...$ini): string
+{
+    $cmd = [PHP_BINARY, '-n', '-d', 'extension_dir=' . ini_get('extension_dir'), '-d', 'extension=vyrtue'];
+    foreach ($ini as $setting) {
+        array_push($cmd, '-d', $setting);
+    }
+    array_push($cmd, '-r', 'echo VyrtueExt\fingerprint();');
+    $proc = proc_open($cmd, [1 => ['pipe', 'w']], $pipes);
+    $output = stream_get_contents($pipes[1]);
+    fclose($pipes[1]);
+    proc_close($proc);
+    return $output;
+}
+
+$fingerprint = VyrtueExt\fingerprint();
+var_dump(preg_match('/^[0-9a-f]{16}$/', $fingerprint));
+var_dump(fingerprint() === fingerprint());
+var_dump(fingerprint() === fingerprint('vyrtue.stats=1'));
+var_dump(fingerprint() === fingerprint('vyrtue.fold_functions=0'));
+var_dump(fingerprint() === fingerprint('vyrtue.strip_functions=assert'));
+
+$proc = proc_open([PHP_BINARY, '-n', '-d', 'extension_dir=' . ini_get('extension_dir'), '-d', 'extension=vyrtue', '-v'], [1 => ['pipe', 'w']], $pipes);
+var_dump(str_contains(stream_get_contents($pipes[1]), 'with vyrtue v' . phpversion('vyrtue') . ','));
+fclose($pipes[1]);
+proc_close($proc);
+--EXPECT--
+int(1)
+bool(true)
+bool(true)
+bool(false)
+bool(false)
+bool(true)
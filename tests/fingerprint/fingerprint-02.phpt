@@ -0,0 +1,55 @@
+--TEST--
+fingerprint 02
+--EXTENSIONS--
+vyrtue
+--SKIPIF--
+<?php
+if (!function_exists('proc_open')) die("skip: proc_open not available");
+if (PHP_VERSION_ID < 80500 && !file_exists(PHP_EXTENSION_DIR . '/opcache.' . PHP_SHLIB_SUFFIX)) die("skip: opcache not available");
+?>
+--FILE--
+<?php
+$dir = sys_get_temp_dir() . '/vyrtue-fingerprint-02-' . getmypid();
+@mkdir("$dir/cache", 0777, true);
+file_put_contents("$dir/a.php", "<?php\nvar_dump(1);\necho \"done\\n\";\n");
+
+function run(string $dir, string ...$ini): void
+{
+    $cmd = [PHP_BINARY, '-n', '-d', 'extension_dir=' . ini_get('extension_dir'), '-d', 'extension=vyrtue'];
+    if (PHP_VERSION_ID < 80500) {
+        array_push($cmd, '-d', 'zend_extension=' . PHP_EXTENSION_DIR . '/opcache.' . PHP_SHLIB_SUFFIX);
+    }
+    array_push($cmd, '-d', 'opcache.enable_cli=1', '-d', "opcache.file_cache=$dir/cache", '-d', 'opcache.file_cache_only=1');
+    foreach ($ini as $setting) {
+        array_push($cmd, '-d', $setting);
+    }
+    $cmd[] = "$dir/a.php";
+    $proc = proc_open($cmd, [1 => ['pipe', 'w'], 2 => ['pipe', 'w']], $pipes);
+    echo stream_get_contents($pipes[1]), stream_get_contents($pipes[2]);
+    fclose($pipes[1]);
+    fclose($pipes[2]);
+    proc_close($proc);
+}
+
+// each configuration gets its own system id, so a script cached with
+// var_dump() stripped is never served once it no longer is
+run($dir, 'vyrtue.strip_functions=var_dump');
+run($dir);
+run($dir, 'vyrtue.strip_functions=var_dump');
+var_dump(count(glob("$dir/cache/*", GLOB_ONLYDIR)));
+--CLEAN--
+<?php
+$dir = sys_get_temp_dir() . '/vyrtue-fingerprint-02-';
+foreach (glob($dir . '*') as $root) {
+    foreach (new RecursiveIteratorIterator(new RecursiveDirectoryIterator($root, FilesystemIterator::SKIP_DOTS), RecursiveIteratorIterator::CHILD_FIRST) as $file) {
+        $file->isDir() ? rmdir($file) : unlink($file);
+    }
+    rmdir($root);
+}
+?>
+--EXPECT--
+done
+int(1)
+done
+done
+int(2)
@@ -0,0 +1,30 @@
+--TEST--
+fold 01
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+var_dump(strlen('abc'));
+var_dump(str_repeat('-', 4));
+var_dump(implode(',', ['a', 'b', 1, true, null]));
+var_dump(array_flip(['a', 'b', 'c']));
+var_dump(json_encode(['a' => 1, 'b' => [-2]]));
+var_dump(json_encode(['a' => 1, 'b' => false]));
+var_dump(count([1, 2, 3]));
+var_dump(\md5('vyrtue'));
+--EXPECT--
+int(3)
+string(4) "----"
+string(8) "a,b,1,1,"
+array(3) {
+  ["a"]=>
+  int(0)
+  ["b"]=>
+  int(1)
+  ["c"]=>
+  int(2)
+}
+string(16) "{"a":1,"b":[-2]}"
+string(17) "{"a":1,"b":false}"
+int(3)
+string(32) "e65cba594d0916c03745e8b4c7cfec1c"
@@ -0,0 +1,13 @@
+--TEST--
+fold 02
+--EXTENSIONS--
+vyrtue
+--ENV--
+PHP_VYRTUE_DEBUG_DUMP_REPLACEMENT=1
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+var_dump(strlen(str_repeat('ab', 2)));
+--EXPECTF--
+BEFORE: str_repeat('ab', 2)AFTER: 'abab'BEFORE: strlen('abab')AFTER: 4int(4)
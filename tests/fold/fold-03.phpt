@@ -0,0 +1,35 @@
+--TEST--
+fold 03 (not folded)
+--EXTENSIONS--
+vyrtue
+--ENV--
+PHP_VYRTUE_DEBUG_DUMP_REPLACEMENT=1
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+namespace FooBar {
+    // may resolve to FooBar\strlen at runtime
+    var_dump(strlen('abc'));
+}
+namespace {
+    $a = 'abc';
+    var_dump(strlen($a));
+    var_dump(strlen(123));
+    var_dump(strlen(...)('abc'));
+    var_dump(implode(',', [[1]]));
+    try {
+        str_repeat('-', -1);
+    } catch (ValueError $e) {
+        echo $e->getMessage(), "\n";
+    }
+}
+--EXPECTF--
+int(3)
+int(3)
+int(3)
+int(3)
+
+Warning: Array to string conversion in %s on line %d
+string(5) "Array"
+str_repeat(): Argument #2 ($times) must be greater than or equal to 0
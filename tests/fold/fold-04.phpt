@@ -0,0 +1,15 @@
+--TEST--
+fold 04 (disabled)
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.fold_functions=0
+--ENV--
+PHP_VYRTUE_DEBUG_DUMP_REPLACEMENT=1
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+var_dump(strlen('abc'));
+--EXPECT--
+int(3)
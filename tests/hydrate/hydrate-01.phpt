@@ -0,0 +1,62 @@
+--TEST--
+hydrate 01
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+#[VyrtueExt\Hydratable]
+class User {
+    public string $name = '';
+    public ?int $age = null;
+    public array $tags = [];
+    public static int $count = 0;
+    public function __construct(public readonly int $id, public bool $active = true) {}
+}
+$user = User::fromArray(['id' => '42', 'name' => 123, 'age' => '7', 'tags' => ['a']]);
+var_dump($user);
+var_dump($user->toArray());
+var_dump(User::fromArray(['id' => 1, 'active' => 0, 'age' => null])->toArray());
+--EXPECTF--
+object(User)#%d (5) {
+  ["name"]=>
+  string(3) "123"
+  ["age"]=>
+  int(7)
+  ["tags"]=>
+  array(1) {
+    [0]=>
+    string(1) "a"
+  }
+  ["id"]=>
+  int(42)
+  ["active"]=>
+  bool(true)
+}
+array(5) {
+  ["id"]=>
+  int(42)
+  ["active"]=>
+  bool(true)
+  ["name"]=>
+  string(3) "123"
+  ["age"]=>
+  int(7)
+  ["tags"]=>
+  array(1) {
+    [0]=>
+    string(1) "a"
+  }
+}
+array(5) {
+  ["id"]=>
+  int(1)
+  ["active"]=>
+  bool(false)
+  ["name"]=>
+  string(0) ""
+  ["age"]=>
+  NULL
+  ["tags"]=>
+  array(0) {
+  }
+}
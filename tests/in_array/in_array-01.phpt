@@ -0,0 +1,41 @@
+--TEST--
+in_array 01
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+function check($x) {
+    return [
+        in_array($x, explode(',', 'a,b,1'), true),
+        in_array($x, explode(',', 'a,b,1')),
+    ];
+}
+var_dump(check('a'));
+var_dump(check('1'));
+var_dump(check(1));
+var_dump(check('c'));
+--EXPECT--
+array(2) {
+  [0]=>
+  bool(true)
+  [1]=>
+  bool(true)
+}
+array(2) {
+  [0]=>
+  bool(true)
+  [1]=>
+  bool(true)
+}
+array(2) {
+  [0]=>
+  bool(false)
+  [1]=>
+  bool(true)
+}
+array(2) {
+  [0]=>
+  bool(false)
+  [1]=>
+  bool(false)
+}
@@ -0,0 +1,18 @@
+--TEST--
+in_array 02 (lowered to ZEND_IN_ARRAY)
+--EXTENSIONS--
+vyrtue
+opcache
+--INI--
+opcache.enable=1
+opcache.enable_cli=1
+opcache.opt_debug_level=0x10000
+--FILE--
+<?php
+function check(string $x) {
+    return in_array($x, explode(',', 'a,b,c'), true);
+}
+var_dump(check('b'));
+--EXPECTF--
+%AIN_ARRAY%s
+%Abool(true)
@@ -0,0 +1,102 @@
+--TEST--
+index 01
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.shm_size=1048576
+--FILE--
+<?php
+namespace App;
+use App\Attr\Route;
+#[Route('/users', methods: ['GET'])]
+class UserController {
+    #[Route('/users/{id}', name: UserController::class)]
+    public function show() {}
+    #[Route(PHP_VERSION)]
+    public function dynamic() {}
+}
+#[\App\Attr\Route('/')]
+function home() {}
+var_dump(\VyrtueExt\attribute_index('\\app\\attr\\route'));
+var_dump(\VyrtueExt\attribute_index('App\\Attr\\Missing'));
+--EXPECTF--
+array(4) {
+  [0]=>
+  array(6) {
+    ["attribute"]=>
+    string(14) "App\Attr\Route"
+    ["class"]=>
+    string(18) "App\UserController"
+    ["member"]=>
+    NULL
+    ["target"]=>
+    string(5) "class"
+    ["file"]=>
+    string(%d) "%sindex-01.php"
+    ["arguments"]=>
+    array(2) {
+      [0]=>
+      string(6) "/users"
+      ["methods"]=>
+      array(1) {
+        [0]=>
+        string(3) "GET"
+      }
+    }
+  }
+  [1]=>
+  array(6) {
+    ["attribute"]=>
+    string(14) "App\Attr\Route"
+    ["class"]=>
+    string(18) "App\UserController"
+    ["member"]=>
+    string(4) "show"
+    ["target"]=>
+    string(6) "method"
+    ["file"]=>
+    string(%d) "%sindex-01.php"
+    ["arguments"]=>
+    array(2) {
+      [0]=>
+      string(11) "/users/{id}"
+      ["name"]=>
+      string(18) "App\UserController"
+    }
+  }
+  [2]=>
+  array(6) {
+    ["attribute"]=>
+    string(14) "App\Attr\Route"
+    ["class"]=>
+    string(18) "App\UserController"
+    ["member"]=>
+    string(7) "dynamic"
+    ["target"]=>
+    string(6) "method"
+    ["file"]=>
+    string(%d) "%sindex-01.php"
+    ["arguments"]=>
+    NULL
+  }
+  [3]=>
+  array(6) {
+    ["attribute"]=>
+    string(14) "App\Attr\Route"
+    ["class"]=>
+    NULL
+    ["member"]=>
+    string(8) "App\home"
+    ["target"]=>
+    string(8) "function"
+    ["file"]=>
+    string(%d) "%sindex-01.php"
+    ["arguments"]=>
+    array(1) {
+      [0]=>
+      string(1) "/"
+    }
+  }
+}
+array(0) {
+}
@@ -0,0 +1,47 @@
+--TEST--
+inject 01
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+namespace App;
+use VyrtueExt\Inject;
+use VyrtueExt\Injectable;
+use Psr\Log\LoggerInterface as Logger;
+class Db {}
+class Container {
+    public function get(string $id) {
+        echo "get($id)\n";
+        return $id === 'App\Db' ? new Db() : ($id === 'dsn' ? 'sqlite::memory:' : null);
+    }
+}
+#[Injectable]
+class Repository {
+    public function __construct(
+        #[Inject] public Db $db,
+        #[Inject('dsn')] public string $dsn,
+        public int $limit = 10,
+        #[Inject] public ?Logger $logger = null,
+    ) {}
+}
+#[Injectable(factory: 'make')]
+class NoConstructor {}
+var_dump(Repository::createFromContainer(new Container()));
+var_dump(NoConstructor::make(new Container()));
+--EXPECTF--
+get(App\Db)
+get(dsn)
+get(Psr\Log\LoggerInterface)
+object(App\Repository)#%d (4) {
+  ["db"]=>
+  object(App\Db)#%d (0) {
+  }
+  ["dsn"]=>
+  string(15) "sqlite::memory:"
+  ["limit"]=>
+  int(10)
+  ["logger"]=>
+  NULL
+}
+object(App\NoConstructor)#%d (0) {
+}
@@ -0,0 +1,42 @@
+--TEST--
+inline 01
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+#[VyrtueExt\Inline]
+function add($a, $b = 10) {
+    return $a + $b;
+}
+#[VyrtueExt\Inline]
+function twice($x) {
+    return $x . $x;
+}
+#[VyrtueExt\Inline]
+function push($arr, $v) {
+    return array_push($arr, $v);
+}
+function next_value() {
+    static $i = 0;
+    echo "next_value\n";
+    return ++$i;
+}
+$arr = [1, 2];
+var_dump(add(1, 2));
+var_dump(add(5));
+var_dump(twice(next_value()));
+var_dump(add(next_value(), next_value()));
+var_dump(push($arr, 3));
+var_dump(count($arr));
+var_dump(twice(...)('ab'));
+--EXPECT--
+int(3)
+int(15)
+next_value
+string(2) "11"
+next_value
+next_value
+int(5)
+int(3)
+int(2)
+string(4) "abab"
@@ -0,0 +1,37 @@
+--TEST--
+inline 02
+--EXTENSIONS--
+vyrtue
+--ENV--
+PHP_VYRTUE_DEBUG_DUMP_AST=1
+PHP_VYRTUE_DEBUG_DUMP_INLINE=1
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+namespace Foo;
+#[\VyrtueExt\Inline]
+function square($x) {
+    return $x * $x;
+}
+#[\VyrtueExt\Inline]
+function greet($name) {
+    return 'Hello ' . $name;
+}
+#[\VyrtueExt\Inline]
+function not_inlined($x) {
+    $y = $x;
+    return $y;
+}
+var_dump(greet('World'));
+var_dump(square($argc));
+var_dump(not_inlined(1));
+--EXPECTF--
+VYRTUE_INLINE: greet
+VYRTUE_INLINE: square
+%Avar_dump('Hello ' . 'World');
+var_dump(%s$__vyrtue_tmp0 = $argc%s ? $__vyrtue_tmp0 * $__vyrtue_tmp0 : null);
+var_dump(not_inlined(1));
+string(11) "Hello World"
+int(1)
+int(1)
@@ -0,0 +1,33 @@
+--TEST--
+inline 03 (parameters used where a variable is required)
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+#[VyrtueExt\Inline]
+function is_set($x) {
+    return isset($x);
+}
+#[VyrtueExt\Inline]
+function is_empty($x) {
+    return empty($x);
+}
+#[VyrtueExt\Inline]
+function ref_list($x) {
+    return [&$x][0] * 2;
+}
+#[VyrtueExt\Inline]
+function dim_set($x) {
+    return isset($x['a']);
+}
+var_dump(is_set(5), is_set(null), is_empty(0), is_empty('a'));
+var_dump(ref_list(7));
+var_dump(dim_set(['a' => 1]), dim_set([]));
+--EXPECT--
+bool(true)
+bool(false)
+bool(true)
+bool(false)
+int(14)
+bool(true)
+bool(false)
@@ -0,0 +1,35 @@
+--TEST--
+loop 01
+--EXTENSIONS--
+vyrtue
+--ENV--
+PHP_VYRTUE_DEBUG_DUMP_AST=1
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+function hoisted(array $items, string $s) {
+    $n = 0;
+    for ($i = 0; $i < count($items) && $i < strlen($s); $i++) {
+        $n += $items[$i];
+    }
+    return $n;
+}
+function not_hoisted(array $items, ?string $s) {
+    for ($i = 0; $i < count($items); $i++) {
+        if ($i < 2) {
+            $items[] = $i;
+        }
+    }
+    for ($i = 0; $i < strlen($s); $i++) {
+    }
+    return count($items);
+}
+var_dump(hoisted([1, 2, 3], 'ab'));
+var_dump(not_hoisted([1, 2, 3], 'ab'));
+--EXPECTF--
+%Afor ($i = 0, $__vyrtue_tmp0 = count($items), $__vyrtue_tmp1 = strlen($s); $i < $__vyrtue_tmp0 && $i < $__vyrtue_tmp1; $i++) {%A
+%Afor ($i = 0; $i < count($items); $i++) {%A
+%Afor ($i = 0; $i < strlen($s); $i++) {%A
+int(3)
+int(5)
@@ -0,0 +1,44 @@
+--TEST--
+loop 02 (conservative def-use)
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+function by_ref(array $items) {
+    $n = 0;
+    for ($i = 0; $i < count($items); $i++) {
+        $n++;
+        if ($i === 0) {
+            array_push($items, 'x');
+        }
+    }
+    return $n;
+}
+function by_closure(array $items) {
+    $push = function () use (&$items) { $items[] = 'x'; };
+    $n = 0;
+    for ($i = 0; $i < count($items); $i++) {
+        $n++;
+        if ($i === 0) {
+            $push();
+        }
+    }
+    return $n;
+}
+function by_extract(array $items) {
+    $n = 0;
+    for ($i = 0; $i < count($items); $i++) {
+        $n++;
+        if ($i === 0) {
+            extract(['items' => [1, 2, 3, 4]]);
+        }
+    }
+    return $n;
+}
+var_dump(by_ref([1]));
+var_dump(by_closure([1]));
+var_dump(by_extract([1]));
+--EXPECT--
+int(2)
+int(2)
+int(4)
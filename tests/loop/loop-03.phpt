@@ -0,0 +1,35 @@
+--TEST--
+loop 03 (static and catch rebind the variable)
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+function by_static(array $items) {
+    $n = 0;
+    for ($i = 0; $i < count($items); $i++) {
+        $n++;
+        static $items = [1, 2, 3];
+    }
+    return $n;
+}
+function by_catch(array $items) {
+    $n = 0;
+    try {
+        for ($i = 0; $i < count($items); $i++) {
+            $n++;
+            try {
+                throw new Exception();
+            } catch (Exception $items) {
+            }
+        }
+    } catch (TypeError $e) {
+        echo $e->getMessage(), "\n";
+    }
+    return $n;
+}
+var_dump(by_static([1]));
+var_dump(by_catch([1]));
+--EXPECT--
+int(3)
+count(): Argument #1 ($value) must be of type Countable|array, Exception given
+int(1)
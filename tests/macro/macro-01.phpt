@@ -0,0 +1,41 @@
+--TEST--
+macro 01
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+namespace Foo;
+#[\VyrtueExt\Macro]
+function square($x) {
+    return $x * $x;
+}
+#[\VyrtueExt\Macro]
+function swap(&$a, &$b) {
+    $tmp = $a;
+    $a = $b;
+    $b = $tmp;
+}
+#[\VyrtueExt\Macro]
+function clamp($value, $max = PHP_INT_MAX) {
+    return \max(0, \min($value, $max));
+}
+$tmp = 'untouched';
+$i = 3;
+var_dump(square($i + 1));
+$x = 1;
+$y = 2;
+swap($x, $y);
+var_dump($x, $y, $tmp);
+var_dump(clamp(-5), clamp(50, 10));
+// the functions still exist
+var_dump(square(5));
+var_dump(call_user_func('Foo\\square', 6));
+--EXPECT--
+int(16)
+int(2)
+int(1)
+string(9) "untouched"
+int(0)
+int(10)
+int(25)
+int(36)
@@ -0,0 +1,36 @@
+--TEST--
+macro 02
+--EXTENSIONS--
+vyrtue
+--ENV--
+PHP_VYRTUE_DEBUG_DUMP_AST=1
+PHP_VYRTUE_DEBUG_DUMP_MACRO=1
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+#[VyrtueExt\Macro]
+function swap(&$a, &$b) {
+    $tmp = $a;
+    $a = $b;
+    $b = $tmp;
+}
+#[VyrtueExt\Macro]
+function this_is_not_a_macro() {
+    return __FUNCTION__;
+}
+$x = 1;
+$y = 2;
+swap($x, $y);
+var_dump($x, $y);
+--EXPECTF--
+Warning: vyrtue: cannot use this_is_not_a_macro() as a macro in %s on line %d
+VYRTUE_MACRO: swap
+%A$x = 1;
+$y = 2;
+$__vyrtue_tmp0 = $x;
+$x = $y;
+$y = $__vyrtue_tmp0;
+var_dump($x, $y);
+int(2)
+int(1)
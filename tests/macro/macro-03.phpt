@@ -0,0 +1,63 @@
+--TEST--
+macro 03
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+#[VyrtueExt\Macro]
+function swap(&$a, &$b) {
+    $tmp = $a;
+    $a = $b;
+    $b = $tmp;
+}
+#[VyrtueExt\Macro]
+function twice($x) {
+    return $x * 2;
+}
+#[VyrtueExt\Macro]
+function reset_to_zero($value) {
+    $value = 0;
+}
+function test() {
+    $x = 1;
+    $y = 2;
+    swap($x, $y);
+    return [$x, $y, twice($x)];
+}
+class Foo {
+    public $a = 1;
+    public $b = 2;
+    public function test() {
+        swap($this->a, $this->b);
+        return [$this->a, $this->b];
+    }
+}
+$z = 5;
+reset_to_zero($z);
+var_dump($z);
+var_dump(test(), (new Foo)->test());
+// the function behaves like the expansion
+$f = 'swap';
+$p = 1;
+$q = 2;
+$f($p, $q);
+var_dump($p, $q);
+--EXPECTF--
+Warning: vyrtue: cannot use reset_to_zero() as a macro, parameter $value is written to and must be declared by reference in %s on line %d
+int(5)
+array(3) {
+  [0]=>
+  int(2)
+  [1]=>
+  int(1)
+  [2]=>
+  int(4)
+}
+array(2) {
+  [0]=>
+  int(2)
+  [1]=>
+  int(1)
+}
+int(2)
+int(1)
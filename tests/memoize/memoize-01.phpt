@@ -0,0 +1,56 @@
+--TEST--
+memoize 01
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+#[VyrtueExt\Memoize]
+function slug(string $s) {
+    echo "slug($s)\n";
+    return strtolower(str_replace(' ', '-', $s));
+}
+#[VyrtueExt\Memoize(maxEntries: 2)]
+function add($a, $b) {
+    echo "add\n";
+    return $a + $b;
+}
+class Fib {
+    #[VyrtueExt\Memoize]
+    public static function fib(int $n): int {
+        return $n < 2 ? $n : self::fib($n - 1) + self::fib($n - 2);
+    }
+}
+var_dump(slug('Hello World'));
+var_dump(slug('Hello World'));
+var_dump(add(1, 2));
+var_dump(add(1, 2));
+var_dump(add('1', 2));
+var_dump(add([1], [2]));
+var_dump(add([1], [2]));
+var_dump(add(2, 2));
+var_dump(add(1, 2));
+var_dump(Fib::fib(50));
+--EXPECT--
+slug(Hello World)
+string(11) "hello-world"
+string(11) "hello-world"
+add
+int(3)
+int(3)
+add
+int(3)
+add
+array(1) {
+  [0]=>
+  int(1)
+}
+add
+array(1) {
+  [0]=>
+  int(1)
+}
+add
+int(4)
+add
+int(3)
+int(12586269025)
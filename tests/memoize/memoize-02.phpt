@@ -0,0 +1,29 @@
+--TEST--
+memoize 02
+--EXTENSIONS--
+vyrtue
+--ENV--
+PHP_VYRTUE_DEBUG_DUMP_AST=1
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+#[VyrtueExt\Memoize(16)]
+function normalize(string $s) {
+    return trim($s);
+}
+var_dump(normalize(' a '));
+--EXPECTF--
+%Afunction normalize(string $s) {
+    static $__vyrtue_tmp0 = [];
+    $__vyrtue_tmp1 = $s;
+    if (isset($__vyrtue_tmp0[$__vyrtue_tmp1]) || \array_key_exists($__vyrtue_tmp1, $__vyrtue_tmp0)) {
+        return $__vyrtue_tmp0[$__vyrtue_tmp1];
+    }
+    if (\count($__vyrtue_tmp0) >= 16) {
+        unset($__vyrtue_tmp0[\array_key_first($__vyrtue_tmp0)]);
+    }
+    $__vyrtue_tmp2 = &$__vyrtue_tmp0;
+    return $__vyrtue_tmp2[$__vyrtue_tmp1] = trim($s);
+}
+%Astring(1) "a"
@@ -0,0 +1,43 @@
+--TEST--
+sprintf 01
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+const PREFIX = 'app';
+function key_for($a, $b, $c) {
+    return [
+        sprintf('%s:%d:%s', $a, $b, $c),
+        sprintf('%s:%s', PREFIX, $a),
+        sprintf('100%%'),
+        sprintf('%d', $c),
+        vsprintf('%s-%s', [$a, $c]),
+    ];
+}
+var_dump(key_for('user', '12abc', null));
+var_dump(key_for(1.5, 3.9, true));
+--EXPECT--
+array(5) {
+  [0]=>
+  string(8) "user:12:"
+  [1]=>
+  string(8) "app:user"
+  [2]=>
+  string(4) "100%"
+  [3]=>
+  string(1) "0"
+  [4]=>
+  string(5) "user-"
+}
+array(5) {
+  [0]=>
+  string(7) "1.5:3:1"
+  [1]=>
+  string(7) "app:1.5"
+  [2]=>
+  string(4) "100%"
+  [3]=>
+  string(1) "1"
+  [4]=>
+  string(5) "1.5-1"
+}
@@ -0,0 +1,27 @@
+--TEST--
+sprintf 02
+--EXTENSIONS--
+vyrtue
+--ENV--
+PHP_VYRTUE_DEBUG_DUMP_REPLACEMENT=1
+--SKIPIF--
+<?php if (!VyrtueExt\DEBUG) die("skip: vyrtue not debug build"); ?>
+--FILE--
+<?php
+$a = 'a';
+$b = 2;
+// rewritten
+echo sprintf('%s:%d', $a, $b), "\n";
+// left alone: padding, too few arguments, non-trivial arguments
+echo sprintf('%05d', $b), "\n";
+echo sprintf('%s', strtoupper($a)), "\n";
+try {
+    sprintf('%s:%s', $a);
+} catch (ArgumentCountError $e) {
+    echo $e->getMessage(), "\n";
+}
+--EXPECTF--
+BEFORE: sprintf(%s)AFTER: %sa:2
+00002
+A
+3 arguments are required, 2 given
@@ -0,0 +1,36 @@
+--TEST--
+sprintf 03
+--EXTENSIONS--
+vyrtue
+--INI--
+zend.assertions=1
+assert.exception=1
+--FILE--
+<?php
+const FOO = 'foo';
+function check($a, $b) {
+    // assert() messages are exported from the rewritten AST at compile time
+    foreach ([
+        fn() => assert(sprintf('%s-%s', $a, 5) === ''),
+        fn() => assert(sprintf('%s:%d', $a, $b) === ''),
+        fn() => assert(sprintf('%s/%s', FOO, $a) === ''),
+        fn() => assert(sprintf('%s.%s', $a, $b) === ''),
+        fn() => assert(sprintf('%d', $b) === ''),
+    ] as $fn) {
+        try {
+            $fn();
+        } catch (AssertionError $e) {
+            echo $e->getMessage(), "\n";
+        }
+    }
+}
+check('a', '2x');
+var_dump(sprintf('%d', '7'), sprintf('%s', 5));
+--EXPECT--
+assert($a . '-' . 5 === '')
+assert($a . ':' . (int)$b === '')
+assert(FOO . '/' . $a === '')
+assert("$a.$b" === '')
+assert((string)(int)$b === '')
+string(1) "7"
+string(1) "5"
@@ -0,0 +1,56 @@
+--TEST--
+stats 01
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.stats=1
+--FILE--
+<?php
+VyrtueExt\stats_reset();
+var_dump(include __DIR__ . '/stats-01.inc');
+
+$stats = VyrtueExt\stats();
+var_dump($stats['enabled']);
+var_dump(array_keys($stats['totals']));
+var_dump($stats['totals']['files']);
+var_dump($stats['totals']['nodes'] > 0);
+var_dump($stats['totals']['name_resolutions'] > 0);
+var_dump($stats['totals']['visitor_calls'] === array_sum(array_map(function ($visitor) {
+    return $visitor['enter_calls'] + $visitor['leave_calls'];
+}, $stats['visitors'])));
+var_dump($stats['visitors']['vyrtue internal']['enter_calls'] > 0);
+$file = $stats['files'][__DIR__ . '/stats-01.inc'];
+var_dump($file['nodes'] === $stats['totals']['nodes']);
+
+VyrtueExt\stats_reset();
+$stats = VyrtueExt\stats();
+var_dump($stats['totals']['files'], $stats['visitors']['vyrtue internal']['enter_calls'], $stats['files']);
+--EXPECT--
+int(6)
+bool(true)
+array(7) {
+  [0]=>
+  string(5) "files"
+  [1]=>
+  string(5) "nodes"
+  [2]=>
+  string(13) "visitor_calls"
+  [3]=>
+  string(12) "replacements"
+  [4]=>
+  string(16) "name_resolutions"
+  [5]=>
+  string(11) "arena_bytes"
+  [6]=>
+  string(7) "time_ns"
+}
+int(1)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+int(0)
+int(0)
+array(0) {
+}
@@ -0,0 +1,54 @@
+--TEST--
+strip 01
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.strip_debug=1
+vyrtue.strip_constants=App\DEBUG
+vyrtue.strip_functions=dump_it
+--FILE--
+<?php
+namespace App;
+const DEBUG = true;
+function dump_it($v) {
+    echo "dump_it\n";
+}
+#[\VyrtueExt\DebugOnly]
+function check_invariant($v): void {
+    echo "check_invariant\n";
+}
+class Service {
+    public function run() {
+        $this->trace('run');
+        self::trace('run');
+        echo "run\n";
+        return 1;
+    }
+    #[\VyrtueExt\DebugOnly]
+    private function trace($msg) {
+        echo "trace\n";
+    }
+}
+check_invariant(1);
+dump_it(2);
+if (DEBUG) {
+    echo "debug\n";
+}
+if (\App\DEBUG) {
+    echo "debug\n";
+} else {
+    echo "production\n";
+}
+if (DEBUG) {
+    echo "debug\n";
+} elseif (true) {
+    echo "elseif\n";
+}
+var_dump((new Service())->run());
+$f = 'App\check_invariant';
+$f(3);
+--EXPECT--
+production
+elseif
+run
+int(1)
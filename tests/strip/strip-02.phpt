@@ -0,0 +1,20 @@
+--TEST--
+strip 02 (disabled)
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.strip_constants=DEBUG
+--FILE--
+<?php
+const DEBUG = true;
+#[VyrtueExt\DebugOnly]
+function check_invariant(): void {
+    echo "check_invariant\n";
+}
+check_invariant();
+if (DEBUG) {
+    echo "debug\n";
+}
+--EXPECT--
+check_invariant
+debug
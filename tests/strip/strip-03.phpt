@@ -0,0 +1,52 @@
+--TEST--
+strip 03 (function and method bodies)
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.strip_debug=1
+vyrtue.strip_constants=App\DEBUG
+vyrtue.strip_functions=App\dump_it
+--FILE--
+<?php
+namespace App;
+const DEBUG = true;
+function dump_it($v) {
+    echo "dump_it\n";
+}
+class Logger {
+    #[\VyrtueExt\DebugOnly]
+    public static function log($msg) {
+        echo "log\n";
+    }
+}
+function run() {
+    dump_it(1);
+    if (DEBUG) {
+        echo "debug\n";
+    }
+    // the argument is not evaluated once the call is gone
+    Logger::log(print("argument\n"));
+    echo "run\n";
+}
+class Service {
+    public function run() {
+        dump_it(2);
+        if (DEBUG) {
+            echo "debug\n";
+        } else {
+            echo "production\n";
+        }
+        Logger::log(print("argument\n"));
+        $f = function () {
+            dump_it(3);
+            echo "closure\n";
+        };
+        $f();
+    }
+}
+run();
+(new Service())->run();
+--EXPECT--
+run
+production
+closure
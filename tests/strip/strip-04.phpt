@@ -0,0 +1,23 @@
+--TEST--
+strip 04 (calls from another file)
+--EXTENSIONS--
+vyrtue
+--INI--
+vyrtue.strip_debug=1
+--FILE--
+<?php
+namespace App;
+#[\VyrtueExt\DebugOnly]
+function check_invariant($v): void {
+    echo "check_invariant\n";
+}
+class Logger {
+    #[\VyrtueExt\DebugOnly]
+    public static function log($msg) {
+        echo "log\n";
+    }
+}
+// compiled after the declarations above, so its calls are removed too
+include __DIR__ . '/strip-04.inc';
+--EXPECT--
+caller
@@ -0,0 +1,55 @@
+--TEST--
+trace 01
+--EXTENSIONS--
+vyrtue
+--SKIPIF--
+<?php if (!function_exists('proc_open')) die("skip: proc_open not available"); ?>
+--FILE--
+<?php
+// the trace is written at the end of the request, so it is recorded in a child process
+$trace_file = __DIR__ . '/trace-01.json';
+@unlink($trace_file);
+
+$cmd = [
+    PHP_BINARY,
+    '-n',
+    '-d', 'extension_dir=' . ini_get('extension_dir'),
+    '-d', 'extension=vyrtue',
+    '-d', 'vyrtue.trace_file=' . $trace_file,
+    '-d', 'vyrtue.trace_threshold_us=0',
+    __DIR__ . '/trace-01.inc',
+];
+$proc = proc_open($cmd, [1 => ['pipe', 'w']], $pipes);
+echo stream_get_contents($pipes[1]);
+fclose($pipes[1]);
+proc_close($proc);
+
+$json = file_get_contents($trace_file);
+var_dump(substr($json, 0, 2));
+$events = json_decode(rtrim($json, ",\n") . ']', true);
+
+$files = array_values(array_filter($events, function ($event) {
+    return $event['cat'] === 'file';
+}));
+var_dump(count($files), $files[0]['name'] === __DIR__ . '/trace-01.inc', $files[0]['ph']);
+
+$visitors = array_filter($events, function ($event) {
+    return $event['cat'] === 'enter' && $event['name'] === 'vyrtue internal';
+});
+var_dump(count($visitors) > 0);
+
+foreach ($visitors as $event) {
+    if ($event['ts'] < $files[0]['ts'] || $event['ts'] + $event['dur'] > $files[0]['ts'] + $files[0]['dur'] + 0.01) {
+        echo "visitor span outside of file span\n";
+    }
+}
+--CLEAN--
+<?php @unlink(__DIR__ . '/trace-01.json'); ?>
+--EXPECT--
+3
+string(2) "[
+"
+int(1)
+bool(true)
+string(1) "X"
+bool(true)
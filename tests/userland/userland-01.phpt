@@ -0,0 +1,53 @@
+--TEST--
+userland 01
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+use VyrtueExt\Node;
+use const VyrtueExt\AST_ARRAY;
+use const VyrtueExt\AST_BINARY_OP;
+use const VyrtueExt\AST_CALL;
+use const VyrtueExt\AST_CONST;
+use function VyrtueExt\register_visitor;
+
+$kept = null;
+
+register_visitor('\\strtoupper', function (Node $node) {
+    $args = $node->children[1]->children;
+    return is_string($args[0]) ? strtoupper($args[0]) : null;
+});
+register_visitor(AST_CONST, function (Node $node) {
+    return $node->children[0]->children[0] === 'APP_ENV' ? 'production' : null;
+});
+register_visitor(AST_CALL, null, function (Node $node) {
+    $name = $node->children[0];
+    if (!$name instanceof Node || $name->children[0] !== 'double') {
+        return null;
+    }
+    // 3 is ZEND_MUL
+    return new Node(AST_BINARY_OP, 3, [$node->children[1]->children[0], 2]);
+});
+register_visitor(AST_ARRAY, function (Node $node) use (&$kept) {
+    $kept = $node;
+    return $node;
+});
+
+var_dump(include __DIR__ . '/userland-01.inc');
+var_dump($kept->kind === AST_ARRAY);
+try {
+    $kept->children;
+} catch (Error $e) {
+    echo $e->getMessage(), "\n";
+}
+--EXPECT--
+array(3) {
+  [0]=>
+  string(3) "ABC"
+  [1]=>
+  string(10) "production"
+  [2]=>
+  int(42)
+}
+bool(true)
+VyrtueExt\Node is no longer attached to the AST being compiled
@@ -0,0 +1,40 @@
+--TEST--
+userland 02
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+use VyrtueExt\Node;
+use const VyrtueExt\AST_BINARY_OP;
+use const VyrtueExt\AST_CALL;
+use const VyrtueExt\AST_SILENCE;
+use function VyrtueExt\register_visitor;
+
+// the visited node is destroyed once its child has replaced it
+register_visitor(AST_SILENCE, null, function (Node $node) {
+    return $node->children[0];
+});
+register_visitor('twice', null, function (Node $node) {
+    $arg = $node->children[1]->children[0];
+    // 1 is ZEND_ADD
+    return new Node(AST_BINARY_OP, 1, [$arg, $arg]);
+});
+register_visitor('broken', null, function (Node $node) {
+    return new Node(0xfff0, 0, []);
+});
+
+function broken() {
+    return 'left as is';
+}
+
+var_dump(include __DIR__ . '/userland-02.inc');
+--EXPECTF--
+Warning: vyrtue: visitor must return null, a scalar, an array or a valid node in %s on line %d
+array(3) {
+  [0]=>
+  int(4)
+  [1]=>
+  int(8)
+  [2]=>
+  string(10) "left as is"
+}
@@ -0,0 +1,54 @@
+--TEST--
+userland 03 (malformed nodes)
+--EXTENSIONS--
+vyrtue
+--FILE--
+<?php
+use VyrtueExt\Node;
+use const VyrtueExt\AST_BINARY_OP;
+use const VyrtueExt\AST_ECHO;
+use const VyrtueExt\AST_IF;
+use function VyrtueExt\register_visitor;
+
+// each of these would crash the compiler, so they are left as is
+register_visitor('no_operands', null, function (Node $node) {
+    return new Node(AST_BINARY_OP, 1, []);
+});
+register_visitor('bad_opcode', null, function (Node $node) {
+    return new Node(AST_BINARY_OP, 0xff, [1, 2]);
+});
+register_visitor('as_statement', null, function (Node $node) {
+    return new Node(AST_ECHO, 0, ['replaced']);
+});
+register_visitor(AST_ECHO, null, function (Node $node) {
+    return new Node(AST_IF, 0, [new Node(AST_BINARY_OP, 1, [1, 2])]);
+});
+
+function no_operands() {
+    return 'no_operands';
+}
+function bad_opcode() {
+    return 'bad_opcode';
+}
+function as_statement() {
+    return 'as_statement';
+}
+
+var_dump(include __DIR__ . '/userland-03.inc');
+--EXPECTF--
+Warning: vyrtue: visitor must return null, a scalar, an array or a valid node in %s on line %d
+
+Warning: vyrtue: visitor must return null, a scalar, an array or a valid node in %s on line %d
+
+Warning: vyrtue: visitor must return null, a scalar, an array or a valid node in %s on line %d
+
+Warning: vyrtue: visitor must return null, a scalar, an array or a valid node in %s on line %d
+echo
+array(3) {
+  [0]=>
+  string(11) "no_operands"
+  [1]=>
+  string(10) "bad_opcode"
+  [2]=>
+  string(12) "as_statement"
+}